@@ -0,0 +1,107 @@
+// ==========================================================================
+// Adaptive Antialiasing
+// ==========================================================================
+
+#include "AdaptiveSampler.h"
+
+#include <algorithm>
+#include <glm/glm.hpp>
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+AdaptiveSampler::AdaptiveSampler(int maxDepth, float threshold)
+    : m_maxDepth(std::max(0, maxDepth)), m_threshold(threshold)
+{
+}
+
+// corners are ordered bottom-left, bottom-right, top-left, top-right
+bool AdaptiveSampler::NeedsRefining(const vec3 corners[4]) const
+{
+    vec3 mean = 0.25f * (corners[0] + corners[1] + corners[2] + corners[3]);
+
+    float variance = 0.f;
+    for (int i = 0; i < 4; ++i)
+    {
+        vec3 d = corners[i] - mean;
+        variance += dot(d, d);
+    }
+
+    return 0.25f * variance > m_threshold;
+}
+
+// --------------------------------------------------------------------------
+
+long long AdaptiveSampler::RefineBlock(const vec3 *image, int imageWidth, int imageHeight,
+                                       int x0, int y0, int width, int height,
+                                       const SampleShader &sample, vec3 *colours) const
+{
+    long long samples = 0;
+
+    for (int y = y0; y < y0 + height; ++y)
+        for (int x = x0; x < x0 + width; ++x)
+        {
+            vec3 &colour = colours[(y - y0) * width + (x - x0)];
+            colour = image[y * imageWidth + x];
+
+            if (m_maxDepth == 0)
+                continue;
+
+            // the other three corners are the neighbours' samples, except
+            // along the right and top edges of the image
+            bool right = x + 1 < imageWidth;
+            bool top = y + 1 < imageHeight;
+
+            vec3 corners[4];
+            corners[0] = colour;
+            corners[1] = right ? image[y * imageWidth + x + 1] : sample(x + 1.f, (float)y);
+            corners[2] = top ? image[(y + 1) * imageWidth + x] : sample((float)x, y + 1.f);
+            corners[3] = (right && top) ? image[(y + 1) * imageWidth + x + 1] : sample(x + 1.f, y + 1.f);
+            samples += (right ? 0 : 1) + (top ? 0 : 1) + ((right && top) ? 0 : 1);
+
+            if (NeedsRefining(corners))
+                colour = Refine(sample, (float)x, (float)y, 1.f, corners, 1, samples);
+        }
+
+    return samples;
+}
+
+vec3 AdaptiveSampler::Refine(const SampleShader &sample, float x, float y, float size,
+                             const vec3 corners[4], int depth, long long &samples) const
+{
+    float half = 0.5f * size;
+
+    // the five points that split the square into four
+    vec3 bottom = sample(x + half, y);
+    vec3 left = sample(x, y + half);
+    vec3 centre = sample(x + half, y + half);
+    vec3 right = sample(x + size, y + half);
+    vec3 top = sample(x + half, y + size);
+    samples += 5;
+
+    const vec3 quarters[4][4] = {
+        { corners[0], bottom, left, centre },
+        { bottom, corners[1], centre, right },
+        { left, centre, corners[2], top },
+        { centre, right, top, corners[3] }
+    };
+    const float offsetX[4] = { 0.f, half, 0.f, half };
+    const float offsetY[4] = { 0.f, 0.f, half, half };
+
+    vec3 sum = vec3(0.f);
+    for (int i = 0; i < 4; ++i)
+    {
+        const vec3 *q = quarters[i];
+
+        if (depth < m_maxDepth && NeedsRefining(q))
+            sum += Refine(sample, x + offsetX[i], y + offsetY[i], half, q, depth + 1, samples);
+        else
+            sum += 0.25f * (q[0] + q[1] + q[2] + q[3]);
+    }
+
+    return 0.25f * sum;
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,51 @@
+// ==========================================================================
+// Adaptive Antialiasing
+//
+// Refines an image that has one sample per pixel, taken at each pixel's
+// bottom-left corner. A pixel whose four corner samples (its own and its
+// neighbours') vary by more than a threshold straddles an edge. Its square is
+// split into four, the new corners are sampled, and any quarter that still
+// varies is split again, up to a maximum depth. The pixel becomes the average
+// of its quarters. Flat regions keep their single sample, so the extra rays
+// go only where the image has edges.
+// ==========================================================================
+#ifndef ADAPTIVESAMPLER_H
+#define ADAPTIVESAMPLER_H
+
+#include <functional>
+#include <glm/vec3.hpp>
+
+// --------------------------------------------------------------------------
+
+class AdaptiveSampler
+{
+public:
+    // returns the colour at a point of the image, in pixels; called
+    // concurrently from all threads
+    typedef std::function<glm::vec3(float x, float y)> SampleShader;
+
+    // a depth of d splits an edge pixel into at most 4^d squares, so 2 is
+    // about as good as 16 samples per pixel; 0 turns refinement off
+    explicit AdaptiveSampler(int maxDepth = 2, float threshold = 0.002f);
+
+    int MaxDepth() const { return m_maxDepth; }
+    float Threshold() const { return m_threshold; }
+
+    // writes the refined width x height block at (x,y) into colours, given
+    // the whole one-sample-per-pixel image; returns the extra samples taken
+    long long RefineBlock(const glm::vec3 *image, int imageWidth, int imageHeight,
+                          int x, int y, int width, int height,
+                          const SampleShader &sample, glm::vec3 *colours) const;
+
+private:
+    glm::vec3 Refine(const SampleShader &sample, float x, float y, float size,
+                     const glm::vec3 corners[4], int depth, long long &samples) const;
+
+    bool NeedsRefining(const glm::vec3 corners[4]) const;
+
+    int m_maxDepth;
+    float m_threshold;
+};
+
+// --------------------------------------------------------------------------
+#endif // ADAPTIVESAMPLER_H
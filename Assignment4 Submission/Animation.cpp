@@ -0,0 +1,76 @@
+// ==========================================================================
+// Ray Tracer Animation
+// ==========================================================================
+
+#include "Animation.h"
+
+#include <algorithm>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+//Index of the last key at or before time, and how far on towards the next
+//one time is; -1 before the first key
+template<class Key>
+static int findKey(const Key *keys, int count, float time, float &blend)
+{
+	const Key *next = upper_bound(keys, keys + count, time,
+		[](float t, const Key &key)
+		{
+			return t < key.time;
+		});
+
+	int before = (int)(next - keys) - 1;
+	blend = 0;
+
+	if (before >= 0 && before + 1 < count)
+	{
+		blend = (time - keys[before].time) / (keys[before + 1].time - keys[before].time);
+	}
+
+	return before;
+}
+
+ObjectKey interpolateKeys(const ObjectKey *keys, int count, float time)
+{
+	float blend;
+	int before = findKey(keys, count, time, blend);
+
+	if (before < 0)
+	{
+		return keys[0];
+	}
+	else if (before + 1 >= count)
+	{
+		return keys[count - 1];
+	}
+
+	const ObjectKey &a = keys[before];
+	const ObjectKey &b = keys[before + 1];
+
+	return ObjectKey(time, mix(a.translation, b.translation, blend), slerp(a.rotation, b.rotation, blend));
+}
+
+CameraKey interpolateKeys(const CameraKey *keys, int count, float time)
+{
+	float blend;
+	int before = findKey(keys, count, time, blend);
+
+	if (before < 0)
+	{
+		return keys[0];
+	}
+	else if (before + 1 >= count)
+	{
+		return keys[count - 1];
+	}
+
+	const CameraKey &a = keys[before];
+	const CameraKey &b = keys[before + 1];
+
+	return CameraKey(time, mix(a.eye, b.eye, blend), mix(a.target, b.target, blend),
+					mix(a.fieldOfView, b.fieldOfView, blend));
+}
+
+// --------------------------------------------------------------------------
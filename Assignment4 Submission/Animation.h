@@ -0,0 +1,98 @@
+// ==========================================================================
+// Ray Tracer Animation
+//
+// Keyframes for the camera and for single shapes. Each of a shape's keys
+// turns it about its pivot and then moves it, relative to where the scene
+// file put it; between two keys the move is blended in a straight line and
+// the turn along the shortest arc. Before the first key and after the last,
+// things hold still.
+//
+// Only rigid motion is keyed, so shapes never change size, which is what lets
+// the BVH be refit around them from frame to frame rather than rebuilt.
+// ==========================================================================
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <stdint.h>
+
+#include "Shapes.h"
+#include "glm/gtc/quaternion.hpp"
+
+// --------------------------------------------------------------------------
+
+//Kinds of shape a track can move
+enum TrackTarget { TRACK_PLANE, TRACK_TRIANGLE, TRACK_SPHERE, TRACK_MESH, TRACK_TARGET_COUNT };
+
+struct ObjectKey
+{
+	float time;				//In seconds
+	vec3 translation;
+	quat rotation;			//About the track's pivot, before the translation
+
+	ObjectKey(){};
+
+	ObjectKey(float t, vec3 trans, quat rot)
+	{
+		time = t;
+		translation = trans;
+		rotation = rot;
+	}
+};
+
+//The keys moving one shape, a run of the scene's object keys in time order
+struct ObjectTrack
+{
+	int target;				//TrackTarget
+	int index;				//Into the scene's planes, triangles, spheres or meshes
+	vec3 pivot;				//Point the shape turns about, its centre
+	uint32_t firstKey;
+	uint32_t keyCount;
+
+	ObjectTrack(){};
+
+	ObjectTrack(int targ, int i, vec3 piv, uint32_t first, uint32_t count)
+	{
+		target = targ;
+		index = i;
+		pivot = piv;
+		firstKey = first;
+		keyCount = count;
+	}
+};
+
+struct CameraKey
+{
+	float time;
+	vec3 eye;
+	vec3 target;
+	float fieldOfView;
+
+	CameraKey(){};
+
+	CameraKey(float t, vec3 e, vec3 targ, float fov)
+	{
+		time = t;
+		eye = e;
+		target = targ;
+		fieldOfView = fov;
+	}
+};
+
+//Blend of the two keys either side of time, keys in time order
+ObjectKey interpolateKeys(const ObjectKey *keys, int count, float time);
+CameraKey interpolateKeys(const CameraKey *keys, int count, float time);
+
+//Where a point of a shape at rest ends up under the key
+inline vec3 applyKey(const ObjectKey &key, vec3 pivot, vec3 point)
+{
+	return pivot + key.translation + key.rotation * (point - pivot);
+}
+
+//Where a point of a shape posed by the key was at rest, the reverse of applyKey
+inline vec3 undoKey(const ObjectKey &key, vec3 pivot, vec3 point)
+{
+	return pivot + inverse(key.rotation) * (point - key.translation - pivot);
+}
+
+// --------------------------------------------------------------------------
+#endif // ANIMATION_H
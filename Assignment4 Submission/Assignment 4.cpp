@@ -15,8 +15,24 @@
 #include <algorithm>
 #include <string>
 #include <iterator>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include "glm/glm.hpp"
 #include "ImageBuffer.h"
+#include "TileRenderer.h"
+#include "ProgressiveRenderer.h"
+#include "Scene.h"
+#include "SceneFile.h"
+#include "RayTracer.h"
+#include "PacketTracer.h"
+#include "Camera.h"
+#include "AdaptiveSampler.h"
+#include "Denoiser.h"
+#include "StressScene.h"
+#include "Profiler.h"
 
 // Specify that we want the OpenGL core profile before including GLFW headers
 #ifndef LAB_LINUX
@@ -39,148 +55,62 @@ string LoadSource(const string &filename);
 GLuint CompileShader(GLenum shaderType, const string &source);
 GLuint LinkProgram(GLuint vertexShader, GLuint fragmentShader);
 
-// ==========================================================================
-// Structs
-
-struct Sphere
-{
-	float radius;
-	vec3 centre;
-	
-	vec3 colour;
-	int phongExponent;
-	
-	Sphere(){};
-	
-	Sphere(float r, vec3 cent, vec3 col, int e)
-	{
-		radius = r;
-		centre = cent;
-		colour = col;
-		phongExponent = e;
-	}
-};
-
-struct Triangle
-{
-	vec3 p1;
-	vec3 p2;
-	vec3 p3;
-	
-	vec3 colour;
-	int phongExponent;
-	
-	Triangle(){};
-	
-	Triangle(vec3 po1, vec3 po2, vec3 po3, vec3 col, int e)
-	{
-		p1 = po1;
-		p2 = po2;
-		p3 = po3;
-		colour = col;
-		phongExponent = e;
-	}
-};
-
-struct Plane
-{
-	vec3 normalVector;
-	vec3 point;
-	
-	vec3 colour;
-	int phongExponent;
-	
-	Plane(){};
-	
-	Plane(vec3 nVec, vec3 poVec, vec3 col, int e)
-	{
-		normalVector = nVec;
-		point = poVec;
-		colour = col;
-		phongExponent = e;
-	}
-};
-
-struct MaterialProperties
-{
-	vec3 normalVector;
-	vec3 intersectionPoint;
-	
-	vec3 colour;
-	int phongExponent;
-	
-	MaterialProperties(){};
-	
-	MaterialProperties(vec3 nVec, vec3 iPoint, vec3 col, int e)
-	{
-		normalVector = nVec;
-		intersectionPoint = iPoint;
-		colour = col;
-		phongExponent = e;
-	}
-};
-
-struct Ray
-{
-	vec3 startPoint;
-	vec3 directionVector;
-	
-	bool hasIntersected;
-	float closestDistance;
-	vec3 colour;
-	float luminance;
-	
-	MaterialProperties struckMaterial;
-	
-	Ray()
-	{
-		hasIntersected = false;
-	};
-	
-	Ray(vec3 start, vec3 direction, vec3 col)
-	{
-		startPoint = start;
-		directionVector = direction;
-		
-		hasIntersected = false;
-		closestDistance = 0;
-		colour = col;
-		
-		struckMaterial = MaterialProperties();
-	}
-};
-
-// ==========================================================================
-// Function prototypes
-
-bool checkLightIntersections(Ray &thisRay);
-void checkAllIntersections(Ray &thisRay);
-
 // ==========================================================================
 // Variables
 
 const float EPSILON = 0.000001f;
 const int defaultRecursion = 0;
 const float defaultMagnification = 1.7;
-const vec3 origin = vec3(0, 0, 0);
+
+//Size of the image rendered in the window, stretched to fit if they differ
+const int defaultWidth = 1024;
+const int defaultHeight = 768;
+
+//Largest image --size takes. The buffers index pixels with int, and the
+//denoiser keeps 16 planes of them with each row padded, so both the area
+//and the sides are capped well inside what that can reach.
+const long long maxImagePixels = 1LL << 26;		//8192x8192
+const int maxImageSide = 1 << 16;
 
 //Coordinate holders
 vector<vec2> pointVectors;
 vector<vec3> colorVectors;
 
-//Shape holders
-vector<Plane> allPlanes;
-vector<Triangle> allTriangles;
-vector<Sphere> allSpheres;
+//Scene being rendered, never modified once it has been loaded
+shared_ptr<const Scene> currentScene;
 
-ImageBuffer myBuffer = ImageBuffer();
+//Scenes behind keys 1 to 3, also used for --scene 1 to 3 and named like the images they save
+const int builtInSceneCount = 3;
+const char *const builtInSceneFiles[builtInSceneCount] = { "scenes/Scene_One.scene", "scenes/Scene_Two.scene", "scenes/Scene_Three.scene" };
+const char *const builtInSceneNames[builtInSceneCount] = { "Scene_One", "Scene_Two", "Scene_Three" };
+
+ImageBuffer myBuffer;
+TileRenderer tileRenderer;
+
+//Refines the window's image in the background so key presses never wait on a frame
+ProgressiveRenderer progressiveRenderer(tileRenderer);
+bool progressiveRendering = true;
 
 bool drawBuffer = false;
-vec3 sceneLight = vec3(0, 0, 0);
 string fileName = "Default";
 
 float magnification = defaultMagnification;
-int recursion = 0;
+
+//Trace primary rays in packets rather than one at a time
+bool packetTracing = true;
+
+//How the window's image is copied to the GPU, U cycles through them
+ImageBuffer::UploadFormat uploadFormat = ImageBuffer::UPLOAD_DIRECT;
+const char *const uploadFormatNames[] = { "direct 32 bit float", "streamed 8 bit RGBA", "streamed 16 bit float" };
+
+//Depth of adaptive antialiasing when it is switched on
+const int defaultAntialiasing = 2;
+bool antialiasing = false;
+
+#ifdef RAYTRACER_PROFILE
+//Set while the window's image is rendering, its profile is printed once it is done
+bool profilePending = false;
+#endif
 // --------------------------------------------------------------------------
 // Functions to set up OpenGL shader programs for rendering
 
@@ -347,357 +277,362 @@ void DestroyGeometry()
 
 //--------------------------------
 
-bool isIntersectionCloser(bool prevIntersection, float prevDistance, float distance)
+//Everything about a render besides the scene itself
+struct RenderSettings
+{
+	Camera camera;
+	int recursion;
+	bool packets;
+	AdaptiveSampler antialias;	//Off unless given a depth
+	int lightSamples;			//See TraceContext
+	int pixelSamples;			//Averaged into each pixel, spread over the pixel, lens and lights
+	bool glossy;				//See TraceContext
+	bool denoise;				//Filter the image once it is traced, guided by what the pixels hit
+	
+	RenderSettings(const Camera &c, int r, bool p) : camera(c), recursion(r), packets(p), antialias(0),
+													lightSamples(DEFAULT_LIGHT_SAMPLES), pixelSamples(1), glossy(false),
+													denoise(false) {}
+	
+	//Whether anything is averaged over samples
+	bool distribution() const { return pixelSamples > 1 || glossy || camera.lensRadius > 0; }
+	
+	//Packets can't average samples or record the denoiser's guides
+	bool tracesPackets() const { return packets && !distribution() && !denoise; }
+};
+
+//Looking down -z from the origin, for scenes that don't give a camera
+Camera defaultCamera(float magnification, int width, int height)
+{
+	return Camera(origin, vec3(0, 0, -1), magnificationToFieldOfView(magnification), width, height);
+}
+
+//The scene's own camera if it has one, zoomed relative to its field of view
+//so the default magnification shows it as the scene file describes
+Camera sceneCamera(const Scene &scene, float magnification, int width, int height)
 {
-	if ( !(prevIntersection) )
+	if (!scene.hasCamera)
 	{
-		return true;
+		return defaultCamera(magnification, width, height);
 	}
-	else if (prevDistance > distance)
+	
+	Camera camera = scene.camera;
+	camera.resize(width, height);
+	
+	if (magnification != defaultMagnification)
 	{
-		return true;
+		float halfWidth = std::tan(radians(camera.fieldOfView) / 2.f) * defaultMagnification / magnification;
+		camera.setFieldOfView(degrees(2.f * std::atan(halfWidth)));
 	}
 	
-	return false;
+	return camera;
 }
 
-vec3 generateColour(Ray &thisRay)
+//Traces the ray through a point of the image, whole numbers are pixel corners.
+//With distribution effects it is the average of the pixel's samples, each
+//from its own point of the lens, and with spread set from its own point of
+//the pixel rather than its corner. Given a guide, it is filled in with what
+//the samples hit first, for the denoiser.
+vec3 tracePixel(const Scene &scene, const RenderSettings &settings, float x, float y, RayCounts &counts,
+				bool spread = false, PixelGuide *guide = 0)
 {
-	vec3 c_r = thisRay.struckMaterial.colour;
-	vec3 c_a = vec3(0.4, 0.4, 0.4);
-	vec3 eVec = -thisRay.directionVector;	//The given vector was going to intersection point, we want to flip
-	vec3 n_norm = normalize(thisRay.struckMaterial.normalVector);
+	TraceContext context = TraceContext(scene, settings.recursion, &counts, settings.lightSamples, settings.camera.pixelSpread());
 	
-	int p = thisRay.struckMaterial.phongExponent;
+	if (!settings.distribution() && !guide)
+	{
+		Ray currentRay = Ray();
+		currentRay.startPoint = settings.camera.pos;
+		currentRay.directionVector = settings.camera.rayDirection(x, y);
+		
+		//Default colouring for testing
+		//currentRay.colour = vec3( (1024.f - x) / 1024.f, (1024.f - y) / 1024.f, 1.f - ((1024.f - y) / 1024.f));
+		
+		counts.primary++;
+		PROFILE_COUNT(PROFILE_PRIMARY_RAYS, 1);
+		
+		return traceRay(currentRay, context);
+	}
 	
-	vec3 c_l = vec3(0.f, 0.f, 0.f);
-	vec3 l = sceneLight - thisRay.struckMaterial.intersectionPoint;
-	vec3 l_norm = normalize(l);
+	context.glossy = settings.glossy;
+	context.pixelSamples = settings.pixelSamples;
 	
-	vec3 h = normalize(eVec + l) / length(eVec + l);
+	uint32_t seed = pixelSeed(x, y);
+	vec3 colour = vec3(0, 0, 0);
 	
-	Ray lightRayCheck = Ray(thisRay.struckMaterial.intersectionPoint, l_norm, vec3(0, 0, 0));
+	PixelGuide sums = PixelGuide();
+	vec3 albedoSquares = vec3(0, 0, 0);
+	float luminanceSquares = 0, reflectedSquares = 0;
 	
-	if ( !checkLightIntersections(lightRayCheck) )
+	for (int i = 0; i < settings.pixelSamples; i++)
 	{
-		c_l = vec3(1.f, 1.f, 1.f);
+		context.sample = PixelSample(seed, i);
+		
+		vec2 offset = (spread && settings.pixelSamples > 1) ? sampleSquare(context.sample, SAMPLE_PIXEL) : vec2(0, 0);
+		vec2 lens = squareToDisc(sampleSquare(context.sample, SAMPLE_LENS));
+		
+		Ray currentRay = Ray();
+		settings.camera.lensRay(x + offset.x, y + offset.y, lens, currentRay.startPoint, currentRay.directionVector);
+		
+		counts.primary++;
+		PROFILE_COUNT(PROFILE_PRIMARY_RAYS, 1);
+		
+		//As traceRay, but keeping what the reflections add apart
+		checkAllIntersections(currentRay, context);
+		
+		vec3 reflected = currentRay.hasIntersected ? traceReflections(currentRay, context) : vec3(0, 0, 0);
+		colour += currentRay.colour + reflected;
+		
+		if (guide)
+		{//Misses are white, face nowhere and are as far off as can be
+			vec3 albedo = vec3(1, 1, 1);
+			
+			if (currentRay.hasIntersected)
+			{
+				vec3 normal = normalize(currentRay.struckMaterial.normalVector);
+				
+				albedo = currentRay.struckMaterial.colour;
+				sums.normal += (dot(normal, currentRay.directionVector) > 0) ? -normal : normal;
+				sums.depth += currentRay.closestDistance;
+			}
+			else
+			{
+				sums.depth += DENOISE_MISS_DEPTH;
+			}
+			
+			float luminance = DenoiseLuminance(currentRay.colour, albedo);
+			float reflectedLuminance = DenoiseLuminance(reflected);
+			
+			sums.albedo += albedo;
+			albedoSquares += albedo * albedo;
+			sums.reflected += reflected;
+			sums.variance += luminance;
+			sums.reflectedVariance += reflectedLuminance;
+			luminanceSquares += luminance * luminance;
+			reflectedSquares += reflectedLuminance * reflectedLuminance;
+		}
 	}
 	
-	vec3 c_p = vec3(0, 0, 0);
+	float samples = (float)settings.pixelSamples;
 	
-	if (recursion > 0)
-	{
-		recursion--;
+	if (guide)
+	{//Variances of the pixel's means, none known from one sample
+		float mean = sums.variance / samples;
+		float reflectedMean = sums.reflectedVariance / samples;
 		
-		vec3 reflectedVector = eVec - 2 * dot(eVec, n_norm) * n_norm;
+		guide->albedo = sums.albedo / samples;
+		guide->normal = sums.normal / samples;
+		guide->depth = sums.depth / samples;
+		guide->reflected = sums.reflected / samples;
 		
-		Ray reflectedRay = Ray(thisRay.struckMaterial.intersectionPoint, normalize(reflectedVector), vec3(0, 0, 0));
+		vec3 albedoVariance = max(albedoSquares / samples - guide->albedo * guide->albedo, vec3(0, 0, 0));
+		guide->albedoVariance = albedoVariance.r + albedoVariance.g + albedoVariance.b;
 		
-		checkAllIntersections(reflectedRay);
+		guide->variance = 0;
+		guide->reflectedVariance = 0;
 		
-		c_p = reflectedRay.colour;
+		if (samples > 1)
+		{
+			guide->variance = std::max(0.f, luminanceSquares / samples - mean * mean) / samples;
+			guide->reflectedVariance = std::max(0.f, reflectedSquares / samples - reflectedMean * reflectedMean) / samples;
+		}
 	}
-
-	float maxDotComponent = std::max( 0.f, dot(n_norm, l_norm) );
-	vec3 colourComponent1 = c_r * (c_a + (c_l * maxDotComponent) );
-	
-	float powerComponent = pow( dot(h, n_norm), p);
-	vec3 colourComponent2 = powerComponent * c_l * c_p;
-
-	vec3 colour = colourComponent1 + colourComponent2;
 	
-	return colour;
+	return colour / samples;
 }
 
-void triangleIntersection(Ray &thisRay, Triangle &thisTriangle, bool lightCheck)
+//Traces a block of pixels as PACKET_WIDTH x PACKET_WIDTH packets, packets
+//hanging over the edge of the block just switch their extra rays off
+void tracePacketBlock(const Scene &scene, const RenderSettings &settings, int x0, int y0, int width, int height, vec3 *colours, RayCounts &counts)
 {
-	vec3 AB = thisTriangle.p2 - thisTriangle.p1;
-	vec3 CB = thisTriangle.p2 - thisTriangle.p3;
-	
-	vec3 BA = thisTriangle.p1 - thisTriangle.p2;
-	vec3 CA = thisTriangle.p1 - thisTriangle.p3;
-	
-	vec3 direction = thisRay.directionVector;
-	vec3 vecPlaneToRayOrigin = thisTriangle.p1 - thisRay.startPoint;
-	
-	vec3 planeNormal = cross(AB, CB);
-	
-	float scaleFactor = dot(vecPlaneToRayOrigin, planeNormal) / dot(direction, planeNormal);
+	TraceContext context = TraceContext(scene, settings.recursion, &counts, settings.lightSamples, settings.camera.pixelSpread());
 	
-	if (scaleFactor < 0)
-	{//If it intersects backwards, don't care and return ray as is
-		return;
-	}
-	
-	vec3 vectorToPlane = scaleFactor * direction;
-	float distance = length(vectorToPlane);
-	
-	vec3 intersection = (thisRay.startPoint + vectorToPlane) - origin;
-
-	//---------
-	
-	vec3 projABToCB = ( dot(CB, AB) / dot(CB, CB) ) * CB;
-	vec3 vA = AB - projABToCB;
-	vec3 AI = vectorToPlane - thisTriangle.p1;
-	float baryA = 1.f - ( dot(vA, AI) / dot(vA, AB) );
-	
-	if (baryA < 0 || baryA > 1)
-	{
-		return;
-	}
-	
-	//---------
-	
-	vec3 projBAToCA = ( dot(CA, BA) / dot(CA, CA) ) * CA;
-	vec3 vB = BA - projBAToCA;
-	vec3 BI = vectorToPlane - thisTriangle.p2;
-	float baryB = 1.f - ( dot(vB, BI) / dot(vB, BA) );
-	
-	if (baryB < 0 || baryB + baryA > 1)
-	{
-		return;
-	}
+	RayPacket packet;
+	packet.startPoint = settings.camera.pos;
 	
-	//---------
+	vec3 packetColours[PACKET_SIZE];
 	
-	//If both A and B barycentric coordiantes are within range, C should be as well
-	
-	if (lightCheck)
+	for (int py = 0; py < height; py += PACKET_WIDTH)
 	{
-		float lightDistance = length(thisRay.startPoint - sceneLight);
-
-		if (lightDistance < distance)
-		{//If we hit the light before impacting a surface
-			return;
-		}
-	}
-	
-	if ( isIntersectionCloser(thisRay.hasIntersected, thisRay.closestDistance, distance) )
-	{//If plane is intersecting closer than anything else
-		thisRay.hasIntersected = true;
-		
-		if (lightCheck)
+		for (int px = 0; px < width; px += PACKET_WIDTH)
 		{
-			return;
+			for (int i = 0; i < PACKET_SIZE; i++)
+			{
+				int x = px + i % PACKET_WIDTH;
+				int y = py + i / PACKET_WIDTH;
+				
+				packet.directions[i] = settings.camera.rayDirection(x0 + x, y0 + y);
+				packet.active[i] = (x < width && y < height);
+				
+				if (packet.active[i])
+				{
+					counts.primary++;
+					PROFILE_COUNT(PROFILE_PRIMARY_RAYS, 1);
+				}
+			}
+			
+			tracePacket(packet, context, packetColours);
+			
+			for (int i = 0; i < PACKET_SIZE; i++)
+			{
+				if (packet.active[i])
+				{
+					int x = px + i % PACKET_WIDTH;
+					int y = py + i / PACKET_WIDTH;
+					
+					colours[y * width + x] = packetColours[i];
+				}
+			}
 		}
-		
-		thisRay.closestDistance = distance;
-		thisRay.struckMaterial = MaterialProperties(planeNormal,
-													intersection,
-													thisTriangle.colour,
-													thisTriangle.phongExponent);
-		thisRay.colour = generateColour(thisRay);
 	}
-	
-	return;
 }
 
-void planeIntersection(Ray &thisRay, Plane &thisPlane, bool lightCheck)
+//Renders the scene into a buffer already sized to match the camera,
+//returns how many rays it took and, if asked, how long the denoiser took
+RayCounts renderImage(const Scene &scene, const RenderSettings &settings, ImageBuffer &buffer, double *denoiseSeconds = 0)
 {
-	vec3 direction = thisRay.directionVector;
-	vec3 vecPlaneToRayOrigin = thisPlane.point - thisRay.startPoint;
-	vec3 planeNormal = thisPlane.normalVector;
+	RayCounts totals;
+	mutex totalsLock;
 	
-	float scaleFactor = dot(vecPlaneToRayOrigin, planeNormal) / dot(direction, planeNormal);
+	Denoiser denoiser;
 	
-	if (scaleFactor < 0)
-	{//If it intersects backwards, don't care and return ray as is
-		return;
+	if (settings.denoise)
+	{
+		denoiser.Prepare(settings.camera.width, settings.camera.height, settings.pixelSamples);
 	}
 	
-	vec3 vectorToPlane = scaleFactor * thisRay.directionVector;
-	float distance = length(vectorToPlane);
-	
-	vec3 intersection = (thisRay.startPoint + vectorToPlane) - origin;
-	
-	if (lightCheck)
+	//Tiles are shaded in parallel, each pixel exactly as the serial loop would
+	tileRenderer.RenderBlocks(buffer, settings.camera.width, settings.camera.height, [&](int x0, int y0, int width, int height, vec3 *colours)
 	{
-		float lightDistance = length(thisRay.startPoint - sceneLight);
-
-		if (lightDistance < distance)
-		{//If we hit the light before impacting a surface
-			return;
+		RayCounts counts;
+		
+		if (settings.tracesPackets())
+		{
+			tracePacketBlock(scene, settings, x0, y0, width, height, colours, counts);
 		}
-	}
+		else
+		{
+			PixelGuide guide;
+			
+			for (int y = 0; y < height; y++)
+			{
+				for (int x = 0; x < width; x++)
+				{
+					colours[y * width + x] = tracePixel(scene, settings, x0 + x, y0 + y, counts, true,
+														settings.denoise ? &guide : 0);
+					
+					if (settings.denoise)
+					{
+						denoiser.SetGuide(x0 + x, y0 + y, guide);
+					}
+				}
+			}
+		}
+		
+		lock_guard<mutex> guard(totalsLock);
+		totals.add(counts);
+	});
 	
-	if ( isIntersectionCloser(thisRay.hasIntersected, thisRay.closestDistance, distance) )
-	{//If plane is intersecting closer than anything else
-		thisRay.hasIntersected = true;
+	if (settings.denoise)
+	{//Before the edges are refined, so the noise isn't taken for edges
+		chrono::steady_clock::time_point denoiseStart = chrono::steady_clock::now();
 		
-		if (lightCheck)
+		denoiser.Apply(buffer, tileRenderer.Pool());
+		
+		if (denoiseSeconds)
 		{
-			return;
+			*denoiseSeconds = chrono::duration<double>(chrono::steady_clock::now() - denoiseStart).count();
 		}
+	}
+	
+	if (settings.antialias.MaxDepth() > 0)
+	{//Every pixel has its corner sample now, refine the ones on edges
+		int width = settings.camera.width;
+		int height = settings.camera.height;
 		
-		thisRay.closestDistance = distance;
-		thisRay.struckMaterial = MaterialProperties(planeNormal,
-													intersection,
-													thisPlane.colour,
-													thisPlane.phongExponent);
+		vector<vec3> firstPass(width * height);
+		buffer.GetBlock(0, 0, width, height, &firstPass[0]);
 		
-		thisRay.colour = generateColour(thisRay);
+		tileRenderer.RenderBlocks(buffer, width, height, [&](int x0, int y0, int w, int h, vec3 *colours)
+		{
+			RayCounts counts;
+			
+			settings.antialias.RefineBlock(&firstPass[0], width, height, x0, y0, w, h, [&](float x, float y)
+			{
+				return tracePixel(scene, settings, x, y, counts);
+			}, colours);
+			
+			lock_guard<mutex> guard(totalsLock);
+			totals.add(counts);
+		});
 	}
 	
-	return;
-
+	return totals;
 }
 
-void sphereIntersection(Ray &thisRay, Sphere &thisSphere, bool lightCheck)
+void generateAllRays()
 {
-	vec3 OC = thisSphere.centre - thisRay.startPoint;	//Ray Origin to Centre
-	
-	float radiusSquared = thisSphere.radius * thisSphere.radius;
-	
-	float OCDotDirection = dot(OC, thisRay.directionVector);
-	
-	if (OCDotDirection < 0)
-	{//Dot is negative when angle > 90 between viewing direction and sphere centre
-		//i.e. sphere is behind us
-		return;
-	}
-	
-	if (dot(OC, OC) < radiusSquared)
-	{//We are inside the sphere
-		return;
-	}
-	
-	vec3 a = OC - OCDotDirection * thisRay.directionVector;
+	//Nothing may still be writing to the buffer when it is resized
+	progressiveRenderer.Cancel();
 	
-	float aSquared = dot(a, a);
+	myBuffer.Initialize(defaultWidth, defaultHeight, tileRenderer.TileSize(), uploadFormat);
 	
-	if (aSquared > radiusSquared)
-	{//Misses the sphere
+	if (!currentScene)
+	{
 		return;
 	}
 	
-	float h = sqrt(radiusSquared - aSquared);
-	
-	vec3 interOne = a - h * thisRay.directionVector;
-	
-	vec3 intersection = thisSphere.centre + interOne;
-	vec3 normal = interOne / thisSphere.radius;
-	
-	vec3 intersectionPoint = intersection - origin;
+	#ifdef RAYTRACER_PROFILE
+	Profiler::Reset();
+	profilePending = true;
+	#endif
 	
+	Camera camera = sceneCamera(*currentScene, magnification, defaultWidth, defaultHeight);
 	
-	float distance = length(intersectionPoint - thisRay.startPoint);
+	RenderSettings settings = RenderSettings(camera, defaultRecursion, packetTracing);
 	
-	if (lightCheck)
+	if (antialiasing)
 	{
-		float lightDistance = length(thisRay.startPoint - sceneLight);
-
-		if (lightDistance < distance)
-		{//If we hit the light before impacting a surface
-			return;
-		}
+		settings.antialias = AdaptiveSampler(defaultAntialiasing);
 	}
 	
-	if ( isIntersectionCloser(thisRay.hasIntersected, thisRay.closestDistance, distance) )
-	{//If plane is intersecting closer than anything else
-		thisRay.hasIntersected = true;
+	if (progressiveRendering)
+	{//Keeps its own hold on the scene, which may be swapped out before it finishes
+		shared_ptr<const Scene> scene = currentScene;
 		
-		if (lightCheck)
+		progressiveRenderer.Start(myBuffer, camera.width, camera.height, [scene, settings](float x, float y)
 		{
-			return;
-		}
+			RayCounts counts;
+			return tracePixel(*scene, settings, x, y, counts);
+		}, settings.antialias);
 		
-		thisRay.closestDistance = distance;
-		thisRay.struckMaterial = MaterialProperties(normal,
-													intersectionPoint,
-													thisSphere.colour,
-													thisSphere.phongExponent);
-		thisRay.colour = generateColour(thisRay);
+		return;
 	}
 	
-	return;
+	renderImage(*currentScene, settings, myBuffer);
 }
 
-bool checkLightIntersections(Ray &thisRay)
+void loadScene(const string &sceneFile)
 {
-	for (unsigned int i = 0; i < allPlanes.size(); i++)
-	{
-		planeIntersection(thisRay, allPlanes[i], true);
-		
-		if (thisRay.hasIntersected)
-		{//If we're checking to see if the light is interrupted, we don't care past that it is
-		//Checking regularly because these if checks are cheaper than checking an extra intersection
-			return true;
-		}
-	}
-	
-	for (unsigned int i = 0; i < allTriangles.size(); i++)
-	{
-		triangleIntersection(thisRay, allTriangles[i], true);
-		
-		if (thisRay.hasIntersected)
-		{
-			return true;
-		}
-	}
+	shared_ptr<Scene> scene = make_shared<Scene>();
 	
-	for (unsigned int i = 0; i < allSpheres.size(); i++)
-	{
-		sphereIntersection(thisRay, allSpheres[i], true);
-		
-		if (thisRay.hasIntersected)
-		{
-			return true;
-		}
+	if ( !loadSceneFile(sceneFile, *scene) )
+	{//Leaves the buffer blank
+		generateAllRays();
+		return;
 	}
 	
-	return false;
-}
-
-void checkAllIntersections(Ray &thisRay)
-{
-	for (unsigned int i = 0; i < allPlanes.size(); i++)
-	{
-		planeIntersection(thisRay, allPlanes[i], false);
+	//The build shares the renderer's pool, which takes one batch at a time
+	progressiveRenderer.Cancel();
 	
-	}
+	chrono::steady_clock::time_point buildStart = chrono::steady_clock::now();
 	
-	for (unsigned int i = 0; i < allTriangles.size(); i++)
-	{
-		triangleIntersection(thisRay, allTriangles[i], false);
-	}
+	scene->build(tileRenderer.Pool());
 	
-	for (unsigned int i = 0; i < allSpheres.size(); i++)
-	{
-		sphereIntersection(thisRay, allSpheres[i], false);
-	}
+	cout << "Build:  " << chrono::duration<double>(chrono::steady_clock::now() - buildStart).count() << " s" << endl;
 	
-	return;
-}
-
-void generateAllRays()
-{
-	myBuffer.Initialize();
+	//From here on the scene is only ever traced, never changed
+	currentScene = scene;
 	
-	for(int x = 0; x<1024; x++)
-	{
-		for(int y = 0; y<768; y++)
-		{
-			Ray currentRay = Ray();
-			currentRay.startPoint = origin;
-			
-			//Assume z direction vector as 1
-			currentRay.directionVector.z = -1.f;
-			
-			currentRay.directionVector.x = ( (x - 512.f) / 512.f ) / magnification;
-			currentRay.directionVector.y = ( (y - 384.f) / 512.f ) / magnification;
-			
-			currentRay.directionVector = normalize(currentRay.directionVector);
-			
-			//Default colouring for testing
-			//currentRay.colour = vec3( (1024.f - x) / 1024.f, (1024.f - y) / 1024.f, 1.f - ((1024.f - y) / 1024.f));
-			
-			recursion = defaultRecursion;
-			
-			checkAllIntersections(currentRay);
-			
-			myBuffer.SetPixel(x, y, currentRay.colour);
-		}
-	}
+	generateAllRays();
 }
 
 bool generateStart()
@@ -717,710 +652,10 @@ bool generateStart()
 	return setGeometry();
 }
 
-void generateSceneOne()
-{
-	sceneLight = vec3(0.f, 2.5f, -7.75f);
-
-	//Reflective grey sphere
-	allSpheres.push_back(Sphere(0.825,
-								vec3(0.9, -1.925, -6.69),
-								vec3(0.5, 0.5, 0.5),
-								32
-								)
-						);
-
-	//Blue pyramid	
-	allTriangles.push_back(Triangle(vec3(-0.4, -2.75, -9.55),
-									vec3(-0.93, 0.55, -8.51),
-									vec3(0.11, -2.75, -7.98),
-									vec3(0, 0.69, 0.82),
-									4
-									)
-							);
-
-	allTriangles.push_back(Triangle(vec3(0.11, -2.75, -7.98),
-									vec3(-0.93, 0.55, -8.51),
-									vec3(-1.46, -2.75, -7.47),
-									vec3(0, 0.69, 0.82),
-									4
-									)
-							);
-							
-	allTriangles.push_back(Triangle(vec3(-1.46, -2.75, -7.47),
-									vec3(-0.93, 0.55, -8.51),
-									vec3(-1.97, -2.75, -9.04),
-									vec3(0, 0.69, 0.82),
-									4
-									)
-							);
-							
-	allTriangles.push_back(Triangle(vec3(-1.97, -2.75, -9.04),
-									vec3(-0.93, 0.55, -8.51),
-									vec3(-0.4, -2.75, -9.55),
-									vec3(0, 0.69, 0.82),
-									4
-									)
-							);
-
-	//Ceiling
-	allTriangles.push_back(Triangle(vec3(2.75, 2.75, -10.5),
-									vec3(2.75, 2.75, -5),
-									vec3(-2.75, 2.75, -5),
-									vec3(0.6, 0.6, 0.6),
-									2
-									)
-							);
-							
-	allTriangles.push_back(Triangle(vec3(-2.75, 2.75, -10.5),
-									vec3(2.75, 2.75, -10.5),
-									vec3(-2.75, 2.75, -5),
-									vec3(0.6, 0.6, 0.6),
-									2
-									)
-							);
-
-	//Green right wall
-	allTriangles.push_back(Triangle(vec3(2.75, 2.75, -5),
-									vec3(2.75, 2.75, -10.5),
-									vec3(2.75, -2.75, -10.5),
-									vec3(0, 1, 0),
-									1
-									)
-							);
-							
-	allTriangles.push_back(Triangle(vec3(2.75, -2.75, -5),
-									vec3(2.75, 2.75, -5),
-									vec3(2.75, -2.75, -10.5),
-									vec3(0, 1, 0),
-									1
-									)
-							);
-
-	//Red left wall
-	allTriangles.push_back(Triangle(vec3(-2.75, -2.75, -5),
-									vec3(-2.75, -2.75, -10.5),
-									vec3(-2.75, 2.75, -10.5),
-									vec3(1, 0, 0),
-									1
-									)
-							);
-							
-	allTriangles.push_back(Triangle(vec3(-2.75, 2.75, -5),
-									vec3(-2.75, -2.75, -5),
-									vec3(-2.75, 2.75, -10.5),
-									vec3(1, 0, 0),
-									1
-									)
-							);
-
-	//Floor
-	allTriangles.push_back(Triangle(vec3(2.75, -2.75, -5),
-									vec3(2.75, -2.75, -10.5),
-									vec3(-2.75, -2.75, -10.5),
-									vec3(0.6, 0.6, 0.6),
-									1
-									)
-							);
-							
-	allTriangles.push_back(Triangle(vec3(-2.75, -2.75, -5),
-									vec3(2.75, -2.75, -5),
-									vec3(-2.75, -2.75, -10.5),
-									vec3(0.6, 0.6, 0.6),
-									1
-									)
-							);
-
-	//Back wall
-	allPlanes.push_back(Plane(vec3(0, 0, 1),
-								vec3(0, 0, -10.5),
-								vec3(0.4, 0.4, 0.4),
-								1
-								)
-						);
-
-	generateAllRays();
-}
-
-void generateSceneTwo()
-{
-	sceneLight = vec3(4.f, 6.f, -1.f);
-
-	//Floor
-	allPlanes.push_back(Plane(vec3(0, 1, 0),
-								vec3(0, -1, 0),
-								vec3(0.8, 0.8, 0.8),
-								1
-								)
-						);
-
-	//Back wall
-	allPlanes.push_back(Plane(vec3(0, 0, 1),
-								vec3(0, 0, -12),
-								vec3(0, 0.69, 0.82),
-								1
-								)
-						);
-
-
-	//Large yellow sphere
-	allSpheres.push_back(Sphere(0.5,
-								vec3(1, -0.5, -3.5),
-								vec3(0.76, 0.79, 0.04),
-								8
-								)
-						);
-
-	//Reflective grey sphere
-	allSpheres.push_back(Sphere(0.4,
-								vec3(0, 1, -5),
-								vec3(0.5, 0.5, 0.5),
-								32
-								)
-						);
-
-	//Metallic purple sphere
-	allSpheres.push_back(Sphere(0.25,
-								vec3(-0.8, -0.75, -4),
-								vec3(0.62, 0.05, 0.66),
-								16
-								)
-						);
-
-//-----------
-
-	//Green cone
-	
-	allTriangles.push_back(Triangle(vec3(0, -1, -5.8),
-									vec3(0, 0.6, -5),
-									vec3(0.4, -1, -5.693),
-									vec3(0, 1, 0),
-									2
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(0.4, -1, -5.693),
-									vec3(0, 0.6, -5),
-									vec3(0.6928, -1, -5.4),
-									vec3(0, 1, 0),
-									2
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(0.6928, -1, -5.4),
-									vec3(0, 0.6, -5),
-									vec3(0.8, -1, -5),
-									vec3(0, 1, 0),
-									2
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(0.8, -1, -5),
-									vec3(0, 0.6, -5),
-									vec3(0.6928, -1, -4.6),
-									vec3(0, 1, 0),
-									2
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(0.6928, -1, -4.6),
-									vec3(0, 0.6, -5),
-									vec3(0.4, -1, -4.307),
-									vec3(0, 1, 0),
-									2
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(0.4, -1, -4.307),
-									vec3(0, 0.6, -5),
-									vec3(0, -1, -4.2),
-									vec3(0, 1, 0),
-									2
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(0, -1, -4.2),
-									vec3(0, 0.6, -5),
-									vec3(-0.4, -1, -4.307),
-									vec3(0, 1, 0),
-									2
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-0.4, -1, -4.307),
-									vec3(0, 0.6, -5),
-									vec3(-0.6928, -1, -4.6),
-									vec3(0, 1, 0),
-									2
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-0.6928, -1, -4.6),
-									vec3(0, 0.6, -5),
-									vec3(-0.8, -1, -5),
-									vec3(0, 1, 0),
-									2
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-0.8, -1, -5),
-									vec3(0, 0.6, -5),
-									vec3(-0.6928, -1, -5.4),
-									vec3(0, 1, 0),
-									2
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-0.6928, -1, -5.4),
-									vec3(0, 0.6, -5),
-									vec3(-0.4, -1, -5.693),
-									vec3(0, 1, 0),
-									2
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-0.4, -1, -5.693),
-									vec3(0, 0.6, -5),
-									vec3(0, -1, -5.8),
-									vec3(0, 1, 0),
-									2
-									)
-							);
-
-//--------
-
-	//Shiny red icosahedron
-	allTriangles.push_back(Triangle(vec3(-2, -1, -7),
-									vec3(-1.276, -0.4472, -6.474),
-									vec3(-2.276, -0.4472, -6.149),
-									vec3(1, 0, 0),
-									32
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-1.276, -0.4472, -6.474),
-									vec3(-2, -1, -7),
-									vec3(-1.276, -0.4472, -7.526),
-									vec3(1, 0, 0),
-									32
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-2, -1, -7),
-									vec3(-2.276, -0.4472, -6.149),
-									vec3(-2.894, -0.4472, -7),
-									vec3(1, 0, 0),
-									32
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-2, -1, -7),
-									vec3(-2.894, -0.4472, -7),
-									vec3(-2.276, -0.4472, -7.851),
-									vec3(1, 0, 0),
-									32
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-2, -1, -7),
-									vec3(-2.276, -0.4472, -7.851),
-									vec3(-1.276, -0.4472, -7.526),
-									vec3(1, 0, 0),
-									32
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-1.276, -0.4472, -6.474),
-									vec3(-1.276, -0.4472, -7.526),
-									vec3(-1.106, 0.4472, -7),
-									vec3(1, 0, 0),
-									32
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-2.276, -0.4472, -6.149),
-									vec3(-1.276, -0.4472, -6.474),
-									vec3(-1.724, 0.4472, -6.149),
-									vec3(1, 0, 0),
-									32
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-2.894, -0.4472, -7),
-									vec3(-2.276, -0.4472, -6.149),
-									vec3(-2.724, 0.4472, -6.474),
-									vec3(1, 0, 0),
-									32
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-2.276, -0.4472, -7.851),
-									vec3(-2.894, -0.4472, -7),
-									vec3(-2.724, 0.4472, -7.526),
-									vec3(1, 0, 0),
-									32
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-1.276, -0.4472, -7.526),
-									vec3(-2.276, -0.4472, -7.851),
-									vec3(-1.724, 0.4472, -7.851),
-									vec3(1, 0, 0),
-									32
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-1.276, -0.4472, -6.474),
-									vec3(-1.106, 0.4472, -7),
-									vec3(-1.724, 0.4472, -6.149),
-									vec3(1, 0, 0),
-									32
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-2.276, -0.4472, -6.149),
-									vec3(-1.724, 0.4472, -6.149),
-									vec3(-2.724, 0.4472, -6.474),
-									vec3(1, 0, 0),
-									32
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-2.894, -0.4472, -7),
-									vec3(-2.724, 0.4472, -6.474),
-									vec3(-2.724, 0.4472, -7.526),
-									vec3(1, 0, 0),
-									32
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-2.276, -0.4472, -7.851),
-									vec3(-2.724, 0.4472, -7.526),
-									vec3(-1.724, 0.4472, -7.851),
-									vec3(1, 0, 0),
-									32
-									)
-							);
-
-	allTriangles.push_back(Triangle(vec3(-1.276, -0.4472, -7.526),
-									vec3(-1.724, 0.4472, -7.851),
-									vec3(-1.106, 0.4472, -7),
-									vec3(1, 0, 0),
-									32
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-1.724, 0.4472, -6.149),
-									vec3(-1.106, 0.4472, -7),
-									vec3(-2, 1, -7),
-									vec3(1, 0, 0),
-									32
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-2.724, 0.4472, -6.474),
-									vec3(-1.724, 0.4472, -6.149),
-									vec3(-2, 1, -7),
-									vec3(1, 0, 0),
-									32
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-2.724, 0.4472, -7.526),
-									vec3(-2.724, 0.4472, -6.474),
-									vec3(-2, 1, -7),
-									vec3(1, 0, 0),
-									32
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-1.724, 0.4472, -7.851),
-									vec3(-2.724, 0.4472, -7.526),
-									vec3(-2.276, -0.4472, -6.149),
-									vec3(1, 0, 0),
-									32
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-1.106, 0.4472, -7),
-									vec3(-1.724, 0.4472, -7.851),
-									vec3(-2, 1, -7),
-									vec3(1, 0, 0),
-									32
-									)
-							);
-
-	generateAllRays();
-}
-
-void generateSceneThree()
-{
-	sceneLight = vec3(-4, 8.f, -0.5);
-
-	//Floor
-	allPlanes.push_back(Plane(vec3(0, 1, 0),
-								vec3(0, -1, 0),
-								vec3(1, 1, 1),
-								1
-								)
-						);
-
-	//Back wall
-	allPlanes.push_back(Plane(vec3(0, 0, 1),
-								vec3(0, 0, -12),
-								vec3(0, 0.69, 0.82),
-								1
-								)
-						);
-
-
-	//Body spheres sphere
-	allSpheres.push_back(Sphere(0.7,
-								vec3(0, -0.5, -4),
-								vec3(1, 1, 1),
-								1
-								)
-						);
-								
-	allSpheres.push_back(Sphere(0.5,
-								vec3(0, 0.3, -4),
-								vec3(1, 1, 1),
-								1
-								)
-						);
-								
-	allSpheres.push_back(Sphere(0.3,
-								vec3(0, 1.0, -4),
-								vec3(1, 1, 1),
-								1
-								)
-						);
-
-	//Buttons
-	allSpheres.push_back(Sphere(0.05,
-								vec3(0, 0.45, -3.55),
-								vec3(0, 0, 0),
-								16
-								)
-						);
-								
-	allSpheres.push_back(Sphere(0.05,
-								vec3(0, 0.3, -3.5),
-								vec3(0, 0, 0),
-								16
-								)
-						);
-								
-	allSpheres.push_back(Sphere(0.05,
-								vec3(0, 0.15, -3.55),
-								vec3(0, 0, 0),
-								16
-								)
-						);
-
-	//Eyes
-	allSpheres.push_back(Sphere(0.07,
-								vec3(-0.1, 1.1, -3.8),
-								vec3(0, 0, 0),
-								32
-								)
-						);
-								
-	allSpheres.push_back(Sphere(0.07,
-								vec3(0.1, 1.1, -3.8),
-								vec3(0, 0, 0),
-								32
-								)
-						);
-						
-	//Mouth
-	allSpheres.push_back(Sphere(0.03,
-								vec3(-0.16, 0.94, -3.74),
-								vec3(0, 0, 0),
-								4
-								)
-						);
-								
-	allSpheres.push_back(Sphere(0.03,
-								vec3(-0.08, 0.91, -3.72),
-								vec3(0, 0, 0),
-								4
-								)
-						);
-								
-	allSpheres.push_back(Sphere(0.03,
-								vec3(0.0, 0.88, -3.7),
-								vec3(0, 0, 0),
-								4
-								)
-						);
-								
-	allSpheres.push_back(Sphere(0.03,
-								vec3(0.08, 0.91, -3.72),
-								vec3(0, 0, 0),
-								4
-								)
-						);
-								
-	allSpheres.push_back(Sphere(0.03,
-								vec3(0.16, 0.94, -3.74),
-								vec3(0, 0, 0),
-								4
-								)
-						);
-
-// Hat--------------
-
-//Hat bottom
-	allTriangles.push_back(Triangle(vec3(-0.4, 1.2, -3.6),
-									vec3(-0.4, 1.2, -4.4),
-									vec3(0.4, 1.2, -4.4),
-									vec3(0, 0, 0),
-									1
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-0.4, 1.2, -3.6),
-									vec3(0.4, 1.2, -4.4),
-									vec3(0.4, 1.2, -3.6),
-									vec3(0, 0, 0),
-									1
-									)
-							);
-							
-//Hat front
-	allTriangles.push_back(Triangle(vec3(-0.3, 1.2, -3.7),
-									vec3(0.3, 1.2, -3.7),
-									vec3(-0.3, 1.6, -3.7),
-									vec3(0, 0, 0),
-									1
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(0.3, 1.6, -3.7),
-									vec3(0.3, 1.2, -3.7),
-									vec3(-0.3, 1.6, -3.7),
-									vec3(0, 0, 0),
-									1
-									)
-							);
-							
-//Hat back
-	allTriangles.push_back(Triangle(vec3(-0.3, 1.2, -4.3),
-									vec3(0.3, 1.2, -4.3),
-									vec3(-0.3, 1.6, -4.3),
-									vec3(0, 0, 0),
-									1
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(0.3, 1.6, -4.3),
-									vec3(0.3, 1.2, -4.3),
-									vec3(-0.3, 1.6, -4.3),
-									vec3(0, 0, 0),
-									1
-									)
-							);
-
-//Hat left
-	allTriangles.push_back(Triangle(vec3(-0.3, 1.2, -4.3),
-									vec3(-0.3, 1.2, -3.7),
-									vec3(-0.3, 1.6, -4.3),
-									vec3(0, 0, 0),
-									1
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-0.3, 1.6, -4.3),
-									vec3(-0.3, 1.6, -3.7),
-									vec3(-0.3, 1.2, -3.7),
-									vec3(0, 0, 0),
-									1
-									)
-							);
-							
-//Hat right
-	allTriangles.push_back(Triangle(vec3(0.3, 1.2, -4.3),
-									vec3(0.3, 1.2, -3.7),
-									vec3(0.3, 1.6, -4.3),
-									vec3(0, 0, 0),
-									1
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(0.3, 1.6, -4.3),
-									vec3(0.3, 1.6, -3.7),
-									vec3(0.3, 1.2, -3.7),
-									vec3(0, 0, 0),
-									1
-									)
-							);
-
-//Hat top
-	allTriangles.push_back(Triangle(vec3(-0.3, 1.2, -3.6),
-									vec3(-0.3, 1.2, -4.4),
-									vec3(0.3, 1.2, -4.4),
-									vec3(0, 0, 0),
-									1
-									)
-							);
-	
-	allTriangles.push_back(Triangle(vec3(-0.3, 1.2, -3.6),
-									vec3(0.3, 1.2, -4.4),
-									vec3(0.3, 1.2, -3.6),
-									vec3(0, 0, 0),
-									1
-									)
-							);
-
-//--------------------
-
-//Nose
-	//Top
-	allTriangles.push_back(Triangle(vec3(-0.05, 1.05, -3.8),
-									vec3(0.05, 1.05, -3.8),
-									vec3(0, 0.95, -3.5),
-									vec3(1, 0.5, 0),
-									1
-									)
-							);
-
-	//Left
-	allTriangles.push_back(Triangle(vec3(-0.05, 1.05, -3.8),
-									vec3(-0.05, 0.95, -3.8),
-									vec3(0, 0.95, -3.5),
-									vec3(1, 0.5, 0),
-									1
-									)
-							);
-							
-	//Right
-	allTriangles.push_back(Triangle(vec3(0.05, 1.05, -3.8),
-									vec3(0.05, 0.95, -3.8),
-									vec3(0, 0.95, -3.5),
-									vec3(1, 0.5, 0),
-									1
-									)
-							);
-							
-	//Bottom
-	allTriangles.push_back(Triangle(vec3(-0.05, 0.95, -3.8),
-									vec3(0.05, 0.95, -3.8),
-									vec3(0, 0.95, -3.5),
-									vec3(1, 0.5, 0),
-									1
-									)
-							);
-
-	generateAllRays();
-}
-
 void clearAllObjects()
 {
-	sceneLight = vec3(0, 0, 0);
-	
-	allPlanes.clear();
-	allTriangles.clear();
-	allSpheres.clear();
+	progressiveRenderer.Cancel();
+	currentScene.reset();
 	
 	pointVectors.clear();
 	colorVectors.clear();
@@ -1492,8 +727,8 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 		magnification = defaultMagnification;
 		
 		drawBuffer = true;
-		fileName = "Scene_One";
-		generateSceneOne();
+		fileName = builtInSceneNames[0];
+		loadScene(builtInSceneFiles[0]);
 	}
 	
 	if (key == GLFW_KEY_2  && action == GLFW_PRESS)
@@ -1503,8 +738,8 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 		magnification = defaultMagnification;
 		
 		drawBuffer = true;
-		fileName = "Scene_Two";
-		generateSceneTwo();
+		fileName = builtInSceneNames[1];
+		loadScene(builtInSceneFiles[1]);
 	}
 	
 	if (key == GLFW_KEY_3  && action == GLFW_PRESS)
@@ -1514,8 +749,8 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 		magnification = defaultMagnification;
 		
 		drawBuffer = true;
-		fileName = "Scene_Three";
-		generateSceneThree();
+		fileName = builtInSceneNames[2];
+		loadScene(builtInSceneFiles[2]);
 	}
 	
 	//Viewing Angle-------------------------------------------
@@ -1560,37 +795,848 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 		}
 	}
 	
-	//Save to file-------------------------------------------
+	//Antialiasing-------------------------------------------
 	
-	if (key == GLFW_KEY_S  && action == GLFW_PRESS)
+	if (key == GLFW_KEY_A  && action == GLFW_PRESS)
     {
-		if( !myBuffer.SaveToFile(fileName) )
+		antialiasing = !antialiasing;
+		cout << (antialiasing ? "Antialiasing on" : "Antialiasing off") << endl;
+		
+		if (drawBuffer)
 		{
-			cout << "ERROR: Failed to save image to file." << endl;
+			myBuffer.Destroy();
+			generateAllRays();
 		}
 	}
 	
+	//Progressive rendering-------------------------------------------
 	
-}
-
-// ==========================================================================
-// PROGRAM ENTRY POINT
-
-int main(int argc, char *argv[])
-{
-	// initialize the GLFW windowing system
-	if (!glfwInit()) {
-		cout << "ERROR: GLFW failed to initialize, TERMINATING" << endl;
-		return -1;
+	if (key == GLFW_KEY_R  && action == GLFW_PRESS)
+    {
+		progressiveRendering = !progressiveRendering;
+		cout << (progressiveRendering ? "Progressive rendering on" : "Progressive rendering off") << endl;
+		
+		if (drawBuffer)
+		{
+			myBuffer.Destroy();
+			generateAllRays();
+		}
 	}
-	glfwSetErrorCallback(ErrorCallback);
-
-	// attempt to create a window with an OpenGL 4.1 core profile context
-	GLFWwindow *window = 0;
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
-	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	
+	//Packet tracing-------------------------------------------
+	
+	if (key == GLFW_KEY_P  && action == GLFW_PRESS)
+    {
+		packetTracing = !packetTracing;
+		cout << (packetTracing ? "Packet tracing on" : "Packet tracing off") << endl;
+		
+		if (drawBuffer)
+		{
+			myBuffer.Destroy();
+			generateAllRays();
+		}
+	}
+	
+	//Texture uploads-------------------------------------------
+	
+	if (key == GLFW_KEY_U  && action == GLFW_PRESS)
+    {
+		uploadFormat = ImageBuffer::UploadFormat((uploadFormat + 1) % 3);
+		cout << "Texture uploads " << uploadFormatNames[uploadFormat] << endl;
+		
+		if (drawBuffer)
+		{
+			myBuffer.Destroy();
+			generateAllRays();
+		}
+	}
+	
+	//Save to file-------------------------------------------
+	
+	if (key == GLFW_KEY_S  && action == GLFW_PRESS)
+    {
+		//The refinement may still have the tile pool busy, so saves get their own
+		static ThreadPool savePool;
+		
+		if( !myBuffer.SaveToFile(fileName, savePool) )
+		{
+			cout << "ERROR: Failed to save image to file." << endl;
+		}
+	}
+	
+	
+}
+
+// --------------------------------------------------------------------------
+// Headless batch rendering, for machines without a display or GPU
+
+struct BatchOptions
+{
+	string sceneFile;
+	string sceneName;		//Default output name
+	int width;
+	int height;
+	float magnification;
+	float fieldOfView;		//0 to work it out from the magnification
+	vec3 eye;
+	bool hasEye;
+	vec3 target;
+	bool hasTarget;
+	int recursion;
+	bool packets;
+	int antialiasing;
+	float antialiasThreshold;
+	int lightSamples;
+	int pixelSamples;
+	bool glossy;
+	bool denoise;
+	float aperture;			//Lens radius, 0 for a pinhole
+	float focus;			//Distance in focus, 0 to focus on the middle of the image
+	string output;
+	int frames;				//Frames of the animation to render, 0 for a single image
+	string convert;			//Scene file to write instead of rendering
+	string profile;			//JSON file for the profile, empty for none
+	string benchDirectory;	//Run the benchmarks against the references here instead
+	float minimumPsnr;
+	bool updateReferences;
+	string results;			//JSON file for the benchmark results, empty for none
+	
+	BatchOptions() : sceneFile(builtInSceneFiles[0]), sceneName(builtInSceneNames[0]),
+					width(defaultWidth), height(defaultHeight), magnification(defaultMagnification),
+					fieldOfView(0), eye(origin), hasEye(false), target(0, 0, -1), hasTarget(false),
+					recursion(defaultRecursion), packets(true),
+					antialiasing(0), antialiasThreshold(AdaptiveSampler().Threshold()),
+					lightSamples(DEFAULT_LIGHT_SAMPLES), pixelSamples(1), glossy(false), denoise(false),
+					aperture(0), focus(0),
+					frames(0), minimumPsnr(40), updateReferences(false) {}
+};
+
+void printUsage(const char *program)
+{
+	cout << "Usage: " << program << " [options]" << endl;
+	cout << "With no options the interactive window opens. With any, the scene is" << endl;
+	cout << "rendered straight to file without creating a window or GL context." << endl;
+	cout << endl;
+	cout << "  --scene N|FILE        Scene 1, 2 or 3, or a scene file (default 1)" << endl;
+	cout << "  --size WxH            Image size in pixels (default 1024x768, at most " << maxImagePixels << " pixels)" << endl;
+	cout << "  --magnification M     Zoom, as with the arrow keys (default " << defaultMagnification << ")" << endl;
+	cout << "  --fov DEGREES         Horizontal field of view, overrides the magnification" << endl;
+	cout << "  --eye X,Y,Z           Camera position (default the scene's, or 0,0,0)" << endl;
+	cout << "  --look-at X,Y,Z       Point the camera looks at (default the scene's, or straight down -z)" << endl;
+	cout << "  --depth N             Reflection recursion depth (default " << defaultRecursion << ")" << endl;
+	cout << "  --antialias N         Adaptive antialiasing, edge pixels split up to N times (default 0, off)" << endl;
+	cout << "  --aa-threshold V      Colour variance that counts as an edge (default " << AdaptiveSampler().Threshold() << ")" << endl;
+	cout << "  --light-samples N     Lights shaded from per hit, more are picked at random by" << endl;
+	cout << "                        brightness (default " << DEFAULT_LIGHT_SAMPLES << ", 0 for every light)" << endl;
+	cout << "  --samples N           Samples averaged into each pixel, spread over the pixel, the" << endl;
+	cout << "                        lens and the area lights (default 1)" << endl;
+	cout << "  --glossy              Blur reflections by each surface's Phong exponent" << endl;
+	cout << "  --denoise             Filter out the noise of few samples once the image is traced" << endl;
+	cout << "  --aperture R          Lens radius for depth of field (default 0, everything sharp)" << endl;
+	cout << "  --focus D             Distance in focus (default whatever is in the middle of the image)" << endl;
+	cout << "  --no-packets          Trace every primary ray on its own" << endl;
+	cout << "  --output FILE         Image to write (default named after the scene)" << endl;
+	cout << "  --frames N            Render N frames spread evenly over the scene's animation," << endl;
+	cout << "                        numbered FILE_0001.png and so on" << endl;
+	cout << "  --convert FILE        Write the scene to FILE instead of rendering it, binary if FILE" << endl;
+	cout << "                        ends in " << BINARY_SCENE_EXTENSION << ", text otherwise" << endl;
+	cout << "  --profile FILE        Write the render's counters and phase times to FILE as JSON" << endl;
+	cout << "                        (builds made with PROFILE=1 only)" << endl;
+	cout << endl;
+	cout << "  --bench DIR           Run the benchmark scenes and compare them to the reference" << endl;
+	cout << "                        images in DIR, --no-packets is the only other option used" << endl;
+	cout << "  --psnr DB             Lowest PSNR against a reference that passes (default 40)" << endl;
+	cout << "  --update-references   Save the benchmark images as the new references" << endl;
+	cout << "  --results FILE        Write the benchmark times and PSNRs to FILE as JSON" << endl;
+}
+
+bool parseBatchOptions(int argc, char *argv[], BatchOptions &options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const char *option = argv[i];
+		const char *value = (i + 1 < argc) ? argv[i + 1] : 0;
+		char extra;
+		
+		if (strcmp(option, "--help") == 0)
+		{
+			return false;
+		}
+		
+		if (strcmp(option, "--no-packets") == 0)
+		{
+			options.packets = false;
+			continue;
+		}
+		
+		if (strcmp(option, "--update-references") == 0)
+		{
+			options.updateReferences = true;
+			continue;
+		}
+		
+		if (strcmp(option, "--glossy") == 0)
+		{
+			options.glossy = true;
+			continue;
+		}
+		
+		if (strcmp(option, "--denoise") == 0)
+		{
+			options.denoise = true;
+			continue;
+		}
+		
+		bool takesValue = strcmp(option, "--scene") == 0 || strcmp(option, "--size") == 0
+						|| strcmp(option, "--magnification") == 0 || strcmp(option, "--fov") == 0
+						|| strcmp(option, "--eye") == 0 || strcmp(option, "--look-at") == 0
+						|| strcmp(option, "--depth") == 0 || strcmp(option, "--antialias") == 0
+						|| strcmp(option, "--aa-threshold") == 0 || strcmp(option, "--light-samples") == 0
+						|| strcmp(option, "--samples") == 0 || strcmp(option, "--aperture") == 0
+						|| strcmp(option, "--focus") == 0
+						|| strcmp(option, "--output") == 0 || strcmp(option, "--frames") == 0
+						|| strcmp(option, "--convert") == 0
+						|| strcmp(option, "--profile") == 0 || strcmp(option, "--bench") == 0
+						|| strcmp(option, "--psnr") == 0 || strcmp(option, "--results") == 0;
+		
+		if (!takesValue)
+		{
+			cout << "ERROR: Unknown option " << option << endl;
+			return false;
+		}
+		
+		if (!value)
+		{
+			cout << "ERROR: Missing value for " << option << endl;
+			return false;
+		}
+		
+		bool valid;
+		
+		if (strcmp(option, "--scene") == 0)
+		{
+			int scene;
+			
+			if (sscanf(value, "%d%c", &scene, &extra) == 1)
+			{
+				valid = scene >= 1 && scene <= builtInSceneCount;
+				
+				if (valid)
+				{
+					options.sceneFile = builtInSceneFiles[scene - 1];
+					options.sceneName = builtInSceneNames[scene - 1];
+				}
+			}
+			else
+			{//Named after the file, without its directory or extension
+				options.sceneFile = value;
+				options.sceneName = options.sceneFile.substr(options.sceneFile.find_last_of("/\\") + 1);
+				options.sceneName = options.sceneName.substr(0, options.sceneName.find_last_of('.'));
+				valid = !options.sceneName.empty();
+			}
+		}
+		else if (strcmp(option, "--size") == 0)
+		{
+			valid = sscanf(value, "%dx%d%c", &options.width, &options.height, &extra) == 2
+					&& options.width > 0 && options.height > 0
+					&& options.width <= maxImageSide && options.height <= maxImageSide
+					&& (long long)options.width * options.height <= maxImagePixels;
+		}
+		else if (strcmp(option, "--magnification") == 0)
+		{
+			valid = sscanf(value, "%f%c", &options.magnification, &extra) == 1 && options.magnification > 0;
+		}
+		else if (strcmp(option, "--fov") == 0)
+		{
+			valid = sscanf(value, "%f%c", &options.fieldOfView, &extra) == 1
+					&& options.fieldOfView > 0 && options.fieldOfView < 180;
+		}
+		else if (strcmp(option, "--eye") == 0)
+		{
+			vec3 &e = options.eye;
+			valid = sscanf(value, "%f,%f,%f%c", &e.x, &e.y, &e.z, &extra) == 3;
+			options.hasEye = true;
+		}
+		else if (strcmp(option, "--look-at") == 0)
+		{
+			vec3 &t = options.target;
+			valid = sscanf(value, "%f,%f,%f%c", &t.x, &t.y, &t.z, &extra) == 3;
+			options.hasTarget = true;
+		}
+		else if (strcmp(option, "--depth") == 0)
+		{
+			valid = sscanf(value, "%d%c", &options.recursion, &extra) == 1 && options.recursion >= 0;
+		}
+		else if (strcmp(option, "--antialias") == 0)
+		{
+			valid = sscanf(value, "%d%c", &options.antialiasing, &extra) == 1
+					&& options.antialiasing >= 0 && options.antialiasing <= 8;
+		}
+		else if (strcmp(option, "--aa-threshold") == 0)
+		{
+			valid = sscanf(value, "%f%c", &options.antialiasThreshold, &extra) == 1 && options.antialiasThreshold >= 0;
+		}
+		else if (strcmp(option, "--light-samples") == 0)
+		{
+			valid = sscanf(value, "%d%c", &options.lightSamples, &extra) == 1 && options.lightSamples >= 0;
+		}
+		else if (strcmp(option, "--samples") == 0)
+		{
+			valid = sscanf(value, "%d%c", &options.pixelSamples, &extra) == 1
+					&& options.pixelSamples >= 1 && options.pixelSamples <= 4096;
+		}
+		else if (strcmp(option, "--aperture") == 0)
+		{
+			valid = sscanf(value, "%f%c", &options.aperture, &extra) == 1 && options.aperture >= 0;
+		}
+		else if (strcmp(option, "--focus") == 0)
+		{
+			valid = sscanf(value, "%f%c", &options.focus, &extra) == 1 && options.focus > 0;
+		}
+		else if (strcmp(option, "--frames") == 0)
+		{
+			valid = sscanf(value, "%d%c", &options.frames, &extra) == 1 && options.frames >= 1;
+		}
+		else if (strcmp(option, "--convert") == 0)
+		{
+			options.convert = value;
+			valid = !options.convert.empty();
+		}
+		else if (strcmp(option, "--profile") == 0)
+		{
+			#ifndef RAYTRACER_PROFILE
+			cout << "ERROR: This build has no profiler, rebuild with make PROFILE=1" << endl;
+			return false;
+			#endif
+			
+			options.profile = value;
+			valid = !options.profile.empty();
+		}
+		else if (strcmp(option, "--bench") == 0)
+		{
+			options.benchDirectory = value;
+			valid = !options.benchDirectory.empty();
+		}
+		else if (strcmp(option, "--psnr") == 0)
+		{
+			valid = sscanf(value, "%f%c", &options.minimumPsnr, &extra) == 1 && options.minimumPsnr >= 0;
+		}
+		else if (strcmp(option, "--results") == 0)
+		{
+			options.results = value;
+			valid = !options.results.empty();
+		}
+		else
+		{
+			options.output = value;
+			valid = !options.output.empty();
+		}
+		
+		if (!valid)
+		{
+			cout << "ERROR: Bad value for " << option << ": " << value << endl;
+			return false;
+		}
+		
+		i++;
+	}
+	
+	return true;
+}
+
+void printSceneCounts(const Scene &scene)
+{
+	cout << scene.lights.size() << " lights, " << scene.planes.size() << " planes, "
+		<< scene.triangles.size() << " triangles, " << scene.spheres.size() << " spheres";
+
+	if (!scene.meshes.empty())
+	{
+		cout << ", " << scene.meshes.size() << " meshes of " << scene.meshTriangles.size()
+			<< " triangles and " << scene.meshVertices.size() << " vertices";
+	}
+
+	if (!scene.instances.empty())
+	{
+		cout << ", " << scene.instances.size() << " instances of " << scene.objects.size() << " objects of "
+			<< scene.objectTriangles.size() << " triangles";
+	}
+
+	if (scene.animated())
+	{
+		cout << ", " << scene.cameraKeys.size() << " camera keys, " << scene.tracks.size() << " keyed shapes";
+	}
+}
+
+//Distance along the view to whatever is in the middle of the image, for a
+//lens not told where to focus; the scene has to be built
+float autofocusDistance(const Scene &scene, const Camera &camera)
+{
+	Ray centreRay = Ray(camera.pos, camera.rayDirection(camera.width / 2.f, camera.height / 2.f), vec3(0, 0, 0));
+	
+	findClosestHit(centreRay, TraceContext(scene, 0));
+	
+	if (!centreRay.hasIntersected)
+	{//Nothing there, focus far off
+		return 1e6f;
+	}
+	
+	return centreRay.closestDistance * dot(centreRay.directionVector, camera.dir);
+}
+
+//The scene's camera as it is now, with the options' changes to it
+bool batchCamera(const Scene &scene, const BatchOptions &options, Camera &camera)
+{
+	camera = sceneCamera(scene, options.magnification, options.width, options.height);
+	
+	if (options.hasEye)
+	{
+		camera.pos = options.eye;
+	}
+	
+	if (options.hasTarget)
+	{
+		if (length(options.target - camera.pos) <= 0)
+		{
+			cout << "ERROR: The camera can't look at its own position" << endl;
+			return false;
+		}
+		
+		camera.lookAt(options.target);
+	}
+	
+	if (options.fieldOfView > 0)
+	{
+		camera.setFieldOfView(options.fieldOfView);
+	}
+	
+	camera.lensRadius = options.aperture;
+	
+	if (options.aperture > 0)
+	{
+		camera.focusDistance = (options.focus > 0) ? options.focus : autofocusDistance(scene, camera);
+	}
+	
+	return true;
+}
+
+//Renders frames spread evenly from the scene's first key to its last, each
+//saved under the output name with its number. The one scene and buffer are
+//kept throughout; between frames the scene is only posed, which moves the
+//keyed shapes and refits the BVH, so a frame costs little more than its render.
+int renderSequence(Scene &scene, const BatchOptions &options, RenderSettings settings, ImageBuffer &buffer, const string &output)
+{
+	typedef chrono::steady_clock Clock;
+	
+	if (!scene.animated())
+	{
+		cout << "ERROR: " << options.sceneFile << " has no camera or shape keys to animate" << endl;
+		return -1;
+	}
+	
+	float start, end;
+	scene.animationTimes(start, end);
+	
+	//Numbers go before the extension, frames are PNGs unless it says otherwise
+	string stem = output;
+	string extension = ".png";
+	size_t dot = output.find_last_of('.');
+	size_t slash = output.find_last_of("/\\");
+	
+	if (dot != string::npos && (slash == string::npos || dot > slash))
+	{
+		stem = output.substr(0, dot);
+		extension = output.substr(dot);
+	}
+	
+	double poseSeconds = 0;
+	double renderSeconds = 0;
+	double saveSeconds = 0;
+	RayCounts totals;
+	
+	for (int frame = 0; frame < options.frames; frame++)
+	{
+		float time = (options.frames > 1) ? start + (end - start) * frame / (options.frames - 1) : start;
+		
+		Clock::time_point poseStart = Clock::now();
+		
+		scene.pose(time, tileRenderer.Pool());
+		
+		if ( !batchCamera(scene, options, settings.camera) )
+		{
+			return -1;
+		}
+		
+		Clock::time_point renderStart = Clock::now();
+		
+		totals.add(renderImage(scene, settings, buffer));
+		
+		Clock::time_point saveStart = Clock::now();
+		
+		char number[16];
+		snprintf(number, sizeof(number), "_%04d", frame + 1);
+		
+		if ( !buffer.SaveToFile(stem + number + extension, tileRenderer.Pool()) )
+		{
+			cout << "ERROR: Failed to save image to file." << endl;
+			return -1;
+		}
+		
+		Clock::time_point saveEnd = Clock::now();
+		
+		poseSeconds += chrono::duration<double>(renderStart - poseStart).count();
+		renderSeconds += chrono::duration<double>(saveStart - renderStart).count();
+		saveSeconds += chrono::duration<double>(saveEnd - saveStart).count();
+	}
+	
+	cout << "Frames: " << options.frames << " from " << start << " s to " << end << " s of the animation" << endl;
+	cout << "Pose:   " << poseSeconds << " s, " << poseSeconds / options.frames << " s per frame" << endl;
+	cout << "Render: " << renderSeconds << " s, " << renderSeconds / options.frames << " s per frame on "
+		<< tileRenderer.ThreadCount() << " threads" << endl;
+	cout << "Save:   " << saveSeconds << " s, " << saveSeconds / options.frames << " s per frame" << endl;
+	cout << "Rays:   " << totals.total() << ", " << totals.total() / renderSeconds / 1e6 << " M rays/s" << endl;
+	
+	return 0;
+}
+
+int runBatch(const BatchOptions &options)
+{
+	typedef chrono::steady_clock Clock;
+	
+	Clock::time_point loadStart = Clock::now();
+	
+	shared_ptr<Scene> scene = make_shared<Scene>();
+	if ( !loadSceneFile(options.sceneFile, *scene) )
+	{
+		return -1;
+	}
+	
+	if (!options.convert.empty())
+	{
+		if ( !saveSceneFile(*scene, options.convert) )
+		{
+			return -1;
+		}
+		
+		cout << "Wrote " << options.convert << ": ";
+		printSceneCounts(*scene);
+		cout << endl;
+		return 0;
+	}
+	
+	Clock::time_point buildStart = Clock::now();
+	
+	scene->build(tileRenderer.Pool());
+	
+	Clock::time_point renderStart = Clock::now();
+	
+	string output = options.output.empty() ? options.sceneName : options.output;
+	
+	Camera camera;
+	if ( !batchCamera(*scene, options, camera) )
+	{
+		return -1;
+	}
+	
+	ImageBuffer buffer;
+	if ( !buffer.Allocate(options.width, options.height, tileRenderer.TileSize()) )
+	{
+		return -1;
+	}
+	
+	RenderSettings settings = RenderSettings(camera, options.recursion, options.packets);
+	settings.antialias = AdaptiveSampler(options.antialiasing, options.antialiasThreshold);
+	settings.lightSamples = options.lightSamples;
+	settings.pixelSamples = options.pixelSamples;
+	settings.glossy = options.glossy;
+	settings.denoise = options.denoise;
+	
+	if (options.frames > 0)
+	{
+		cout << "Load:   " << chrono::duration<double>(buildStart - loadStart).count() << " s, ";
+		printSceneCounts(*scene);
+		cout << endl;
+		cout << "Build:  " << chrono::duration<double>(renderStart - buildStart).count() << " s" << endl;
+		
+		return renderSequence(*scene, options, settings, buffer, output);
+	}
+	
+	#ifdef RAYTRACER_PROFILE
+	Profiler::Reset();
+	#endif
+	
+	double denoiseSeconds = 0;
+	RayCounts counts = renderImage(*scene, settings, buffer, &denoiseSeconds);
+	
+	Clock::time_point renderEnd = Clock::now();
+	
+	double loadSeconds = chrono::duration<double>(buildStart - loadStart).count();
+	double buildSeconds = chrono::duration<double>(renderStart - buildStart).count();
+	double renderSeconds = chrono::duration<double>(renderEnd - renderStart).count();
+	
+	cout << options.sceneFile << ", " << options.width << "x" << options.height
+		<< ", field of view " << camera.fieldOfView << ", depth " << options.recursion
+		<< ", packets " << (settings.tracesPackets() ? "on" : "off")
+		<< ", antialiasing " << options.antialiasing << ", light samples " << options.lightSamples
+		<< ", samples " << options.pixelSamples << (options.glossy ? ", glossy" : "")
+		<< (options.denoise ? ", denoised" : "");
+	
+	if (camera.lensRadius > 0)
+	{
+		cout << ", aperture " << camera.lensRadius << " focused at " << camera.focusDistance;
+	}
+	
+	cout << endl;
+	cout << "Load:   " << loadSeconds << " s, ";
+	printSceneCounts(*scene);
+	cout << (scene->triangles.attached() ? ", mapped" : "") << endl;
+	cout << "Build:  " << buildSeconds << " s" << endl;
+	cout << "Render: " << renderSeconds << " s on " << tileRenderer.ThreadCount() << " threads" << endl;
+	
+	if (settings.denoise)
+	{
+		cout << "Denoise: " << denoiseSeconds << " s of the render" << endl;
+	}
+	
+	cout << "Rays:   " << counts.total() << " (" << counts.primary << " primary, " << counts.shadow
+		<< " shadow, " << counts.reflected << " reflected), "
+		<< counts.total() / renderSeconds / 1e6 << " M rays/s" << endl;
+	cout << "Samples: " << counts.primary << ", "
+		<< double(counts.primary) / (options.width * options.height) << " per pixel" << endl;
+	cout << "Shaded: " << counts.shaded << " hits, " << counts.closerHits - counts.shaded
+		<< " closer hits passed over before the closest was found" << endl;
+	
+	#ifdef RAYTRACER_PROFILE
+	Profiler::Totals profile = Profiler::Collect();
+	Profiler::PrintSummary(cout, profile);
+	
+	if ( !options.profile.empty() && !Profiler::WriteJson(options.profile, options.sceneFile, profile) )
+	{
+		return -1;
+	}
+	#endif
+	
+	if ( !buffer.SaveToFile(output, tileRenderer.Pool()) )
+	{
+		cout << "ERROR: Failed to save image to file." << endl;
+		return -1;
+	}
+	
+	return 0;
+}
+
+// --------------------------------------------------------------------------
+// Benchmarks, timed renders at fixed sizes checked against reference images
+
+struct BenchCase
+{
+	const char *name;			//Also the name of its reference image
+	const char *sceneFile;		//0 for a stress scene of these counts
+	int sphereCount;
+	int triangleCount;
+	int treeCount;				//Above 0 for a forest of this many trees instead
+	int width;
+	int height;
+	int recursion;
+	int pixelSamples;
+	bool glossy;
+	float aperture;				//0 for a pinhole
+	float focus;
+	bool denoise;
+	float time;					//Where an animated scene is posed, as for a frame of --frames
+};
+
+const BenchCase benchCases[] =
+{
+	{ "Scene_One",             "scenes/Scene_One.scene",      0,       0,       0,     1024, 768, 4, 1, false, 0,     0,    false, 0 },
+	{ "Scene_Two",             "scenes/Scene_Two.scene",      0,       0,       0,     1024, 768, 4, 1, false, 0,     0,    false, 0 },
+	{ "Scene_Three",           "scenes/Scene_Three.scene",    0,       0,       0,     1024, 768, 4, 1, false, 0,     0,    false, 0 },
+	{ "Stress_10k",            0,                             10000,   10000,   0,     640,  480, 2, 1, false, 0,     0,    false, 0 },
+	{ "Stress_1M",             0,                             1000000, 1000000, 0,     640,  480, 2, 1, false, 0,     0,    false, 0 },
+	{ "Forest_10k",            0,                             0,       0,       10000, 640,  480, 2, 1, false, 0,     0,    false, 0 },
+	{ "Distribution",          "scenes/Distribution.scene",   0,       0,       0,     640,  480, 3, 8, true,  0.06f, 4.5f, false, 0 },
+	{ "Distribution_Denoised", "scenes/Distribution.scene",   0,       0,       0,     640,  480, 3, 4, true,  0.06f, 4.5f, true,  0 },
+	{ "Denormal",              "scenes/Denormal.scene",       0,       0,       0,     160,  120, 1, 1, false, 0,     0,    false, 0 },
+	{ "TexturedMotion_0001",   "scenes/TexturedMotion.scene", 0,       0,       0,     320,  240, 2, 1, false, 0,     0,    false, 0 },
+	{ "TexturedMotion_0002",   "scenes/TexturedMotion.scene", 0,       0,       0,     320,  240, 2, 1, false, 0,     0,    false, 2 },
+	{ "TexturedMotion_0003",   "scenes/TexturedMotion.scene", 0,       0,       0,     320,  240, 2, 1, false, 0,     0,    false, 4 }
+};
+const int benchCaseCount = sizeof(benchCases) / sizeof(benchCases[0]);
+
+//Recorded with the results, as timings from an unoptimised build mean little
+#ifdef __OPTIMIZE__
+const bool benchOptimized = true;
+#else
+const bool benchOptimized = false;
+#endif
+
+int runBench(const BatchOptions &options)
+{
+	typedef chrono::steady_clock Clock;
+	
+	ofstream results;
+	if (!options.results.empty())
+	{
+		results.open(options.results.c_str());
+		
+		if (!results)
+		{
+			cout << "ERROR: Could not write results to " << options.results << endl;
+			return -1;
+		}
+		
+		results << "{" << endl;
+		results << "  \"threads\": " << tileRenderer.ThreadCount() << ", \"packets\": "
+			<< (options.packets ? "true" : "false") << ", \"minimum_psnr\": " << options.minimumPsnr << "," << endl;
+		results << "  \"optimized\": " << (benchOptimized ? "true" : "false") << "," << endl;
+		results << "  \"cases\": [" << endl;
+	}
+	
+	int failures = 0;
+	int written = 0;
+	
+	for (int i = 0; i < benchCaseCount; i++)
+	{
+		const BenchCase &bench = benchCases[i];
+		
+		Clock::time_point loadStart = Clock::now();
+		
+		shared_ptr<Scene> scene = make_shared<Scene>();
+		
+		if (bench.sceneFile)
+		{
+			if ( !loadSceneFile(bench.sceneFile, *scene) )
+			{
+				cout << bench.name << ": FAILED, the scene didn't load" << endl;
+				failures++;
+				continue;
+			}
+		}
+		else if (bench.treeCount > 0)
+		{
+			generateForestScene(*scene, bench.treeCount);
+		}
+		else
+		{
+			generateStressScene(*scene, bench.sphereCount, bench.triangleCount);
+		}
+		
+		Clock::time_point buildStart = Clock::now();
+		
+		scene->build(tileRenderer.Pool());
+		
+		if (scene->animated())
+		{
+			scene->pose(bench.time, tileRenderer.Pool());
+		}
+		
+		Clock::time_point renderStart = Clock::now();
+		
+		ImageBuffer buffer;
+		if ( !buffer.Allocate(bench.width, bench.height, tileRenderer.TileSize()) )
+		{
+			return -1;
+		}
+		
+		Camera camera = sceneCamera(*scene, defaultMagnification, bench.width, bench.height);
+		camera.lensRadius = bench.aperture;
+		camera.focusDistance = bench.focus;
+		
+		RenderSettings settings = RenderSettings(camera, bench.recursion, options.packets);
+		settings.pixelSamples = bench.pixelSamples;
+		settings.glossy = bench.glossy;
+		settings.denoise = bench.denoise;
+		
+		RayCounts counts = renderImage(*scene, settings, buffer);
+		
+		Clock::time_point renderEnd = Clock::now();
+		
+		double loadSeconds = chrono::duration<double>(buildStart - loadStart).count();
+		double buildSeconds = chrono::duration<double>(renderStart - buildStart).count();
+		double renderSeconds = chrono::duration<double>(renderEnd - renderStart).count();
+		double raysPerSecond = counts.total() / renderSeconds;
+		
+		string reference = options.benchDirectory + "/" + bench.name + ".png";
+		double psnr = 0;
+		bool passed;
+		
+		if (options.updateReferences)
+		{
+			passed = buffer.SaveToFile(reference, tileRenderer.Pool());
+			psnr = ImageBuffer::MAX_PSNR;
+		}
+		else
+		{
+			passed = buffer.CompareToFile(reference, psnr) && psnr >= options.minimumPsnr;
+		}
+		
+		if (!passed)
+		{
+			failures++;
+		}
+		
+		cout << bench.name << ", " << bench.width << "x" << bench.height << ", depth " << bench.recursion
+			<< ": load " << loadSeconds << " s, build " << buildSeconds << " s, render " << renderSeconds << " s, "
+			<< raysPerSecond / 1e6 << " M rays/s, PSNR " << psnr << " dB, " << (passed ? "passed" : "FAILED") << endl;
+		
+		if (results.is_open())
+		{
+			results << (written++ > 0 ? ",\n" : "") << "    { \"name\": \"" << bench.name << "\", \"width\": " << bench.width
+				<< ", \"height\": " << bench.height << ", \"depth\": " << bench.recursion
+				<< ", \"load_seconds\": " << loadSeconds << ", \"build_seconds\": " << buildSeconds
+				<< ", \"render_seconds\": " << renderSeconds << ", \"rays\": " << counts.total()
+				<< ", \"rays_per_second\": " << raysPerSecond << ", \"psnr\": " << psnr
+				<< ", \"passed\": " << (passed ? "true" : "false") << " }";
+		}
+	}
+	
+	if (results.is_open())
+	{
+		results << endl << "  ]," << endl;
+		results << "  \"failures\": " << failures << endl;
+		results << "}" << endl;
+	}
+	
+	cout << benchCaseCount - failures << " of " << benchCaseCount << " benchmarks passed" << endl;
+	
+	return failures == 0 ? 0 : -1;
+}
+
+// ==========================================================================
+// PROGRAM ENTRY POINT
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1)
+	{//Any arguments mean a batch render straight to file, GLFW is never touched
+		BatchOptions options;
+		
+		if ( !parseBatchOptions(argc, argv, options) )
+		{
+			printUsage(argv[0]);
+			return -1;
+		}
+		
+		if (!options.benchDirectory.empty())
+		{
+			return runBench(options);
+		}
+		
+		return runBatch(options);
+	}
+	
+	// initialize the GLFW windowing system
+	if (!glfwInit()) {
+		cout << "ERROR: GLFW failed to initialize, TERMINATING" << endl;
+		return -1;
+	}
+	glfwSetErrorCallback(ErrorCallback);
+
+	// attempt to create a window with an OpenGL 4.1 core profile context
+	GLFWwindow *window = 0;
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	window = glfwCreateWindow(1024, 768, "CPSC 453 OpenGL Boilerplate", 0, 0);
 	if (!window) {
 		cout << "Program failed to create GLFW window, TERMINATING" << endl;
@@ -1636,9 +1682,18 @@ int main(int argc, char *argv[])
 		RenderScene();
 		glfwSwapBuffers(window);
 		glfwPollEvents();
+		
+		#ifdef RAYTRACER_PROFILE
+		if ( profilePending && !progressiveRenderer.Busy() )
+		{//Only read once nothing is counting any more
+			profilePending = false;
+			Profiler::PrintSummary(cout, Profiler::Collect());
+		}
+		#endif
 	}
 
 	// clean up allocated resources before exit
+	progressiveRenderer.Cancel();
 	DestroyGeometry();
 	DestroyShaders();
 	myBuffer.Destroy();
@@ -0,0 +1,816 @@
+// ==========================================================================
+// Bounding Volume Hierarchy construction
+// ==========================================================================
+
+#include "BVH.h"
+#include "ThreadPool.h"
+
+#include <cmath>
+#include <functional>
+#include <stdint.h>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+// SAH build parameters
+
+const int SAH_BIN_COUNT = 16;
+const int MAX_LEAF_SIZE = 8;
+const float TRAVERSAL_COST = 1.f;
+const float INTERSECTION_COST = 1.f;
+
+// --------------------------------------------------------------------------
+// Parallel build parameters
+
+//Trees over fewer primitives than this are built on the calling thread, as
+//starting the threads would cost more than it saves
+const int PARALLEL_BUILD_MINIMUM = 65536;
+
+//Roughly how many clusters a big tree is cut into. It doesn't depend on the
+//number of cores, so the tree, and so the image, is the same on any machine.
+const int BUILD_CLUSTER_COUNT = 256;
+
+//Bits of Morton code per axis, sorted a radix digit at a time
+const int MORTON_BITS = 10;
+const int RADIX_BITS = 10;
+const int RADIX_SIZE = 1 << RADIX_BITS;
+
+//The tree joining the clusters stops choosing splits by SAH this deep, to
+//leave the clusters' subtrees room within the traversal stack
+const int CLUSTER_TREE_SAH_DEPTH = 24;
+
+// --------------------------------------------------------------------------
+
+void BVH::clear()
+{
+	nodes.clear();
+	primitives.clear();
+	nodeArea = 0;
+	builtAreaRatio = 0;
+
+	parents.clear();
+	leaves.clear();
+	for (int type = 0; type < BVHPrimitive::TYPE_COUNT; type++)
+	{
+		positions[type].clear();
+	}
+	refitNodes.clear();
+	refitMarks.clear();
+}
+
+static AABB triangleBounds(const Triangle &triangle)
+{
+	AABB bounds;
+	bounds.extend(triangle.p1);
+	bounds.extend(triangle.p2);
+	bounds.extend(triangle.p3);
+	return bounds;
+}
+
+static AABB meshTriangleBounds(const PrimitiveArray<vec3> &meshVertices, const MeshTriangle &triangle)
+{
+	AABB bounds;
+	for (int corner = 0; corner < 3; corner++)
+	{
+		bounds.extend(meshVertices[triangle.corners[corner]]);
+	}
+	return bounds;
+}
+
+static AABB sphereBounds(const Sphere &sphere)
+{
+	vec3 radius = vec3(sphere.radius);
+	return AABB(sphere.centre - radius, sphere.centre + radius);
+}
+
+void BVH::build(const PrimitiveArray<Triangle> &triangles, const PrimitiveArray<vec3> &meshVertices,
+	const PrimitiveArray<MeshTriangle> &meshTriangles, const PrimitiveArray<Sphere> &spheres,
+	const vector<AABB> &instanceBounds, ThreadPool &pool)
+{
+	clear();
+
+	vector<BuildReference> references;
+	references.reserve(triangles.size() + meshTriangles.size() + spheres.size() + instanceBounds.size());
+
+	for (unsigned int i = 0; i < triangles.size(); i++)
+	{
+		BuildReference reference;
+		reference.bounds = triangleBounds(triangles[i]);
+		reference.centroid = reference.bounds.centre();
+		reference.primitive = BVHPrimitive(BVHPrimitive::TRIANGLE, i);
+		references.push_back(reference);
+	}
+
+	for (unsigned int i = 0; i < meshTriangles.size(); i++)
+	{
+		BuildReference reference;
+		reference.bounds = meshTriangleBounds(meshVertices, meshTriangles[i]);
+		reference.centroid = reference.bounds.centre();
+		reference.primitive = BVHPrimitive(BVHPrimitive::MESH_TRIANGLE, i);
+		references.push_back(reference);
+	}
+
+	for (unsigned int i = 0; i < spheres.size(); i++)
+	{
+		BuildReference reference;
+		reference.bounds = sphereBounds(spheres[i]);
+		reference.centroid = spheres[i].centre;
+		reference.primitive = BVHPrimitive(BVHPrimitive::SPHERE, i);
+		references.push_back(reference);
+	}
+
+	for (unsigned int i = 0; i < instanceBounds.size(); i++)
+	{
+		BuildReference reference;
+		reference.bounds = instanceBounds[i];
+		reference.centroid = reference.bounds.centre();
+		reference.primitive = BVHPrimitive(BVHPrimitive::INSTANCE, i);
+		references.push_back(reference);
+	}
+
+	buildTree(references, pool);
+}
+
+void BVH::build(const PrimitiveArray<vec3> &vertices, const PrimitiveArray<MeshTriangle> &triangles, const Mesh &object,
+	ThreadPool &pool)
+{
+	clear();
+
+	vector<BuildReference> references;
+	references.reserve(object.triangleCount);
+
+	for (uint32_t i = object.firstTriangle; i < object.firstTriangle + object.triangleCount; i++)
+	{
+		BuildReference reference;
+		reference.bounds = meshTriangleBounds(vertices, triangles[i]);
+		reference.centroid = reference.bounds.centre();
+		reference.primitive = BVHPrimitive(BVHPrimitive::MESH_TRIANGLE, i);
+		references.push_back(reference);
+	}
+
+	buildTree(references, pool);
+}
+
+void BVH::buildTree(vector<BuildReference> &references, ThreadPool &pool)
+{
+	if (references.empty())
+	{
+		return;
+	}
+
+	if ((int)references.size() < PARALLEL_BUILD_MINIMUM)
+	{//A binary tree never has more than 2n - 1 nodes
+		BuildArena arena;
+		arena.nodes.reserve(2 * references.size() - 1);
+		arena.primitives.reserve(references.size());
+
+		buildRecursive(arena, references, 0, (int)references.size(), 0);
+
+		nodes.swap(arena.nodes);
+		primitives.swap(arena.primitives);
+	}
+	else
+	{
+		buildParallel(references, pool);
+	}
+
+	for (const BVHNode &node : nodes)
+	{
+		nodeArea += node.bounds.surfaceArea();
+	}
+	builtAreaRatio = areaRatio();
+}
+
+void BVH::prepareRefit()
+{
+	parents.assign(nodes.size(), -1);
+	leaves.assign(primitives.size(), 0);
+	refitMarks.assign(nodes.size(), false);
+
+	for (int i = 0; i < (int)nodes.size(); i++)
+	{
+		const BVHNode &node = nodes[i];
+
+		if (node.isLeaf())
+		{
+			for (int p = node.offset; p < node.offset + node.count; p++)
+			{
+				leaves[p] = i;
+			}
+		}
+		else
+		{
+			parents[i + 1] = i;
+			parents[node.offset] = i;
+		}
+	}
+
+	for (int p = 0; p < (int)primitives.size(); p++)
+	{
+		vector<int> &typePositions = positions[primitives[p].type];
+
+		if ((int)typePositions.size() <= primitives[p].index)
+		{
+			typePositions.resize(primitives[p].index + 1, -1);
+		}
+		typePositions[primitives[p].index] = p;
+	}
+}
+
+bool BVH::refit(const PrimitiveArray<Triangle> &triangles, const PrimitiveArray<vec3> &meshVertices,
+	const PrimitiveArray<MeshTriangle> &meshTriangles, const PrimitiveArray<Sphere> &spheres,
+	const vector<AABB> &instanceBounds, const vector<BVHPrimitive> &moved)
+{
+	if (nodes.empty())
+	{
+		return true;
+	}
+
+	if (parents.empty())
+	{
+		prepareRefit();
+	}
+
+	//Each moved primitive's leaf and the nodes above it, stopping where
+	//another primitive's path has already been
+	for (const BVHPrimitive &primitive : moved)
+	{
+		int node = leaves[position(primitive)];
+
+		while (node >= 0 && !refitMarks[node])
+		{
+			refitMarks[node] = true;
+			refitNodes.push_back(node);
+			node = parents[node];
+		}
+	}
+
+	//Children always come after their parent, so going backwards every
+	//node's children are done before it is
+	sort(refitNodes.begin(), refitNodes.end(), greater<int>());
+
+	for (int i : refitNodes)
+	{
+		BVHNode &node = nodes[i];
+		AABB bounds;
+
+		if (node.isLeaf())
+		{
+			for (int p = node.offset; p < node.offset + node.count; p++)
+			{
+				const BVHPrimitive &primitive = primitives[p];
+
+				if (primitive.type == BVHPrimitive::TRIANGLE)
+				{
+					bounds.extend(triangleBounds(triangles[primitive.index]));
+				}
+				else if (primitive.type == BVHPrimitive::MESH_TRIANGLE)
+				{
+					bounds.extend(meshTriangleBounds(meshVertices, meshTriangles[primitive.index]));
+				}
+				else if (primitive.type == BVHPrimitive::SPHERE)
+				{
+					bounds.extend(sphereBounds(spheres[primitive.index]));
+				}
+				else
+				{
+					bounds.extend(instanceBounds[primitive.index]);
+				}
+			}
+		}
+		else
+		{
+			bounds = nodes[i + 1].bounds;
+			bounds.extend(nodes[node.offset].bounds);
+		}
+
+		nodeArea += bounds.surfaceArea() - node.bounds.surfaceArea();
+		node.bounds = bounds;
+		refitMarks[i] = false;
+	}
+
+	refitNodes.clear();
+
+	return areaRatio() <= builtAreaRatio * REFIT_REBUILD_RATIO;
+}
+
+float BVH::areaRatio() const
+{
+	if (nodes.empty() || nodes[0].bounds.surfaceArea() <= 0)
+	{
+		return 0;
+	}
+
+	return (float)(nodeArea / nodes[0].bounds.surfaceArea());
+}
+
+// --------------------------------------------------------------------------
+
+//SAH bin of a centroid this far along the axis, clamped at both ends, as
+//rounding can take the offset a hair outside the centroid bounds
+static int sahBin(float offset, float binScale)
+{
+	float bin = offset * binScale;
+
+	if (!(bin > 0.f))
+	{//Also NaN
+		return 0;
+	}
+
+	return (bin < SAH_BIN_COUNT - 1) ? (int)bin : SAH_BIN_COUNT - 1;
+}
+
+int BVH::buildRecursive(BuildArena &arena, vector<BuildReference> &references, int first, int last, int depth)
+{
+	vector<BVHNode> &nodes = arena.nodes;
+	int nodeIndex = (int)nodes.size();
+	nodes.push_back(BVHNode());
+
+	AABB bounds, centroidBounds;
+	for (int i = first; i < last; i++)
+	{
+		bounds.extend(references[i].bounds);
+		centroidBounds.extend(references[i].centroid);
+	}
+	nodes[nodeIndex].bounds = bounds;
+
+	int count = last - first;
+	vec3 extent = centroidBounds.upper - centroidBounds.lower;
+
+	//Find the cheapest binned SAH split along any axis
+	int bestAxis = -1;
+	int bestBin = 0;
+	float bestCost = 1e30f;
+	float leafCost = INTERSECTION_COST * count;
+
+	if (count > 1)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float binScale = SAH_BIN_COUNT / extent[axis];
+
+			if (extent[axis] <= 0.f || !std::isfinite(binScale))
+			{//Every centroid is in the same spot along this axis, or so nearly
+				//that the bins can't tell them apart
+				continue;
+			}
+
+			AABB binBounds[SAH_BIN_COUNT];
+			int binCounts[SAH_BIN_COUNT] = { 0 };
+
+			for (int i = first; i < last; i++)
+			{
+				int bin = sahBin(references[i].centroid[axis] - centroidBounds.lower[axis], binScale);
+				binBounds[bin].extend(references[i].bounds);
+				binCounts[bin]++;
+			}
+
+			//Sweep from the right to get the cost of everything past each plane
+			float rightArea[SAH_BIN_COUNT];
+			int rightCount[SAH_BIN_COUNT];
+			AABB sweep;
+			int sweepCount = 0;
+			for (int bin = SAH_BIN_COUNT - 1; bin > 0; bin--)
+			{
+				sweep.extend(binBounds[bin]);
+				sweepCount += binCounts[bin];
+				rightArea[bin] = sweep.surfaceArea();
+				rightCount[bin] = sweepCount;
+			}
+
+			sweep = AABB();
+			sweepCount = 0;
+			for (int bin = 1; bin < SAH_BIN_COUNT; bin++)
+			{
+				sweep.extend(binBounds[bin - 1]);
+				sweepCount += binCounts[bin - 1];
+
+				if (sweepCount == 0 || rightCount[bin] == 0)
+				{
+					continue;
+				}
+
+				float cost = sweep.surfaceArea() * sweepCount + rightArea[bin] * rightCount[bin];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = bin;
+				}
+			}
+		}
+
+		float parentArea = bounds.surfaceArea();
+		if (parentArea > 0.f)
+		{
+			bestCost = TRAVERSAL_COST + INTERSECTION_COST * bestCost / parentArea;
+		}
+	}
+
+	bool canSplit = count > 1 && depth < BVH_STACK_SIZE - 2;
+	int middle = first + count / 2;
+
+	if (canSplit && bestAxis >= 0 && bestCost < leafCost)
+	{//Split at the chosen bin boundary
+		int axis = bestAxis;
+		float binScale = SAH_BIN_COUNT / extent[axis];
+		float lower = centroidBounds.lower[axis];
+		middle = (int)(partition(references.begin() + first, references.begin() + last,
+			[&](const BuildReference &reference)
+			{
+				return sahBin(reference.centroid[axis] - lower, binScale) < bestBin;
+			}) - references.begin());
+	}
+	else if (canSplit && count > MAX_LEAF_SIZE)
+	{//Too many primitives for one leaf, fall back to a median split
+		int axis = 0;
+		if (extent.y > extent[axis]) axis = 1;
+		if (extent.z > extent[axis]) axis = 2;
+
+		nth_element(references.begin() + first, references.begin() + middle, references.begin() + last,
+			[axis](const BuildReference &a, const BuildReference &b)
+			{
+				return a.centroid[axis] < b.centroid[axis];
+			});
+	}
+	else
+	{//Make a leaf, triangles first so they can be tested as one packed run
+		stable_sort(references.begin() + first, references.begin() + last,
+			[](const BuildReference &a, const BuildReference &b)
+			{
+				return a.primitive.type < b.primitive.type;
+			});
+		
+		nodes[nodeIndex].offset = (int)arena.primitives.size();
+		nodes[nodeIndex].count = count;
+		for (int i = first; i < last; i++)
+		{
+			arena.primitives.push_back(references[i].primitive);
+		}
+		return nodeIndex;
+	}
+
+	//Left child goes straight after this node, right child after the left subtree
+	nodes[nodeIndex].count = 0;
+	buildRecursive(arena, references, first, middle, depth + 1);
+	int right = buildRecursive(arena, references, middle, last, depth + 1);
+	nodes[nodeIndex].offset = right;
+
+	return nodeIndex;
+}
+
+// --------------------------------------------------------------------------
+// Parallel build
+
+//Spreads the bits of a 10 bit number out to every third bit
+static uint32_t spreadBits(uint32_t x)
+{
+	x = (x | (x << 16)) & 0x030000ff;
+	x = (x | (x << 8)) & 0x0300f00f;
+	x = (x | (x << 4)) & 0x030c30c3;
+	x = (x | (x << 2)) & 0x09249249;
+	return x;
+}
+
+//Position along a Morton curve through the box, which visits nearby points
+//one after another
+static uint32_t mortonCode(vec3 point, const AABB &box)
+{
+	vec3 extent = box.upper - box.lower;
+	uint32_t code = 0;
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float along = (extent[axis] > 0) ? (point[axis] - box.lower[axis]) / extent[axis] : 0;
+		uint32_t cell = (uint32_t)std::min(std::max(along * (1 << MORTON_BITS), 0.f), (float)((1 << MORTON_BITS) - 1));
+
+		code |= spreadBits(cell) << (2 - axis);
+	}
+
+	return code;
+}
+
+//Stable radix sort of the codes, carrying order along; each pass every chunk
+//counts its own digits, then writes them where the counts before it end, so
+//no two threads ever write the same place
+static void radixSort(ThreadPool &pool, vector<uint32_t> &codes, vector<int> &order)
+{
+	int count = (int)codes.size();
+	int chunkCount = (int)pool.ThreadCount() * 4;
+	int chunkSize = (count + chunkCount - 1) / chunkCount;
+
+	vector<uint32_t> sortedCodes(count);
+	vector<int> sortedOrder(count);
+	vector<int> offsets(chunkCount * RADIX_SIZE);
+
+	for (int shift = 0; shift < 3 * MORTON_BITS; shift += RADIX_BITS)
+	{
+		pool.ParallelFor(chunkCount, [&](int chunk)
+		{
+			int *chunkOffsets = &offsets[chunk * RADIX_SIZE];
+			fill(chunkOffsets, chunkOffsets + RADIX_SIZE, 0);
+
+			for (int i = chunk * chunkSize; i < std::min(count, (chunk + 1) * chunkSize); i++)
+			{
+				chunkOffsets[(codes[i] >> shift) & (RADIX_SIZE - 1)]++;
+			}
+		});
+
+		int total = 0;
+		for (int digit = 0; digit < RADIX_SIZE; digit++)
+		{
+			for (int chunk = 0; chunk < chunkCount; chunk++)
+			{
+				int digitCount = offsets[chunk * RADIX_SIZE + digit];
+				offsets[chunk * RADIX_SIZE + digit] = total;
+				total += digitCount;
+			}
+		}
+
+		pool.ParallelFor(chunkCount, [&](int chunk)
+		{
+			int *chunkOffsets = &offsets[chunk * RADIX_SIZE];
+
+			for (int i = chunk * chunkSize; i < std::min(count, (chunk + 1) * chunkSize); i++)
+			{
+				int place = chunkOffsets[(codes[i] >> shift) & (RADIX_SIZE - 1)]++;
+				sortedCodes[place] = codes[i];
+				sortedOrder[place] = order[i];
+			}
+		});
+
+		codes.swap(sortedCodes);
+		order.swap(sortedOrder);
+	}
+}
+
+//Cuts [first, last) of the sorted codes where the highest bit they don't all
+//share changes, halving the space they cover, until each run is small enough
+static void splitClusters(const vector<uint32_t> &codes, int first, int last, int bit, int maxSize, vector<pair<int, int> > &runs)
+{
+	if (last - first <= maxSize)
+	{
+		runs.push_back(make_pair(first, last));
+		return;
+	}
+
+	uint32_t differing = codes[first] ^ codes[last - 1];
+	while (bit >= 0 && !((differing >> bit) & 1))
+	{
+		bit--;
+	}
+
+	int middle;
+	if (bit < 0)
+	{//All in the same cell, just halve them
+		middle = (first + last) / 2;
+	}
+	else
+	{
+		middle = (int)(partition_point(codes.begin() + first, codes.begin() + last,
+			[bit](uint32_t code)
+			{
+				return !((code >> bit) & 1);
+			}) - codes.begin());
+	}
+
+	splitClusters(codes, first, middle, bit - 1, maxSize, runs);
+	splitClusters(codes, middle, last, bit - 1, maxSize, runs);
+}
+
+void BVH::buildParallel(vector<BuildReference> &references, ThreadPool &pool)
+{
+	int count = (int)references.size();
+	int chunkCount = (int)pool.ThreadCount() * 4;
+	int chunkSize = (count + chunkCount - 1) / chunkCount;
+
+	//Box around every centroid, a piece per chunk
+	vector<AABB> chunkBounds(chunkCount);
+	pool.ParallelFor(chunkCount, [&](int chunk)
+	{
+		for (int i = chunk * chunkSize; i < std::min(count, (chunk + 1) * chunkSize); i++)
+		{
+			chunkBounds[chunk].extend(references[i].centroid);
+		}
+	});
+
+	AABB centroidBounds;
+	for (const AABB &bounds : chunkBounds)
+	{
+		centroidBounds.extend(bounds);
+	}
+
+	//References in Morton order, so each cluster is a run of neighbours
+	vector<uint32_t> codes(count);
+	vector<int> order(count);
+	pool.ParallelFor(chunkCount, [&](int chunk)
+	{
+		for (int i = chunk * chunkSize; i < std::min(count, (chunk + 1) * chunkSize); i++)
+		{
+			codes[i] = mortonCode(references[i].centroid, centroidBounds);
+			order[i] = i;
+		}
+	});
+
+	radixSort(pool, codes, order);
+
+	vector<BuildReference> sorted(count);
+	pool.ParallelFor(chunkCount, [&](int chunk)
+	{
+		for (int i = chunk * chunkSize; i < std::min(count, (chunk + 1) * chunkSize); i++)
+		{
+			sorted[i] = references[order[i]];
+		}
+	});
+	references.swap(sorted);
+
+	vector<pair<int, int> > runs;
+	splitClusters(codes, 0, count, 3 * MORTON_BITS - 1, std::max(MAX_LEAF_SIZE, count / BUILD_CLUSTER_COUNT), runs);
+
+	vector<BuildCluster> clusters(runs.size());
+	pool.ParallelFor((int)clusters.size(), [&](int i)
+	{
+		BuildCluster &cluster = clusters[i];
+		cluster.first = runs[i].first;
+		cluster.last = runs[i].second;
+
+		for (int r = cluster.first; r < cluster.last; r++)
+		{
+			cluster.bounds.extend(references[r].bounds);
+		}
+	});
+
+	//Joining the clusters first tells each how deep its subtree starts
+	vector<ClusterNode> clusterNodes;
+	vector<int> clusterOrder(clusters.size());
+	for (unsigned int i = 0; i < clusters.size(); i++)
+	{
+		clusterOrder[i] = i;
+	}
+	buildClusterTree(clusters, clusterOrder, 0, (int)clusters.size(), 0, clusterNodes);
+
+	//Each subtree goes on the end of the arena of the lane that builds it
+	vector<BuildArena> arenas(pool.ThreadCount());
+	for (BuildArena &arena : arenas)
+	{
+		arena.nodes.reserve(2 * count / arenas.size());
+		arena.primitives.reserve(count / arenas.size());
+	}
+
+	pool.ParallelForLanes((int)clusters.size(), [&](int i, int lane)
+	{
+		BuildCluster &cluster = clusters[i];
+		cluster.arena = lane;
+
+		BuildArena &arena = arenas[cluster.arena];
+		cluster.arenaNode = (int)arena.nodes.size();
+		cluster.arenaPrimitive = (int)arena.primitives.size();
+
+		buildRecursive(arena, references, cluster.first, cluster.last, cluster.depth);
+
+		cluster.nodeCount = (int)arena.nodes.size() - cluster.arenaNode;
+		cluster.primitiveCount = (int)arena.primitives.size() - cluster.arenaPrimitive;
+	});
+
+	//Lay the joining nodes out and leave a gap for each subtree, then fill
+	//the gaps all at once
+	size_t nodeCount = clusterNodes.size();
+	for (const BuildCluster &cluster : clusters)
+	{
+		nodeCount += cluster.nodeCount;
+	}
+	nodes.reserve(nodeCount);
+	primitives.reserve(count);
+	placeClusters(clusterNodes, 0, clusters);
+
+	pool.ParallelFor((int)clusters.size(), [&](int i)
+	{
+		const BuildCluster &cluster = clusters[i];
+		const BuildArena &arena = arenas[cluster.arena];
+
+		for (int n = 0; n < cluster.nodeCount; n++)
+		{
+			BVHNode node = arena.nodes[cluster.arenaNode + n];
+			node.offset += node.isLeaf() ? cluster.primitive - cluster.arenaPrimitive : cluster.node - cluster.arenaNode;
+			nodes[cluster.node + n] = node;
+		}
+
+		copy(arena.primitives.begin() + cluster.arenaPrimitive,
+			arena.primitives.begin() + cluster.arenaPrimitive + cluster.primitiveCount,
+			primitives.begin() + cluster.primitive);
+	});
+}
+
+int BVH::buildClusterTree(vector<BuildCluster> &clusters, vector<int> &order, int first, int last,
+	int depth, vector<ClusterNode> &clusterNodes)
+{
+	int nodeIndex = (int)clusterNodes.size();
+	clusterNodes.push_back(ClusterNode());
+
+	AABB bounds;
+	for (int i = first; i < last; i++)
+	{
+		bounds.extend(clusters[order[i]].bounds);
+	}
+	clusterNodes[nodeIndex].bounds = bounds;
+	clusterNodes[nodeIndex].cluster = -1;
+
+	if (last - first == 1)
+	{
+		clusterNodes[nodeIndex].cluster = order[first];
+		clusters[order[first]].depth = depth;
+		return nodeIndex;
+	}
+
+	//Few enough clusters to try every split along each axis, weighing each
+	//side by the primitives in it; too deep, keep to the Morton order
+	int middle = (first + last) / 2;
+
+	if (depth < CLUSTER_TREE_SAH_DEPTH)
+	{
+		int count = last - first;
+		int bestAxis = 0;
+		float bestCost = 1e30f;
+		vector<float> rightCost(count);
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			sort(order.begin() + first, order.begin() + last,
+				[&](int a, int b)
+				{
+					return clusters[a].bounds.centre()[axis] < clusters[b].bounds.centre()[axis];
+				});
+
+			AABB sweep;
+			int sweepCount = 0;
+			for (int i = count - 1; i > 0; i--)
+			{
+				const BuildCluster &cluster = clusters[order[first + i]];
+				sweep.extend(cluster.bounds);
+				sweepCount += cluster.last - cluster.first;
+				rightCost[i] = sweep.surfaceArea() * sweepCount;
+			}
+
+			sweep = AABB();
+			sweepCount = 0;
+			for (int i = 1; i < count; i++)
+			{
+				const BuildCluster &cluster = clusters[order[first + i - 1]];
+				sweep.extend(cluster.bounds);
+				sweepCount += cluster.last - cluster.first;
+
+				float cost = sweep.surfaceArea() * sweepCount + rightCost[i];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					middle = first + i;
+				}
+			}
+		}
+
+		sort(order.begin() + first, order.begin() + last,
+			[&](int a, int b)
+			{
+				return clusters[a].bounds.centre()[bestAxis] < clusters[b].bounds.centre()[bestAxis];
+			});
+	}
+	else
+	{
+		sort(order.begin() + first, order.begin() + last);
+	}
+
+	int left = buildClusterTree(clusters, order, first, middle, depth + 1, clusterNodes);
+	int right = buildClusterTree(clusters, order, middle, last, depth + 1, clusterNodes);
+	clusterNodes[nodeIndex].left = left;
+	clusterNodes[nodeIndex].right = right;
+
+	return nodeIndex;
+}
+
+void BVH::placeClusters(const vector<ClusterNode> &clusterNodes, int index, vector<BuildCluster> &clusters)
+{
+	const ClusterNode &clusterNode = clusterNodes[index];
+
+	if (clusterNode.cluster >= 0)
+	{
+		BuildCluster &cluster = clusters[clusterNode.cluster];
+		cluster.node = (int)nodes.size();
+		cluster.primitive = (int)primitives.size();
+
+		nodes.resize(nodes.size() + cluster.nodeCount);
+		primitives.resize(primitives.size() + cluster.primitiveCount);
+		return;
+	}
+
+	int nodeIndex = (int)nodes.size();
+	nodes.push_back(BVHNode());
+	nodes[nodeIndex].bounds = clusterNode.bounds;
+	nodes[nodeIndex].count = 0;
+
+	placeClusters(clusterNodes, clusterNode.left, clusters);
+	nodes[nodeIndex].offset = (int)nodes.size();
+	placeClusters(clusterNodes, clusterNode.right, clusters);
+}
+
+// --------------------------------------------------------------------------
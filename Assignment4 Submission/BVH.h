@@ -0,0 +1,463 @@
+// ==========================================================================
+// Bounding Volume Hierarchy
+//
+// A binary tree of axis-aligned boxes over the scene's triangles, mesh
+// triangles, spheres and instances,
+// built with the surface area heuristic (SAH). Planes are unbounded, so they
+// stay outside the tree and are tested separately by the tracer.
+//
+// Instances make it two levels deep: each object has a tree of its own over
+// its triangles, where they sit before being placed, and the scene's tree
+// only holds every instance's box. A ray reaching an instance is moved into
+// its object's space and carries on down the object's tree.
+//
+// Big trees are built on every thread of the pool the caller hands over.
+// The primitives are sorted along a Morton curve and cut into a few hundred
+// clusters of neighbours, the clusters are joined at the top by SAH, and
+// each cluster's subtree is then built as a task of its own, into the node
+// arena of whichever pool lane runs it, before the pieces are copied into
+// place. Below the top the tree is the same binned SAH build a small scene
+// gets.
+//
+// Traversal hands each leaf it reaches to a visitor that runs the exact
+// intersection tests, so the tree never needs to know how shapes are shaded.
+// Within a leaf the loose triangles always come first, which lets the tracer
+// test them together as one packed run, then mesh triangles, then spheres,
+// then instances.
+// ==========================================================================
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include "Shapes.h"
+#include "PrimitiveArray.h"
+#include "Profiler.h"
+
+class ThreadPool;
+
+// --------------------------------------------------------------------------
+
+//Rounding in the slab test can lose a ray that grazes a box face, which shows
+//up as missing pixels along the silhouette of flat boxes. Stretching the exit
+//distance by a few ulps keeps the test conservative.
+const float SLAB_EXIT_SCALE = 1.0000004f;
+
+struct AABB
+{
+	vec3 lower;
+	vec3 upper;
+
+	AABB() : lower(vec3(1e30f)), upper(vec3(-1e30f)) {}
+	AABB(vec3 l, vec3 u) : lower(l), upper(u) {}
+
+	void extend(const AABB &other)
+	{
+		lower = min(lower, other.lower);
+		upper = max(upper, other.upper);
+	}
+
+	void extend(const vec3 &point)
+	{
+		lower = min(lower, point);
+		upper = max(upper, point);
+	}
+
+	vec3 centre() const { return 0.5f * (lower + upper); }
+
+	float surfaceArea() const
+	{
+		vec3 d = upper - lower;
+		if (d.x < 0 || d.y < 0 || d.z < 0) return 0.f;
+		return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+
+	//Slab test, returns the distance at which the ray enters the box
+	bool intersect(const vec3 &start, const vec3 &inverseDirection, float maxDistance, float &entry) const
+	{
+		vec3 t0 = (lower - start) * inverseDirection;
+		vec3 t1 = (upper - start) * inverseDirection;
+		vec3 tNear = min(t0, t1);
+		vec3 tFar = max(t0, t1);
+
+		entry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.f));
+		float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance)) * SLAB_EXIT_SCALE;
+
+		return entry <= exit;
+	}
+};
+
+struct BVHPrimitive
+{
+	//In the order they sit within a leaf
+	enum Type { TRIANGLE, MESH_TRIANGLE, SPHERE, INSTANCE, TYPE_COUNT };
+
+	Type type;
+	int index;		//Into the scene's triangles, meshTriangles, spheres or instances
+
+	BVHPrimitive(){};
+	BVHPrimitive(Type t, int i) : type(t), index(i) {}
+};
+
+//Refitting keeps the tree's shape, so once shapes have moved far enough for
+//the boxes to overlap badly it is built again instead: when the expected cost
+//of a ray through the tree grows past this many times what it was when built
+const float REFIT_REBUILD_RATIO = 2.f;
+
+//Interior nodes keep their left child right after themselves and point at the
+//right child; leaves point at a run of primitives
+struct BVHNode
+{
+	AABB bounds;
+	int offset;		//Right child for interior nodes, first primitive for leaves
+	int count;		//Number of primitives, 0 for interior nodes
+
+	bool isLeaf() const { return count > 0; }
+};
+
+// --------------------------------------------------------------------------
+
+class BVH
+{
+public:
+	BVH() : nodeArea(0), builtAreaRatio(0) {}
+
+	//Builds the tree from scratch over every triangle, mesh triangle, sphere
+	//and instance, given the box around each instance as placed
+	void build(const PrimitiveArray<Triangle> &triangles, const PrimitiveArray<vec3> &meshVertices,
+		const PrimitiveArray<MeshTriangle> &meshTriangles, const PrimitiveArray<Sphere> &spheres,
+		const std::vector<AABB> &instanceBounds, ThreadPool &pool);
+
+	//Builds an object's own tree, over its run of triangles alone
+	void build(const PrimitiveArray<vec3> &vertices, const PrimitiveArray<MeshTriangle> &triangles, const Mesh &object,
+		ThreadPool &pool);
+	void clear();
+
+	//Recomputes the boxes around the primitives that have moved, and every
+	//box above them, keeping the tree's shape. Only those boxes are visited,
+	//so the rest of the tree costs nothing however big it is. Returns false
+	//if the tree has become poor enough that it should be built again.
+	bool refit(const PrimitiveArray<Triangle> &triangles, const PrimitiveArray<vec3> &meshVertices,
+		const PrimitiveArray<MeshTriangle> &meshTriangles, const PrimitiveArray<Sphere> &spheres,
+		const std::vector<AABB> &instanceBounds, const std::vector<BVHPrimitive> &moved);
+
+	//Where a shape sits in the primitive order, once refit() has been called
+	int position(const BVHPrimitive &primitive) const { return positions[primitive.type][primitive.index]; }
+
+	bool empty() const { return nodes.empty(); }
+	int nodeCount() const { return (int)nodes.size(); }
+	const BVHNode &node(int i) const { return nodes[i]; }
+
+	//Primitives in leaf order, leaves refer to runs of these
+	int primitiveCount() const { return (int)primitives.size(); }
+	const BVHPrimitive &primitive(int i) const { return primitives[i]; }
+
+	//Closest hit: visits leaves near to far as visit(first, count), skipping
+	//any subtree that starts beyond the closest hit recorded in the ray so far
+	template <class Visitor>
+	void closestHit(Ray &thisRay, Visitor visit) const;
+
+	//Any hit: stops as soon as visit(first, count) reports an occluder closer
+	//than maxDistance
+	template <class Visitor>
+	bool anyHit(const Ray &thisRay, float maxDistance, Visitor visit) const;
+
+	//Any hit for up to BVH_BATCH_SIZE rays leaving one start point, such as
+	//the shadow rays from a surface to each light. The tree is walked once
+	//for the whole batch, each node only for the rays still unblocked that
+	//reach it, and the walk stops once every ray is blocked. visit(first,
+	//count, ray) reports whether something in the leaf blocks that ray;
+	//blocked[] must start out false for rays that still need testing.
+	//Directions come one component per array.
+	template <class Visitor>
+	void anyHitBatch(const vec3 &startPoint, const float *directionX, const float *directionY, const float *directionZ,
+		const float *maxDistances, int count, bool *blocked, Visitor visit) const;
+
+private:
+	struct BuildReference
+	{
+		AABB bounds;
+		vec3 centroid;
+		BVHPrimitive primitive;
+	};
+
+	//Nodes and primitives of subtrees built by one thread, with the offsets
+	//in each node relative to the arena
+	struct BuildArena
+	{
+		std::vector<BVHNode> nodes;
+		std::vector<BVHPrimitive> primitives;
+	};
+
+	//A run of Morton-sorted references built into one subtree, and where
+	//that subtree sits in its arena and then in the tree
+	struct BuildCluster
+	{
+		int first;
+		int last;
+		AABB bounds;
+		int depth;
+		int arena;
+		int arenaNode;
+		int arenaPrimitive;
+		int nodeCount;
+		int primitiveCount;
+		int node;
+		int primitive;
+	};
+
+	//Node of the tree joining the clusters, either a cluster or two children
+	struct ClusterNode
+	{
+		AABB bounds;
+		int cluster;
+		int left;
+		int right;
+	};
+
+	void buildTree(std::vector<BuildReference> &references, ThreadPool &pool);
+	void buildParallel(std::vector<BuildReference> &references, ThreadPool &pool);
+	static int buildRecursive(BuildArena &arena, std::vector<BuildReference> &references, int first, int last, int depth);
+	static int buildClusterTree(std::vector<BuildCluster> &clusters, std::vector<int> &order, int first, int last,
+		int depth, std::vector<ClusterNode> &clusterNodes);
+	void placeClusters(const std::vector<ClusterNode> &clusterNodes, int index, std::vector<BuildCluster> &clusters);
+
+	//Sum of every node's surface area over the root's, which is in
+	//proportion to the number of boxes a ray through the tree tests (SAH)
+	float areaRatio() const;
+
+	//Fills in the lookups refit() needs, the first time it is called
+	void prepareRefit();
+
+	std::vector<BVHNode> nodes;
+	std::vector<BVHPrimitive> primitives;
+
+	double nodeArea;			//Sum of every node's surface area
+	float builtAreaRatio;		//areaRatio() straight after building
+
+	//Only kept for trees that are refit: each node's parent (-1 for the
+	//root), the leaf holding each primitive, and each shape's position in
+	//the primitive order by BVHPrimitive::Type
+	std::vector<int> parents;
+	std::vector<int> leaves;
+	std::vector<int> positions[BVHPrimitive::TYPE_COUNT];
+	std::vector<int> refitNodes;
+	std::vector<bool> refitMarks;
+};
+
+// --------------------------------------------------------------------------
+// Traversal
+
+const int BVH_STACK_SIZE = 64;
+const int BVH_BATCH_SIZE = 32;		//Rays in a batch, one bit each
+
+//Axis-aligned directions would give 0 * inf = NaN in the slab test whenever
+//the ray starts on a box face, so nudge zero components off zero
+inline vec3 inverseRayDirection(const vec3 &direction)
+{
+	vec3 inverse;
+	for (int i = 0; i < 3; i++)
+	{
+		float d = direction[i];
+		if (std::abs(d) < 1e-20f)
+		{
+			d = (d < 0.f) ? -1e-20f : 1e-20f;
+		}
+		inverse[i] = 1.f / d;
+	}
+	return inverse;
+}
+
+template <class Visitor>
+void BVH::closestHit(Ray &thisRay, Visitor visit) const
+{
+	if (nodes.empty()) return;
+
+	vec3 inverseDirection = inverseRayDirection(thisRay.directionVector);
+
+	int stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	int current = 0;
+
+	float entry;
+	if ( !nodes[0].bounds.intersect(thisRay.startPoint, inverseDirection, 1e30f, entry) )
+	{
+		return;
+	}
+
+	while (true)
+	{
+		const BVHNode &node = nodes[current];
+		PROFILE_COUNT(PROFILE_BVH_NODES, 1);
+
+		if (node.isLeaf())
+		{
+			visit(node.offset, node.count);
+		}
+		else
+		{
+			float maxDistance = thisRay.hasIntersected ? thisRay.closestDistance : 1e30f;
+
+			int left = current + 1;
+			int right = node.offset;
+			float leftEntry, rightEntry;
+			bool hitLeft = nodes[left].bounds.intersect(thisRay.startPoint, inverseDirection, maxDistance, leftEntry);
+			bool hitRight = nodes[right].bounds.intersect(thisRay.startPoint, inverseDirection, maxDistance, rightEntry);
+
+			if (hitLeft && hitRight)
+			{//Go to the nearer child first, the far one may be culled by then
+				if (rightEntry < leftEntry)
+				{
+					std::swap(left, right);
+				}
+				stack[stackSize++] = right;
+				current = left;
+				continue;
+			}
+			else if (hitLeft || hitRight)
+			{
+				current = hitLeft ? left : right;
+				continue;
+			}
+		}
+
+		//Pop until we find a subtree that can still hold a closer hit
+		bool found = false;
+		while (stackSize > 0)
+		{
+			current = stack[--stackSize];
+			float maxDistance = thisRay.hasIntersected ? thisRay.closestDistance : 1e30f;
+			if ( nodes[current].bounds.intersect(thisRay.startPoint, inverseDirection, maxDistance, entry) )
+			{
+				found = true;
+				break;
+			}
+		}
+
+		if (!found)
+		{
+			return;
+		}
+	}
+}
+
+template <class Visitor>
+bool BVH::anyHit(const Ray &thisRay, float maxDistance, Visitor visit) const
+{
+	if (nodes.empty()) return false;
+
+	vec3 inverseDirection = inverseRayDirection(thisRay.directionVector);
+
+	int stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const BVHNode &node = nodes[stack[--stackSize]];
+
+		float entry;
+		if ( !node.bounds.intersect(thisRay.startPoint, inverseDirection, maxDistance, entry) )
+		{
+			continue;
+		}
+
+		PROFILE_COUNT(PROFILE_BVH_NODES, 1);
+
+		if (node.isLeaf())
+		{
+			if ( visit(node.offset, node.count) )
+			{//Any occluder will do, no need to find the closest
+				return true;
+			}
+		}
+		else
+		{
+			stack[stackSize++] = node.offset;
+			stack[stackSize++] = (int)(&node - &nodes[0]) + 1;
+		}
+	}
+
+	return false;
+}
+
+template <class Visitor>
+void BVH::anyHitBatch(const vec3 &startPoint, const float *directionX, const float *directionY, const float *directionZ,
+	const float *maxDistances, int count, bool *blocked, Visitor visit) const
+{
+	if (nodes.empty()) return;
+
+	//Plain floats rather than vec3s, which would all be zeroed first
+	float inverseX[BVH_BATCH_SIZE], inverseY[BVH_BATCH_SIZE], inverseZ[BVH_BATCH_SIZE];
+	unsigned int unblocked = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		vec3 inverse = inverseRayDirection(vec3(directionX[i], directionY[i], directionZ[i]));
+		inverseX[i] = inverse.x;
+		inverseY[i] = inverse.y;
+		inverseZ[i] = inverse.z;
+
+		if (!blocked[i])
+		{
+			unblocked |= 1u << i;
+		}
+	}
+
+	//Each entry carries the rays that reached its parent
+	int stack[BVH_STACK_SIZE];
+	unsigned int stackRays[BVH_STACK_SIZE];
+	int stackSize = 0;
+
+	stack[stackSize] = 0;
+	stackRays[stackSize++] = unblocked;
+
+	while (stackSize > 0 && unblocked != 0)
+	{
+		stackSize--;
+		const BVHNode &node = nodes[stack[stackSize]];
+		unsigned int candidates = stackRays[stackSize] & unblocked;
+		unsigned int reaching = 0;
+
+		for (int i = 0; i < count; i++)
+		{
+			float entry;
+			if ( (candidates & (1u << i))
+				&& node.bounds.intersect(startPoint, vec3(inverseX[i], inverseY[i], inverseZ[i]), maxDistances[i], entry) )
+			{
+				reaching |= 1u << i;
+			}
+		}
+
+		if (reaching == 0)
+		{
+			continue;
+		}
+
+		PROFILE_COUNT(PROFILE_BVH_NODES, 1);
+
+		if (node.isLeaf())
+		{
+			for (int i = 0; i < count; i++)
+			{
+				if ( (reaching & (1u << i)) && visit(node.offset, node.count, i) )
+				{
+					blocked[i] = true;
+					unblocked &= ~(1u << i);
+				}
+			}
+		}
+		else
+		{
+			stack[stackSize] = node.offset;
+			stackRays[stackSize++] = reaching;
+			stack[stackSize] = (int)(&node - &nodes[0]) + 1;
+			stackRays[stackSize++] = reaching;
+		}
+	}
+}
+
+// --------------------------------------------------------------------------
+#endif // BVH_H
@@ -0,0 +1,110 @@
+// ==========================================================================
+// Ray Tracer Camera
+// ==========================================================================
+
+#include "Camera.h"
+
+#include <cmath>
+
+// --------------------------------------------------------------------------
+
+Camera::Camera():	pos(vec3(0, 0, 0)),
+					dir(vec3(0, 0, -1)),
+					up(vec3(0, 1, 0)),
+					right(vec3(1, 0, 0)),
+					fieldOfView(90.f),
+					width(1024),
+					height(768),
+					lensRadius(0),
+					focusDistance(1)
+{
+	update();
+}
+
+Camera::Camera(vec3 _pos, vec3 _dir, float fov, int w, int h):	pos(_pos),
+																fieldOfView(fov),
+																width(w),
+																height(h),
+																lensRadius(0),
+																focusDistance(1)
+{
+	lookAlong(_dir);
+}
+
+void Camera::lookAlong(vec3 _dir)
+{
+	dir = normalize(_dir);
+
+	vec3 worldUp = vec3(0, 1, 0);
+
+	if (std::abs(dot(dir, worldUp)) > 0.9999f)
+	{//Looking straight up or down, any right will do
+		worldUp = vec3(0, 0, -1);
+	}
+
+	right = normalize(cross(dir, worldUp));
+	up = normalize(cross(right, dir));
+
+	update();
+}
+
+void Camera::lookAt(vec3 target)
+{
+	lookAlong(target - pos);
+}
+
+void Camera::setFieldOfView(float degrees)
+{
+	fieldOfView = degrees;
+	update();
+}
+
+void Camera::resize(int w, int h)
+{
+	width = w;
+	height = h;
+	update();
+}
+
+void Camera::update()
+{
+	float halfWidth = width / 2.f;
+	float planeHalfWidth = std::tan(radians(fieldOfView) / 2.f);
+
+	//Pixels are square, so one step is the same size both ways
+	pixelRight = right * (planeHalfWidth / halfWidth);
+	pixelUp = up * (planeHalfWidth / halfWidth);
+}
+
+vec3 Camera::rayDirection(float x, float y) const
+{
+	vec3 direction = dir + (x - width / 2.f) * pixelRight + (y - height / 2.f) * pixelUp;
+
+	return normalize(direction);
+}
+
+void Camera::lensRay(float x, float y, vec2 lens, vec3 &start, vec3 &direction) const
+{
+	direction = rayDirection(x, y);
+	start = pos;
+
+	if (lensRadius <= 0)
+	{
+		return;
+	}
+
+	//Every ray through the pixel meets the pinhole ray on the plane in focus
+	vec3 focus = pos + direction * (focusDistance / dot(direction, dir));
+
+	start = pos + lensRadius * (lens.x * right + lens.y * up);
+	direction = normalize(focus - start);
+}
+
+// --------------------------------------------------------------------------
+
+float magnificationToFieldOfView(float magnification)
+{
+	return degrees(2.f * std::atan(1.f / magnification));
+}
+
+// --------------------------------------------------------------------------
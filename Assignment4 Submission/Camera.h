@@ -0,0 +1,71 @@
+// ==========================================================================
+// Ray Tracer Camera
+//
+// A pinhole camera: where it sits, which way it looks, how wide it sees and
+// the size of the image it makes. Primary rays come from here, so the same
+// code renders a small preview or a full size final just by changing the
+// dimensions. Pixel (0, 0) is the bottom-left corner of the image.
+//
+// Given a lens radius it becomes a thin lens instead: rays start anywhere on
+// the lens and meet again on the plane in focus, so only what is at the
+// focus distance is sharp and the rest blurs with its distance from it.
+// ==========================================================================
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include "glm/glm.hpp"
+
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+class Camera
+{
+public:
+	Camera();
+	Camera(vec3 _pos, vec3 _dir, float fov, int w, int h);
+
+	vec3 pos;
+	vec3 dir;
+	vec3 up;
+	vec3 right;
+
+	float fieldOfView;		//Across the width of the image, in degrees
+	int width;
+	int height;
+
+	float lensRadius;		//0 for a pinhole, where everything is sharp
+	float focusDistance;	//Along dir to the plane in focus
+
+	//Points the camera along _dir, keeping the world's up direction up
+	void lookAlong(vec3 _dir);
+	void lookAt(vec3 target);
+
+	void setFieldOfView(float degrees);
+	void resize(int w, int h);
+
+	//Direction of the ray through a point of the image, in pixels; whole
+	//numbers are the bottom-left corners of pixels
+	vec3 rayDirection(float x, float y) const;
+
+	//Ray through a point of the image from the point of the lens at lens, on
+	//the disc of radius 1; the same as the pinhole ray without a lens
+	void lensRay(float x, float y, vec2 lens, vec3 &start, vec3 &direction) const;
+
+	//Width of a pixel on the view plane one unit in front of the camera
+	float pixelSpread() const { return length(pixelRight); }
+
+private:
+	//Steps across and up the view plane one unit in front of the camera
+	vec3 pixelRight;
+	vec3 pixelUp;
+
+	void update();
+};
+
+//Field of view matching the original zoom, where the view plane one unit in
+//front of the camera spans 2 / magnification across the image
+float magnificationToFieldOfView(float magnification);
+
+// --------------------------------------------------------------------------
+#endif // CAMERA_H
@@ -0,0 +1,394 @@
+// ==========================================================================
+// Edge-Aware Denoiser
+// ==========================================================================
+
+#include "Denoiser.h"
+#include "Float4.h"
+#include "ImageBuffer.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <glm/glm.hpp>
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+// how sharply each guide cuts a neighbour's weight: brightness differences
+// against COLOUR_SIGMA standard deviations of the noise, normals by the
+// square of their difference, depths relative to the nearer of the two and
+// to how far apart the pixels are, and albedos by the square of theirs over
+// ALBEDO_SIGMA squared plus the albedo variance around the centre pixel;
+// reflections don't follow the albedo, so theirs are only cut by the others
+static const float COLOUR_SIGMA = 4.f;
+static const float NORMAL_WEIGHT = 64.f;
+static const float DEPTH_SIGMA = 0.02f;
+static const float ALBEDO_SIGMA = 0.1f;
+
+// keeps the brightness test finite where there is no noise at all
+static const float MIN_DEVIATION = 1e-4f;
+
+// depth of the padding either side of each row, which no pixel ever matches
+static const float PADDING_DEPTH = 1e30f;
+
+// rows handed to a thread at a time
+static const int BAND_ROWS = 8;
+
+// B3 spline, the a-trous kernel's weights 0, 1 and 2 taps from the centre
+static const float KERNEL[3] = { 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+
+static float Luminance(float r, float g, float b)
+{
+    return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+}
+
+static Float4 Luminance(Float4 r, Float4 g, Float4 b)
+{
+    return Float4(0.2126f) * r + Float4(0.7152f) * g + Float4(0.0722f) * b;
+}
+
+float DenoiseLuminance(const vec3 &colour)
+{
+    return Luminance(colour.r, colour.g, colour.b);
+}
+
+float DenoiseLuminance(const vec3 &colour, const vec3 &albedo)
+{
+    return DenoiseLuminance(colour / max(albedo, vec3(DENOISE_MIN_ALBEDO)));
+}
+
+// --------------------------------------------------------------------------
+
+const int Denoiser::LAYERS[LAYER_COUNT] = { RED, REFLECTED_RED };
+
+Denoiser::Denoiser(int passes)
+    : m_passes(passes), m_width(0), m_height(0), m_samplesPerPixel(1),
+      m_padding(0), m_stride(0), m_planeSize(0)
+{
+}
+
+void Denoiser::Prepare(int width, int height, int samplesPerPixel)
+{
+    m_width = width;
+    m_height = height;
+    m_samplesPerPixel = samplesPerPixel;
+
+    // the last pass reaches two of its steps out, and rows are read in
+    // fours, so round them up
+    m_padding = 2 << (m_passes - 1);
+    m_stride = m_padding * 2 + (width + 3) / 4 * 4;
+    m_planeSize = m_stride * height;
+
+    m_planes.assign(PLANE_COUNT * m_planeSize, 0.f);
+    m_filtered.assign(FILTERED_PLANE_COUNT * m_planeSize, 0.f);
+    m_blurred.assign((LAYER_COUNT + 1) * m_planeSize, 0.f);
+
+    fill(m_planes.begin() + DEPTH * m_planeSize, m_planes.begin() + (DEPTH + 1) * m_planeSize, PADDING_DEPTH);
+}
+
+float *Denoiser::PlaneRow(vector<float> &planes, int plane, int y)
+{
+    return &planes[plane * m_planeSize + y * m_stride + m_padding];
+}
+
+float *Denoiser::BlurredRow(int blurred, int y)
+{
+    return &m_blurred[blurred * m_planeSize + y * m_stride + m_padding];
+}
+
+void Denoiser::SetGuide(int x, int y, const PixelGuide &guide)
+{
+    PlaneRow(m_planes, VARIANCE, y)[x] = guide.variance;
+    PlaneRow(m_planes, REFLECTED_RED, y)[x] = guide.reflected.r;
+    PlaneRow(m_planes, REFLECTED_GREEN, y)[x] = guide.reflected.g;
+    PlaneRow(m_planes, REFLECTED_BLUE, y)[x] = guide.reflected.b;
+    PlaneRow(m_planes, REFLECTED_VARIANCE, y)[x] = guide.reflectedVariance;
+    PlaneRow(m_planes, ALBEDO_RED, y)[x] = guide.albedo.r;
+    PlaneRow(m_planes, ALBEDO_GREEN, y)[x] = guide.albedo.g;
+    PlaneRow(m_planes, ALBEDO_BLUE, y)[x] = guide.albedo.b;
+    PlaneRow(m_planes, ALBEDO_VARIANCE, y)[x] = guide.albedoVariance;
+    PlaneRow(m_planes, NORMAL_X, y)[x] = guide.normal.x;
+    PlaneRow(m_planes, NORMAL_Y, y)[x] = guide.normal.y;
+    PlaneRow(m_planes, NORMAL_Z, y)[x] = guide.normal.z;
+    PlaneRow(m_planes, DEPTH, y)[x] = guide.depth;
+}
+
+// --------------------------------------------------------------------------
+
+void Denoiser::Apply(ImageBuffer &buffer, ThreadPool &pool)
+{
+    PROFILE_PHASE(PHASE_DENOISE);
+
+    vector<vec3> image(m_width * m_height);
+    buffer.GetBlock(0, 0, m_width, m_height, &image[0]);
+
+    int bands = (m_height + BAND_ROWS - 1) / BAND_ROWS;
+
+    // runs a row function over every row, a band per job
+    auto forEachRow = [&](const function<void(int y)> &row)
+    {
+        pool.ParallelFor(bands, [&](int band)
+        {
+            for (int y = band * BAND_ROWS; y < std::min(m_height, (band + 1) * BAND_ROWS); ++y)
+                row(y);
+        });
+    };
+
+    // the first layer is the rest of the colour over the albedo
+    forEachRow([&](int y)
+    {
+        for (int x = 0; x < m_width; ++x)
+        {
+            vec3 reflected(PlaneRow(m_planes, REFLECTED_RED, y)[x], PlaneRow(m_planes, REFLECTED_GREEN, y)[x],
+                           PlaneRow(m_planes, REFLECTED_BLUE, y)[x]);
+            vec3 albedo(PlaneRow(m_planes, ALBEDO_RED, y)[x], PlaneRow(m_planes, ALBEDO_GREEN, y)[x],
+                        PlaneRow(m_planes, ALBEDO_BLUE, y)[x]);
+
+            vec3 lighting = (image[y * m_width + x] - reflected) / max(albedo, vec3(DENOISE_MIN_ALBEDO));
+
+            PlaneRow(m_planes, RED, y)[x] = lighting.r;
+            PlaneRow(m_planes, GREEN, y)[x] = lighting.g;
+            PlaneRow(m_planes, BLUE, y)[x] = lighting.b;
+        }
+    });
+
+    if (m_samplesPerPixel <= 1)
+    {
+        forEachRow([&](int y)
+        {
+            for (int layer = 0; layer < LAYER_COUNT; ++layer)
+                EstimateVariance(layer, y);
+        });
+    }
+
+    // the albedo variance is never filtered, so its blur serves every pass
+    forEachRow([&](int y) { BlurVariance(ALBEDO_VARIANCE, BLURRED_ALBEDO, y); });
+
+    for (int pass = 0; pass < m_passes; ++pass)
+    {
+        forEachRow([&](int y)
+        {
+            for (int layer = 0; layer < LAYER_COUNT; ++layer)
+                BlurVariance(LAYERS[layer] + VARIANCE, layer, y);
+        });
+
+        forEachRow([&](int y) { FilterRow(pass, y); });
+
+        // the filtered layers are what the next pass reads
+        swap_ranges(m_filtered.begin(), m_filtered.end(), m_planes.begin());
+    }
+
+    // and the filtered albedo back on, with the reflections
+    forEachRow([&](int y)
+    {
+        for (int x = 0; x < m_width; ++x)
+        {
+            vec3 lighting(PlaneRow(m_planes, RED, y)[x], PlaneRow(m_planes, GREEN, y)[x],
+                          PlaneRow(m_planes, BLUE, y)[x]);
+            vec3 reflected(PlaneRow(m_planes, REFLECTED_RED, y)[x], PlaneRow(m_planes, REFLECTED_GREEN, y)[x],
+                           PlaneRow(m_planes, REFLECTED_BLUE, y)[x]);
+            vec3 albedo(PlaneRow(m_planes, ALBEDO_RED, y)[x], PlaneRow(m_planes, ALBEDO_GREEN, y)[x],
+                        PlaneRow(m_planes, ALBEDO_BLUE, y)[x]);
+
+            image[y * m_width + x] = lighting * max(albedo, vec3(DENOISE_MIN_ALBEDO)) + reflected;
+        }
+    });
+
+    buffer.SetBlock(0, 0, m_width, m_height, &image[0]);
+}
+
+// with one sample a pixel has no variance of its own, so it takes that of
+// the brightness of the 3x3 pixels around it
+void Denoiser::EstimateVariance(int layer, int y)
+{
+    int first = LAYERS[layer];
+    float *variance = PlaneRow(m_planes, first + VARIANCE, y);
+
+    for (int x = 0; x < m_width; ++x)
+    {
+        float sum = 0, sumSquares = 0;
+        int count = 0;
+
+        for (int qy = std::max(0, y - 1); qy <= std::min(m_height - 1, y + 1); ++qy)
+        {
+            const float *r = PlaneRow(m_planes, first + RED, qy);
+            const float *g = PlaneRow(m_planes, first + GREEN, qy);
+            const float *b = PlaneRow(m_planes, first + BLUE, qy);
+
+            for (int qx = std::max(0, x - 1); qx <= std::min(m_width - 1, x + 1); ++qx)
+            {
+                float luminance = Luminance(r[qx], g[qx], b[qx]);
+                sum += luminance;
+                sumSquares += luminance * luminance;
+                ++count;
+            }
+        }
+
+        float mean = sum / count;
+        variance[x] = std::max(0.f, sumSquares / count - mean * mean);
+    }
+}
+
+// the weights use variances smoothed over 3x3 pixels, as one pixel's
+// estimate is itself noisy
+void Denoiser::BlurVariance(int plane, int blurred, int y)
+{
+    static const float blur[3] = { 0.25f, 0.5f, 0.25f };
+
+    float *out = BlurredRow(blurred, y);
+
+    for (int x = 0; x < m_width; ++x)
+    {
+        float sum = 0, weights = 0;
+
+        for (int dy = -1; dy <= 1; ++dy)
+        {
+            if (y + dy < 0 || y + dy >= m_height) continue;
+            const float *variance = PlaneRow(m_planes, plane, y + dy);
+
+            for (int dx = -1; dx <= 1; ++dx)
+            {
+                if (x + dx < 0 || x + dx >= m_width) continue;
+
+                float weight = blur[dx + 1] * blur[dy + 1];
+                sum += weight * variance[x + dx];
+                weights += weight;
+            }
+        }
+
+        out[x] = sum / weights;
+    }
+}
+
+void Denoiser::FilterRow(int pass, int y)
+{
+    int step = 1 << pass;
+
+    const float *centreRow[PLANE_COUNT];
+    for (int plane = 0; plane < PLANE_COUNT; ++plane)
+        centreRow[plane] = PlaneRow(m_planes, plane, y);
+
+    const float *blurred[LAYER_COUNT + 1];
+    for (int i = 0; i <= LAYER_COUNT; ++i)
+        blurred[i] = BlurredRow(i, y);
+
+    float *out[FILTERED_PLANE_COUNT];
+    for (int plane = 0; plane < FILTERED_PLANE_COUNT; ++plane)
+        out[plane] = PlaneRow(m_filtered, plane, y);
+
+    // past the last pixel of a row the lanes read padding and what they
+    // write there is never used
+    for (int x = 0; x < m_width; x += 4)
+    {
+        Float4 centre[PLANE_COUNT];
+        for (int plane = 0; plane < PLANE_COUNT; ++plane)
+            centre[plane] = Float4::load(centreRow[plane] + x);
+
+        Float4 luminance[LAYER_COUNT], luminanceScale[LAYER_COUNT];
+        for (int layer = 0; layer < LAYER_COUNT; ++layer)
+        {
+            int first = LAYERS[layer];
+
+            luminance[layer] = Luminance(centre[first + RED], centre[first + GREEN], centre[first + BLUE]);
+            luminanceScale[layer] = Float4(1.f) / (Float4(COLOUR_SIGMA) * sqrt(max(Float4::load(blurred[layer] + x), Float4(0.f)))
+                                                   + Float4(MIN_DEVIATION));
+        }
+
+        Float4 albedoScale = Float4(1.f) / (Float4(ALBEDO_SIGMA * ALBEDO_SIGMA) + Float4::load(blurred[BLURRED_ALBEDO] + x));
+
+        Float4 sum[FILTERED_PLANE_COUNT], sumWeights[LAYER_COUNT];
+        for (int plane = 0; plane < FILTERED_PLANE_COUNT; ++plane)
+            sum[plane] = Float4(0.f);
+        for (int layer = 0; layer < LAYER_COUNT; ++layer)
+            sumWeights[layer] = Float4(0.f);
+
+        for (int dy = -2; dy <= 2; ++dy)
+        {
+            int qy = y + dy * step;
+            if (qy < 0 || qy >= m_height) continue;
+
+            const float *row[PLANE_COUNT];
+            for (int plane = 0; plane < PLANE_COUNT; ++plane)
+                row[plane] = PlaneRow(m_planes, plane, qy) + x;
+
+            for (int dx = -2; dx <= 2; ++dx)
+            {
+                int offset = dx * step;
+
+                Float4 depth = Float4::load(row[DEPTH] + offset);
+
+                Float4 nx = Float4::load(row[NORMAL_X] + offset) - centre[NORMAL_X];
+                Float4 ny = Float4::load(row[NORMAL_Y] + offset) - centre[NORMAL_Y];
+                Float4 nz = Float4::load(row[NORMAL_Z] + offset) - centre[NORMAL_Z];
+                Float4 albedoR = Float4::load(row[ALBEDO_RED] + offset);
+                Float4 albedoG = Float4::load(row[ALBEDO_GREEN] + offset);
+                Float4 albedoB = Float4::load(row[ALBEDO_BLUE] + offset);
+
+                Float4 ar = albedoR - centre[ALBEDO_RED];
+                Float4 ag = albedoG - centre[ALBEDO_GREEN];
+                Float4 ab = albedoB - centre[ALBEDO_BLUE];
+
+                float distance = (float)(std::max(1, std::abs(dx) + std::abs(dy)) * step);
+
+                Float4 surfaceCost = Float4(NORMAL_WEIGHT) * (nx * nx + ny * ny + nz * nz)
+                                   + abs(depth - centre[DEPTH]) / (Float4(DEPTH_SIGMA * distance) * min(depth, centre[DEPTH]));
+                Float4 albedoCost = albedoScale * (ar * ar + ag * ag + ab * ab);
+                Float4 kernel = Float4(KERNEL[std::abs(dx)] * KERNEL[std::abs(dy)]);
+
+                for (int layer = 0; layer < LAYER_COUNT; ++layer)
+                {
+                    int first = LAYERS[layer];
+
+                    Float4 r = Float4::load(row[first + RED] + offset);
+                    Float4 g = Float4::load(row[first + GREEN] + offset);
+                    Float4 b = Float4::load(row[first + BLUE] + offset);
+
+                    Float4 cost = surfaceCost + abs(Luminance(r, g, b) - luminance[layer]) * luminanceScale[layer];
+                    if (first == RED)
+                        cost = cost + albedoCost;
+
+                    Float4 weight = kernel * exp(Float4(0.f) - cost);
+
+                    if (first == RED)
+                    {
+                        sum[ALBEDO_RED] = sum[ALBEDO_RED] + weight * albedoR;
+                        sum[ALBEDO_GREEN] = sum[ALBEDO_GREEN] + weight * albedoG;
+                        sum[ALBEDO_BLUE] = sum[ALBEDO_BLUE] + weight * albedoB;
+                    }
+
+                    sum[first + RED] = sum[first + RED] + weight * r;
+                    sum[first + GREEN] = sum[first + GREEN] + weight * g;
+                    sum[first + BLUE] = sum[first + BLUE] + weight * b;
+                    sum[first + VARIANCE] = sum[first + VARIANCE] + weight * weight * Float4::load(row[first + VARIANCE] + offset);
+                    sumWeights[layer] = sumWeights[layer] + weight;
+                }
+            }
+        }
+
+        // the centre always counts fully, so the weights never sum to 0
+        for (int layer = 0; layer < LAYER_COUNT; ++layer)
+        {
+            int first = LAYERS[layer];
+            Float4 scale = Float4(1.f) / sumWeights[layer];
+
+            (sum[first + RED] * scale).store(out[first + RED] + x);
+            (sum[first + GREEN] * scale).store(out[first + GREEN] + x);
+            (sum[first + BLUE] * scale).store(out[first + BLUE] + x);
+            (sum[first + VARIANCE] * scale * scale).store(out[first + VARIANCE] + x);
+
+            if (first == RED)
+            {
+                (sum[ALBEDO_RED] * scale).store(out[ALBEDO_RED] + x);
+                (sum[ALBEDO_GREEN] * scale).store(out[ALBEDO_GREEN] + x);
+                (sum[ALBEDO_BLUE] * scale).store(out[ALBEDO_BLUE] + x);
+            }
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
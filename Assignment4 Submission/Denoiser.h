@@ -0,0 +1,122 @@
+// ==========================================================================
+// Edge-Aware Denoiser
+//
+// Cleans up a render taken with few samples per pixel. Alongside the colour
+// the tracer records a guide for every pixel: the albedo, normal and depth
+// of the first surface its rays hit, what its reflections added, and how
+// much its samples' brightness varied. The filter blurs the noise out only
+// between pixels whose guides agree, so the edges of shapes, creases and
+// texture detail stay sharp.
+//
+// It is an a-trous wavelet filter: five passes of a 5x5 kernel whose taps
+// spread 1, 2, 4, 8 and then 16 pixels apart, covering a 125 pixel wide
+// area for 25 taps a pass. The image is filtered as two layers. The light
+// the first surface sends back itself is divided by its albedo first, so
+// textures aren't blurred with the lighting, and multiplied back after; the
+// reflections, which don't follow the albedo, are filtered as they are. The
+// brightness each pass tolerates between neighbours follows the variance,
+// which each pass lowers, so noisy pixels are blurred hard and clean ones
+// like mirror reflections hardly at all.
+//
+// The image is held as one plane of floats per channel, padded at the sides
+// so every row's taps can be read four pixels at a time with no edge tests;
+// the padding lies infinitely deep, so it never gets any weight. Bands of
+// rows are filtered on the thread pool.
+//
+// Where a pixel's samples saw different albedos, on the edges of shapes and
+// textures or out of focus, its albedo is as noisy as its lighting; there
+// the albedo test is relaxed and the albedo is filtered along with the
+// lighting it multiplies.
+// ==========================================================================
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include <vector>
+#include <glm/vec3.hpp>
+
+class ImageBuffer;
+class ThreadPool;
+
+// --------------------------------------------------------------------------
+
+// depth given to pixels whose rays hit nothing
+const float DENOISE_MISS_DEPTH = 1e6f;
+
+// albedos are taken as at least this when the colour is divided by them, so
+// surfaces black in one channel keep their reflections in it
+const float DENOISE_MIN_ALBEDO = 0.05f;
+
+// what a pixel's rays saw first, averaged over its samples
+struct PixelGuide
+{
+    glm::vec3 albedo;           // surface colour with its texture, 1s for misses
+    float albedoVariance;       // of the samples' albedos, summed over the channels
+    glm::vec3 normal;           // turned to face the camera, 0s for misses
+    float depth;                // along the ray, DENOISE_MISS_DEPTH for misses
+    glm::vec3 reflected;        // the part of the colour its reflections added
+    float variance;             // of the mean of DenoiseLuminance() of the rest
+    float reflectedVariance;    // and of that of reflected
+};
+
+// brightness of a colour, and of one over its albedo; what the filter
+// compares between pixels
+float DenoiseLuminance(const glm::vec3 &colour);
+float DenoiseLuminance(const glm::vec3 &colour, const glm::vec3 &albedo);
+
+class Denoiser
+{
+public:
+    explicit Denoiser(int passes = 5);
+
+    // clears the guides for a width x height image of samplesPerPixel
+    // samples; with only one the variance is estimated from each pixel's
+    // neighbours instead
+    void Prepare(int width, int height, int samplesPerPixel);
+
+    // records pixel (x,y)'s guide; called concurrently for different pixels
+    void SetGuide(int x, int y, const PixelGuide &guide);
+
+    // filters the image in the buffer in place, bands of rows on the pool
+    void Apply(ImageBuffer &buffer, ThreadPool &pool);
+
+private:
+    enum Plane
+    {
+        RED, GREEN, BLUE, VARIANCE,                     // filtered, pass by pass
+        REFLECTED_RED, REFLECTED_GREEN, REFLECTED_BLUE,
+        REFLECTED_VARIANCE,
+        ALBEDO_RED, ALBEDO_GREEN, ALBEDO_BLUE,
+        ALBEDO_VARIANCE, NORMAL_X, NORMAL_Y, NORMAL_Z,  // guides
+        DEPTH,
+        PLANE_COUNT,
+        FILTERED_PLANE_COUNT = ALBEDO_BLUE + 1
+    };
+
+    // the two layers, each red, green, blue and variance from its first plane
+    static const int LAYER_COUNT = 2;
+    static const int LAYERS[LAYER_COUNT];
+
+    // m_blurred holds each layer's variance and then the albedo's
+    static const int BLURRED_ALBEDO = LAYER_COUNT;
+
+    float *PlaneRow(std::vector<float> &planes, int plane, int y);
+    float *BlurredRow(int blurred, int y);
+    void EstimateVariance(int layer, int y);
+    void BlurVariance(int plane, int blurred, int y);
+    void FilterRow(int pass, int y);
+
+    int m_passes;
+    int m_width, m_height;
+    int m_samplesPerPixel;
+
+    int m_padding;          // floats either side of a row, the widest tap reach
+    int m_stride;           // floats from one row to the next
+    int m_planeSize;        // floats in a plane
+
+    std::vector<float> m_planes;        // every plane, read by a pass
+    std::vector<float> m_filtered;      // the planes a pass writes
+    std::vector<float> m_blurred;       // variances, blurred, for the weights
+};
+
+// --------------------------------------------------------------------------
+#endif // DENOISER_H
@@ -0,0 +1,139 @@
+// ==========================================================================
+// Four-Lane Floats
+//
+// A thin wrapper over SSE registers so packet code can be written once with
+// ordinary operators. Builds without SSE2 get a plain array version that
+// behaves the same, one lane at a time.
+// ==========================================================================
+#ifndef FLOAT4_H
+#define FLOAT4_H
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define FLOAT4_SSE
+	#include <emmintrin.h>
+#else
+	#include <cmath>
+#endif
+
+// --------------------------------------------------------------------------
+
+//Result of comparing two Float4s, one flag per lane
+struct Mask4
+{
+#ifdef FLOAT4_SSE
+	__m128 m;
+
+	Mask4() {}
+	explicit Mask4(__m128 mask) : m(mask) {}
+
+	//Bit i is set if lane i is
+	int bits() const { return _mm_movemask_ps(m); }
+
+	friend Mask4 operator&(Mask4 a, Mask4 b) { return Mask4(_mm_and_ps(a.m, b.m)); }
+	friend Mask4 operator|(Mask4 a, Mask4 b) { return Mask4(_mm_or_ps(a.m, b.m)); }
+#else
+	bool m[4];
+
+	int bits() const { return (m[0] ? 1 : 0) | (m[1] ? 2 : 0) | (m[2] ? 4 : 0) | (m[3] ? 8 : 0); }
+
+	friend Mask4 operator&(Mask4 a, Mask4 b) { Mask4 r; for (int i = 0; i < 4; i++) r.m[i] = a.m[i] && b.m[i]; return r; }
+	friend Mask4 operator|(Mask4 a, Mask4 b) { Mask4 r; for (int i = 0; i < 4; i++) r.m[i] = a.m[i] || b.m[i]; return r; }
+#endif
+
+	bool any() const { return bits() != 0; }
+};
+
+// --------------------------------------------------------------------------
+
+struct Float4
+{
+#ifdef FLOAT4_SSE
+	__m128 v;
+
+	Float4() {}
+	explicit Float4(__m128 value) : v(value) {}
+	explicit Float4(float value) : v(_mm_set1_ps(value)) {}
+
+	static Float4 load(const float *p) { return Float4(_mm_loadu_ps(p)); }
+	void store(float *p) const { _mm_storeu_ps(p, v); }
+
+	friend Float4 operator+(Float4 a, Float4 b) { return Float4(_mm_add_ps(a.v, b.v)); }
+	friend Float4 operator-(Float4 a, Float4 b) { return Float4(_mm_sub_ps(a.v, b.v)); }
+	friend Float4 operator*(Float4 a, Float4 b) { return Float4(_mm_mul_ps(a.v, b.v)); }
+	friend Float4 operator/(Float4 a, Float4 b) { return Float4(_mm_div_ps(a.v, b.v)); }
+
+	friend Mask4 operator<(Float4 a, Float4 b) { return Mask4(_mm_cmplt_ps(a.v, b.v)); }
+	friend Mask4 operator<=(Float4 a, Float4 b) { return Mask4(_mm_cmple_ps(a.v, b.v)); }
+	friend Mask4 operator>(Float4 a, Float4 b) { return Mask4(_mm_cmpgt_ps(a.v, b.v)); }
+	friend Mask4 operator>=(Float4 a, Float4 b) { return Mask4(_mm_cmpge_ps(a.v, b.v)); }
+
+	friend Float4 min(Float4 a, Float4 b) { return Float4(_mm_min_ps(a.v, b.v)); }
+	friend Float4 max(Float4 a, Float4 b) { return Float4(_mm_max_ps(a.v, b.v)); }
+	friend Float4 abs(Float4 a) { return Float4(_mm_andnot_ps(_mm_set1_ps(-0.f), a.v)); }
+	friend Float4 sqrt(Float4 a) { return Float4(_mm_sqrt_ps(a.v)); }
+
+	//Lanes of a where the mask is set, lanes of b elsewhere
+	friend Float4 select(Mask4 mask, Float4 a, Float4 b)
+	{
+		return Float4(_mm_or_ps(_mm_and_ps(mask.m, a.v), _mm_andnot_ps(mask.m, b.v)));
+	}
+
+	//e to the a, to about 1e-4 relative, close enough for weights; lanes
+	//below -87 give about 0. The whole part of the power of 2 goes straight
+	//into the exponent bits and a polynomial covers the fraction.
+	friend Float4 exp(Float4 a)
+	{
+		__m128 x = _mm_max_ps(_mm_min_ps(a.v, _mm_set1_ps(88.f)), _mm_set1_ps(-87.f));
+		__m128 t = _mm_mul_ps(x, _mm_set1_ps(1.44269504f));
+
+		__m128 whole = _mm_cvtepi32_ps(_mm_cvttps_epi32(t));
+		whole = _mm_sub_ps(whole, _mm_and_ps(_mm_cmpgt_ps(whole, t), _mm_set1_ps(1.f)));
+		__m128 f = _mm_sub_ps(t, whole);
+
+		__m128 p = _mm_set1_ps(1.333355e-3f);
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.618129e-3f));
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.550411e-2f));
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.402265e-1f));
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.931472e-1f));
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.f));
+
+		__m128i power = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(whole), _mm_set1_epi32(127)), 23);
+		return Float4(_mm_mul_ps(p, _mm_castsi128_ps(power)));
+	}
+#else
+	float v[4];
+
+	Float4() {}
+	explicit Float4(float value) { for (int i = 0; i < 4; i++) v[i] = value; }
+
+	static Float4 load(const float *p) { Float4 r; for (int i = 0; i < 4; i++) r.v[i] = p[i]; return r; }
+	void store(float *p) const { for (int i = 0; i < 4; i++) p[i] = v[i]; }
+
+	#define FLOAT4_LANEWISE(expression) Float4 r; for (int i = 0; i < 4; i++) r.v[i] = (expression); return r;
+	#define MASK4_LANEWISE(expression) Mask4 r; for (int i = 0; i < 4; i++) r.m[i] = (expression); return r;
+
+	friend Float4 operator+(Float4 a, Float4 b) { FLOAT4_LANEWISE(a.v[i] + b.v[i]) }
+	friend Float4 operator-(Float4 a, Float4 b) { FLOAT4_LANEWISE(a.v[i] - b.v[i]) }
+	friend Float4 operator*(Float4 a, Float4 b) { FLOAT4_LANEWISE(a.v[i] * b.v[i]) }
+	friend Float4 operator/(Float4 a, Float4 b) { FLOAT4_LANEWISE(a.v[i] / b.v[i]) }
+
+	friend Mask4 operator<(Float4 a, Float4 b) { MASK4_LANEWISE(a.v[i] < b.v[i]) }
+	friend Mask4 operator<=(Float4 a, Float4 b) { MASK4_LANEWISE(a.v[i] <= b.v[i]) }
+	friend Mask4 operator>(Float4 a, Float4 b) { MASK4_LANEWISE(a.v[i] > b.v[i]) }
+	friend Mask4 operator>=(Float4 a, Float4 b) { MASK4_LANEWISE(a.v[i] >= b.v[i]) }
+
+	friend Float4 min(Float4 a, Float4 b) { FLOAT4_LANEWISE(b.v[i] < a.v[i] ? b.v[i] : a.v[i]) }
+	friend Float4 max(Float4 a, Float4 b) { FLOAT4_LANEWISE(a.v[i] < b.v[i] ? b.v[i] : a.v[i]) }
+	friend Float4 abs(Float4 a) { FLOAT4_LANEWISE(a.v[i] < 0.f ? -a.v[i] : a.v[i]) }
+	friend Float4 sqrt(Float4 a) { FLOAT4_LANEWISE(std::sqrt(a.v[i])) }
+	friend Float4 exp(Float4 a) { FLOAT4_LANEWISE(std::exp(a.v[i] < -87.f ? -87.f : a.v[i])) }
+
+	friend Float4 select(Mask4 mask, Float4 a, Float4 b) { FLOAT4_LANEWISE(mask.m[i] ? a.v[i] : b.v[i]) }
+
+	#undef FLOAT4_LANEWISE
+	#undef MASK4_LANEWISE
+#endif
+};
+
+// --------------------------------------------------------------------------
+#endif // FLOAT4_H
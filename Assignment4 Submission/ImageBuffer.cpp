@@ -16,10 +16,15 @@
 // ==========================================================================
 
 #include "ImageBuffer.h"
+#include "ImageWriter.h"
+#include "Profiler.h"
 
 #include <iostream>
+#include <cmath>
+#include <cstring>
 #include <glm/common.hpp>
 #include <algorithm>
+#include <thread>
 
 // --------------------------------------------------------------------------
 // Set these defines to choose which image library to use for saving image
@@ -32,6 +37,8 @@
 #ifdef USE_STB
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image_write.h>
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
 #endif
 #ifdef USE_IMAGEMAGICK
 #include <Magick++.h>
@@ -50,12 +57,22 @@
 using namespace std;
 using namespace glm;
 
+const double ImageBuffer::MAX_PSNR = 100.0;
+
 // --------------------------------------------------------------------------
 
 ImageBuffer::ImageBuffer()
     : m_textureName(0), m_framebufferObject(0),
-      m_width(0), m_height(0), m_modified(false), destroyed(false)
+      m_width(0), m_height(0),
+      m_tileSize(0), m_tilesX(0), m_tilesY(0), m_tileStride(0), m_tileBase(0),
+      m_uploadFormat(UPLOAD_DIRECT), m_uploadNext(0), m_uploadPixelSize(0),
+      m_modified(false), destroyed(false)
 {
+    for (int i = 0; i < UPLOAD_RING_SIZE; ++i)
+    {
+        m_uploadBuffers[i] = 0;
+        m_uploadFences[i] = 0;
+    }
 }
 
 ImageBuffer::~ImageBuffer()
@@ -76,35 +93,72 @@ void ImageBuffer::ResetModified()
     m_modifiedUpper = 0;
 }
 
-// --------------------------------------------------------------------------
+vec3 *ImageBuffer::TilePixels(int tile)
+{
+    return reinterpret_cast<vec3 *>(m_tileBase + tile * m_tileStride);
+}
 
-bool ImageBuffer::Initialize()
+vec3 &ImageBuffer::Pixel(int x, int y)
 {
-    // retrieve the current viewport size
-    GLint viewport[4];
-    glGetIntegerv(GL_VIEWPORT, viewport);
-    m_width = viewport[2];
-    m_height = viewport[3];
+    if (!m_tileSize)
+        return m_imageData[y * m_width + x];
+
+    int tile = (y / m_tileSize) * m_tilesX + x / m_tileSize;
+    return TilePixels(tile)[(y % m_tileSize) * m_tileSize + x % m_tileSize];
+}
 
+// tiles are only held for a copy of a few kilobytes, so spinning is cheaper
+// than a mutex for each of them
+void ImageBuffer::LockTile(int tile)
+{
+    while (m_tileStates[tile].busy.exchange(true, std::memory_order_acquire))
+        std::this_thread::yield();
+}
+
+void ImageBuffer::UnlockTile(int tile)
+{
+    m_tileStates[tile].busy.store(false, std::memory_order_release);
+}
+
+// --------------------------------------------------------------------------
+
+bool ImageBuffer::Initialize(int width, int height, int tileSize, UploadFormat uploadFormat)
+{
     // allocate image data
-    m_imageData.resize(m_width * m_height);
-    for (int i = 0, k = 0; i < m_height; ++i)
-        for (int j = 0; j < m_width; ++j, ++k)
-        {
-            int p = (i >> 4) + (j >> 4);
-            float c = 0.2f + ((p & 1) ? 0.1f : 0.0f);
-            m_imageData[k] = vec3(c);
-        }
+    if (!Allocate(width, height, tileSize))
+        return false;
+
+    m_uploadFormat = uploadFormat;
+    bool streamed = m_uploadFormat != UPLOAD_DIRECT;
+
+    // allocate texture object; 16 bit float RGB isn't always something a
+    // framebuffer can hold, so that is kept as RGBA
+    GLint internalFormat = GL_RGB;
+    if (m_uploadFormat == UPLOAD_RGBA8)
+        internalFormat = GL_RGBA8;
+    else if (m_uploadFormat == UPLOAD_RGB16F)
+        internalFormat = GL_RGBA16F;
 
-    // allocate texture object
     if (!m_textureName)
         glGenTextures(1, &m_textureName);
     glBindTexture(GL_TEXTURE_RECTANGLE, m_textureName);
-    glTexImage2D(GL_TEXTURE_RECTANGLE, 0, GL_RGB, m_width, m_height, 0, GL_RGB,
-                 GL_FLOAT, &m_imageData[0]);
+    glTexImage2D(GL_TEXTURE_RECTANGLE, 0, internalFormat, m_width, m_height, 0, GL_RGB,
+                 GL_FLOAT, (m_tileSize || streamed) ? 0 : &m_imageData[0]);
     glBindTexture(GL_TEXTURE_RECTANGLE, 0);
     ResetModified();
 
+    // tiles all start dirty, rows have to be marked, so the first Render()
+    // fills in whatever wasn't uploaded above
+    if (streamed && !m_tileSize)
+    {
+        m_modified = true;
+        m_modifiedLower = 0;
+        m_modifiedUpper = m_height;
+    }
+
+    if (streamed && !CreateUploadBuffers())
+        return false;
+
     // allocate framebuffer object
     if (!m_framebufferObject)
         glGenFramebuffers(1, &m_framebufferObject);
@@ -121,6 +175,65 @@ bool ImageBuffer::Initialize()
     return status == GL_FRAMEBUFFER_COMPLETE;
 }
 
+bool ImageBuffer::Allocate(int width, int height, int tileSize)
+{
+    if (width <= 0 || height <= 0)
+    {
+        cout << "ImageBuffer ERROR: Invalid image size " << width << "x" << height << endl;
+        return false;
+    }
+
+    m_width = width;
+    m_height = height;
+    m_tileSize = std::max(0, tileSize);
+
+    if (m_tileSize)
+    {
+        m_imageData.clear();
+        m_imageData.shrink_to_fit();
+
+        // each tile rounded up to whole cache lines, with room to move the
+        // first one onto a line boundary
+        const int lineFloats = CACHE_LINE_SIZE / sizeof(float);
+        m_tilesX = (m_width + m_tileSize - 1) / m_tileSize;
+        m_tilesY = (m_height + m_tileSize - 1) / m_tileSize;
+        m_tileStride = (m_tileSize * m_tileSize * 3 + lineFloats - 1) / lineFloats * lineFloats;
+        m_tileData.assign((size_t)m_tilesX * m_tilesY * m_tileStride + lineFloats, 0.f);
+
+        size_t misalignment = reinterpret_cast<size_t>(&m_tileData[0]) % CACHE_LINE_SIZE;
+        m_tileBase = &m_tileData[0] + (misalignment ? (CACHE_LINE_SIZE - misalignment) / sizeof(float) : 0);
+
+        m_tileStates.reset(new TileState[m_tilesX * m_tilesY]);
+        for (int tile = 0; tile < m_tilesX * m_tilesY; ++tile)
+        {
+            m_tileStates[tile].busy = false;
+            m_tileStates[tile].dirty = true;
+        }
+    }
+    else
+    {
+        m_tilesX = m_tilesY = m_tileStride = 0;
+        m_tileData.clear();
+        m_tileData.shrink_to_fit();
+        m_tileBase = 0;
+        m_tileStates.reset();
+
+        m_imageData.resize(m_width * m_height);
+    }
+
+    // fill with a checkerboard until the image is rendered over it
+    for (int i = 0; i < m_height; ++i)
+        for (int j = 0; j < m_width; ++j)
+        {
+            int p = (i >> 4) + (j >> 4);
+            float c = 0.2f + ((p & 1) ? 0.1f : 0.0f);
+            Pixel(j, i) = vec3(c);
+        }
+
+    ResetModified();
+    return true;
+}
+
 bool ImageBuffer::Destroy()
 {
     if(!destroyed)
@@ -129,33 +242,213 @@ bool ImageBuffer::Destroy()
             glDeleteFramebuffers(1, &m_framebufferObject);
         if (m_textureName)
             glDeleteTextures(1, &m_textureName);
+        DeleteUploadBuffers();
         destroyed = true;
     }
     return destroyed;
 }
 
+bool ImageBuffer::CreateUploadBuffers()
+{
+    DeleteUploadBuffers();
+
+    // each buffer holds a whole image, for when everything has changed
+    m_uploadPixelSize = (m_uploadFormat == UPLOAD_RGBA8) ? 4 : 3 * sizeof(uint16_t);
+    GLsizeiptr size = (GLsizeiptr)m_width * m_height * m_uploadPixelSize;
+
+    glGenBuffers(UPLOAD_RING_SIZE, m_uploadBuffers);
+    for (int i = 0; i < UPLOAD_RING_SIZE; ++i)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_uploadBuffers[i]);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, 0, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    m_uploadNext = 0;
+
+    if (glGetError() != GL_NO_ERROR)
+    {
+        cout << "ImageBuffer ERROR: Could not create pixel buffers for streaming!" << endl;
+        DeleteUploadBuffers();
+        m_uploadFormat = UPLOAD_DIRECT;
+        return false;
+    }
+    return true;
+}
+
+void ImageBuffer::DeleteUploadBuffers()
+{
+    for (int i = 0; i < UPLOAD_RING_SIZE; ++i)
+    {
+        if (m_uploadFences[i])
+            glDeleteSync(m_uploadFences[i]);
+        m_uploadFences[i] = 0;
+    }
+
+    if (m_uploadBuffers[0])
+        glDeleteBuffers(UPLOAD_RING_SIZE, m_uploadBuffers);
+    for (int i = 0; i < UPLOAD_RING_SIZE; ++i)
+        m_uploadBuffers[i] = 0;
+}
+
 // --------------------------------------------------------------------------
 
 void ImageBuffer::SetPixel(int x, int y, vec3 colour)
 {
-    int index = y * m_width + x;
-    m_imageData[index] = colour;
+    Pixel(x, y) = colour;
 
     // mark that something was changed
+    if (m_tileSize)
+    {
+        m_tileStates[(y / m_tileSize) * m_tilesX + x / m_tileSize].dirty = true;
+        return;
+    }
+
     m_modified = true;
     m_modifiedLower = std::min(m_modifiedLower, y);
     m_modifiedUpper = std::max(m_modifiedUpper, y+1);
 }
 
+void ImageBuffer::SetBlock(int x, int y, int width, int height, const vec3 *colours)
+{
+    if (m_tileSize)
+    {
+        // copy the part of the block over each tile under that tile's lock
+        for (int ty = y / m_tileSize; ty * m_tileSize < y + height; ++ty)
+            for (int tx = x / m_tileSize; tx * m_tileSize < x + width; ++tx)
+            {
+                int tile = ty * m_tilesX + tx;
+                int x0 = std::max(x, tx * m_tileSize), x1 = std::min(x + width, (tx + 1) * m_tileSize);
+                int y0 = std::max(y, ty * m_tileSize), y1 = std::min(y + height, (ty + 1) * m_tileSize);
+
+                vec3 *pixels = TilePixels(tile);
+                LockTile(tile);
+                for (int j = y0; j < y1; ++j)
+                    std::copy(colours + (j - y) * width + (x0 - x), colours + (j - y) * width + (x1 - x),
+                              pixels + (j - ty * m_tileSize) * m_tileSize + (x0 - tx * m_tileSize));
+                m_tileStates[tile].dirty = true;
+                UnlockTile(tile);
+            }
+        return;
+    }
+
+    // a block is a few kilobytes, so holding the lock for the copy is cheap
+    // and keeps Render() from uploading half-written rows
+    std::lock_guard<std::mutex> guard(m_dataLock);
+    for (int j = 0; j < height; ++j)
+        std::copy(colours + j * width, colours + (j+1) * width,
+                  m_imageData.begin() + (y + j) * m_width + x);
+
+    m_modified = true;
+    m_modifiedLower = std::min(m_modifiedLower, y);
+    m_modifiedUpper = std::max(m_modifiedUpper, y+height);
+}
+
+void ImageBuffer::SetTile(int tileX, int tileY, const vec3 *colours)
+{
+    int x = tileX * m_tileSize;
+    int y = tileY * m_tileSize;
+    int width = std::min(m_tileSize, m_width - x);
+    int height = std::min(m_tileSize, m_height - y);
+
+    if (!m_tileSize)
+        return;
+
+    int tile = tileY * m_tilesX + tileX;
+    vec3 *pixels = TilePixels(tile);
+
+    LockTile(tile);
+    if (width == m_tileSize)
+        std::copy(colours, colours + width * height, pixels);
+    else
+        for (int j = 0; j < height; ++j)
+            std::copy(colours + j * width, colours + (j+1) * width, pixels + j * m_tileSize);
+    m_tileStates[tile].dirty = true;
+    UnlockTile(tile);
+}
+
+void ImageBuffer::GetBlock(int x, int y, int width, int height, vec3 *colours)
+{
+    if (m_tileSize)
+    {
+        for (int ty = y / m_tileSize; ty * m_tileSize < y + height; ++ty)
+            for (int tx = x / m_tileSize; tx * m_tileSize < x + width; ++tx)
+            {
+                int tile = ty * m_tilesX + tx;
+                int x0 = std::max(x, tx * m_tileSize), x1 = std::min(x + width, (tx + 1) * m_tileSize);
+                int y0 = std::max(y, ty * m_tileSize), y1 = std::min(y + height, (ty + 1) * m_tileSize);
+
+                const vec3 *pixels = TilePixels(tile);
+                LockTile(tile);
+                for (int j = y0; j < y1; ++j)
+                {
+                    const vec3 *row = pixels + (j - ty * m_tileSize) * m_tileSize;
+                    std::copy(row + (x0 - tx * m_tileSize), row + (x1 - tx * m_tileSize),
+                              colours + (j - y) * width + (x0 - x));
+                }
+                UnlockTile(tile);
+            }
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(m_dataLock);
+    for (int j = 0; j < height; ++j)
+    {
+        std::vector<vec3>::const_iterator row = m_imageData.begin() + (y + j) * m_width + x;
+        std::copy(row, row + width, colours + j * width);
+    }
+}
+
 // --------------------------------------------------------------------------
 
 void ImageBuffer::Render()
 {
     if (!m_framebufferObject) return;
 
+    if (m_uploadFormat != UPLOAD_DIRECT)
+    {
+        StreamChanges();
+    }
+    else if (m_tileSize)
+    {
+        // upload only the tiles written since the last frame, straight from
+        // their own storage, locking one at a time
+        bool bound = false;
+        for (int tile = 0; tile < m_tilesX * m_tilesY; ++tile)
+        {
+            if (!m_tileStates[tile].dirty.exchange(false))
+                continue;
+
+            PROFILE_PHASE(PHASE_UPLOAD);
+
+            if (!bound)
+            {
+                glBindTexture(GL_TEXTURE_RECTANGLE, m_textureName);
+                glPixelStorei(GL_UNPACK_ROW_LENGTH, m_tileSize);
+                bound = true;
+            }
+
+            int x = (tile % m_tilesX) * m_tileSize;
+            int y = (tile / m_tilesX) * m_tileSize;
+
+            LockTile(tile);
+            glTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, x, y, std::min(m_tileSize, m_width - x),
+                            std::min(m_tileSize, m_height - y), GL_RGB, GL_FLOAT, TilePixels(tile));
+            UnlockTile(tile);
+        }
+
+        if (bound)
+        {
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+            glBindTexture(GL_TEXTURE_RECTANGLE, 0);
+        }
+    }
+
     // check for modifications to the image data and update texture as needed
-    if (m_modified)
+    std::unique_lock<std::mutex> lock(m_dataLock);
+    if (m_modified && m_uploadFormat == UPLOAD_DIRECT)
     {
+        PROFILE_PHASE(PHASE_UPLOAD);
+
         int sizeY = m_modifiedUpper - m_modifiedLower;
         int index = m_modifiedLower * m_width;
 
@@ -168,18 +461,182 @@ void ImageBuffer::Render()
         // mark that we've updated the texture
         ResetModified();
     }
+    lock.unlock();
+
+    // the image need not match the window, so stretch it over the viewport
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
 
     // bind the framebuffer object with our texture in it and copy to screen
     glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebufferObject);
     glBlitFramebuffer(0, 0, m_width, m_height,
-                      0, 0, m_width, m_height,
+                      viewport[0], viewport[1], viewport[0] + viewport[2], viewport[1] + viewport[3],
                       GL_COLOR_BUFFER_BIT, GL_NEAREST);
     glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
 }
 
+// nearest 16 bit float, flushing numbers too small for one to 0 and clamping
+// ones too big to the largest; colours never need infinities or NaNs
+static uint16_t FloatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint16_t sign = (bits >> 16) & 0x8000;
+    int exponent = int((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (exponent <= 0)
+        return sign;
+    if (exponent >= 31)
+        return sign | 0x7bff;
+
+    // round to nearest, letting a carry out of the mantissa bump the exponent
+    uint32_t half = (uint32_t(exponent) << 10) | (mantissa >> 13);
+    half += (mantissa >> 12) & 1;
+    return sign | uint16_t(std::min<uint32_t>(half, 0x7bff));
+}
+
+// writes a width x height block, rows rowLength pixels apart, in the upload
+// format and returns the end of what was written
+unsigned char *ImageBuffer::PackPixels(const vec3 *pixels, int rowLength, int width, int height,
+                                       unsigned char *out)
+{
+    for (int y = 0; y < height; ++y)
+    {
+        const vec3 *row = pixels + y * rowLength;
+
+        if (m_uploadFormat == UPLOAD_RGBA8)
+        {
+            for (int x = 0; x < width; ++x, out += 4)
+            {
+                out[0] = (unsigned char) (255 * clamp(row[x].r, 0.f, 1.f));
+                out[1] = (unsigned char) (255 * clamp(row[x].g, 0.f, 1.f));
+                out[2] = (unsigned char) (255 * clamp(row[x].b, 0.f, 1.f));
+                out[3] = 255;
+            }
+        }
+        else
+        {
+            uint16_t *half = reinterpret_cast<uint16_t *>(out);
+            for (int x = 0; x < width; ++x, half += 3)
+            {
+                half[0] = FloatToHalf(row[x].r);
+                half[1] = FloatToHalf(row[x].g);
+                half[2] = FloatToHalf(row[x].b);
+            }
+            out = reinterpret_cast<unsigned char *>(half);
+        }
+    }
+    return out;
+}
+
+void ImageBuffer::StreamChanges()
+{
+    int slot = m_uploadNext;
+
+    // the GPU may still be copying out of the next buffer; rather than wait
+    // for it, leave the changes for a later frame
+    if (m_uploadFences[slot])
+    {
+        GLenum state = glClientWaitSync(m_uploadFences[slot], 0, 0);
+        if (state == GL_TIMEOUT_EXPIRED)
+            return;
+        glDeleteSync(m_uploadFences[slot]);
+        m_uploadFences[slot] = 0;
+    }
+
+    bool changed = false;
+    if (m_tileSize)
+    {
+        for (int tile = 0; tile < m_tilesX * m_tilesY && !changed; ++tile)
+            changed = m_tileStates[tile].dirty;
+    }
+    else
+    {
+        std::lock_guard<std::mutex> guard(m_dataLock);
+        changed = m_modified;
+    }
+    if (!changed)
+        return;
+
+    PROFILE_PHASE(PHASE_UPLOAD);
+
+    // the fence says nothing reads this buffer any more, so the driver needn't
+    // check again when it is mapped
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_uploadBuffers[slot]);
+    GLsizeiptr size = (GLsizeiptr)m_width * m_height * m_uploadPixelSize;
+    unsigned char *mapped = static_cast<unsigned char *>(
+        glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+    if (!mapped)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return;
+    }
+
+    // pack every changed region one after another, remembering where each
+    // went, and only then copy them into the texture once the buffer is
+    // unmapped
+    struct Region { int x, y, width, height; size_t offset; };
+    vector<Region> regions;
+    unsigned char *out = mapped;
+
+    if (m_tileSize)
+    {
+        for (int tile = 0; tile < m_tilesX * m_tilesY; ++tile)
+        {
+            if (!m_tileStates[tile].dirty.exchange(false))
+                continue;
+
+            Region region;
+            region.x = (tile % m_tilesX) * m_tileSize;
+            region.y = (tile / m_tilesX) * m_tileSize;
+            region.width = std::min(m_tileSize, m_width - region.x);
+            region.height = std::min(m_tileSize, m_height - region.y);
+            region.offset = out - mapped;
+            regions.push_back(region);
+
+            LockTile(tile);
+            out = PackPixels(TilePixels(tile), m_tileSize, region.width, region.height, out);
+            UnlockTile(tile);
+        }
+    }
+    else
+    {
+        std::lock_guard<std::mutex> guard(m_dataLock);
+        if (m_modified)
+        {
+            Region region = { 0, m_modifiedLower, m_width, m_modifiedUpper - m_modifiedLower, 0 };
+            regions.push_back(region);
+
+            out = PackPixels(&m_imageData[m_modifiedLower * m_width], m_width, region.width, region.height, out);
+            ResetModified();
+        }
+    }
+
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    // with a buffer bound the copies read from it, at the offsets given in
+    // place of pointers, and return without waiting for the GPU
+    GLenum type = (m_uploadFormat == UPLOAD_RGBA8) ? GL_UNSIGNED_BYTE : GL_HALF_FLOAT;
+    GLenum format = (m_uploadFormat == UPLOAD_RGBA8) ? GL_RGBA : GL_RGB;
+
+    glBindTexture(GL_TEXTURE_RECTANGLE, m_textureName);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    for (size_t i = 0; i < regions.size(); ++i)
+        glTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, regions[i].x, regions[i].y, regions[i].width,
+                        regions[i].height, format, type, reinterpret_cast<const void *>(regions[i].offset));
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_RECTANGLE, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    m_uploadFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_uploadNext = (slot + 1) % UPLOAD_RING_SIZE;
+}
+
 // --------------------------------------------------------------------------
 
-bool ImageBuffer::SaveToFile(const string &imageFileName)
+bool ImageBuffer::SaveToFile(const string &imageFileName, ThreadPool &pool)
 {
     if (m_width == 0 || m_height == 0)
     {
@@ -188,6 +645,21 @@ bool ImageBuffer::SaveToFile(const string &imageFileName)
     }
     cout << "ImageBuffer saving image to " << imageFileName << "..." << endl;
 
+	// the writers pull the image a band of rows at a time, so it is never
+	// copied whole, and may do so while it is still refining
+	ImageRowSource rows = [this](int y, int count, vec3 *colours)
+	{
+		GetBlock(0, y, m_width, count, colours);
+	};
+
+	// floats are kept as they are whichever library is used
+	const string floatExtension = ".pfm";
+	if (imageFileName.size() >= floatExtension.size() &&
+		imageFileName.compare(imageFileName.size() - floatExtension.size(), floatExtension.size(), floatExtension) == 0)
+	{
+		return WritePfm(imageFileName, m_width, m_height, rows);
+	}
+
 	#ifdef USE_IMAGEMAGICK
 		using namespace Magick;
 
@@ -253,13 +725,33 @@ bool ImageBuffer::SaveToFile(const string &imageFileName)
 	#endif
 
 	#ifdef USE_STB
+	// the pixels stbi_write_png() would write, compressed in parallel
+	if (!WritePng(imageFileName, m_width, m_height, rows, pool))
+	{
+		// Fail! exit
+		cout << "ImageBuffer failed to write image " << imageFileName << endl;
+		return false;
+	}
+
+	//success, exit
+	return true;
+	#endif
+
+    return false;
+}
+
+void ImageBuffer::GetBytes(vector<unsigned char> &pixels)
+{
 	const unsigned numComponents = 3; //RGB
-	unsigned char* pixels = new unsigned char[m_width*m_height*numComponents];
+	pixels.resize(m_width*m_height*numComponents);
 
+	// the image may still be refining in the background
+	vector<vec3> image(m_width*m_height);
+	GetBlock(0, 0, m_width, m_height, &image[0]);
 	for (int y = 0; y < m_height; ++y)
 		for (int x = 0; x < m_width; ++x)
 		{
-			glm::vec3& color = m_imageData[y * m_width + x];
+			glm::vec3& color = image[y * m_width + x];
 			int i = (m_height - 1 - y) * m_width + x;
 			i *= numComponents;
 
@@ -267,23 +759,48 @@ bool ImageBuffer::SaveToFile(const string &imageFileName)
 			pixels[i + 1] = (unsigned char) (255 * clamp(color.g, 0.f, 1.f));	// green
 			pixels[i + 2] = (unsigned char) (255 * clamp(color.b, 0.f, 1.f));	// blue
 		}
+}
+
+bool ImageBuffer::CompareToFile(const string &imageFileName, double &psnr)
+{
+	#ifdef USE_STB
+	int width, height, components;
+	unsigned char *reference = stbi_load(imageFileName.c_str(), &width, &height, &components, 3);
+	if (!reference)
+	{
+		cout << "ImageBuffer ERROR: Could not read image " << imageFileName << endl;
+		return false;
+	}
 
-	// Save the image to disk
-	int stride = 0;
-	if (!stbi_write_png(imageFileName.data(), m_width, m_height, numComponents, pixels, stride))
+	if (width != m_width || height != m_height)
 	{
-		// Fail! delete and exit
-		cout << "STB failed to write image " << imageFileName << endl;
-		delete[] pixels;
+		cout << "ImageBuffer ERROR: " << imageFileName << " is " << width << "x" << height
+			 << ", not " << m_width << "x" << m_height << endl;
+		stbi_image_free(reference);
 		return false;
 	}
 
-	//success, delete and exit
-	delete[] pixels;
+	// compare exactly what SaveToFile would have written
+	vector<unsigned char> pixels;
+	GetBytes(pixels);
+
+	double squaredError = 0;
+	for (size_t i = 0; i < pixels.size(); ++i)
+	{
+		double difference = double(pixels[i]) - double(reference[i]);
+		squaredError += difference * difference;
+	}
+	stbi_image_free(reference);
+
+	double meanSquaredError = squaredError / pixels.size();
+	psnr = MAX_PSNR;
+	if (meanSquaredError > 0)
+		psnr = std::min(MAX_PSNR, 10.0 * log10(255.0 * 255.0 / meanSquaredError));
 	return true;
+	#else
+	cout << "ImageBuffer ERROR: Comparing images needs the stb library" << endl;
+	return false;
 	#endif
-
-    return false;
 }
 
 // --------------------------------------------------------------------------
@@ -13,8 +13,11 @@
 #ifndef IMAGEBUFFER_H
 #define IMAGEBUFFER_H
 
+#include <atomic>
+#include <memory>
 #include <vector>
 #include <string>
+#include <mutex>
 #include <glm/vec3.hpp>
 
 // Specify that we want the OpenGL core profile before including GLFW headers
@@ -26,10 +29,30 @@
 #endif
 #include <GLFW/glfw3.h>
 
+class ThreadPool;
+
 // --------------------------------------------------------------------------
 // This class encapsulates functionality for setting pixel colours in an
 // image memory buffer, copying the buffer into an OpenGL window for display,
 // and saving the buffer to disk as an image file.
+//
+// Given a tile size the image is stored tile by tile instead of row by row:
+// each tile's pixels sit together starting on a cache line of their own, with
+// a lock and dirty flag per tile, so render threads filling different tiles
+// never touch the same memory and Render() uploads just the tiles that
+// changed. Without one, a single lock and range of modified rows cover the
+// whole image.
+//
+// The changes are normally copied into the texture as 32 bit floats, and
+// Render() waits while the driver takes them. They can instead be streamed:
+// packed to 8 bit RGBA or 16 bit float RGB into one of a ring of pixel buffer
+// objects, which the GPU copies into the texture while the program carries
+// on. A buffer is only refilled once a fence shows its last copy is done; if
+// none is free the changes wait for the next frame instead of stalling, and
+// the window shows the last upload that completed.
+
+// size of a cache line, which tiles and their state are aligned to
+const int CACHE_LINE_SIZE = 64;
 
 class ImageBuffer
 {
@@ -41,13 +64,67 @@ class ImageBuffer
     int     m_width, m_height;
     std::vector<glm::vec3> m_imageData;
 
+    // tiled storage, used instead of m_imageData when m_tileSize isn't 0:
+    // tile (tx,ty) holds m_tileSize rows of m_tileSize pixels (fewer are used
+    // at the right and top edges) m_tileStride floats after the one before
+    int     m_tileSize;
+    int     m_tilesX, m_tilesY;
+    int     m_tileStride;
+    std::vector<float> m_tileData;
+    float  *m_tileBase;
+
+    // a cache line per tile, so neighbouring tiles' flags never share one
+    struct TileState
+    {
+        std::atomic<bool> busy;     // held while the tile's pixels are copied
+        std::atomic<bool> dirty;    // changed since it was last uploaded
+        char padding[CACHE_LINE_SIZE - 2 * sizeof(std::atomic<bool>)];
+    };
+    std::unique_ptr<TileState[]> m_tileStates;
+
+public:
+    // how Render() copies changes into the texture
+    enum UploadFormat
+    {
+        UPLOAD_DIRECT,              // 32 bit float RGB straight from the image
+        UPLOAD_RGBA8,               // streamed as 8 bit RGBA
+        UPLOAD_RGB16F               // streamed as 16 bit float RGB
+    };
+
+private:
+    // ring of pixel buffers streamed uploads are packed into, each with the
+    // fence set after the texture was last copied from it
+    static const int UPLOAD_RING_SIZE = 3;
+    UploadFormat m_uploadFormat;
+    GLuint  m_uploadBuffers[UPLOAD_RING_SIZE];
+    GLsync  m_uploadFences[UPLOAD_RING_SIZE];
+    int     m_uploadNext;
+    int     m_uploadPixelSize;
+
     // state variables to keep track of modified region
     bool    m_modified;
     int     m_modifiedLower, m_modifiedUpper;
 
+    // guards the pixels and modified region while render threads fill them in
+    std::mutex m_dataLock;
+
     void ResetModified();
     bool destroyed;
 
+    glm::vec3 *TilePixels(int tile);
+    glm::vec3 &Pixel(int x, int y);
+    void LockTile(int tile);
+    void UnlockTile(int tile);
+
+    bool CreateUploadBuffers();
+    void DeleteUploadBuffers();
+    void StreamChanges();
+    unsigned char *PackPixels(const glm::vec3 *pixels, int rowLength, int width, int height,
+                              unsigned char *out);
+
+    // 8 bit RGB rows from the top of the image down, as they are saved
+    void GetBytes(std::vector<unsigned char> &pixels);
+
 public:
     ImageBuffer();
     ~ImageBuffer();
@@ -56,21 +133,56 @@ public:
     int Width() const  { return m_width; }
     int Height() const { return m_height; }
 
-    // call this after your OpenGL context is all set up to create an image
-    // buffer that matches the size of your viewport
-    bool Initialize();
+    // call this after your OpenGL context is all set up to create a width x
+    // height image buffer; it is stretched over the viewport when rendered.
+    // A tileSize above 0 stores the image in tiles of that size, and the
+    // upload format says how changes reach the texture.
+    bool Initialize(int width, int height, int tileSize = 0,
+                    UploadFormat uploadFormat = UPLOAD_DIRECT);
     bool Destroy();
 
+    // allocate a width x height image in memory only, with no OpenGL calls,
+    // for rendering straight to file; Render() then does nothing
+    bool Allocate(int width, int height, int tileSize = 0);
+
+    // side of the tiles the image is stored in, 0 if it is stored in rows
+    int TileSize() const { return m_tileSize; }
+
+    UploadFormat GetUploadFormat() const { return m_uploadFormat; }
+
     // set a pixel in this image buffer to a specified colour:
     //  - (0,0) is the bottom-left pixel of the image
     //  - colour is RGB given as floating point numbers in the range [0,1]
     void SetPixel(int x, int y, glm::vec3 colour);
 
+    // copy a width x height block of pixels, stored row by row from its
+    // bottom-left corner, into the image with (x,y) as that corner; safe to
+    // call from other threads while Render() or SaveToFile() run
+    void SetBlock(int x, int y, int width, int height, const glm::vec3 *colours);
+
+    // copy a width x height block of pixels out of the image, the reverse
+    // of SetBlock()
+    void GetBlock(int x, int y, int width, int height, glm::vec3 *colours);
+
+    // replace the whole of tile (tileX,tileY) of a tiled image, colours
+    // stored row by row as for SetBlock() and clipped to the image at its
+    // edges; only that tile's lock is taken, so threads writing different
+    // tiles never wait for each other
+    void SetTile(int tileX, int tileY, const glm::vec3 *colours);
+
     // call this in your render function to copy this image onto your screen
     void Render();
 
-    // call this at the end of your render to save the image to file
-    bool SaveToFile(const std::string &imageFileName);
+    // call this at the end of your render to save the image to file; PNGs
+    // are compressed across pool, which must not be running another batch
+    bool SaveToFile(const std::string &imageFileName, ThreadPool &pool);
+
+    // peak signal to noise ratio in dB between the image, as it would be
+    // saved, and an image file of the same size; identical images score
+    // MAX_PSNR. Needs the stb library.
+    bool CompareToFile(const std::string &imageFileName, double &psnr);
+
+    static const double MAX_PSNR;
 };
 
 // --------------------------------------------------------------------------
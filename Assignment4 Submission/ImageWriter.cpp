@@ -0,0 +1,520 @@
+// ==========================================================================
+// Image File Writers
+// ==========================================================================
+
+#include "ImageWriter.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdint.h>
+#include <vector>
+#include <glm/common.hpp>
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    // rows converted and compressed together: enough to compress well, few
+    // enough that there are plenty of bands to share between threads
+    const int BAND_ROWS = 32;
+
+    // ---- checksums ----
+
+    struct CrcTable
+    {
+        uint32_t entries[256];
+
+        CrcTable()
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; ++bit)
+                    crc = (crc & 1) ? 0xedb88320u ^ (crc >> 1) : crc >> 1;
+                entries[i] = crc;
+            }
+        }
+    };
+
+    // continues crc over more data; start from 0
+    uint32_t Crc32(uint32_t crc, const unsigned char *data, size_t size)
+    {
+        static const CrcTable table;
+
+        crc = ~crc;
+        for (size_t i = 0; i < size; ++i)
+            crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    const uint32_t ADLER_BASE = 65521;
+
+    uint32_t Adler32(const unsigned char *data, size_t size)
+    {
+        uint32_t a = 1, b = 0;
+        while (size > 0)
+        {
+            // the most bytes before b could overflow
+            size_t run = std::min(size, (size_t)5552);
+            for (size_t i = 0; i < run; ++i)
+            {
+                a += data[i];
+                b += a;
+            }
+            a %= ADLER_BASE;
+            b %= ADLER_BASE;
+            data += run;
+            size -= run;
+        }
+        return (b << 16) | a;
+    }
+
+    // checksum of two pieces of data one after the other, given each one's
+    // and the length of the second, as zlib's adler32_combine()
+    uint32_t CombineAdler32(uint32_t first, uint32_t second, size_t secondSize)
+    {
+        uint32_t remainder = (uint32_t)(secondSize % ADLER_BASE);
+        uint32_t a = first & 0xffff;
+        uint32_t b = (uint32_t)(((uint64_t)remainder * a) % ADLER_BASE);
+
+        a += (second & 0xffff) + ADLER_BASE - 1;
+        b += (first >> 16) + (second >> 16) + ADLER_BASE - remainder;
+
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+        return (b << 16) | a;
+    }
+
+    // ---- deflate ----
+
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(vector<unsigned char> &out) : m_out(out), m_bits(0), m_count(0) {}
+
+        // least significant bit first, as deflate packs everything but codes
+        void Write(uint32_t value, int length)
+        {
+            m_bits |= value << m_count;
+            m_count += length;
+            while (m_count >= 8)
+            {
+                m_out.push_back((unsigned char)m_bits);
+                m_bits >>= 8;
+                m_count -= 8;
+            }
+        }
+
+        // Huffman codes go most significant bit first
+        void WriteCode(uint32_t code, int length)
+        {
+            uint32_t reversed = 0;
+            for (int i = 0; i < length; ++i, code >>= 1)
+                reversed = (reversed << 1) | (code & 1);
+            Write(reversed, length);
+        }
+
+        // pad with zeros to the next byte
+        void Align()
+        {
+            if (m_count > 0)
+                m_out.push_back((unsigned char)m_bits);
+            m_bits = 0;
+            m_count = 0;
+        }
+
+    private:
+        vector<unsigned char> &m_out;
+        uint32_t m_bits;
+        int m_count;
+    };
+
+    const int LENGTH_CODES = 29;
+    const int lengthBase[LENGTH_CODES] =
+    {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    const int lengthExtra[LENGTH_CODES] =
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+
+    const int DISTANCE_CODES = 30;
+    const int distanceBase[DISTANCE_CODES] =
+    {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+    };
+    const int distanceExtra[DISTANCE_CODES] =
+    {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+    };
+
+    // a literal byte, the end of block (256) or a length code (257 up) in
+    // deflate's fixed Huffman code
+    void WriteSymbol(BitWriter &writer, int symbol)
+    {
+        if (symbol < 144)
+            writer.WriteCode(0x30 + symbol, 8);
+        else if (symbol < 256)
+            writer.WriteCode(0x190 + symbol - 144, 9);
+        else if (symbol < 280)
+            writer.WriteCode(symbol - 256, 7);
+        else
+            writer.WriteCode(0xc0 + symbol - 280, 8);
+    }
+
+    void WriteMatch(BitWriter &writer, int length, int distance)
+    {
+        int code = int(upper_bound(lengthBase, lengthBase + LENGTH_CODES, length) - lengthBase) - 1;
+        WriteSymbol(writer, 257 + code);
+        writer.Write(length - lengthBase[code], lengthExtra[code]);
+
+        code = int(upper_bound(distanceBase, distanceBase + DISTANCE_CODES, distance) - distanceBase) - 1;
+        writer.WriteCode(code, 5);
+        writer.Write(distance - distanceBase[code], distanceExtra[code]);
+    }
+
+    const int HASH_BITS = 15;
+    const int WINDOW_SIZE = 32768;
+    const int MIN_MATCH = 3;
+    const int MAX_MATCH = 258;
+
+    // how many earlier places with the same first bytes are tried; filtered
+    // image rows repeat in short runs, so a long search gains little
+    const int MAX_CHAIN = 16;
+
+    uint32_t Hash(const unsigned char *data)
+    {
+        uint32_t key = (uint32_t(data[0]) << 16) | (uint32_t(data[1]) << 8) | data[2];
+        return (key * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    // compresses data as one non-final block with the fixed Huffman code, the
+    // same as stb_image_write does, then an empty stored block so the output
+    // ends on a byte boundary and another band's blocks can follow it
+    void Deflate(const unsigned char *data, int size, vector<unsigned char> &out)
+    {
+        vector<int> head(1 << HASH_BITS, -1);
+        vector<int> previous(size);
+
+        BitWriter writer(out);
+        writer.Write(0, 1);     // not the last block
+        writer.Write(1, 2);     // fixed Huffman code
+
+        int i = 0;
+        while (i < size)
+        {
+            int bestLength = 0, bestDistance = 0;
+            if (i + MIN_MATCH <= size)
+            {
+                int limit = std::min(MAX_MATCH, size - i);
+                int chain = MAX_CHAIN;
+                for (int candidate = head[Hash(data + i)];
+                     candidate >= 0 && i - candidate <= WINDOW_SIZE && chain > 0;
+                     candidate = previous[candidate], --chain)
+                {
+                    // only worth comparing if it could beat the best so far
+                    if (data[candidate + bestLength] != data[i + bestLength])
+                        continue;
+
+                    int length = 0;
+                    while (length < limit && data[candidate + length] == data[i + length])
+                        ++length;
+
+                    if (length > bestLength)
+                    {
+                        bestLength = length;
+                        bestDistance = i - candidate;
+                        if (length == limit)
+                            break;
+                    }
+                }
+            }
+
+            int advance = 1;
+            if (bestLength >= MIN_MATCH)
+            {
+                WriteMatch(writer, bestLength, bestDistance);
+                advance = bestLength;
+            }
+            else
+            {
+                WriteSymbol(writer, data[i]);
+            }
+
+            for (int end = i + advance; i < end; ++i)
+            {
+                if (i + MIN_MATCH > size)
+                    continue;
+                uint32_t hash = Hash(data + i);
+                previous[i] = head[hash];
+                head[hash] = i;
+            }
+        }
+        WriteSymbol(writer, 256);
+
+        // empty stored block: header, padding, then a length of 0 and its complement
+        writer.Write(0, 3);
+        writer.Align();
+        const unsigned char storedLength[4] = { 0x00, 0x00, 0xff, 0xff };
+        out.insert(out.end(), storedLength, storedLength + 4);
+    }
+
+    // ---- PNG ----
+
+    int Paeth(int left, int above, int aboveLeft)
+    {
+        int estimate = left + above - aboveLeft;
+        int toLeft = std::abs(estimate - left);
+        int toAbove = std::abs(estimate - above);
+        int toAboveLeft = std::abs(estimate - aboveLeft);
+        if (toLeft <= toAbove && toLeft <= toAboveLeft)
+            return left;
+        return toAbove <= toAboveLeft ? above : aboveLeft;
+    }
+
+    // writes the filter type and filtered row, picking whichever of the five
+    // filters gives the smallest sum of (signed) bytes, as stb_image_write
+    // does; above is the row before in the file, or a row of zeros for the first
+    void FilterRow(const unsigned char *row, const unsigned char *above, int length,
+                   vector<unsigned char> &scratch, unsigned char *out)
+    {
+        const int pixelSize = 3;
+        scratch.resize(length);
+        unsigned char *filtered = &scratch[0];
+
+        int bestScore = -1;
+        for (int filter = 0; filter < 5; ++filter)
+        {
+            // the first pixel has nothing to its left
+            for (int i = 0; i < pixelSize; ++i)
+            {
+                int predicted = 0;
+                if (filter == 2 || filter == 4)
+                    predicted = above[i];
+                else if (filter == 3)
+                    predicted = above[i] >> 1;
+                filtered[i] = (unsigned char)(row[i] - predicted);
+            }
+
+            switch (filter)
+            {
+                case 0:
+                    copy(row + pixelSize, row + length, filtered + pixelSize);
+                    break;
+                case 1:
+                    for (int i = pixelSize; i < length; ++i)
+                        filtered[i] = (unsigned char)(row[i] - row[i - pixelSize]);
+                    break;
+                case 2:
+                    for (int i = pixelSize; i < length; ++i)
+                        filtered[i] = (unsigned char)(row[i] - above[i]);
+                    break;
+                case 3:
+                    for (int i = pixelSize; i < length; ++i)
+                        filtered[i] = (unsigned char)(row[i] - ((row[i - pixelSize] + above[i]) >> 1));
+                    break;
+                case 4:
+                    for (int i = pixelSize; i < length; ++i)
+                        filtered[i] = (unsigned char)(row[i] - Paeth(row[i - pixelSize], above[i], above[i - pixelSize]));
+                    break;
+            }
+
+            int score = 0;
+            for (int i = 0; i < length; ++i)
+                score += std::abs((int)(signed char)filtered[i]);
+
+            if (bestScore < 0 || score < bestScore)
+            {
+                bestScore = score;
+                out[0] = (unsigned char)filter;
+                copy(filtered, filtered + length, out + 1);
+            }
+        }
+    }
+
+    struct PngBand
+    {
+        vector<unsigned char> data;     // this band's part of the zlib stream
+        uint32_t crc;                   // of the chunk type and data
+        uint32_t adler;                 // of the uncompressed, filtered rows
+        size_t filteredSize;
+    };
+
+    void AppendUint32(vector<unsigned char> &out, uint32_t value)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            out.push_back((unsigned char)(value >> shift));
+    }
+
+    bool WriteChunk(ostream &out, const char *type, const unsigned char *data, size_t size, uint32_t crc)
+    {
+        vector<unsigned char> header;
+        AppendUint32(header, (uint32_t)size);
+        header.insert(header.end(), type, type + 4);
+
+        vector<unsigned char> footer;
+        AppendUint32(footer, crc);
+
+        out.write((const char *)&header[0], header.size());
+        if (size > 0)
+            out.write((const char *)data, size);
+        out.write((const char *)&footer[0], footer.size());
+        return bool(out);
+    }
+
+    bool WriteChunk(ostream &out, const char *type, const vector<unsigned char> &data)
+    {
+        uint32_t crc = Crc32(0, (const unsigned char *)type, 4);
+        crc = Crc32(crc, data.empty() ? 0 : &data[0], data.size());
+        return WriteChunk(out, type, data.empty() ? 0 : &data[0], data.size(), crc);
+    }
+
+    // converts, filters and compresses PNG rows firstRow to firstRow+rowCount-1,
+    // counting from the top as the file does
+    void CompressBand(int width, int height, int firstRow, int rowCount,
+                      const ImageRowSource &rows, PngBand &band)
+    {
+        // the image's rows go bottom up, so the row above the band in the
+        // file is the one after it in the image
+        int rowLength = width * 3;
+        bool hasAbove = firstRow > 0;
+        int fetched = rowCount + (hasAbove ? 1 : 0);
+
+        vector<vec3> colours(width * fetched);
+        rows(height - firstRow - rowCount, fetched, &colours[0]);
+
+        vector<unsigned char> bytes(rowLength * fetched);
+        for (size_t i = 0; i < colours.size(); ++i)
+            for (int c = 0; c < 3; ++c)
+                bytes[i * 3 + c] = (unsigned char)(255 * clamp(colours[i][c], 0.f, 1.f));
+
+        vector<unsigned char> filtered((rowLength + 1) * rowCount);
+        vector<unsigned char> scratch;
+        vector<unsigned char> zeros(rowLength, 0);
+        for (int k = 0; k < rowCount; ++k)
+        {
+            const unsigned char *row = &bytes[(rowCount - 1 - k) * rowLength];
+            const unsigned char *above = (k > 0 || hasAbove) ? row + rowLength : &zeros[0];
+            FilterRow(row, above, rowLength, scratch, &filtered[k * (rowLength + 1)]);
+        }
+
+        // the first band carries the zlib header
+        band.data.clear();
+        if (firstRow == 0)
+        {
+            band.data.push_back(0x78);
+            band.data.push_back(0x5e);
+        }
+        Deflate(&filtered[0], (int)filtered.size(), band.data);
+
+        band.crc = Crc32(Crc32(0, (const unsigned char *)"IDAT", 4), &band.data[0], band.data.size());
+        band.adler = Adler32(&filtered[0], filtered.size());
+        band.filteredSize = filtered.size();
+    }
+}
+
+// --------------------------------------------------------------------------
+
+bool WritePng(const string &fileName, int width, int height, const ImageRowSource &rows, ThreadPool &pool)
+{
+    ofstream out(fileName.c_str(), ios::binary);
+    if (!out)
+    {
+        cout << "ERROR: Could not write image to " << fileName << endl;
+        return false;
+    }
+
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    out.write((const char *)signature, sizeof(signature));
+
+    // 8 bit RGB, no interlacing
+    vector<unsigned char> header;
+    AppendUint32(header, width);
+    AppendUint32(header, height);
+    const unsigned char format[5] = { 8, 2, 0, 0, 0 };
+    header.insert(header.end(), format, format + 5);
+    WriteChunk(out, "IHDR", header);
+
+    // a few bands per thread at a time, written in order once they are all
+    // done, so only those bands are ever held
+    int bandCount = (height + BAND_ROWS - 1) / BAND_ROWS;
+    int batchSize = pool.ThreadCount() * 2;
+    vector<PngBand> bands(batchSize);
+    uint32_t adler = 1;
+
+    for (int firstBand = 0; firstBand < bandCount && out; firstBand += batchSize)
+    {
+        int count = std::min(batchSize, bandCount - firstBand);
+        pool.ParallelFor(count, [&](int i)
+        {
+            int firstRow = (firstBand + i) * BAND_ROWS;
+            CompressBand(width, height, firstRow, std::min(BAND_ROWS, height - firstRow), rows, bands[i]);
+        });
+
+        for (int i = 0; i < count; ++i)
+        {
+            WriteChunk(out, "IDAT", &bands[i].data[0], bands[i].data.size(), bands[i].crc);
+            adler = CombineAdler32(adler, bands[i].adler, bands[i].filteredSize);
+        }
+    }
+
+    // an empty final block closes the stream, then its checksum
+    vector<unsigned char> end;
+    end.push_back(0x03);
+    end.push_back(0x00);
+    AppendUint32(end, adler);
+    WriteChunk(out, "IDAT", end);
+    WriteChunk(out, "IEND", vector<unsigned char>());
+
+    out.close();
+    if (!out)
+    {
+        cout << "ERROR: Could not write image to " << fileName << endl;
+        return false;
+    }
+    return true;
+}
+
+bool WritePfm(const string &fileName, int width, int height, const ImageRowSource &rows)
+{
+    ofstream out(fileName.c_str(), ios::binary);
+    if (!out)
+    {
+        cout << "ERROR: Could not write image to " << fileName << endl;
+        return false;
+    }
+
+    // a negative scale means little endian floats
+    const uint16_t probe = 1;
+    bool littleEndian = *(const unsigned char *)&probe == 1;
+    out << "PF\n" << width << " " << height << "\n" << (littleEndian ? "-1.0" : "1.0") << "\n";
+
+    vector<vec3> colours(width * BAND_ROWS);
+    for (int y = 0; y < height && out; y += BAND_ROWS)
+    {
+        int count = std::min(BAND_ROWS, height - y);
+        rows(y, count, &colours[0]);
+        out.write((const char *)&colours[0], sizeof(vec3) * width * count);
+    }
+
+    out.close();
+    if (!out)
+    {
+        cout << "ERROR: Could not write image to " << fileName << endl;
+        return false;
+    }
+    return true;
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,40 @@
+// ==========================================================================
+// Image File Writers
+//
+// Writers for saving large renders quickly. Neither ever holds a converted
+// copy of the whole image: rows are pulled from the caller a band at a time
+// and written out as soon as they are ready.
+//
+// PNGs are converted to 8 bits, filtered and compressed a band of rows at a
+// time across the caller's thread pool. Each band is compressed on its own and ends on a
+// byte boundary (a deflate sync flush), so the bands' data can be written one
+// after another as separate IDAT chunks of the one zlib stream, with their
+// checksums combined at the end. Only a few bands are held at once.
+//
+// PFMs keep the full float colour, without clamping, for HDR results. They
+// are a short text header followed by the raw floats, bottom row first, which
+// is the order the image is already stored in.
+// ==========================================================================
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <functional>
+#include <string>
+#include <glm/vec3.hpp>
+
+class ThreadPool;
+
+// --------------------------------------------------------------------------
+
+// fills colours with rows y to y+rows-1 of the image, row by row starting
+// from the bottom, as ImageBuffer::GetBlock() does; called from many threads
+typedef std::function<void(int y, int rows, glm::vec3 *colours)> ImageRowSource;
+
+// colours clamped to [0,1] and truncated to 8 bits per channel
+bool WritePng(const std::string &fileName, int width, int height, const ImageRowSource &rows, ThreadPool &pool);
+
+// 32 bit float RGB in the machine's byte order, which the header records
+bool WritePfm(const std::string &fileName, int width, int height, const ImageRowSource &rows);
+
+// --------------------------------------------------------------------------
+#endif // IMAGEWRITER_H
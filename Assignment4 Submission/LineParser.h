@@ -0,0 +1,109 @@
+// ==========================================================================
+// Line Parser
+//
+// Splits one line of a text file into words and numbers, stopping at a #
+// comment. Shared by the scene and mesh readers, which read their files a
+// line at a time.
+// ==========================================================================
+#ifndef LINEPARSER_H
+#define LINEPARSER_H
+
+#include <cmath>
+#include <cstdlib>
+#include <string>
+
+#include "glm/glm.hpp"
+
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+//Splits one line into words and numbers, stopping at a comment
+class LineParser
+{
+public:
+	LineParser(const char *line) : p(line) {}
+
+	bool atEnd()
+	{
+		skipSpace();
+		return *p == '\0' || *p == '#';
+	}
+
+	bool word(std::string &w)
+	{
+		if (atEnd())
+		{
+			return false;
+		}
+
+		const char *start = p;
+		while (*p != '\0' && *p != '#' && !isSpace(*p))
+		{
+			p++;
+		}
+
+		w.assign(start, p);
+		return true;
+	}
+
+	bool number(float &f)
+	{
+		if (atEnd())
+		{
+			return false;
+		}
+
+		char *end;
+		f = strtof(p, &end);
+
+		if (end == p || !(*end == '\0' || *end == '#' || isSpace(*end)))
+		{
+			return false;
+		}
+
+		p = end;
+		return std::isfinite(f);
+	}
+
+	bool number(int &i)
+	{
+		if (atEnd())
+		{
+			return false;
+		}
+
+		char *end;
+		long l = strtol(p, &end, 10);
+
+		if (end == p || !(*end == '\0' || *end == '#' || isSpace(*end)))
+		{
+			return false;
+		}
+
+		p = end;
+		i = (int)l;
+		return l == i;
+	}
+
+	bool point(vec3 &v)
+	{
+		return number(v.x) && number(v.y) && number(v.z);
+	}
+
+private:
+	const char *p;
+
+	static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+	void skipSpace()
+	{
+		while (isSpace(*p))
+		{
+			p++;
+		}
+	}
+};
+
+// --------------------------------------------------------------------------
+#endif // LINEPARSER_H
@@ -0,0 +1,779 @@
+// ==========================================================================
+// Mesh Files
+// ==========================================================================
+
+#include "MeshFile.h"
+#include "LineParser.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+//Mesh as read from a file, corners index its own vertices
+struct MeshData
+{
+	vector<vec3> vertices;
+	vector<MeshTriangle> triangles;
+};
+
+//Splits a polygon into a fan of triangles around its first corner
+static void addPolygon(MeshData &mesh, const vector<uint32_t> &corners)
+{
+	for (unsigned int i = 2; i < corners.size(); i++)
+	{
+		mesh.triangles.push_back(MeshTriangle(corners[0], corners[i - 1], corners[i]));
+	}
+}
+
+// --------------------------------------------------------------------------
+// OBJ
+
+static bool readObj(istream &in, const string &fileName, MeshData &mesh)
+{
+	string line;
+	string keyword;
+	string corner;
+	vector<uint32_t> corners;
+	int lineNumber = 0;
+
+	while (getline(in, line))
+	{
+		lineNumber++;
+
+		LineParser parser(line.c_str());
+
+		if (!parser.word(keyword))
+		{
+			continue;
+		}
+
+		string error;
+
+		if (keyword == "v")
+		{
+			vec3 vertex;
+			float w;
+
+			if (!parser.point(vertex))
+			{
+				error = "expected v x y z";
+			}
+			else
+			{
+				parser.number(w);
+				mesh.vertices.push_back(vertex);
+			}
+		}
+		else if (keyword == "f")
+		{
+			corners.clear();
+
+			while (error.empty() && parser.word(corner))
+			{//Corners look like v, v/vt, v//vn or v/vt/vn, negative counts back from the last vertex
+				char *end;
+				long index = strtol(corner.c_str(), &end, 10);
+
+				if (end == corner.c_str() || (*end != '\0' && *end != '/'))
+				{
+					error = "bad face corner " + corner;
+				}
+				else if (index < 0)
+				{
+					index += (long)mesh.vertices.size();
+				}
+				else
+				{
+					index--;
+				}
+
+				if (error.empty() && (index < 0 || index >= (long)mesh.vertices.size()))
+				{
+					error = "face corner " + corner + " refers to a vertex that doesn't exist";
+				}
+
+				corners.push_back((uint32_t)index);
+			}
+
+			if (error.empty() && corners.size() < 3)
+			{
+				error = "a face needs at least three corners";
+			}
+
+			if (error.empty())
+			{
+				addPolygon(mesh, corners);
+			}
+		}
+
+		//Normals, texture coordinates, groups and materials are all ignored
+
+		if (!error.empty())
+		{
+			cout << "ERROR: " << fileName << ":" << lineNumber << ": " << error << endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// --------------------------------------------------------------------------
+// PLY
+
+enum PlyType { PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64, PLY_UNKNOWN };
+
+static PlyType plyType(const string &name)
+{
+	const char *const names[][2] = {
+		{ "char", "int8" }, { "uchar", "uint8" }, { "short", "int16" }, { "ushort", "uint16" },
+		{ "int", "int32" }, { "uint", "uint32" }, { "float", "float32" }, { "double", "float64" }
+	};
+
+	for (int i = 0; i < PLY_UNKNOWN; i++)
+	{
+		if (name == names[i][0] || name == names[i][1])
+		{
+			return (PlyType)i;
+		}
+	}
+
+	return PLY_UNKNOWN;
+}
+
+static int plyTypeSize(PlyType type)
+{
+	const int sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+	return sizes[type];
+}
+
+struct PlyProperty
+{
+	string name;
+	PlyType type;
+	bool isList;
+	PlyType countType;		//Type of a list's length
+};
+
+struct PlyElement
+{
+	string name;
+	unsigned long long count;
+	vector<PlyProperty> properties;
+};
+
+//Reads values one at a time, as text or as raw bytes in either byte order
+class PlyReader
+{
+public:
+	PlyReader(istream &i, bool isBinary, bool isBigEndian) : in(i), binary(isBinary)
+	{
+		const uint16_t one = 1;
+		bool hostBigEndian = *(const unsigned char *)&one == 0;
+		swap = binary && isBigEndian != hostBigEndian;
+	}
+
+	bool read(PlyType type, double &value)
+	{
+		if (!binary)
+		{
+			return (bool)(in >> value);
+		}
+
+		unsigned char bytes[8];
+		int size = plyTypeSize(type);
+
+		if (in.rdbuf()->sgetn((char *)bytes, size) != size)
+		{
+			return false;
+		}
+
+		if (swap)
+		{
+			for (int i = 0; i < size / 2; i++)
+			{
+				std::swap(bytes[i], bytes[size - 1 - i]);
+			}
+		}
+
+		switch (type)
+		{
+			case PLY_INT8:		{ int8_t v; memcpy(&v, bytes, 1); value = v; break; }
+			case PLY_UINT8:		{ uint8_t v; memcpy(&v, bytes, 1); value = v; break; }
+			case PLY_INT16:		{ int16_t v; memcpy(&v, bytes, 2); value = v; break; }
+			case PLY_UINT16:	{ uint16_t v; memcpy(&v, bytes, 2); value = v; break; }
+			case PLY_INT32:		{ int32_t v; memcpy(&v, bytes, 4); value = v; break; }
+			case PLY_UINT32:	{ uint32_t v; memcpy(&v, bytes, 4); value = v; break; }
+			case PLY_FLOAT32:	{ float v; memcpy(&v, bytes, 4); value = v; break; }
+			default:			{ double v; memcpy(&v, bytes, 8); value = v; break; }
+		}
+
+		return true;
+	}
+
+	//True once nothing but, for text, white space is left
+	bool atEnd()
+	{
+		if (!binary)
+		{
+			return (in >> ws).eof();
+		}
+
+		return in.rdbuf()->sgetc() == char_traits<char>::eof();
+	}
+
+private:
+	istream &in;
+	bool binary;
+	bool swap;
+};
+
+//An element without properties takes up no data, so any count of them
+//could be claimed and none of them would ever run out
+static bool hasData(const PlyElement &element)
+{
+	return element.count == 0 || !element.properties.empty();
+}
+
+static bool readPlyHeader(istream &in, const string &fileName, vector<PlyElement> &elements, bool &binary, bool &bigEndian)
+{
+	string line;
+	string keyword;
+	string word;
+	int lineNumber = 0;
+	bool hasFormat = false;
+
+	while (getline(in, line))
+	{
+		lineNumber++;
+
+		if (!line.empty() && line[line.size() - 1] == '\r')
+		{
+			line.erase(line.size() - 1);
+		}
+
+		//Comments don't start with #, so they are skipped before parsing
+		if (line.compare(0, 7, "comment") == 0 || line.compare(0, 8, "obj_info") == 0)
+		{
+			continue;
+		}
+
+		LineParser parser(line.c_str());
+
+		if (!parser.word(keyword))
+		{
+			continue;
+		}
+
+		string error;
+
+		if (keyword == "ply")
+		{
+			if (lineNumber != 1)
+			{
+				error = "ply has to be the first line";
+			}
+		}
+		else if (keyword == "format")
+		{
+			parser.word(word);
+			hasFormat = true;
+			binary = word != "ascii";
+			bigEndian = word == "binary_big_endian";
+
+			if (binary && !bigEndian && word != "binary_little_endian")
+			{
+				error = "unknown format " + word;
+			}
+		}
+		else if (keyword == "element")
+		{
+			PlyElement element;
+			string count;
+
+			if (!elements.empty() && !hasData(elements.back()))
+			{
+				error = "element " + elements.back().name + " has no properties";
+			}
+			else if (!parser.word(element.name) || !parser.word(count) || sscanf(count.c_str(), "%llu", &element.count) != 1)
+			{
+				error = "expected element name count";
+			}
+
+			elements.push_back(element);
+		}
+		else if (keyword == "property")
+		{
+			PlyProperty property;
+			property.isList = false;
+			property.countType = PLY_UNKNOWN;
+
+			parser.word(word);
+
+			if (word == "list")
+			{
+				property.isList = true;
+				parser.word(word);
+				property.countType = plyType(word);
+				parser.word(word);
+			}
+
+			property.type = plyType(word);
+
+			if (!parser.word(property.name) || property.type == PLY_UNKNOWN || (property.isList && property.countType == PLY_UNKNOWN))
+			{
+				error = "bad property";
+			}
+			else if (elements.empty())
+			{
+				error = "property before any element";
+			}
+			else
+			{
+				elements.back().properties.push_back(property);
+			}
+		}
+		else if (keyword == "end_header")
+		{
+			if (!hasFormat)
+			{
+				error = "no format given";
+			}
+			else if (!elements.empty() && !hasData(elements.back()))
+			{
+				error = "element " + elements.back().name + " has no properties";
+			}
+			else
+			{
+				return true;
+			}
+		}
+		else
+		{
+			error = "unknown header line " + keyword;
+		}
+
+		if (!error.empty())
+		{
+			cout << "ERROR: " << fileName << ":" << lineNumber << ": " << error << endl;
+			return false;
+		}
+	}
+
+	cout << "ERROR: " << fileName << ": the header never ends" << endl;
+	return false;
+}
+
+static bool readPly(istream &in, const string &fileName, MeshData &mesh)
+{
+	vector<PlyElement> elements;
+	bool binary = false;
+	bool bigEndian = false;
+
+	if (!readPlyHeader(in, fileName, elements, binary, bigEndian))
+	{
+		return false;
+	}
+
+	PlyReader reader(in, binary, bigEndian);
+	vector<uint32_t> corners;
+
+	//Corners are checked against the header's vertex count as they are read,
+	//as a value outside what a corner can hold can't even be kept
+	double vertexLimit = 0;
+	for (const PlyElement &element : elements)
+	{
+		if (element.name == "vertex")
+		{
+			vertexLimit = (double)std::min(element.count, (unsigned long long)UINT32_MAX);
+		}
+	}
+
+	for (unsigned int e = 0; e < elements.size(); e++)
+	{
+		const PlyElement &element = elements[e];
+		bool isVertex = element.name == "vertex";
+		bool isFace = element.name == "face";
+
+		//Which property holds each coordinate, or the corner list
+		vector<int> coordinate(element.properties.size(), -1);
+		for (unsigned int p = 0; p < element.properties.size(); p++)
+		{
+			const string &name = element.properties[p].name;
+
+			if (isVertex && name.size() == 1 && name[0] >= 'x' && name[0] <= 'z')
+			{
+				coordinate[p] = name[0] - 'x';
+			}
+			else if (isFace && element.properties[p].isList && (name == "vertex_indices" || name == "vertex_index"))
+			{
+				coordinate[p] = 0;
+			}
+		}
+
+		//A damaged count could ask for anything, so only trust it so far
+		size_t expected = (size_t)std::min(element.count, 1ULL << 24);
+
+		if (isVertex)
+		{
+			mesh.vertices.reserve(expected);
+		}
+		else if (isFace)
+		{
+			mesh.triangles.reserve(expected);
+		}
+
+		for (unsigned long long item = 0; item < element.count; item++)
+		{
+			if (reader.atEnd())
+			{//Stop at once however many more the header claimed
+				cout << "ERROR: " << fileName << " ends after " << item << " of its " << element.count << " " << element.name << " items" << endl;
+				return false;
+			}
+
+			vec3 vertex = vec3(0, 0, 0);
+
+			for (unsigned int p = 0; p < element.properties.size(); p++)
+			{
+				const PlyProperty &property = element.properties[p];
+				double value;
+
+				if (!property.isList)
+				{
+					if (!reader.read(property.type, value))
+					{
+						cout << "ERROR: " << fileName << " ends in the middle of its " << element.name << " data" << endl;
+						return false;
+					}
+
+					if (isVertex && coordinate[p] >= 0)
+					{
+						vertex[coordinate[p]] = (float)value;
+					}
+
+					continue;
+				}
+
+				double length;
+				if (!reader.read(property.countType, length))
+				{
+					cout << "ERROR: " << fileName << " ends in the middle of its " << element.name << " data" << endl;
+					return false;
+				}
+
+				if (!(length >= 0 && length <= INT_MAX))
+				{//Also NaN
+					cout << "ERROR: " << fileName << ": " << element.name << " " << item << " has a list of " << length << " values" << endl;
+					return false;
+				}
+
+				bool isCorners = isFace && coordinate[p] >= 0;
+				corners.clear();
+
+				for (int i = 0; i < (int)length; i++)
+				{
+					if (!reader.read(property.type, value))
+					{
+						cout << "ERROR: " << fileName << " ends in the middle of its " << element.name << " data" << endl;
+						return false;
+					}
+
+					if (!isCorners)
+					{
+						continue;
+					}
+
+					if (!(value >= 0 && value < vertexLimit))
+					{
+						cout << "ERROR: " << fileName << ": face " << item << " corner " << value << " refers to a vertex that doesn't exist" << endl;
+						return false;
+					}
+
+					corners.push_back((uint32_t)value);
+				}
+
+				if (isCorners)
+				{
+					if (corners.size() < 3)
+					{
+						cout << "ERROR: " << fileName << ": face " << item << " has fewer than three corners" << endl;
+						return false;
+					}
+
+					addPolygon(mesh, corners);
+				}
+			}
+
+			if (isVertex)
+			{
+				mesh.vertices.push_back(vertex);
+			}
+		}
+	}
+
+	return true;
+}
+
+// --------------------------------------------------------------------------
+
+//Exact position of a vertex, for merging duplicates
+struct VertexKey
+{
+	uint32_t bits[3];
+
+	VertexKey(vec3 v)
+	{
+		//Adding zero turns -0 into 0, they are the same point
+		for (int i = 0; i < 3; i++)
+		{
+			float f = v[i] + 0.f;
+			memcpy(&bits[i], &f, sizeof(f));
+		}
+	}
+
+	bool operator==(const VertexKey &other) const
+	{
+		return bits[0] == other.bits[0] && bits[1] == other.bits[1] && bits[2] == other.bits[2];
+	}
+};
+
+struct VertexKeyHash
+{
+	size_t operator()(const VertexKey &key) const
+	{
+		return (key.bits[0] * 73856093u) ^ (key.bits[1] * 19349663u) ^ (key.bits[2] * 83492791u);
+	}
+};
+
+//Merges duplicate and drops unused vertices, renumbering the corners, and
+//drops triangles that have collapsed to a line or a point
+static void compact(MeshData &mesh)
+{
+	vector<uint32_t> remap(mesh.vertices.size(), UINT32_MAX);
+	vector<vec3> vertices;
+	unordered_map<VertexKey, uint32_t, VertexKeyHash> merged;
+
+	merged.reserve(mesh.vertices.size());
+
+	unsigned int kept = 0;
+
+	for (unsigned int t = 0; t < mesh.triangles.size(); t++)
+	{
+		MeshTriangle triangle = mesh.triangles[t];
+
+		for (int c = 0; c < 3; c++)
+		{
+			uint32_t &corner = triangle.corners[c];
+
+			if (remap[corner] == UINT32_MAX)
+			{
+				VertexKey key = VertexKey(mesh.vertices[corner]);
+				unordered_map<VertexKey, uint32_t, VertexKeyHash>::iterator found = merged.find(key);
+
+				if (found == merged.end())
+				{
+					found = merged.insert(make_pair(key, (uint32_t)vertices.size())).first;
+					vertices.push_back(mesh.vertices[corner]);
+				}
+
+				remap[corner] = found->second;
+			}
+
+			corner = remap[corner];
+		}
+
+		const uint32_t *c = triangle.corners;
+		if (c[0] != c[1] && c[1] != c[2] && c[2] != c[0])
+		{
+			mesh.triangles[kept++] = triangle;
+		}
+	}
+
+	mesh.triangles.resize(kept);
+	mesh.vertices.swap(vertices);
+}
+
+//Reads, checks and tidies the mesh in the file, then places it as
+//loadMeshFile describes
+static bool readMeshFile(const string &fileName, MeshData &mesh, vec3 centre, float size)
+{
+	ifstream in(fileName.c_str(), ios::binary);
+	if (!in)
+	{
+		cout << "ERROR: Failed to open " << fileName << endl;
+		return false;
+	}
+
+	string firstLine;
+	getline(in, firstLine);
+	in.clear();
+	in.seekg(0, ios::beg);
+
+	bool loaded;
+	if (firstLine == "ply" || firstLine == "ply\r")
+	{
+		loaded = readPly(in, fileName, mesh);
+	}
+	else
+	{
+		loaded = readObj(in, fileName, mesh);
+	}
+
+	if (!loaded)
+	{
+		return false;
+	}
+
+	for (unsigned int t = 0; t < mesh.triangles.size(); t++)
+	{//PLY corners are only checked once every vertex is known
+		for (int c = 0; c < 3; c++)
+		{
+			if (mesh.triangles[t].corners[c] >= mesh.vertices.size())
+			{
+				cout << "ERROR: " << fileName << ": face " << t << " refers to a vertex that doesn't exist" << endl;
+				return false;
+			}
+		}
+	}
+
+	compact(mesh);
+
+	if (mesh.triangles.empty())
+	{
+		cout << "ERROR: " << fileName << " has no triangles" << endl;
+		return false;
+	}
+
+	if (size > 0)
+	{
+		vec3 lower = mesh.vertices[0];
+		vec3 upper = mesh.vertices[0];
+
+		for (unsigned int i = 1; i < mesh.vertices.size(); i++)
+		{
+			lower = min(lower, mesh.vertices[i]);
+			upper = max(upper, mesh.vertices[i]);
+		}
+
+		vec3 extent = upper - lower;
+		float longest = std::max(extent.x, std::max(extent.y, extent.z));
+		float scale = (longest > 0) ? size / longest : 1.f;
+		vec3 boxCentre = 0.5f * (lower + upper);
+
+		for (unsigned int i = 0; i < mesh.vertices.size(); i++)
+		{
+			mesh.vertices[i] = (mesh.vertices[i] - boxCentre) * scale + centre;
+		}
+	}
+
+	return true;
+}
+
+//Adds the mesh's vertices and triangles to the end of the arrays given, and
+//the mesh covering them to meshes
+static bool appendMesh(const string &fileName, const MeshData &mesh, PrimitiveArray<vec3> &vertices,
+	PrimitiveArray<MeshTriangle> &triangles, PrimitiveArray<Mesh> &meshes, vec3 colour, int phongExponent, float reflectivity, int texture)
+{
+	if ((unsigned long long)vertices.size() + mesh.vertices.size() > UINT32_MAX
+		|| (unsigned long long)triangles.size() + mesh.triangles.size() > INT32_MAX)
+	{
+		cout << "ERROR: " << fileName << " doesn't fit in the scene, it has too many vertices or triangles" << endl;
+		return false;
+	}
+
+	uint32_t firstVertex = (uint32_t)vertices.size();
+	uint32_t firstTriangle = (uint32_t)triangles.size();
+
+	vertices.reserve(vertices.size() + mesh.vertices.size());
+	for (unsigned int i = 0; i < mesh.vertices.size(); i++)
+	{
+		vertices.push_back(mesh.vertices[i]);
+	}
+
+	triangles.reserve(triangles.size() + mesh.triangles.size());
+	for (unsigned int t = 0; t < mesh.triangles.size(); t++)
+	{
+		const uint32_t *c = mesh.triangles[t].corners;
+		triangles.push_back(MeshTriangle(c[0] + firstVertex, c[1] + firstVertex, c[2] + firstVertex));
+	}
+
+	meshes.push_back(Mesh(firstTriangle, (uint32_t)mesh.triangles.size(),
+		firstVertex, (uint32_t)mesh.vertices.size(), colour, phongExponent, reflectivity, texture));
+
+	return true;
+}
+
+bool loadMeshFile(const string &fileName, Scene &scene, vec3 colour, int phongExponent, float reflectivity,
+	vec3 centre, float size, int texture)
+{
+	MeshData mesh;
+
+	return readMeshFile(fileName, mesh, centre, size)
+		&& appendMesh(fileName, mesh, scene.meshVertices, scene.meshTriangles, scene.meshes,
+					colour, phongExponent, reflectivity, texture);
+}
+
+bool loadObjectFile(const string &fileName, Scene &scene, vec3 centre, float size)
+{
+	MeshData mesh;
+
+	return readMeshFile(fileName, mesh, centre, size)
+		&& appendMesh(fileName, mesh, scene.objectVertices, scene.objectTriangles, scene.objects,
+					vec3(1, 1, 1), 0, 0, -1);
+}
+
+// --------------------------------------------------------------------------
+
+static bool writeObj(const PrimitiveArray<vec3> &vertices, const PrimitiveArray<MeshTriangle> &triangles,
+	const Mesh &mesh, const string &fileName)
+{
+	ofstream out(fileName.c_str());
+	if (!out)
+	{
+		cout << "ERROR: Failed to open " << fileName << " for writing" << endl;
+		return false;
+	}
+
+	char line[128];
+
+	for (uint32_t i = 0; i < mesh.vertexCount; i++)
+	{//Enough digits that every float reads back exactly
+		vec3 v = vertices[mesh.firstVertex + i];
+		snprintf(line, sizeof(line), "v %.9g %.9g %.9g\n", v.x, v.y, v.z);
+		out << line;
+	}
+
+	for (uint32_t t = 0; t < mesh.triangleCount; t++)
+	{//OBJ counts vertices from 1
+		const uint32_t *c = triangles[mesh.firstTriangle + t].corners;
+		out << "f " << c[0] - mesh.firstVertex + 1 << " " << c[1] - mesh.firstVertex + 1 << " " << c[2] - mesh.firstVertex + 1 << "\n";
+	}
+
+	if (!out.flush())
+	{
+		cout << "ERROR: Failed writing " << fileName << endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool saveMeshObj(const Scene &scene, int mesh, const string &fileName)
+{
+	return writeObj(scene.meshVertices, scene.meshTriangles, scene.meshes[mesh], fileName);
+}
+
+bool saveObjectObj(const Scene &scene, int object, const string &fileName)
+{
+	return writeObj(scene.objectVertices, scene.objectTriangles, scene.objects[object], fileName);
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,41 @@
+// ==========================================================================
+// Mesh Files
+//
+// Triangle meshes from Wavefront OBJ and Stanford PLY files (ascii or binary,
+// either byte order), the formats most scanned models come in. Only vertex
+// positions and faces are read; polygons are split into fans of triangles.
+//
+// Every mesh is added to the scene as an indexed mesh with one material, or
+// as an object for instances to place.
+// Vertices at exactly the same position are merged, so files that repeat a
+// corner for every face it touches still end up sharing it, and vertices no
+// face uses are dropped.
+// ==========================================================================
+#ifndef MESHFILE_H
+#define MESHFILE_H
+
+#include <string>
+
+#include "Scene.h"
+
+// --------------------------------------------------------------------------
+
+//Appends the mesh in the file to the scene, telling OBJ and PLY apart by the
+//file's first line. With a size above zero the model is scaled so its longest
+//side is that long and moved so its box is centred on centre, which places
+//scanned models whatever units they were saved in; otherwise it is used as
+//is. The whole mesh uses the scene texture given, if any. Problems are
+//reported on cout.
+bool loadMeshFile(const std::string &fileName, Scene &scene, vec3 colour, int phongExponent, float reflectivity,
+	vec3 centre = vec3(0, 0, 0), float size = 0, int texture = -1);
+
+//Appends the mesh in the file to the scene's objects instead, placed the
+//same way, for instances of it to use
+bool loadObjectFile(const std::string &fileName, Scene &scene, vec3 centre = vec3(0, 0, 0), float size = 0);
+
+//Writes one of the scene's meshes, or objects, out as an OBJ
+bool saveMeshObj(const Scene &scene, int mesh, const std::string &fileName);
+bool saveObjectObj(const Scene &scene, int object, const std::string &fileName);
+
+// --------------------------------------------------------------------------
+#endif // MESHFILE_H
@@ -0,0 +1,563 @@
+// ==========================================================================
+// Packet Ray Tracer
+// ==========================================================================
+
+#include "PacketTracer.h"
+#include "Float4.h"
+#include "Profiler.h"
+
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+const int PACKET_GROUPS = PACKET_SIZE / 4;				//Float4s needed per component
+
+//The packet spread out one component per array, four rays to a Float4
+struct PacketLanes
+{
+	vec3 startPoint;
+
+	Float4 directionX[PACKET_GROUPS];
+	Float4 directionY[PACKET_GROUPS];
+	Float4 directionZ[PACKET_GROUPS];
+
+	Float4 inverseX[PACKET_GROUPS];
+	Float4 inverseY[PACKET_GROUPS];
+	Float4 inverseZ[PACKET_GROUPS];
+
+	//Closest hit so far; rays that are switched off sit below zero so
+	//nothing is ever closer
+	Float4 closest[PACKET_GROUPS];
+
+	int hitType[PACKET_SIZE];
+	int hitIndex[PACKET_SIZE];
+	int hitTriangle[PACKET_SIZE];		//Object triangle, for HIT_INSTANCE
+	int closerHits;		//Hits that were the closest yet for their ray, as RayCounts keeps them
+
+	//Average direction, used to order children near to far
+	vec3 mainDirection;
+};
+
+//Four planes through the start point that every ray of the packet lies
+//inside, normals pointing in
+struct PacketFrustum
+{
+	bool valid;
+	vec3 normals[4];
+};
+
+// --------------------------------------------------------------------------
+
+void setUpLanes(const RayPacket &packet, PacketLanes &lanes)
+{
+	float dx[PACKET_SIZE], dy[PACKET_SIZE], dz[PACKET_SIZE];
+	float ix[PACKET_SIZE], iy[PACKET_SIZE], iz[PACKET_SIZE];
+	float closest[PACKET_SIZE];
+
+	lanes.startPoint = packet.startPoint;
+	lanes.mainDirection = vec3(0, 0, 0);
+	lanes.closerHits = 0;
+
+	for (int i = 0; i < PACKET_SIZE; i++)
+	{
+		vec3 direction = packet.directions[i];
+		vec3 inverse = inverseRayDirection(direction);
+
+		dx[i] = direction.x;
+		dy[i] = direction.y;
+		dz[i] = direction.z;
+		ix[i] = inverse.x;
+		iy[i] = inverse.y;
+		iz[i] = inverse.z;
+		closest[i] = packet.active[i] ? numeric_limits<float>::max() : -1.f;
+
+		lanes.hitType[i] = HIT_NONE;
+		lanes.hitIndex[i] = -1;
+		lanes.hitTriangle[i] = -1;
+		lanes.mainDirection += direction;
+	}
+
+	for (int g = 0; g < PACKET_GROUPS; g++)
+	{
+		lanes.directionX[g] = Float4::load(dx + 4 * g);
+		lanes.directionY[g] = Float4::load(dy + 4 * g);
+		lanes.directionZ[g] = Float4::load(dz + 4 * g);
+		lanes.inverseX[g] = Float4::load(ix + 4 * g);
+		lanes.inverseY[g] = Float4::load(iy + 4 * g);
+		lanes.inverseZ[g] = Float4::load(iz + 4 * g);
+		lanes.closest[g] = Float4::load(closest + 4 * g);
+	}
+}
+
+//Builds the frustum from the corner rays; if any ray strays outside it
+//(a packet that isn't a regular grid) culling is simply turned off
+void setUpFrustum(const RayPacket &packet, const PacketLanes &lanes, PacketFrustum &frustum)
+{
+	const int corners[4] = { 0, PACKET_WIDTH - 1, PACKET_SIZE - 1, PACKET_SIZE - PACKET_WIDTH };
+
+	frustum.valid = true;
+
+	for (int i = 0; i < 4; i++)
+	{
+		vec3 a = packet.directions[corners[i]];
+		vec3 b = packet.directions[corners[(i + 1) % 4]];
+		vec3 normal = cross(a, b);
+
+		if (dot(normal, lanes.mainDirection) < 0)
+		{//Winding depends on which way the image is flipped
+			normal = -normal;
+		}
+
+		if (dot(normal, normal) < 1e-12f)
+		{//Corner rays too close together to span a plane
+			frustum.valid = false;
+			return;
+		}
+
+		frustum.normals[i] = normal;
+	}
+
+	for (int i = 0; i < PACKET_SIZE; i++)
+	{
+		for (int j = 0; j < 4; j++)
+		{
+			if (dot(frustum.normals[j], packet.directions[i]) < 0)
+			{
+				frustum.valid = false;
+				return;
+			}
+		}
+	}
+}
+
+//True if the box lies entirely outside one of the frustum planes
+bool frustumMissesBox(const PacketFrustum &frustum, const vec3 &startPoint, const AABB &box)
+{
+	if (!frustum.valid)
+	{
+		return false;
+	}
+
+	for (int i = 0; i < 4; i++)
+	{//Corner of the box furthest along the normal
+		const vec3 &normal = frustum.normals[i];
+		vec3 corner = vec3(normal.x >= 0 ? box.upper.x : box.lower.x,
+						normal.y >= 0 ? box.upper.y : box.lower.y,
+						normal.z >= 0 ? box.upper.z : box.lower.z);
+
+		if (dot(normal, corner - startPoint) < 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+//Slab test of every ray against the box, true if any ray still looking for
+//a closer hit reaches it
+bool packetHitsBox(const PacketLanes &lanes, const AABB &box)
+{
+	Float4 lowerX = Float4(box.lower.x - lanes.startPoint.x);
+	Float4 lowerY = Float4(box.lower.y - lanes.startPoint.y);
+	Float4 lowerZ = Float4(box.lower.z - lanes.startPoint.z);
+	Float4 upperX = Float4(box.upper.x - lanes.startPoint.x);
+	Float4 upperY = Float4(box.upper.y - lanes.startPoint.y);
+	Float4 upperZ = Float4(box.upper.z - lanes.startPoint.z);
+	Float4 zero = Float4(0.f);
+	Float4 exitScale = Float4(SLAB_EXIT_SCALE);
+
+	for (int g = 0; g < PACKET_GROUPS; g++)
+	{
+		Float4 t0x = lowerX * lanes.inverseX[g];
+		Float4 t1x = upperX * lanes.inverseX[g];
+		Float4 t0y = lowerY * lanes.inverseY[g];
+		Float4 t1y = upperY * lanes.inverseY[g];
+		Float4 t0z = lowerZ * lanes.inverseZ[g];
+		Float4 t1z = upperZ * lanes.inverseZ[g];
+
+		Float4 entry = max(max(min(t0x, t1x), min(t0y, t1y)), max(min(t0z, t1z), zero));
+		Float4 exit = min(min(max(t0x, t1x), max(t0y, t1y)), min(max(t0z, t1z), lanes.closest[g])) * exitScale;
+
+		if ( (entry <= exit).any() )
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+//Takes the rays in the mask as hitting this shape at distance t
+void recordHits(PacketLanes &lanes, int group, Mask4 hits, Float4 t, int type, int index)
+{
+	int bits = hits.bits();
+
+	if (bits == 0)
+	{
+		return;
+	}
+
+	lanes.closest[group] = select(hits, t, lanes.closest[group]);
+
+	for (int lane = 0; lane < 4; lane++)
+	{
+		if (bits & (1 << lane))
+		{
+			lanes.hitType[4 * group + lane] = type;
+			lanes.hitIndex[4 * group + lane] = index;
+			lanes.closerHits++;
+		}
+	}
+
+	#ifdef RAYTRACER_PROFILE
+	static const ProfileCounter hitCounters[] = { PROFILE_PLANE_HITS, PROFILE_PLANE_HITS, PROFILE_TRIANGLE_HITS,
+												PROFILE_MESH_TRIANGLE_HITS, PROFILE_SPHERE_HITS };
+	PROFILE_COUNT(hitCounters[type], (bits & 1) + ((bits >> 1) & 1) + ((bits >> 2) & 1) + ((bits >> 3) & 1));
+	#endif
+}
+
+// --------------------------------------------------------------------------
+// Shapes
+
+void planePacketIntersection(PacketLanes &lanes, const Plane &thisPlane, int index)
+{
+	vec3 planeNormal = thisPlane.normalVector;
+	Float4 scaleNumerator = Float4( dot(thisPlane.point - lanes.startPoint, planeNormal) );
+	Float4 normalX = Float4(planeNormal.x);
+	Float4 normalY = Float4(planeNormal.y);
+	Float4 normalZ = Float4(planeNormal.z);
+	Float4 zero = Float4(0.f);
+
+	PROFILE_COUNT(PROFILE_PLANE_TESTS, PACKET_SIZE);
+
+	for (int g = 0; g < PACKET_GROUPS; g++)
+	{
+		Float4 denominator = lanes.directionX[g] * normalX + lanes.directionY[g] * normalY + lanes.directionZ[g] * normalZ;
+		Float4 t = scaleNumerator / denominator;
+
+		recordHits(lanes, g, (t >= zero) & (t < lanes.closest[g]), t, HIT_PLANE, index);
+	}
+}
+
+//Moller-Trumbore against every ray; with one shared start point the s and q
+//vectors, and so the distance numerator, are the same for the whole packet
+void trianglePacketIntersection(PacketLanes &lanes, vec3 v0, vec3 e1, vec3 e2, int type, int index)
+{
+	PROFILE_COUNT(type == HIT_TRIANGLE ? PROFILE_TRIANGLE_TESTS : PROFILE_MESH_TRIANGLE_TESTS, PACKET_SIZE);
+
+	Float4 zero = Float4(0.f);
+	Float4 one = Float4(1.f);
+	Float4 epsilon = Float4(DETERMINANT_EPSILON);
+
+	vec3 s = lanes.startPoint - v0;
+	vec3 q = cross(s, e1);
+
+	Float4 e1x = Float4(e1.x), e1y = Float4(e1.y), e1z = Float4(e1.z);
+	Float4 e2x = Float4(e2.x), e2y = Float4(e2.y), e2z = Float4(e2.z);
+	Float4 sx = Float4(s.x), sy = Float4(s.y), sz = Float4(s.z);
+	Float4 qx = Float4(q.x), qy = Float4(q.y), qz = Float4(q.z);
+	Float4 distanceNumerator = Float4( dot(e2, q) );
+
+	for (int g = 0; g < PACKET_GROUPS; g++)
+	{
+		const Float4 &dx = lanes.directionX[g];
+		const Float4 &dy = lanes.directionY[g];
+		const Float4 &dz = lanes.directionZ[g];
+
+		Float4 px = dy * e2z - dz * e2y;
+		Float4 py = dz * e2x - dx * e2z;
+		Float4 pz = dx * e2y - dy * e2x;
+
+		Float4 det = e1x * px + e1y * py + e1z * pz;
+		Float4 inverseDet = one / det;
+
+		Float4 u = (sx * px + sy * py + sz * pz) * inverseDet;
+		Float4 v = (dx * qx + dy * qy + dz * qz) * inverseDet;
+		Float4 t = distanceNumerator * inverseDet;
+
+		Mask4 hits = (abs(det) > epsilon) & (u >= zero) & (v >= zero) & (u + v <= one)
+					& (t >= zero) & (t < lanes.closest[g]);
+
+		recordHits(lanes, g, hits, t, type, index);
+	}
+}
+
+//Triangles in packed slots [firstSlot, lastSlot) of the store
+void packedTrianglePacketIntersection(PacketLanes &lanes, const TriangleStore &store, int firstSlot, int lastSlot)
+{
+	TriangleStore::Arrays a = store.arrays();
+
+	for (int slot = firstSlot; slot < lastSlot; slot++)
+	{
+		vec3 v0 = vec3(a.v0[0][slot], a.v0[1][slot], a.v0[2][slot]);
+		vec3 e1 = vec3(a.e1[0][slot], a.e1[1][slot], a.e1[2][slot]);
+		vec3 e2 = vec3(a.e2[0][slot], a.e2[1][slot], a.e2[2][slot]);
+
+		trianglePacketIntersection(lanes, v0, e1, e2, HIT_TRIANGLE, store.triangleIndex(slot));
+	}
+}
+
+//Mesh triangles of BVH primitives [first, last), edges worked out from the
+//shared vertices exactly as the store would have packed them
+void meshTrianglePacketIntersection(PacketLanes &lanes, const Scene &scene, int first, int last)
+{
+	for (int i = first; i < last; i++)
+	{
+		int triangle = scene.bvh().primitive(i).index;
+		const uint32_t *corners = scene.meshTriangles[triangle].corners;
+
+		vec3 v0 = scene.meshVertices[corners[0]];
+		vec3 e1 = scene.meshVertices[corners[1]] - v0;
+		vec3 e2 = scene.meshVertices[corners[2]] - v0;
+
+		trianglePacketIntersection(lanes, v0, e1, e2, HIT_MESH_TRIANGLE, triangle);
+	}
+}
+
+void spherePacketIntersection(PacketLanes &lanes, const Sphere &thisSphere, int index)
+{
+	vec3 OC = thisSphere.centre - lanes.startPoint;	//Ray Origin to Centre
+	float radiusSquared = thisSphere.radius * thisSphere.radius;
+
+	PROFILE_COUNT(PROFILE_SPHERE_TESTS, PACKET_SIZE);
+
+	if (dot(OC, OC) < radiusSquared)
+	{//Every ray starts inside the sphere, the single-ray test ignores those
+		return;
+	}
+
+	Float4 ocX = Float4(OC.x), ocY = Float4(OC.y), ocZ = Float4(OC.z);
+	Float4 r2 = Float4(radiusSquared);
+	Float4 zero = Float4(0.f);
+
+	for (int g = 0; g < PACKET_GROUPS; g++)
+	{
+		const Float4 &dx = lanes.directionX[g];
+		const Float4 &dy = lanes.directionY[g];
+		const Float4 &dz = lanes.directionZ[g];
+
+		Float4 OCDotDirection = ocX * dx + ocY * dy + ocZ * dz;
+
+		//Closest approach to centre
+		Float4 ax = ocX - OCDotDirection * dx;
+		Float4 ay = ocY - OCDotDirection * dy;
+		Float4 az = ocZ - OCDotDirection * dz;
+		Float4 aSquared = ax * ax + ay * ay + az * az;
+
+		Mask4 hits = (OCDotDirection >= zero) & (aSquared <= r2);
+
+		if ( !hits.any() )
+		{
+			continue;
+		}
+
+		Float4 h = sqrt( max(r2 - aSquared, zero) );
+		Float4 t = OCDotDirection - h;
+
+		recordHits(lanes, g, hits & (t < lanes.closest[g]), t, HIT_SPHERE, index);
+	}
+}
+
+//Instances are followed one ray at a time: in the object's space the rays no
+//longer share their start point, which the packet tests rely on
+void instancePacketIntersection(PacketLanes &lanes, const Scene &scene, int instance)
+{
+	float closest[PACKET_SIZE];
+	float dx[PACKET_SIZE], dy[PACKET_SIZE], dz[PACKET_SIZE];
+
+	for (int g = 0; g < PACKET_GROUPS; g++)
+	{
+		lanes.closest[g].store(closest + 4 * g);
+		lanes.directionX[g].store(dx + 4 * g);
+		lanes.directionY[g].store(dy + 4 * g);
+		lanes.directionZ[g].store(dz + 4 * g);
+	}
+
+	bool found = false;
+
+	for (int i = 0; i < PACKET_SIZE; i++)
+	{
+		if (closest[i] < 0)
+		{//Switched off
+			continue;
+		}
+
+		float distance = closest[i];
+		int triangle = instanceHit(scene, instance, lanes.startPoint, vec3(dx[i], dy[i], dz[i]), false, distance);
+
+		if (triangle >= 0)
+		{
+			closest[i] = distance;
+			lanes.hitType[i] = HIT_INSTANCE;
+			lanes.hitIndex[i] = instance;
+			lanes.hitTriangle[i] = triangle;
+			lanes.closerHits++;
+			found = true;
+
+			PROFILE_COUNT(PROFILE_MESH_TRIANGLE_HITS, 1);
+		}
+	}
+
+	if (found)
+	{
+		for (int g = 0; g < PACKET_GROUPS; g++)
+		{
+			lanes.closest[g] = Float4::load(closest + 4 * g);
+		}
+	}
+}
+
+void leafPacketIntersection(PacketLanes &lanes, const Scene &scene, int first, int count)
+{
+	const TriangleStore &store = scene.triangleStore();
+
+	int firstSlot = store.firstSlot(first);
+	int lastSlot = store.firstSlot(first + count);
+
+	packedTrianglePacketIntersection(lanes, store, firstSlot, lastSlot);
+
+	int i = first + (lastSlot - firstSlot);
+	int last = first + count;
+
+	int meshEnd = i;
+	while (meshEnd < last && scene.bvh().primitive(meshEnd).type == BVHPrimitive::MESH_TRIANGLE)
+	{
+		meshEnd++;
+	}
+
+	meshTrianglePacketIntersection(lanes, scene, i, meshEnd);
+
+	for (i = meshEnd; i < last && scene.bvh().primitive(i).type == BVHPrimitive::SPHERE; i++)
+	{
+		int sphere = scene.bvh().primitive(i).index;
+		spherePacketIntersection(lanes, scene.spheres[sphere], sphere);
+	}
+
+	//The rest of the leaf is instances
+	for (; i < last; i++)
+	{
+		instancePacketIntersection(lanes, scene, scene.bvh().primitive(i).index);
+	}
+}
+
+// --------------------------------------------------------------------------
+
+void findPacketHits(PacketLanes &lanes, const PacketFrustum &frustum, const Scene &scene)
+{
+	PROFILE_PHASE(PHASE_TRAVERSAL);
+
+	for (unsigned int i = 0; i < scene.planes.size(); i++)
+	{
+		planePacketIntersection(lanes, scene.planes[i], i);
+	}
+
+	const BVH &bvh = scene.bvh();
+
+	if (bvh.empty())
+	{
+		return;
+	}
+
+	int stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		int current = stack[--stackSize];
+		const BVHNode &node = bvh.node(current);
+
+		if ( frustumMissesBox(frustum, lanes.startPoint, node.bounds) || !packetHitsBox(lanes, node.bounds) )
+		{
+			continue;
+		}
+
+		PROFILE_COUNT(PROFILE_BVH_NODES, 1);
+
+		if (node.isLeaf())
+		{
+			leafPacketIntersection(lanes, scene, node.offset, node.count);
+			continue;
+		}
+
+		int left = current + 1;
+		int right = node.offset;
+
+		float leftDistance = dot(bvh.node(left).bounds.centre() - lanes.startPoint, lanes.mainDirection);
+		float rightDistance = dot(bvh.node(right).bounds.centre() - lanes.startPoint, lanes.mainDirection);
+
+		if (leftDistance < rightDistance)
+		{//Nearer child goes on top so it is visited first
+			stack[stackSize++] = right;
+			stack[stackSize++] = left;
+		}
+		else
+		{
+			stack[stackSize++] = left;
+			stack[stackSize++] = right;
+		}
+	}
+}
+
+void tracePacket(const RayPacket &packet, const TraceContext &context, vec3 colours[PACKET_SIZE])
+{
+	const Scene &scene = context.scene;
+
+	PacketLanes lanes;
+	PacketFrustum frustum;
+
+	setUpLanes(packet, lanes);
+	setUpFrustum(packet, lanes, frustum);
+
+	findPacketHits(lanes, frustum, scene);
+
+	if (context.counts)
+	{
+		context.counts->closerHits += lanes.closerHits;
+	}
+
+	#ifdef RAYTRACER_PROFILE
+	for (int i = 0; i < PACKET_SIZE; i++)
+	{
+		if (packet.active[i])
+		{
+			PROFILE_COUNT(PROFILE_CLOSEST_SEARCHES, 1);
+			PROFILE_COUNT(PROFILE_CLOSEST_FOUND, lanes.hitType[i] != HIT_NONE);
+		}
+	}
+	#endif
+	
+	float distances[PACKET_SIZE];
+	for (int g = 0; g < PACKET_GROUPS; g++)
+	{
+		lanes.closest[g].store(distances + 4 * g);
+	}
+
+	for (int i = 0; i < PACKET_SIZE; i++)
+	{
+		colours[i] = vec3(0, 0, 0);
+
+		if (!packet.active[i] || lanes.hitType[i] == HIT_NONE)
+		{
+			continue;
+		}
+
+		//Shade exactly as the single-ray path would for the same hit
+		Ray thisRay = Ray(packet.startPoint, packet.directions[i], vec3(0, 0, 0));
+
+		thisRay.hasIntersected = true;
+		thisRay.closestDistance = distances[i];
+		thisRay.struckType = lanes.hitType[i];
+		thisRay.struckIndex = lanes.hitIndex[i];
+		thisRay.struckTriangle = lanes.hitTriangle[i];
+
+		shadeClosestHit(thisRay, context);
+		colours[i] = thisRay.colour + traceReflections(thisRay, context);
+	}
+}
+
+// --------------------------------------------------------------------------
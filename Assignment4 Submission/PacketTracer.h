@@ -0,0 +1,39 @@
+// ==========================================================================
+// Packet Ray Tracer
+//
+// Primary rays through a small square of neighbouring pixels start at the
+// same point and head in nearly the same direction, so they tend to visit
+// the same BVH nodes and hit the same shapes. Here they are traced together:
+// each node is first tested against the frustum around the whole packet, then
+// against every ray four at a time, and each shape is tested against all the
+// rays still looking for a closer hit.
+//
+// Only the search for the closest hit is done as a packet. Shadow and
+// reflected rays scatter, so each hit is shaded through the single-ray path.
+// ==========================================================================
+#ifndef PACKETTRACER_H
+#define PACKETTRACER_H
+
+#include "Shapes.h"
+#include "RayTracer.h"
+
+const int PACKET_WIDTH = 8;								//Rays across and down a packet
+const int PACKET_SIZE = PACKET_WIDTH * PACKET_WIDTH;
+
+// --------------------------------------------------------------------------
+
+//Rays of a packet in row order, all leaving from one start point. Rays that
+//are switched off (pixels past the edge of the image) are carried along but
+//never hit anything.
+struct RayPacket
+{
+	vec3 startPoint;
+	vec3 directions[PACKET_SIZE];
+	bool active[PACKET_SIZE];
+};
+
+//Leaves the shaded colour of every active ray in colours
+void tracePacket(const RayPacket &packet, const TraceContext &context, vec3 colours[PACKET_SIZE]);
+
+// --------------------------------------------------------------------------
+#endif // PACKETTRACER_H
@@ -0,0 +1,90 @@
+// ==========================================================================
+// Primitive Array
+//
+// The list of one kind of shape in a scene. Usually it owns its shapes like
+// a vector does, but it can also be pointed at shapes that already sit in
+// memory somewhere else, such as a binary scene file mapped straight into
+// the address space, so a large scene is rendered from the file's pages
+// without ever being copied. Adding or changing a shape in an array in that
+// state takes a private copy first, so the memory it points at is never
+// written.
+// ==========================================================================
+#ifndef PRIMITIVEARRAY_H
+#define PRIMITIVEARRAY_H
+
+#include <cstddef>
+#include <vector>
+
+// --------------------------------------------------------------------------
+
+template<class T>
+class PrimitiveArray
+{
+public:
+	PrimitiveArray() : external(0), externalCount(0) {}
+
+	//Use count shapes at p in place, the memory has to outlive the array
+	void attach(const T *p, size_t count)
+	{
+		owned.clear();
+		external = p;
+		externalCount = count;
+	}
+
+	void push_back(const T &primitive)
+	{
+		makeOwned();
+		owned.push_back(primitive);
+	}
+
+	void reserve(size_t count)
+	{
+		makeOwned();
+		owned.reserve(count);
+	}
+
+	void clear()
+	{
+		owned.clear();
+		external = 0;
+		externalCount = 0;
+	}
+
+	size_t size() const { return external ? externalCount : owned.size(); }
+	bool empty() const { return size() == 0; }
+
+	const T *data() const { return external ? external : (owned.empty() ? 0 : &owned[0]); }
+	const T &operator[](size_t i) const { return data()[i]; }
+
+	//For moving shapes in place, such as when animating
+	T *writableData()
+	{
+		makeOwned();
+		return owned.empty() ? 0 : &owned[0];
+	}
+
+	const T *begin() const { return data(); }
+	const T *end() const { return data() + size(); }
+
+	//True while the shapes are somebody else's memory
+	bool attached() const { return external != 0; }
+
+private:
+	std::vector<T> owned;
+
+	const T *external;
+	size_t externalCount;
+
+	void makeOwned()
+	{
+		if (external)
+		{
+			owned.assign(external, external + externalCount);
+			external = 0;
+			externalCount = 0;
+		}
+	}
+};
+
+// --------------------------------------------------------------------------
+#endif // PRIMITIVEARRAY_H
@@ -0,0 +1,202 @@
+// ==========================================================================
+// Render Profiler
+// ==========================================================================
+
+#include "Profiler.h"
+
+#ifdef RAYTRACER_PROFILE
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+// names in the JSON, in the order of the enums
+static const char *const s_counterNames[PROFILE_COUNTER_COUNT] =
+{
+    "primary_rays", "reflected_rays", "closest_searches", "closest_found",
+    "shadow_rays", "shadow_blocked", "shaded",
+    "plane_tests", "plane_hits", "triangle_tests", "triangle_hits",
+    "mesh_triangle_tests", "mesh_triangle_hits", "sphere_tests", "sphere_hits",
+    "bvh_nodes"
+};
+
+static const char *const s_phaseNames[PROFILE_PHASE_COUNT] =
+{
+    "traversal", "shading", "shadow_rays", "upload", "denoise"
+};
+
+namespace
+{
+    // every thread's block, and what threads that have exited left behind
+    struct Registry
+    {
+        mutex lock;
+        vector<Profiler::Totals *> live;
+        Profiler::Totals retired;
+    };
+
+    // never destroyed, as pool threads of global objects can still retire
+    // their blocks into it after main returns and statics are torn down
+    Registry &GetRegistry()
+    {
+        static Registry *registry = new Registry;
+        return *registry;
+    }
+
+    struct ThreadBlock
+    {
+        Profiler::Totals totals;
+
+        ThreadBlock()
+        {
+            Registry &registry = GetRegistry();
+            lock_guard<mutex> guard(registry.lock);
+            registry.live.push_back(&totals);
+        }
+
+        ~ThreadBlock()
+        {
+            Registry &registry = GetRegistry();
+            lock_guard<mutex> guard(registry.lock);
+            registry.retired.Add(totals);
+            registry.live.erase(find(registry.live.begin(), registry.live.end(), &totals));
+        }
+    };
+
+    thread_local ThreadBlock t_block;
+
+    // share of part in whole as a percentage, 0 when there is no whole
+    double Percent(long long part, long long whole)
+    {
+        return whole > 0 ? 100.0 * part / whole : 0.0;
+    }
+}
+
+// --------------------------------------------------------------------------
+
+Profiler::Totals::Totals()
+{
+    fill(counters, counters + PROFILE_COUNTER_COUNT, 0);
+    fill(seconds, seconds + PROFILE_PHASE_COUNT, 0.0);
+}
+
+void Profiler::Totals::Add(const Totals &other)
+{
+    for (int i = 0; i < PROFILE_COUNTER_COUNT; ++i)
+        counters[i] += other.counters[i];
+    for (int i = 0; i < PROFILE_PHASE_COUNT; ++i)
+        seconds[i] += other.seconds[i];
+}
+
+Profiler::Totals &Profiler::Local()
+{
+    return t_block.totals;
+}
+
+void Profiler::Reset()
+{
+    Registry &registry = GetRegistry();
+    lock_guard<mutex> guard(registry.lock);
+
+    for (size_t i = 0; i < registry.live.size(); ++i)
+        *registry.live[i] = Totals();
+    registry.retired = Totals();
+}
+
+Profiler::Totals Profiler::Collect()
+{
+    Registry &registry = GetRegistry();
+    lock_guard<mutex> guard(registry.lock);
+
+    Totals totals = registry.retired;
+    for (size_t i = 0; i < registry.live.size(); ++i)
+        totals.Add(*registry.live[i]);
+    return totals;
+}
+
+// --------------------------------------------------------------------------
+
+void Profiler::PrintSummary(ostream &out, const Totals &totals)
+{
+    const long long *c = totals.counters;
+    const double *s = totals.seconds;
+
+    long long closestRays = c[PROFILE_CLOSEST_SEARCHES];
+
+    out << "Profile (seconds summed over threads):" << endl;
+    out << "  Traversal: " << s[PHASE_TRAVERSAL] << " s" << endl;
+    out << "  Shading:   " << s[PHASE_SHADING] << " s, " << s[PHASE_SHADOW_RAYS] << " s of it shadow rays" << endl;
+    out << "  Upload:    " << s[PHASE_UPLOAD] << " s" << endl;
+    out << "  Denoise:   " << s[PHASE_DENOISE] << " s" << endl;
+    out << "  Rays:      " << c[PROFILE_PRIMARY_RAYS] << " primary, " << c[PROFILE_SHADOW_RAYS] << " shadow, "
+        << c[PROFILE_REFLECTED_RAYS] << " reflected" << endl;
+    out << "  Hit rates: " << Percent(c[PROFILE_CLOSEST_FOUND], closestRays) << "% of closest hit searches, "
+        << Percent(c[PROFILE_SHADOW_BLOCKED], c[PROFILE_SHADOW_RAYS]) << "% of shadow rays blocked, "
+        << c[PROFILE_SHADED] << " hits shaded" << endl;
+    out << "  Tests:     " << c[PROFILE_PLANE_TESTS] << " plane ("
+        << Percent(c[PROFILE_PLANE_HITS], c[PROFILE_PLANE_TESTS]) << "% hit), "
+        << c[PROFILE_TRIANGLE_TESTS] << " triangle ("
+        << Percent(c[PROFILE_TRIANGLE_HITS], c[PROFILE_TRIANGLE_TESTS]) << "% hit), "
+        << c[PROFILE_MESH_TRIANGLE_TESTS] << " mesh triangle ("
+        << Percent(c[PROFILE_MESH_TRIANGLE_HITS], c[PROFILE_MESH_TRIANGLE_TESTS]) << "% hit), "
+        << c[PROFILE_SPHERE_TESTS] << " sphere ("
+        << Percent(c[PROFILE_SPHERE_HITS], c[PROFILE_SPHERE_TESTS]) << "% hit)" << endl;
+    out << "  BVH nodes: " << c[PROFILE_BVH_NODES] << " visited, "
+        << (closestRays + c[PROFILE_SHADOW_RAYS] > 0
+            ? double(c[PROFILE_BVH_NODES]) / (closestRays + c[PROFILE_SHADOW_RAYS]) : 0.0)
+        << " per ray" << endl;
+}
+
+bool Profiler::WriteJson(const string &fileName, const string &label, const Totals &totals)
+{
+    ofstream out(fileName.c_str());
+    if (!out)
+    {
+        cout << "ERROR: Could not write profile to " << fileName << endl;
+        return false;
+    }
+
+    const long long *c = totals.counters;
+
+    // the label is a file name, only quotes and backslashes need escaping
+    string escaped;
+    for (size_t i = 0; i < label.size(); ++i)
+    {
+        if (label[i] == '"' || label[i] == '\\')
+            escaped += '\\';
+        escaped += label[i];
+    }
+
+    out << "{" << endl;
+    out << "  \"label\": \"" << escaped << "\"," << endl;
+
+    out << "  \"seconds\": {";
+    for (int i = 0; i < PROFILE_PHASE_COUNT; ++i)
+        out << (i ? ", " : " ") << "\"" << s_phaseNames[i] << "\": " << totals.seconds[i];
+    out << " }," << endl;
+
+    out << "  \"counters\": {";
+    for (int i = 0; i < PROFILE_COUNTER_COUNT; ++i)
+        out << (i ? ", " : " ") << "\"" << s_counterNames[i] << "\": " << c[i];
+    out << " }," << endl;
+
+    out << "  \"hit_rates\": { \"closest\": " << Percent(c[PROFILE_CLOSEST_FOUND], c[PROFILE_CLOSEST_SEARCHES]) / 100
+        << ", \"shadow_blocked\": " << Percent(c[PROFILE_SHADOW_BLOCKED], c[PROFILE_SHADOW_RAYS]) / 100
+        << ", \"plane\": " << Percent(c[PROFILE_PLANE_HITS], c[PROFILE_PLANE_TESTS]) / 100
+        << ", \"triangle\": " << Percent(c[PROFILE_TRIANGLE_HITS], c[PROFILE_TRIANGLE_TESTS]) / 100
+        << ", \"mesh_triangle\": " << Percent(c[PROFILE_MESH_TRIANGLE_HITS], c[PROFILE_MESH_TRIANGLE_TESTS]) / 100
+        << ", \"sphere\": " << Percent(c[PROFILE_SPHERE_HITS], c[PROFILE_SPHERE_TESTS]) / 100 << " }" << endl;
+    out << "}" << endl;
+
+    return bool(out);
+}
+
+#endif // RAYTRACER_PROFILE
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,122 @@
+// ==========================================================================
+// Render Profiler
+//
+// Counters and phase timers that show where a render's time goes: how many
+// rays of each kind were traced, how many intersection tests each kind of
+// primitive took and how many of them hit, how many BVH nodes were visited,
+// and how long was spent finding hits, shading them and uploading the image.
+//
+// It is only built with RAYTRACER_PROFILE defined (make PROFILE=1). Without
+// it the PROFILE_ macros expand to nothing, so the tracer carries no trace of
+// it. Each thread counts into its own block, so counting takes no locks; the
+// blocks are summed by Collect(), which must only run while nothing renders.
+// Phase times are added up over every thread, so with several threads they
+// can exceed the time the render took.
+// ==========================================================================
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#ifdef RAYTRACER_PROFILE
+
+#include <chrono>
+#include <ostream>
+#include <string>
+
+// --------------------------------------------------------------------------
+
+enum ProfileCounter
+{
+    PROFILE_PRIMARY_RAYS,
+    PROFILE_REFLECTED_RAYS,
+    PROFILE_CLOSEST_SEARCHES,       // primary and reflected rays looking for their closest hit
+    PROFILE_CLOSEST_FOUND,          // ... and finding one
+    PROFILE_SHADOW_RAYS,
+    PROFILE_SHADOW_BLOCKED,
+    PROFILE_SHADED,
+
+    // a hit is a test that gave a ray a new closest hit or blocked a shadow
+    // ray; a packed triangle run only reports its closest
+    PROFILE_PLANE_TESTS,
+    PROFILE_PLANE_HITS,
+    PROFILE_TRIANGLE_TESTS,
+    PROFILE_TRIANGLE_HITS,
+    PROFILE_MESH_TRIANGLE_TESTS,
+    PROFILE_MESH_TRIANGLE_HITS,
+    PROFILE_SPHERE_TESTS,
+    PROFILE_SPHERE_HITS,
+
+    // a batch or packet walk counts each node once for all its rays
+    PROFILE_BVH_NODES,
+
+    PROFILE_COUNTER_COUNT
+};
+
+enum ProfilePhase
+{
+    PHASE_TRAVERSAL,                // closest hit searches, single rays and packets
+    PHASE_SHADING,                  // shading hits, shadow rays included
+    PHASE_SHADOW_RAYS,              // the shadow ray part of shading
+    PHASE_UPLOAD,                   // copying the image into the window's texture
+    PHASE_DENOISE,                  // filtering the finished image
+
+    PROFILE_PHASE_COUNT
+};
+
+class Profiler
+{
+public:
+    struct Totals
+    {
+        long long counters[PROFILE_COUNTER_COUNT];
+        double seconds[PROFILE_PHASE_COUNT];
+
+        Totals();
+        void Add(const Totals &other);
+    };
+
+    // the calling thread's own block, registered on first use
+    static Totals &Local();
+
+    // zeroes every thread's block
+    static void Reset();
+
+    // sum of every thread's block, including threads that have since exited
+    static Totals Collect();
+
+    // a few lines for people, or a JSON object for scripts; label names the
+    // render, such as its scene file
+    static void PrintSummary(std::ostream &out, const Totals &totals);
+    static bool WriteJson(const std::string &fileName, const std::string &label, const Totals &totals);
+};
+
+// adds the time from construction to destruction to a phase
+class ProfilePhaseTimer
+{
+public:
+    explicit ProfilePhaseTimer(ProfilePhase phase)
+        : m_phase(phase), m_start(std::chrono::steady_clock::now())
+    {}
+
+    ~ProfilePhaseTimer()
+    {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_start;
+        Profiler::Local().seconds[m_phase] += elapsed.count();
+    }
+
+private:
+    ProfilePhase m_phase;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#define PROFILE_COUNT(counter, n) (Profiler::Local().counters[counter] += (n))
+#define PROFILE_PHASE(phase) ProfilePhaseTimer profilePhaseTimer(phase)
+
+#else
+
+#define PROFILE_COUNT(counter, n) ((void)0)
+#define PROFILE_PHASE(phase) ((void)0)
+
+#endif // RAYTRACER_PROFILE
+
+// --------------------------------------------------------------------------
+#endif // PROFILER_H
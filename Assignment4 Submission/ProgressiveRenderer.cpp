@@ -0,0 +1,189 @@
+// ==========================================================================
+// Progressive Renderer
+// ==========================================================================
+
+#include "ProgressiveRenderer.h"
+#include "ImageBuffer.h"
+
+#include <algorithm>
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+ProgressiveRenderer::ProgressiveRenderer(TileRenderer &renderer, int coarseStep)
+    : m_renderer(renderer), m_coarseStep(1),
+      m_hasJob(false), m_busy(false), m_quit(false),
+      m_generation(0), m_finishedStep(0), m_antialiasSamples(0)
+{
+    // blocks must never straddle two tiles, or two threads would share them
+    while (m_coarseStep * 2 <= coarseStep && renderer.TileSize() % (m_coarseStep * 2) == 0)
+        m_coarseStep *= 2;
+
+    m_thread = thread(&ProgressiveRenderer::Run, this);
+}
+
+ProgressiveRenderer::~ProgressiveRenderer()
+{
+    {
+        lock_guard<mutex> guard(m_mutex);
+        m_quit = true;
+        ++m_generation;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+// --------------------------------------------------------------------------
+
+void ProgressiveRenderer::Start(ImageBuffer &buffer, int width, int height, const SampleShader &shade,
+                                const AdaptiveSampler &antialias)
+{
+    Cancel();
+
+    lock_guard<mutex> guard(m_mutex);
+    m_job.buffer = &buffer;
+    m_job.width = width;
+    m_job.height = height;
+    m_job.shade = shade;
+    m_job.antialias = antialias;
+    m_hasJob = true;
+    m_finishedStep = 0;
+    m_antialiasSamples = 0;
+    m_wake.notify_one();
+}
+
+void ProgressiveRenderer::Cancel()
+{
+    unique_lock<mutex> lock(m_mutex);
+    m_hasJob = false;
+    ++m_generation;
+
+    // tiles check the generation as they go, so this is at most one tile
+    m_idle.wait(lock, [this] { return !m_busy; });
+}
+
+bool ProgressiveRenderer::Busy()
+{
+    lock_guard<mutex> guard(m_mutex);
+    return m_hasJob || m_busy;
+}
+
+// --------------------------------------------------------------------------
+
+void ProgressiveRenderer::Run()
+{
+    unique_lock<mutex> lock(m_mutex);
+
+    while (true)
+    {
+        m_wake.wait(lock, [this] { return m_quit || m_hasJob; });
+        if (m_quit)
+            return;
+
+        Job job = m_job;
+        unsigned int generation = m_generation;
+        m_hasJob = false;
+        m_busy = true;
+        lock.unlock();
+
+        m_samples.resize(job.width * job.height);
+        bool finished = true;
+        for (int step = m_coarseStep; step >= 1 && finished; step /= 2)
+        {
+            finished = RenderPass(job, step, generation);
+            if (finished)
+                m_finishedStep = step;
+        }
+
+        if (finished && job.antialias.MaxDepth() > 0)
+            AntialiasPass(job, generation);
+
+        // drop the shader, and with it whatever scene it holds on to
+        job.shade = SampleShader();
+
+        lock.lock();
+        m_busy = false;
+        m_idle.notify_all();
+    }
+}
+
+bool ProgressiveRenderer::RenderPass(const Job &job, int step, unsigned int generation)
+{
+    int tileSize = m_renderer.TileSize();
+    int tilesX = (job.width + tileSize - 1) / tileSize;
+    int tilesY = (job.height + tileSize - 1) / tileSize;
+    bool firstPass = (step == m_coarseStep);
+
+    m_renderer.Pool().ParallelFor(tilesX * tilesY, [&](int tile)
+    {
+        if (m_generation != generation)
+            return;
+
+        int x0 = (tile % tilesX) * tileSize;
+        int y0 = (tile / tilesX) * tileSize;
+        int w = std::min(tileSize, job.width - x0);
+        int h = std::min(tileSize, job.height - y0);
+
+        vector<vec3> pixels(w * h);
+
+        for (int by = y0; by < y0 + h; by += step)
+        {
+            if (m_generation != generation)
+                return;
+
+            for (int bx = x0; bx < x0 + w; bx += step)
+            {
+                // pixels on the coarser grid were shaded by an earlier pass
+                bool shaded = !firstPass && (bx % (2 * step)) == 0 && (by % (2 * step)) == 0;
+
+                vec3 &sample = m_samples[by * job.width + bx];
+                if (!shaded)
+                    sample = job.shade((float)bx, (float)by);
+
+                // fill the block this sample stands for until it is refined
+                int yEnd = std::min(by + step, y0 + h);
+                int xEnd = std::min(bx + step, x0 + w);
+                for (int y = by; y < yEnd; ++y)
+                    for (int x = bx; x < xEnd; ++x)
+                        pixels[(y - y0) * w + (x - x0)] = sample;
+            }
+        }
+
+        job.buffer->SetBlock(x0, y0, w, h, &pixels[0]);
+    });
+
+    return m_generation == generation;
+}
+
+bool ProgressiveRenderer::AntialiasPass(const Job &job, unsigned int generation)
+{
+    int tileSize = m_renderer.TileSize();
+    int tilesX = (job.width + tileSize - 1) / tileSize;
+    int tilesY = (job.height + tileSize - 1) / tileSize;
+
+    // every pixel now holds its own sample, which is what the refinement
+    // reads its corners from
+    m_renderer.Pool().ParallelFor(tilesX * tilesY, [&](int tile)
+    {
+        if (m_generation != generation)
+            return;
+
+        int x0 = (tile % tilesX) * tileSize;
+        int y0 = (tile / tilesX) * tileSize;
+        int w = std::min(tileSize, job.width - x0);
+        int h = std::min(tileSize, job.height - y0);
+
+        vector<vec3> pixels(w * h);
+        m_antialiasSamples += job.antialias.RefineBlock(&m_samples[0], job.width, job.height,
+                                                        x0, y0, w, h, job.shade, &pixels[0]);
+
+        if (m_generation == generation)
+            job.buffer->SetBlock(x0, y0, w, h, &pixels[0]);
+    });
+
+    return m_generation == generation;
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,98 @@
+// ==========================================================================
+// Progressive Renderer
+//
+// Renders an image in passes on a background thread so the window stays
+// responsive. The first pass shades one pixel in every coarse block and
+// fills the whole block with it; each pass after that halves the block size
+// and only shades the pixels the earlier passes skipped, so the last pass
+// leaves exactly the image a full render would, having shaded every pixel
+// once. An antialiasing pass can follow, refining the pixels on edges.
+// Starting a new image cancels the passes still in flight.
+// ==========================================================================
+#ifndef PROGRESSIVERENDERER_H
+#define PROGRESSIVERENDERER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <glm/vec3.hpp>
+
+#include "TileRenderer.h"
+#include "AdaptiveSampler.h"
+
+class ImageBuffer;
+
+// --------------------------------------------------------------------------
+
+class ProgressiveRenderer
+{
+public:
+    // colour at a point of the image, in pixels
+    typedef AdaptiveSampler::SampleShader SampleShader;
+
+    // passes run on the renderer's pool; the first shades one pixel per
+    // coarseStep x coarseStep block (rounded down to a power of two that
+    // divides the tile size)
+    explicit ProgressiveRenderer(TileRenderer &renderer, int coarseStep = 8);
+    ~ProgressiveRenderer();
+
+    // cancels any image in flight and starts refining a new one; returns
+    // straight away, the buffer fills in as the passes complete
+    void Start(ImageBuffer &buffer, int width, int height, const SampleShader &shade,
+               const AdaptiveSampler &antialias = AdaptiveSampler(0));
+
+    // stops the passes in flight and returns once nothing touches the buffer
+    void Cancel();
+
+    // true while an image is still being refined
+    bool Busy();
+
+    // block size of the last pass to finish, 1 once every pixel is shaded
+    int FinishedStep() const { return m_finishedStep; }
+
+    // samples taken by the antialiasing pass of the last image
+    long long AntialiasSamples() const { return m_antialiasSamples; }
+
+private:
+    struct Job
+    {
+        ImageBuffer *buffer;
+        int width, height;
+        SampleShader shade;
+        AdaptiveSampler antialias;
+    };
+
+    void Run();
+    bool RenderPass(const Job &job, int step, unsigned int generation);
+    bool AntialiasPass(const Job &job, unsigned int generation);
+
+    TileRenderer &m_renderer;
+    int m_coarseStep;
+
+    // colours of the pixels shaded so far, reused to fill blocks in later passes
+    std::vector<glm::vec3> m_samples;
+
+    // job hand-off to the background thread
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_idle;
+    Job m_job;
+    bool m_hasJob;
+    bool m_busy;
+    bool m_quit;
+
+    // bumped on every cancel; tiles of an older generation are dropped
+    std::atomic<unsigned int> m_generation;
+    std::atomic<int> m_finishedStep;
+    std::atomic<long long> m_antialiasSamples;
+
+    std::thread m_thread;
+
+    ProgressiveRenderer(const ProgressiveRenderer &);
+    ProgressiveRenderer &operator=(const ProgressiveRenderer &);
+};
+
+// --------------------------------------------------------------------------
+#endif // PROGRESSIVERENDERER_H
@@ -0,0 +1,920 @@
+// ==========================================================================
+// Ray Tracer
+// ==========================================================================
+
+#include "RayTracer.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+bool isIntersectionCloser(bool prevIntersection, float prevDistance, float distance)
+{
+	if ( !(prevIntersection) )
+	{
+		return true;
+	}
+	else if (prevDistance > distance)
+	{
+		return true;
+	}
+	
+	return false;
+}
+
+//Cheap random numbers for sampling, seeded from the point being shaded so it
+//gets the same samples every time, whichever thread shades it. Each use of a
+//point gives its own stream so they don't pick the same numbers.
+class SampleRandom
+{
+public:
+	SampleRandom(const vec3 &point, int stream)
+	{
+		uint32_t bits[3];
+		memcpy(bits, &point[0], sizeof(bits));
+		
+		state = 2166136261u ^ (uint32_t)stream;
+		for (int i = 0; i < 3; i++)
+		{
+			state = (state ^ bits[i]) * 16777619u;
+		}
+		next();
+	}
+	
+	//From 0 up to but not including 1
+	float next()
+	{
+		state = state * 747796405u + 2891336453u;
+		uint32_t word = ((state >> ((state >> 28) + 4)) ^ state) * 277803737u;
+		return (float)(((word >> 22) ^ word) >> 8) / 16777216.f;
+	}
+	
+private:
+	uint32_t state;
+};
+
+//Spreads an area light's share of the shadow rays over it so every one of
+//them has a row and a column of an n by n grid to itself. With a stream
+//the whole pattern is moved by the pixel sample's point instead of each ray
+//being jittered, so the pixel's samples between them cover the light evenly.
+template <class Flush>
+static void addAreaLightSamples(ShadowBatch &batch, const Light &light, int samples, vec3 colour, SampleRandom &random,
+	const PixelSample &sample, uint32_t dimension, Flush flush)
+{
+	int columns[MAX_AREA_LIGHT_SAMPLES];
+	
+	for (int i = 0; i < samples; i++)
+	{
+		columns[i] = i;
+	}
+	
+	for (int i = samples - 1; i > 0; i--)
+	{
+		std::swap(columns[i], columns[std::min((int)(random.next() * (i + 1)), i)]);
+	}
+	
+	vec2 shift = sample.valid() ? sampleSquare(sample, dimension) : vec2(0, 0);
+	
+	for (int i = 0; i < samples; i++)
+	{
+		float u = (i + (sample.valid() ? shift.x : random.next())) / samples;
+		float v = (columns[i] + (sample.valid() ? shift.y : random.next())) / samples;
+		
+		batch.add(light.pointAt(u, v), colour / (float)samples);
+		
+		if (batch.full())
+		{
+			flush();
+		}
+	}
+}
+
+vec3 traceRay(Ray &thisRay, const TraceContext &context)
+{
+	checkAllIntersections(thisRay, context);
+	
+	if (!thisRay.hasIntersected)
+	{
+		return thisRay.colour;
+	}
+	
+	return thisRay.colour + traceReflections(thisRay, context);
+}
+
+vec3 offsetFromSurface(vec3 point, vec3 normal, vec3 direction)
+{
+	float size = std::max( std::max(std::abs(point.x), std::abs(point.y)), std::abs(point.z) );
+	float offset = SURFACE_OFFSET * (1.f + size);
+	
+	return point + (dot(normal, direction) >= 0 ? offset : -offset) * normalize(normal);
+}
+
+vec3 generateColour(Ray &thisRay, const TraceContext &context)
+{
+	const Scene &scene = context.scene;
+	
+	PROFILE_PHASE(PHASE_SHADING);
+	PROFILE_COUNT(PROFILE_SHADED, 1);
+	
+	if (context.counts)
+	{
+		context.counts->shaded++;
+	}
+	
+	vec3 c_r = thisRay.struckMaterial.colour;
+	vec3 c_a = vec3(0.4, 0.4, 0.4);
+	vec3 eVec = -thisRay.directionVector;	//The given vector was going to intersection point, we want to flip
+	vec3 n_norm = normalize(thisRay.struckMaterial.normalVector);
+	
+	int p = thisRay.struckMaterial.phongExponent;
+	float reflectivity = thisRay.struckMaterial.reflectivity;
+	
+	//Summed over every shadow ray that reaches its light. The highlight is
+	//the reflection of the light itself, which reflected rays never see.
+	vec3 diffuse = vec3(0, 0, 0);
+	vec3 highlight = vec3(0, 0, 0);
+	
+	//Shadow rays leave from the side the surface is seen from
+	vec3 point = thisRay.struckMaterial.intersectionPoint;
+	ShadowBatch batch = ShadowBatch(offsetFromSurface(point, n_norm, eVec));
+	
+	auto flush = [&]()
+	{
+		if (context.counts)
+		{
+			context.counts->shadow += batch.count;
+		}
+		
+		PROFILE_COUNT(PROFILE_SHADOW_RAYS, batch.count);
+		
+		{
+			PROFILE_PHASE(PHASE_SHADOW_RAYS);
+			checkShadowRays(batch, context);
+		}
+		
+		for (int i = 0; i < batch.count; i++)
+		{
+			if (batch.blocked[i])
+			{
+				PROFILE_COUNT(PROFILE_SHADOW_BLOCKED, 1);
+				continue;
+			}
+			
+			vec3 l_norm = batch.direction(i);
+			vec3 c_l = batch.colour(i);
+			
+			float maxDotComponent = std::max( 0.f, dot(n_norm, l_norm) );
+			diffuse += c_l * maxDotComponent;
+			
+			if (reflectivity > 0)
+			{
+				vec3 h = normalize(eVec + l_norm);
+				highlight += c_l * (float)pow( std::max(0.f, dot(h, n_norm)), p );
+			}
+		}
+		
+		batch.count = 0;
+	};
+	
+	int lightCount = (int)scene.lights.size();
+	bool sampling = context.lightSamples > 0 && lightCount > context.lightSamples;
+	int picks = sampling ? context.lightSamples : lightCount;
+	
+	SampleRandom random = SampleRandom(point, 0);
+	
+	for (int pick = 0; pick < picks; pick++)
+	{
+		int index = pick;
+		float probability = 1;
+		
+		if (sampling)
+		{//Bright lights are picked more often and count for less each time
+			index = scene.pickLight(random.next(), probability);
+			
+			if (probability <= 0)
+			{
+				continue;
+			}
+		}
+		
+		const Light &light = scene.lights[index];
+		vec3 colour = sampling ? light.colour / (probability * picks) : light.colour;
+		
+		if (light.isArea())
+		{//The pixel's samples share the light's rays out between them
+			int samples = std::max(1, (light.samples + context.pixelSamples - 1) / context.pixelSamples);
+			
+			addAreaLightSamples(batch, light, samples, colour, random, context.sample, SAMPLE_LIGHT + pick, flush);
+		}
+		else
+		{
+			batch.add(light.position, colour);
+			
+			if (batch.full())
+			{
+				flush();
+			}
+		}
+	}
+	
+	if (batch.count > 0)
+	{
+		flush();
+	}
+	
+	vec3 colourComponent1 = c_r * (c_a + diffuse);
+	vec3 colour = colourComponent1 + reflectivity * highlight;
+	
+	return colour;
+}
+
+vec3 traceReflections(const Ray &thisRay, const TraceContext &context)
+{
+	vec3 colour = vec3(0, 0, 0);
+	float throughput = 1;	//Share of what the next surface sends back that reaches the start of the path
+	
+	Ray current = thisRay;
+	SampleRandom random = SampleRandom(thisRay.struckMaterial.intersectionPoint, 1);
+	
+	for (int bounce = 0; bounce < context.reflectionDepth; bounce++)
+	{
+		const MaterialProperties &surface = current.struckMaterial;
+		
+		throughput *= surface.reflectivity;
+		
+		if (throughput <= 0)
+		{
+			break;
+		}
+		
+		if (throughput < RUSSIAN_ROULETTE_THRESHOLD)
+		{
+			if (random.next() * RUSSIAN_ROULETTE_THRESHOLD >= throughput)
+			{
+				break;
+			}
+			
+			throughput = RUSSIAN_ROULETTE_THRESHOLD;
+		}
+		
+		vec3 n_norm = normalize(surface.normalVector);
+		vec3 direction = current.directionVector;
+		vec3 reflectedVector = normalize(direction - 2 * dot(direction, n_norm) * n_norm);
+		
+		if (context.glossy)
+		{//Directions that dip under the surface are mirrored back out of it
+			vec2 u = context.sample.valid() ? sampleSquare(context.sample, SAMPLE_GLOSSY + bounce) : vec2(random.next(), random.next());
+			vec3 glossyVector = phongLobeDirection(reflectedVector, (float)surface.phongExponent, u);
+			
+			if (dot(glossyVector, n_norm) * dot(reflectedVector, n_norm) < 0)
+			{
+				glossyVector -= 2 * dot(glossyVector, n_norm) * n_norm;
+			}
+			
+			reflectedVector = glossyVector;
+		}
+		
+		Ray reflectedRay = Ray(offsetFromSurface(surface.intersectionPoint, n_norm, reflectedVector), reflectedVector, vec3(0, 0, 0));
+		
+		if (context.counts)
+		{
+			context.counts->reflected++;
+		}
+		
+		PROFILE_COUNT(PROFILE_REFLECTED_RAYS, 1);
+		
+		checkAllIntersections(reflectedRay, context);
+		
+		if (!reflectedRay.hasIntersected)
+		{//Off into the empty background
+			break;
+		}
+		
+		colour += throughput * reflectedRay.colour;
+		current = reflectedRay;
+	}
+	
+	return colour;
+}
+
+MaterialProperties planeMaterial(const Plane &thisPlane, vec3 intersection)
+{
+	return MaterialProperties(thisPlane.normalVector,
+							intersection,
+							thisPlane.colour,
+							thisPlane.phongExponent,
+							thisPlane.reflectivity);
+}
+
+MaterialProperties triangleMaterial(const Triangle &thisTriangle, vec3 intersection)
+{
+	vec3 AB = thisTriangle.p2 - thisTriangle.p1;
+	vec3 CB = thisTriangle.p2 - thisTriangle.p3;
+	vec3 planeNormal = cross(AB, CB);
+	
+	return MaterialProperties(planeNormal,
+							intersection,
+							thisTriangle.colour,
+							thisTriangle.phongExponent,
+							thisTriangle.reflectivity);
+}
+
+MaterialProperties sphereMaterial(const Sphere &thisSphere, vec3 intersection)
+{
+	vec3 normal = (intersection - thisSphere.centre) / thisSphere.radius;
+	
+	return MaterialProperties(normal,
+							intersection,
+							thisSphere.colour,
+							thisSphere.phongExponent,
+							thisSphere.reflectivity);
+}
+
+MaterialProperties meshTriangleMaterial(const Scene &scene, int triangle, vec3 intersection)
+{
+	const uint32_t *corners = scene.meshTriangles[triangle].corners;
+	const Mesh &mesh = scene.meshOf(triangle);
+	
+	vec3 AB = scene.meshVertices[corners[1]] - scene.meshVertices[corners[0]];
+	vec3 CB = scene.meshVertices[corners[1]] - scene.meshVertices[corners[2]];
+	vec3 planeNormal = cross(AB, CB);
+	
+	return MaterialProperties(planeNormal,
+							intersection,
+							mesh.colour,
+							mesh.phongExponent,
+							mesh.reflectivity);
+}
+
+MaterialProperties instanceMaterial(const Scene &scene, int instance, int triangle, vec3 intersection)
+{
+	const Instance &thisInstance = scene.instances[instance];
+	const uint32_t *corners = scene.objectTriangles[triangle].corners;
+	
+	vec3 AB = scene.objectVertices[corners[1]] - scene.objectVertices[corners[0]];
+	vec3 CB = scene.objectVertices[corners[1]] - scene.objectVertices[corners[2]];
+	
+	//Through the inverse transpose, so the normal stays square to the
+	//surface however the instance is scaled
+	vec3 planeNormal = transpose(mat3(scene.instanceTransform(instance).toObject)) * cross(AB, CB);
+	
+	return MaterialProperties(planeNormal,
+							intersection,
+							thisInstance.colour,
+							thisInstance.phongExponent,
+							thisInstance.reflectivity);
+}
+
+//Moves a hit on a keyed shape back to where it is on the shape at rest.
+//Instances aren't keyed, so they never move.
+static void hitToRestPose(const Scene &scene, int type, int index, vec3 &point, vec3 &normal)
+{
+	if (type == HIT_PLANE)
+	{
+		scene.toRestPose(TRACK_PLANE, index, point, normal);
+	}
+	else if (type == HIT_TRIANGLE)
+	{
+		scene.toRestPose(TRACK_TRIANGLE, index, point, normal);
+	}
+	else if (type == HIT_SPHERE)
+	{
+		scene.toRestPose(TRACK_SPHERE, index, point, normal);
+	}
+	else if (type == HIT_MESH_TRIANGLE)
+	{
+		scene.toRestPose(TRACK_MESH, (int)(&scene.meshOf(index) - &scene.meshes[0]), point, normal);
+	}
+}
+
+MaterialProperties hitMaterial(const Scene &scene, int type, int index, int triangle, vec3 intersection, float footprint)
+{
+	MaterialProperties material;
+	int texture;
+	
+	if (type == HIT_PLANE)
+	{
+		material = planeMaterial(scene.planes[index], intersection);
+		texture = scene.planes[index].texture;
+	}
+	else if (type == HIT_TRIANGLE)
+	{
+		material = triangleMaterial(scene.triangles[index], intersection);
+		texture = scene.triangles[index].texture;
+	}
+	else if (type == HIT_MESH_TRIANGLE)
+	{
+		material = meshTriangleMaterial(scene, index, intersection);
+		texture = scene.meshOf(index).texture;
+	}
+	else if (type == HIT_INSTANCE)
+	{
+		material = instanceMaterial(scene, index, triangle, intersection);
+		texture = scene.instances[index].texture;
+	}
+	else
+	{
+		material = sphereMaterial(scene.spheres[index], intersection);
+		texture = scene.spheres[index].texture;
+	}
+	
+	if (texture >= 0)
+	{
+		const Texture &thisTexture = scene.textures[texture];
+		const MipImage *image = (thisTexture.kind == TEXTURE_IMAGE) ? scene.textureImages[thisTexture.image].get() : 0;
+		
+		//Looked up where the hit is on the shape at rest, so the texture
+		//moves along with a keyed shape rather than the shape through it
+		MaterialProperties rest = material;
+		hitToRestPose(scene, type, index, rest.intersectionPoint, rest.normalVector);
+		
+		float uvPerUnit = 0;
+		vec2 uv = image ? textureCoordinates(scene, thisTexture, type, index, rest, uvPerUnit) : vec2(0, 0);
+		
+		material.colour *= textureColour(thisTexture, image, rest.intersectionPoint, uv, uvPerUnit, footprint);
+	}
+	
+	return material;
+}
+
+static const float PI = 3.14159265f;
+
+vec2 textureCoordinates(const Scene &scene, const Texture &texture, int type, int index,
+	const MaterialProperties &material, float &uvPerUnit)
+{
+	if (type == HIT_SPHERE)
+	{//Once around the equator, and pole to pole
+		const Sphere &thisSphere = scene.spheres[index];
+		vec3 n = normalize(material.normalVector);
+		
+		uvPerUnit = 1.f / (2.f * PI * thisSphere.radius);
+		
+		return vec2(0.5f + atan2(n.z, n.x) / (2.f * PI),
+					0.5f + asin(clamp(n.y, -1.f, 1.f)) / PI);
+	}
+	
+	//Axes across the surface that only depend on which way it faces, so
+	//triangles in the same plane line up with each other and with planes
+	vec3 n = normalize(material.normalVector);
+	vec3 axis = (std::abs(n.y) < 0.9f) ? vec3(0, 1, 0) : vec3(0, 0, -1);
+	vec3 across = normalize(cross(axis, n));
+	vec3 up = cross(n, across);
+	
+	uvPerUnit = 1.f / texture.scale;
+	
+	return vec2(dot(material.intersectionPoint, across), dot(material.intersectionPoint, up)) * uvPerUnit;
+}
+
+void recordHit(Ray &thisRay, int type, int index, float distance, const TraceContext &context)
+{
+	thisRay.hasIntersected = true;
+	thisRay.closestDistance = distance;
+	thisRay.struckType = type;
+	thisRay.struckIndex = index;
+	thisRay.struckTriangle = -1;
+	
+	if (context.counts)
+	{
+		context.counts->closerHits++;
+	}
+}
+
+void triangleIntersection(Ray &thisRay, int firstSlot, int lastSlot, bool lightCheck, const TraceContext &context)
+{
+	const TriangleStore &store = context.scene.triangleStore();
+	
+	PROFILE_COUNT(PROFILE_TRIANGLE_TESTS, lastSlot - firstSlot);
+	
+	if (lightCheck)
+	{//Any triangle before the light will do
+		if ( store.anyHit(thisRay.startPoint, thisRay.directionVector, firstSlot, lastSlot, thisRay.closestDistance) )
+		{
+			thisRay.hasIntersected = true;
+			PROFILE_COUNT(PROFILE_TRIANGLE_HITS, 1);
+		}
+		
+		return;
+	}
+	
+	float maxDistance = thisRay.hasIntersected ? thisRay.closestDistance : numeric_limits<float>::max();
+	float distance;
+	
+	int slot = store.closestHit(thisRay.startPoint, thisRay.directionVector, firstSlot, lastSlot, maxDistance, distance);
+	
+	if (slot < 0)
+	{//Nothing in this run is closer than what we already have
+		return;
+	}
+	
+	recordHit(thisRay, HIT_TRIANGLE, store.triangleIndex(slot), distance, context);
+	PROFILE_COUNT(PROFILE_TRIANGLE_HITS, 1);
+}
+
+void planeIntersection(Ray &thisRay, const Plane &thisPlane, int index, bool lightCheck, const TraceContext &context)
+{
+	PROFILE_COUNT(PROFILE_PLANE_TESTS, 1);
+	
+	vec3 direction = thisRay.directionVector;
+	vec3 vecPlaneToRayOrigin = thisPlane.point - thisRay.startPoint;
+	vec3 planeNormal = thisPlane.normalVector;
+	
+	float scaleFactor = dot(vecPlaneToRayOrigin, planeNormal) / dot(direction, planeNormal);
+	
+	if (scaleFactor < 0)
+	{//If it intersects backwards, don't care and return ray as is
+		return;
+	}
+	
+	vec3 vectorToPlane = scaleFactor * thisRay.directionVector;
+	float distance = length(vectorToPlane);
+	
+	if (lightCheck)
+	{
+		if (thisRay.closestDistance < distance)
+		{//If we hit the light before impacting a surface
+			return;
+		}
+	}
+	
+	if ( isIntersectionCloser(thisRay.hasIntersected, thisRay.closestDistance, distance) )
+	{//If plane is intersecting closer than anything else
+		PROFILE_COUNT(PROFILE_PLANE_HITS, 1);
+		
+		if (lightCheck)
+		{
+			thisRay.hasIntersected = true;
+			return;
+		}
+		
+		recordHit(thisRay, HIT_PLANE, index, distance, context);
+	}
+	
+	return;
+
+}
+
+void sphereIntersection(Ray &thisRay, const Sphere &thisSphere, int index, bool lightCheck, const TraceContext &context)
+{
+	PROFILE_COUNT(PROFILE_SPHERE_TESTS, 1);
+	
+	vec3 OC = thisSphere.centre - thisRay.startPoint;	//Ray Origin to Centre
+	
+	float radiusSquared = thisSphere.radius * thisSphere.radius;
+	
+	float OCDotDirection = dot(OC, thisRay.directionVector);
+	
+	if (OCDotDirection < 0)
+	{//Dot is negative when angle > 90 between viewing direction and sphere centre
+		//i.e. sphere is behind us
+		return;
+	}
+	
+	if (dot(OC, OC) < radiusSquared)
+	{//We are inside the sphere
+		return;
+	}
+	
+	vec3 a = OC - OCDotDirection * thisRay.directionVector;	//Closest approach to centre
+	
+	float aSquared = dot(a, a);
+	
+	if (aSquared > radiusSquared)
+	{//Misses the sphere
+		return;
+	}
+	
+	float h = sqrt(radiusSquared - aSquared);
+	
+	vec3 interOne = -a - h * thisRay.directionVector;	//Centre to near intersection
+	
+	vec3 intersection = thisSphere.centre + interOne;
+	
+	vec3 intersectionPoint = intersection - origin;
+	
+	
+	float distance = length(intersectionPoint - thisRay.startPoint);
+	
+	if (lightCheck)
+	{
+		if (thisRay.closestDistance < distance)
+		{//If we hit the light before impacting a surface
+			return;
+		}
+	}
+	
+	if ( isIntersectionCloser(thisRay.hasIntersected, thisRay.closestDistance, distance) )
+	{//If plane is intersecting closer than anything else
+		PROFILE_COUNT(PROFILE_SPHERE_HITS, 1);
+		
+		if (lightCheck)
+		{
+			thisRay.hasIntersected = true;
+			return;
+		}
+		
+		recordHit(thisRay, HIT_SPHERE, index, distance, context);
+	}
+	
+	return;
+}
+
+//Moller-Trumbore over the mesh triangles of BVH primitives [first, last),
+//the same test as the packed triangles, so a mesh renders exactly like the
+//same triangles given one by one. Returns the closest triangle nearer than
+//maxDistance and leaves its distance there, or -1; with anyHit the first
+//one found will do.
+static int closestMeshTriangle(const BVH &bvh, const PrimitiveArray<vec3> &vertices, const PrimitiveArray<MeshTriangle> &triangles,
+	vec3 start, vec3 direction, int first, int last, bool anyHit, float &maxDistance)
+{
+	int closestTriangle = -1;
+	
+	for (int i = first; i < last; i++)
+	{
+		int triangle = bvh.primitive(i).index;
+		const uint32_t *corners = triangles[triangle].corners;
+		
+		PROFILE_COUNT(PROFILE_MESH_TRIANGLE_TESTS, 1);
+		
+		vec3 v0 = vertices[corners[0]];
+		vec3 e1 = vertices[corners[1]] - v0;
+		vec3 e2 = vertices[corners[2]] - v0;
+		
+		vec3 p = cross(direction, e2);
+		float det = dot(e1, p);
+		if (std::abs(det) <= DETERMINANT_EPSILON)
+		{
+			continue;
+		}
+		float inverseDet = 1.f / det;
+		
+		vec3 s = start - v0;
+		float u = dot(s, p) * inverseDet;
+		vec3 q = cross(s, e1);
+		float v = dot(direction, q) * inverseDet;
+		float t = dot(e2, q) * inverseDet;
+		
+		if (u < 0.f || v < 0.f || u + v > 1.f || t < 0.f)
+		{
+			continue;
+		}
+		
+		if (anyHit)
+		{//Any triangle before the light will do
+			if (t <= maxDistance)
+			{
+				return triangle;
+			}
+		}
+		else if (t < maxDistance)
+		{
+			maxDistance = t;
+			closestTriangle = triangle;
+		}
+	}
+	
+	return closestTriangle;
+}
+
+void meshTriangleIntersection(Ray &thisRay, int first, int last, bool lightCheck, const TraceContext &context)
+{
+	const Scene &scene = context.scene;
+	
+	float distance = numeric_limits<float>::max();
+	
+	if (lightCheck || thisRay.hasIntersected)
+	{
+		distance = thisRay.closestDistance;
+	}
+	
+	int triangle = closestMeshTriangle(scene.bvh(), scene.meshVertices, scene.meshTriangles,
+		thisRay.startPoint, thisRay.directionVector, first, last, lightCheck, distance);
+	
+	if (triangle < 0)
+	{
+		return;
+	}
+	
+	PROFILE_COUNT(PROFILE_MESH_TRIANGLE_HITS, 1);
+	
+	if (lightCheck)
+	{
+		thisRay.hasIntersected = true;
+		return;
+	}
+	
+	recordHit(thisRay, HIT_MESH_TRIANGLE, triangle, distance, context);
+}
+
+int instanceHit(const Scene &scene, int instance, vec3 start, vec3 direction, bool anyHit, float &distance)
+{
+	const InstanceTransform &transform = scene.instanceTransform(instance);
+	const BVH &object = scene.objectBVH(scene.instances[instance].object);
+	
+	//The direction isn't normalised again, so a distance along the ray is
+	//the same in the object's space as in the scene's
+	Ray objectRay = Ray(vec3(transform.toObject * vec4(start, 1.f)), mat3(transform.toObject) * direction, vec3(0, 0, 0));
+	objectRay.closestDistance = distance;
+	
+	int closestTriangle = -1;
+	
+	if (anyHit)
+	{
+		object.anyHit(objectRay, distance, [&](int first, int count)
+		{
+			float maxDistance = distance;
+			closestTriangle = closestMeshTriangle(object, scene.objectVertices, scene.objectTriangles,
+				objectRay.startPoint, objectRay.directionVector, first, first + count, true, maxDistance);
+			
+			return closestTriangle >= 0;
+		});
+		
+		return closestTriangle;
+	}
+	
+	//As if something had already been hit at distance, so the walk never
+	//looks past it
+	objectRay.hasIntersected = true;
+	
+	object.closestHit(objectRay, [&](int first, int count)
+	{
+		int triangle = closestMeshTriangle(object, scene.objectVertices, scene.objectTriangles,
+			objectRay.startPoint, objectRay.directionVector, first, first + count, false, objectRay.closestDistance);
+		
+		if (triangle >= 0)
+		{
+			closestTriangle = triangle;
+		}
+	});
+	
+	distance = objectRay.closestDistance;
+	
+	return closestTriangle;
+}
+
+void instanceIntersection(Ray &thisRay, int instance, bool lightCheck, const TraceContext &context)
+{
+	float distance = numeric_limits<float>::max();
+	
+	if (lightCheck || thisRay.hasIntersected)
+	{
+		distance = thisRay.closestDistance;
+	}
+	
+	int triangle = instanceHit(context.scene, instance, thisRay.startPoint, thisRay.directionVector, lightCheck, distance);
+	
+	if (triangle < 0)
+	{
+		return;
+	}
+	
+	PROFILE_COUNT(PROFILE_MESH_TRIANGLE_HITS, 1);
+	
+	if (lightCheck)
+	{
+		thisRay.hasIntersected = true;
+		return;
+	}
+	
+	recordHit(thisRay, HIT_INSTANCE, instance, distance, context);
+	thisRay.struckTriangle = triangle;
+}
+
+//Tests every primitive in a BVH leaf: loose triangles as one packed run,
+//then mesh triangles, then spheres, then instances
+void leafIntersection(Ray &thisRay, int first, int count, bool lightCheck, const TraceContext &context)
+{
+	const Scene &scene = context.scene;
+	const BVH &bvh = scene.bvh();
+	const TriangleStore &store = scene.triangleStore();
+	
+	int firstSlot = store.firstSlot(first);
+	int lastSlot = store.firstSlot(first + count);
+	
+	triangleIntersection(thisRay, firstSlot, lastSlot, lightCheck, context);
+	
+	int i = first + (lastSlot - firstSlot);
+	int last = first + count;
+	
+	int meshEnd = i;
+	while (meshEnd < last && bvh.primitive(meshEnd).type == BVHPrimitive::MESH_TRIANGLE)
+	{
+		meshEnd++;
+	}
+	
+	if (i < meshEnd && !(lightCheck && thisRay.hasIntersected))
+	{
+		meshTriangleIntersection(thisRay, i, meshEnd, lightCheck, context);
+	}
+	
+	for (i = meshEnd; i < last && bvh.primitive(i).type == BVHPrimitive::SPHERE; i++)
+	{
+		if (lightCheck && thisRay.hasIntersected)
+		{
+			return;
+		}
+		
+		int sphere = bvh.primitive(i).index;
+		sphereIntersection(thisRay, scene.spheres[sphere], sphere, lightCheck, context);
+	}
+	
+	//The rest of the leaf is instances
+	for (; i < last; i++)
+	{
+		if (lightCheck && thisRay.hasIntersected)
+		{
+			return;
+		}
+		
+		instanceIntersection(thisRay, bvh.primitive(i).index, lightCheck, context);
+	}
+}
+
+void checkShadowRays(ShadowBatch &batch, const TraceContext &context)
+{
+	const Scene &scene = context.scene;
+	
+	for (int i = 0; i < batch.count; i++)
+	{
+		Ray shadowRay = Ray(batch.startPoint, batch.direction(i), vec3(0, 0, 0));
+		shadowRay.closestDistance = batch.distances[i];
+		
+		for (unsigned int j = 0; j < scene.planes.size(); j++)
+		{
+			planeIntersection(shadowRay, scene.planes[j], j, true, context);
+			
+			if (shadowRay.hasIntersected)
+			{//If we're checking to see if the light is interrupted, we don't care past that it is
+				batch.blocked[i] = true;
+				break;
+			}
+		}
+	}
+	
+	//Nothing past a ray's light can block it
+	scene.bvh().anyHitBatch(batch.startPoint, batch.directionX, batch.directionY, batch.directionZ,
+		batch.distances, batch.count, batch.blocked, [&](int first, int count, int ray)
+		{
+			Ray shadowRay = Ray(batch.startPoint, batch.direction(ray), vec3(0, 0, 0));
+			shadowRay.closestDistance = batch.distances[ray];
+			
+			leafIntersection(shadowRay, first, count, true, context);
+			
+			return shadowRay.hasIntersected;
+		});
+}
+
+void findClosestHit(Ray &thisRay, const TraceContext &context)
+{
+	const Scene &scene = context.scene;
+	
+	PROFILE_PHASE(PHASE_TRAVERSAL);
+	PROFILE_COUNT(PROFILE_CLOSEST_SEARCHES, 1);
+	
+	for (unsigned int i = 0; i < scene.planes.size(); i++)
+	{
+		planeIntersection(thisRay, scene.planes[i], i, false, context);
+	
+	}
+	
+	//Triangles and spheres are only tested when the ray reaches their box
+	scene.bvh().closestHit(thisRay, [&](int first, int count)
+	{
+		leafIntersection(thisRay, first, count, false, context);
+	});
+	
+	if (thisRay.hasIntersected)
+	{
+		PROFILE_COUNT(PROFILE_CLOSEST_FOUND, 1);
+	}
+	
+	return;
+}
+
+void shadeClosestHit(Ray &thisRay, const TraceContext &context)
+{
+	vec3 intersection = (thisRay.startPoint + thisRay.closestDistance * thisRay.directionVector) - origin;
+	
+	float footprint = thisRay.closestDistance * context.pixelSpread;
+	
+	thisRay.struckMaterial = hitMaterial(context.scene, thisRay.struckType, thisRay.struckIndex, thisRay.struckTriangle,
+										intersection, footprint);
+	thisRay.colour = generateColour(thisRay, context);
+}
+
+void checkAllIntersections(Ray &thisRay, const TraceContext &context)
+{
+	findClosestHit(thisRay, context);
+	
+	if (thisRay.hasIntersected)
+	{//Only the hit that is left gets shaded
+		shadeClosestHit(thisRay, context);
+	}
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,199 @@
+// ==========================================================================
+// Ray Tracer
+//
+// Intersection and shading of rays against a Scene. Nothing here touches
+// global state: the scene is read-only and everything that changes while a
+// ray is traced lives in the ray itself or in its TraceContext, so rays can
+// be traced from any number of threads at once.
+//
+// Tracing a ray is two steps. The intersection tests only record which shape
+// is the closest so far and how far away it is; once every candidate has been
+// tested the one hit that is left is shaded. Shading costs shadow rays, so
+// shading every closer hit as it turned up would pay for each shape in front
+// of the last one found.
+// ==========================================================================
+#ifndef RAYTRACER_H
+#define RAYTRACER_H
+
+#include "Shapes.h"
+#include "Scene.h"
+#include "Sampling.h"
+
+const vec3 origin = vec3(0, 0, 0);
+
+//Up to this many lights every light is shaded from at each hit; past it that
+//many are picked at random each time, so the cost stays the same however many
+//lights the scene has
+const int DEFAULT_LIGHT_SAMPLES = 8;
+
+//Rays leaving a surface start this far off it, relative to the size of the
+//coordinates, so rounding can't put them back behind the surface they leave
+const float SURFACE_OFFSET = 1e-4f;
+
+//A reflection path carrying less than this survives only with the chance of
+//carrying it on, and those that survive count for that much more, so deep
+//bounces cost about what they add to the image
+const float RUSSIAN_ROULETTE_THRESHOLD = 0.1f;
+
+// --------------------------------------------------------------------------
+
+//Rays traced, kept per tile by the caller and added up once the tile is done
+struct RayCounts
+{
+	long long primary;
+	long long shadow;
+	long long reflected;
+	
+	//Hits that were the closest yet when found, and the hits actually shaded.
+	//The difference is the shading that waiting for the closest hit saved.
+	long long closerHits;
+	long long shaded;
+	
+	RayCounts() : primary(0), shadow(0), reflected(0), closerHits(0), shaded(0) {}
+	
+	long long total() const { return primary + shadow + reflected; }
+	
+	void add(const RayCounts &other)
+	{
+		primary += other.primary;
+		shadow += other.shadow;
+		reflected += other.reflected;
+		closerHits += other.closerHits;
+		shaded += other.shaded;
+	}
+};
+
+//Everything a ray needs besides itself, shared by all the rays of a render
+struct TraceContext
+{
+	const Scene &scene;
+	int reflectionDepth;	//Most mirror bounces a path may take
+	RayCounts *counts;		//Optional, 0 if nobody is counting
+	int lightSamples;		//Lights shaded from per hit when there are more, 0 for all of them
+	float pixelSpread;		//Width a pixel covers one unit from the camera, sizes texture lookups
+	
+	bool glossy;			//Reflections spread about the mirror direction by each surface's Phong exponent
+	int pixelSamples;		//Samples averaged into each pixel, which share out the area lights' shadow rays
+	PixelSample sample;		//Which of them the ray belongs to, for its well spread numbers
+	
+	TraceContext(const Scene &s, int depth, RayCounts *c = 0, int lights = DEFAULT_LIGHT_SAMPLES, float spread = 0)
+		: scene(s), reflectionDepth(depth), counts(c), lightSamples(lights), pixelSpread(spread),
+		glossy(false), pixelSamples(1), sample(0, 0) {}
+};
+
+//Shadow rays from one shaded point towards points on the lights, tested
+//against the scene together. One component per array: arrays of vec3 would
+//all be zeroed every time a point is shaded.
+struct ShadowBatch
+{
+	vec3 startPoint;
+	int count;
+	
+	float lightX[BVH_BATCH_SIZE], lightY[BVH_BATCH_SIZE], lightZ[BVH_BATCH_SIZE];
+	float directionX[BVH_BATCH_SIZE], directionY[BVH_BATCH_SIZE], directionZ[BVH_BATCH_SIZE];
+	float distances[BVH_BATCH_SIZE];
+	float colourR[BVH_BATCH_SIZE], colourG[BVH_BATCH_SIZE], colourB[BVH_BATCH_SIZE];
+	bool blocked[BVH_BATCH_SIZE];
+	
+	ShadowBatch(vec3 start) : startPoint(start), count(0) {}
+	
+	bool full() const { return count == BVH_BATCH_SIZE; }
+	
+	void add(vec3 lightPoint, vec3 colour)
+	{
+		vec3 toLight = lightPoint - startPoint;
+		vec3 direction = normalize(toLight);
+		
+		lightX[count] = lightPoint.x;
+		lightY[count] = lightPoint.y;
+		lightZ[count] = lightPoint.z;
+		directionX[count] = direction.x;
+		directionY[count] = direction.y;
+		directionZ[count] = direction.z;
+		distances[count] = length(toLight);
+		colourR[count] = colour.r;
+		colourG[count] = colour.g;
+		colourB[count] = colour.b;
+		blocked[count] = false;
+		count++;
+	}
+	
+	//Point on the light the ray heads for, and the light it brings if it gets there
+	vec3 lightPoint(int i) const { return vec3(lightX[i], lightY[i], lightZ[i]); }
+	vec3 direction(int i) const { return vec3(directionX[i], directionY[i], directionZ[i]); }
+	vec3 colour(int i) const { return vec3(colourR[i], colourG[i], colourB[i]); }
+};
+
+// --------------------------------------------------------------------------
+
+//Colour seen along a ray: its closest hit, and what that reflects
+vec3 traceRay(Ray &thisRay, const TraceContext &context);
+
+//Light from the surface the ray hit itself, lit by the scene's lights
+vec3 generateColour(Ray &thisRay, const TraceContext &context);
+
+//Follows the mirror reflections from the surface the ray hit, one bounce
+//after another, and returns the light they add to its colour. Glossy
+//reflections leave in a direction drawn about the mirror one instead.
+vec3 traceReflections(const Ray &thisRay, const TraceContext &context);
+
+//Where a ray leaving the surface at point in this direction should start
+vec3 offsetFromSurface(vec3 point, vec3 normal, vec3 direction);
+
+//Surface properties where a ray meets each kind of shape
+MaterialProperties planeMaterial(const Plane &thisPlane, vec3 intersection);
+MaterialProperties triangleMaterial(const Triangle &thisTriangle, vec3 intersection);
+MaterialProperties sphereMaterial(const Sphere &thisSphere, vec3 intersection);
+MaterialProperties meshTriangleMaterial(const Scene &scene, int triangle, vec3 intersection);
+MaterialProperties instanceMaterial(const Scene &scene, int instance, int triangle, vec3 intersection);
+
+//Surface properties of the shape a hit records, by its HitType and index,
+//and for an instance the object triangle hit, with its texture applied;
+//footprint is the width of surface the pixel covers
+MaterialProperties hitMaterial(const Scene &scene, int type, int index, int triangle, vec3 intersection, float footprint = 0);
+
+//Where a point on the shape falls in an image texture, and how fast that
+//changes per unit across the surface: flat across planes and triangles,
+//latitude and longitude around spheres. The material gives the point and
+//normal, which hitMaterial has taken back to the shape's rest pose.
+vec2 textureCoordinates(const Scene &scene, const Texture &texture, int type, int index,
+	const MaterialProperties &material, float &uvPerUnit);
+
+//Takes the shape as the ray's closest hit so far, at distance along it
+void recordHit(Ray &thisRay, int type, int index, float distance, const TraceContext &context);
+
+//With lightCheck set the ray is a shadow ray, looking for anything at all
+//closer than its closestDistance, the distance to its light
+
+//Tests the packed triangles in slots [firstSlot, lastSlot) of the scene's store
+void triangleIntersection(Ray &thisRay, int firstSlot, int lastSlot, bool lightCheck, const TraceContext &context);
+//Planes and spheres are given their index in the scene for the hit to record
+void planeIntersection(Ray &thisRay, const Plane &thisPlane, int index, bool lightCheck, const TraceContext &context);
+void sphereIntersection(Ray &thisRay, const Sphere &thisSphere, int index, bool lightCheck, const TraceContext &context);
+
+//Tests the mesh triangles of BVH primitives [first, last), read straight from
+//the shared vertices
+void meshTriangleIntersection(Ray &thisRay, int first, int last, bool lightCheck, const TraceContext &context);
+
+//Follows a ray into an instance's object, down the object's own BVH. Returns
+//the object triangle hit closest, nearer than distance, and leaves how far
+//along the ray it is there, or -1; with anyHit the first one found will do.
+int instanceHit(const Scene &scene, int instance, vec3 start, vec3 direction, bool anyHit, float &distance);
+void instanceIntersection(Ray &thisRay, int instance, bool lightCheck, const TraceContext &context);
+void leafIntersection(Ray &thisRay, int first, int count, bool lightCheck, const TraceContext &context);
+
+//Marks the rays of the batch that something blocks before they reach their
+//light. Planes are checked for each ray, the BVH is walked once for them all.
+void checkShadowRays(ShadowBatch &batch, const TraceContext &context);
+
+//Finds the closest hit without shading anything
+void findClosestHit(Ray &thisRay, const TraceContext &context);
+
+//Works out the material of the hit the ray recorded and shades it
+void shadeClosestHit(Ray &thisRay, const TraceContext &context);
+
+//Finds the closest hit and leaves its shaded colour in the ray
+void checkAllIntersections(Ray &thisRay, const TraceContext &context);
+
+// --------------------------------------------------------------------------
+#endif // RAYTRACER_H
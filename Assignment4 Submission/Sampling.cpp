@@ -0,0 +1,138 @@
+// ==========================================================================
+// Ray Tracer Sampling
+// ==========================================================================
+
+#include "Sampling.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+static uint32_t hashBits(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+static uint32_t combineSeeds(uint32_t seed, uint32_t value)
+{
+	return hashBits(seed ^ (value * 0x9e3779b9u + 0x632be5abu));
+}
+
+static uint32_t reverseBits(uint32_t x)
+{
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+	x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+	return x;
+}
+
+//Owen scrambling: each bit is flipped or not by the bits above it, which
+//moves points around inside their strata without breaking them up
+static uint32_t owenScramble(uint32_t x, uint32_t seed)
+{
+	x = reverseBits(x);
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return reverseBits(x);
+}
+
+//Second dimension of the Sobol sequence; the first is reverseBits(index)
+static uint32_t sobolSecond(uint32_t index)
+{
+	uint32_t result = 0;
+
+	for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+	{
+		if (index & 1)
+		{
+			result ^= v;
+		}
+	}
+
+	return result;
+}
+
+// --------------------------------------------------------------------------
+
+uint32_t pixelSeed(float x, float y)
+{
+	uint32_t bits[2];
+	memcpy(&bits[0], &x, sizeof(float));
+	memcpy(&bits[1], &y, sizeof(float));
+
+	uint32_t seed = combineSeeds(hashBits(bits[0]), bits[1]);
+	return seed ? seed : 1;
+}
+
+vec2 sampleSquare(const PixelSample &sample, uint32_t dimension)
+{
+	uint32_t seed = combineSeeds(sample.seed, dimension);
+
+	//Shuffling the order means each dimension takes the points in its own
+	//order, so two dimensions' first n points don't pair up the same way
+	uint32_t index = owenScramble(sample.index, seed);
+
+	uint32_t x = owenScramble(reverseBits(index), combineSeeds(seed, 1));
+	uint32_t y = owenScramble(sobolSecond(index), combineSeeds(seed, 2));
+
+	//Top 24 bits, so the result rounds to a float below 1
+	return vec2((x >> 8) / 16777216.f, (y >> 8) / 16777216.f);
+}
+
+vec2 squareToDisc(vec2 u)
+{
+	//Concentric mapping, which keeps the square's strata compact on the disc
+	float a = 2 * u.x - 1;
+	float b = 2 * u.y - 1;
+
+	if (a == 0 && b == 0)
+	{
+		return vec2(0, 0);
+	}
+
+	const float quarterPi = 0.78539816f;
+	float radius, angle;
+
+	if (std::abs(a) > std::abs(b))
+	{
+		radius = a;
+		angle = quarterPi * (b / a);
+	}
+	else
+	{
+		radius = b;
+		angle = 2 * quarterPi - quarterPi * (a / b);
+	}
+
+	return radius * vec2(std::cos(angle), std::sin(angle));
+}
+
+vec3 phongLobeDirection(vec3 axis, float exponent, vec2 u)
+{
+	float cosTheta = std::pow(u.x, 1.f / (exponent + 1));
+	float sinTheta = std::sqrt(std::max(0.f, 1 - cosTheta * cosTheta));
+	float phi = 6.2831853f * u.y;
+
+	//Any two directions square to the axis and to each other
+	vec3 other = (std::abs(axis.x) > 0.9f) ? vec3(0, 1, 0) : vec3(1, 0, 0);
+	vec3 tangent = normalize(cross(axis, other));
+	vec3 bitangent = cross(axis, tangent);
+
+	return normalize(cosTheta * axis + sinTheta * (std::cos(phi) * tangent + std::sin(phi) * bitangent));
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,67 @@
+// ==========================================================================
+// Ray Tracer Sampling
+//
+// Numbers for the effects that are averaged over many samples per pixel:
+// where in the pixel and on the lens a primary ray starts, which way a
+// glossy surface sends its reflection and where on an area light a shadow
+// ray heads. Each comes from its own dimension of a pixel's sample stream.
+//
+// A stream is a Sobol (0,2) sequence, shuffled and scrambled with a hash of
+// the pixel and the dimension. Any power of two run of its points from the
+// start is stratified both ways at once, one point in every row and every
+// column of the square and in every box of each power of two grid between,
+// so a pixel reaches a given noise level in far fewer samples than random
+// numbers need. The scrambling keeps neighbouring pixels and dimensions from
+// lining up with each other, which would show up as patterns.
+// ==========================================================================
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <stdint.h>
+
+#include "glm/glm.hpp"
+
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+//Dimensions of a pixel's stream, one for each choice a sample makes. Every
+//bounce and every light picked gets a dimension of its own.
+const uint32_t SAMPLE_PIXEL = 0;
+const uint32_t SAMPLE_LENS = 1;
+const uint32_t SAMPLE_GLOSSY = 16;		//Plus the bounce
+const uint32_t SAMPLE_LIGHT = 64;		//Plus the pick
+
+//Which of its pixel's samples a ray belongs to
+struct PixelSample
+{
+	uint32_t seed;		//Hash of the pixel, 0 when there is no stream
+	uint32_t index;		//From 0 to the pixel's sample count
+
+	PixelSample(){};
+
+	PixelSample(uint32_t s, uint32_t i)
+	{
+		seed = s;
+		index = i;
+	}
+
+	bool valid() const { return seed != 0; }
+};
+
+//Seed for a pixel's stream from the point of the image it samples, so each
+//point gets the same samples on any thread and in any order
+uint32_t pixelSeed(float x, float y);
+
+//The sample's point in the square, both from 0 up to but not including 1
+vec2 sampleSquare(const PixelSample &sample, uint32_t dimension);
+
+//Point on a disc of radius 1, evenly spread, for a point in the square
+vec2 squareToDisc(vec2 u);
+
+//Direction about axis drawn from a Phong lobe, cos^exponent of the angle
+//from the axis; 0 is even over the hemisphere, large exponents stay close
+vec3 phongLobeDirection(vec3 axis, float exponent, vec2 u);
+
+// --------------------------------------------------------------------------
+#endif // SAMPLING_H
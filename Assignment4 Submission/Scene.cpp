@@ -0,0 +1,356 @@
+// ==========================================================================
+// Ray Tracer Scene
+// ==========================================================================
+
+#include "Scene.h"
+
+#include <algorithm>
+
+#include "glm/gtc/matrix_transform.hpp"
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+Scene::Scene() : hasCamera(false)
+{
+}
+
+void Scene::build(ThreadPool &pool)
+{
+	if (animated())
+	{
+		float start, end;
+		animationTimes(start, end);
+
+		saveRestPose();
+		moveShapes(start);
+	}
+
+	buildInstances(pool);
+
+	hierarchy.build(triangles, meshVertices, meshTriangles, spheres, instanceBounds, pool);
+	packedTriangles.build(triangles, hierarchy);
+
+	buildLightSlots();
+}
+
+void Scene::buildInstances(ThreadPool &pool)
+{
+	objectHierarchies.assign(objects.size(), BVH());
+
+	for (unsigned int i = 0; i < objects.size(); i++)
+	{
+		objectHierarchies[i].build(objectVertices, objectTriangles, objects[i], pool);
+	}
+
+	instanceTransforms.resize(instances.size());
+	instanceBounds.resize(instances.size());
+
+	for (unsigned int i = 0; i < instances.size(); i++)
+	{
+		const Instance &instance = instances[i];
+		mat4 toScene = translate(mat4(1.f), instance.position);
+
+		if (instance.degrees != 0 && dot(instance.axis, instance.axis) > 0)
+		{
+			toScene = rotate(toScene, radians(instance.degrees), normalize(instance.axis));
+		}
+		toScene = glm::scale(toScene, vec3(instance.scale));
+
+		instanceTransforms[i].toScene = toScene;
+		instanceTransforms[i].toObject = inverse(toScene);
+
+		//Box around the corners of the object's box, as placed
+		const BVH &object = objectHierarchies[instance.object];
+		AABB bounds;
+
+		if (!object.empty())
+		{
+			const AABB &objectBounds = object.node(0).bounds;
+
+			for (int corner = 0; corner < 8; corner++)
+			{
+				vec3 point = vec3((corner & 1) ? objectBounds.upper.x : objectBounds.lower.x,
+								(corner & 2) ? objectBounds.upper.y : objectBounds.lower.y,
+								(corner & 4) ? objectBounds.upper.z : objectBounds.lower.z);
+
+				bounds.extend(vec3(toScene * vec4(point, 1.f)));
+			}
+		}
+
+		instanceBounds[i] = bounds;
+	}
+}
+
+void Scene::pose(float time, ThreadPool &pool)
+{
+	moveShapes(time);
+
+	if (movedPrimitives.empty())
+	{//Only the camera or planes moved, the BVH still fits
+		return;
+	}
+
+	//Rigid moves leave every primitive in the same leaf, only the boxes change
+	if (hierarchy.refit(triangles, meshVertices, meshTriangles, spheres, instanceBounds, movedPrimitives))
+	{
+		packedTriangles.update(triangles, hierarchy, movedPrimitives);
+	}
+	else
+	{
+		hierarchy.build(triangles, meshVertices, meshTriangles, spheres, instanceBounds, pool);
+		packedTriangles.build(triangles, hierarchy);
+	}
+}
+
+void Scene::animationTimes(float &start, float &end) const
+{
+	start = 0;
+	end = 0;
+	bool found = false;
+
+	if (!cameraKeys.empty())
+	{
+		start = cameraKeys[0].time;
+		end = cameraKeys[cameraKeys.size() - 1].time;
+		found = true;
+	}
+
+	for (const ObjectTrack &track : tracks)
+	{
+		float first = objectKeys[track.firstKey].time;
+		float last = objectKeys[track.firstKey + track.keyCount - 1].time;
+
+		start = found ? std::min(start, first) : first;
+		end = found ? std::max(end, last) : last;
+		found = true;
+	}
+}
+
+void Scene::saveRestPose()
+{
+	restPlanes.clear();
+	restTriangles.clear();
+	restSpheres.clear();
+	restVertices.clear();
+	restOffsets.clear();
+
+	shapeTracks[TRACK_PLANE].assign(planes.size(), -1);
+	shapeTracks[TRACK_TRIANGLE].assign(triangles.size(), -1);
+	shapeTracks[TRACK_SPHERE].assign(spheres.size(), -1);
+	shapeTracks[TRACK_MESH].assign(meshes.size(), -1);
+
+	for (unsigned int i = 0; i < tracks.size(); i++)
+	{
+		shapeTracks[tracks[i].target][tracks[i].index] = i;
+	}
+
+	for (const ObjectTrack &track : tracks)
+	{
+		if (track.target == TRACK_PLANE)
+		{
+			restOffsets.push_back((int)restPlanes.size());
+			restPlanes.push_back(planes[track.index]);
+		}
+		else if (track.target == TRACK_TRIANGLE)
+		{
+			restOffsets.push_back((int)restTriangles.size());
+			restTriangles.push_back(triangles[track.index]);
+		}
+		else if (track.target == TRACK_SPHERE)
+		{
+			restOffsets.push_back((int)restSpheres.size());
+			restSpheres.push_back(spheres[track.index]);
+		}
+		else
+		{
+			const Mesh &mesh = meshes[track.index];
+			const vec3 *first = meshVertices.begin() + mesh.firstVertex;
+
+			restOffsets.push_back((int)restVertices.size());
+			restVertices.insert(restVertices.end(), first, first + mesh.vertexCount);
+		}
+	}
+}
+
+void Scene::moveShapes(float time)
+{
+	if (!cameraKeys.empty())
+	{
+		CameraKey key = interpolateKeys(cameraKeys.data(), (int)cameraKeys.size(), time);
+
+		hasCamera = true;
+		camera = Camera(key.eye, key.target - key.eye, key.fieldOfView, camera.width, camera.height);
+	}
+
+	movedPrimitives.clear();
+	poseKeys.resize(tracks.size());
+
+	for (unsigned int i = 0; i < tracks.size(); i++)
+	{
+		const ObjectTrack &track = tracks[i];
+		ObjectKey key = interpolateKeys(objectKeys.data() + track.firstKey, track.keyCount, time);
+		int rest = restOffsets[i];
+
+		poseKeys[i] = key;
+
+		if (track.target == TRACK_PLANE)
+		{
+			Plane &plane = planes.writableData()[track.index];
+			plane.point = applyKey(key, track.pivot, restPlanes[rest].point);
+			plane.normalVector = key.rotation * restPlanes[rest].normalVector;
+		}
+		else if (track.target == TRACK_TRIANGLE)
+		{
+			Triangle &triangle = triangles.writableData()[track.index];
+			triangle.p1 = applyKey(key, track.pivot, restTriangles[rest].p1);
+			triangle.p2 = applyKey(key, track.pivot, restTriangles[rest].p2);
+			triangle.p3 = applyKey(key, track.pivot, restTriangles[rest].p3);
+
+			movedPrimitives.push_back(BVHPrimitive(BVHPrimitive::TRIANGLE, track.index));
+		}
+		else if (track.target == TRACK_SPHERE)
+		{
+			Sphere &sphere = spheres.writableData()[track.index];
+			sphere.centre = applyKey(key, track.pivot, restSpheres[rest].centre);
+
+			movedPrimitives.push_back(BVHPrimitive(BVHPrimitive::SPHERE, track.index));
+		}
+		else
+		{
+			const Mesh &mesh = meshes[track.index];
+			vec3 *vertices = meshVertices.writableData() + mesh.firstVertex;
+
+			for (uint32_t v = 0; v < mesh.vertexCount; v++)
+			{
+				vertices[v] = applyKey(key, track.pivot, restVertices[rest + v]);
+			}
+
+			for (uint32_t t = mesh.firstTriangle; t < mesh.firstTriangle + mesh.triangleCount; t++)
+			{
+				movedPrimitives.push_back(BVHPrimitive(BVHPrimitive::MESH_TRIANGLE, t));
+			}
+		}
+	}
+}
+
+void Scene::toRestPose(TrackTarget target, int index, vec3 &point, vec3 &normal) const
+{
+	const vector<int> &trackOf = shapeTracks[target];
+
+	if (index >= (int)trackOf.size() || trackOf[index] < 0)
+	{//Also scenes that were never animated
+		return;
+	}
+
+	int track = trackOf[index];
+	const ObjectKey &key = poseKeys[track];
+
+	point = undoKey(key, tracks[track].pivot, point);
+	normal = inverse(key.rotation) * normal;
+}
+
+void Scene::buildLightSlots()
+{
+	int count = (int)lights.size();
+	lightSlots.assign(count, LightSlot());
+
+	float total = 0;
+	for (int i = 0; i < count; i++)
+	{
+		total += lights[i].colour.r + lights[i].colour.g + lights[i].colour.b;
+	}
+
+	//Each light's share scaled so the average slot holds 1, and split into
+	//the lights that don't fill their slot and those that spill over
+	vector<float> shares(count);
+	vector<int> small, large;
+
+	for (int i = 0; i < count; i++)
+	{
+		float brightness = lights[i].colour.r + lights[i].colour.g + lights[i].colour.b;
+		lightSlots[i].probability = (total > 0) ? brightness / total : 1.f / count;
+		lightSlots[i].alias = i;
+
+		shares[i] = lightSlots[i].probability * count;
+		(shares[i] < 1.f ? small : large).push_back(i);
+	}
+
+	//Top up each small slot from a large light, which may become small itself
+	while (!small.empty() && !large.empty())
+	{
+		int under = small.back();
+		int over = large.back();
+		small.pop_back();
+
+		lightSlots[under].threshold = shares[under];
+		lightSlots[under].alias = over;
+
+		shares[over] -= 1.f - shares[under];
+		if (shares[over] < 1.f)
+		{
+			large.pop_back();
+			small.push_back(over);
+		}
+	}
+
+	//Whatever is left is full up to rounding
+	for (int i : small)
+	{
+		lightSlots[i].threshold = 1.f;
+	}
+	for (int i : large)
+	{
+		lightSlots[i].threshold = 1.f;
+	}
+}
+
+int Scene::pickLight(float u, float &probability) const
+{
+	int count = (int)lightSlots.size();
+
+	float scaled = u * count;
+	int slot = std::min((int)scaled, count - 1);
+	const LightSlot &picked = lightSlots[slot];
+
+	int light = (scaled - slot < picked.threshold) ? slot : picked.alias;
+	probability = lightSlots[light].probability;
+
+	return light;
+}
+
+const Mesh &Scene::meshOf(int triangle) const
+{//Last mesh starting at or before the triangle
+	const Mesh *found = std::upper_bound(meshes.begin(), meshes.end(), (uint32_t)triangle,
+		[](uint32_t t, const Mesh &mesh)
+		{
+			return t < mesh.firstTriangle;
+		});
+
+	return *(found - 1);
+}
+
+int Scene::addTextureImage(const string &fileName)
+{
+	for (unsigned int i = 0; i < textureImageFiles.size(); i++)
+	{
+		if (textureImageFiles[i] == fileName)
+		{
+			return i;
+		}
+	}
+
+	shared_ptr<const MipImage> image = loadTextureImage(fileName);
+	if (!image)
+	{
+		return -1;
+	}
+
+	textureImages.push_back(image);
+	textureImageFiles.push_back(fileName);
+
+	return (int)textureImages.size() - 1;
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,182 @@
+// ==========================================================================
+// Ray Tracer Scene
+//
+// Everything a ray can hit or be lit by. A scene is filled in while it loads,
+// then build() prepares its acceleration structure; from then on it is only
+// ever handed out as a const Scene, so any number of threads can trace rays
+// through it at once.
+//
+// An animated scene is the exception: between frames, while nothing traces
+// it, pose() moves its keyed shapes and camera to a new time. Only the shapes
+// that move are touched and the BVH is refit around them, so the rest of the
+// scene is shared by every frame without being copied or rebuilt.
+//
+// Instanced objects get a BVH each when the scene is built, which every
+// instance of them shares, and the scene's own BVH holds the instances.
+//
+// Scenes loaded from a binary file leave their shapes in the mapped file
+// rather than copying them, and hold on to the mapping for as long as they
+// live.
+// ==========================================================================
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Shapes.h"
+#include "PrimitiveArray.h"
+#include "Camera.h"
+#include "BVH.h"
+#include "TriangleStore.h"
+#include "Texture.h"
+#include "Animation.h"
+
+class ThreadPool;
+
+// --------------------------------------------------------------------------
+
+//Where an instance is placed, both ways round. Normals go back to the scene
+//through the transpose of toObject.
+struct InstanceTransform
+{
+	mat4 toScene;
+	mat4 toObject;
+};
+
+class Scene
+{
+public:
+	Scene();
+
+	//Shapes, planes stay outside the BVH
+	PrimitiveArray<Plane> planes;
+	PrimitiveArray<Triangle> triangles;
+	PrimitiveArray<Sphere> spheres;
+
+	//Indexed meshes, also in the BVH. Triangle corners are indices into
+	//meshVertices and every mesh covers a run of meshTriangles.
+	PrimitiveArray<vec3> meshVertices;
+	PrimitiveArray<MeshTriangle> meshTriangles;
+	PrimitiveArray<Mesh> meshes;
+
+	//Mesh that meshTriangles[triangle] belongs to
+	const Mesh &meshOf(int triangle) const;
+
+	//Models that are only drawn through instances, laid out like the meshes
+	//but kept where they were loaded, outside the BVH. The objects' own
+	//materials go unused, each instance has its own.
+	PrimitiveArray<vec3> objectVertices;
+	PrimitiveArray<MeshTriangle> objectTriangles;
+	PrimitiveArray<Mesh> objects;
+	PrimitiveArray<Instance> instances;
+
+	PrimitiveArray<Light> lights;
+
+	//Textures the shapes name, and the images they use from the shared
+	//cache, with the files they came from
+	PrimitiveArray<Texture> textures;
+	std::vector<std::shared_ptr<const MipImage> > textureImages;
+	std::vector<std::string> textureImageFiles;
+
+	//Adds the image in the file, or finds it if it is already here, and
+	//returns its index; -1 if it can't be read
+	int addTextureImage(const std::string &fileName);
+
+	//Picks a light with probability in proportion to its brightness, given u
+	//from 0 to 1, for shading from a few of many lights. Takes the same time
+	//however many lights there are.
+	int pickLight(float u, float &probability) const;
+
+	//Viewpoint the scene was written for, the default camera is used without one
+	bool hasCamera;
+	Camera camera;
+
+	//Keyframes, in time order; each track moves one shape through a run of
+	//objectKeys
+	PrimitiveArray<CameraKey> cameraKeys;
+	PrimitiveArray<ObjectTrack> tracks;
+	PrimitiveArray<ObjectKey> objectKeys;
+
+	bool animated() const { return !cameraKeys.empty() || !tracks.empty(); }
+
+	//Times of the first and last keys, both 0 without any
+	void animationTimes(float &start, float &end) const;
+
+	//Moves the keyed shapes and the camera to where they are at time. The
+	//scene has to have been built, and nothing may be tracing it meanwhile.
+	//A tree too poor to refit is built again on pool.
+	void pose(float time, ThreadPool &pool);
+
+	//Takes a point and normal on a shape, as it is posed, back to where they
+	//sat at rest, so whatever is painted on the shape moves along with it.
+	//index is into the target's own array, the mesh's own for a mesh. Shapes
+	//without a track are left where they are.
+	void toRestPose(TrackTarget target, int index, vec3 &point, vec3 &normal) const;
+
+	//Memory the shape arrays are attached to, if any
+	std::shared_ptr<const void> storage;
+
+	//Call once every shape has been added. An animated scene is posed at
+	//its start time first. Big trees are built across pool's threads.
+	void build(ThreadPool &pool);
+
+	const BVH &bvh() const { return hierarchy; }
+	const TriangleStore &triangleStore() const { return packedTriangles; }
+
+	//Over objectTriangles, in the object's own space
+	const BVH &objectBVH(int object) const { return objectHierarchies[object]; }
+	const InstanceTransform &instanceTransform(int instance) const { return instanceTransforms[instance]; }
+
+private:
+	void buildLightSlots();
+
+	//Builds each object's tree, then places every instance and works out
+	//its box in the scene
+	void buildInstances(ThreadPool &pool);
+	std::vector<BVH> objectHierarchies;
+	std::vector<InstanceTransform> instanceTransforms;
+	std::vector<AABB> instanceBounds;
+
+	//Copies of the keyed shapes as loaded, which every pose starts from; a
+	//mesh keeps its vertices. restOffsets gives each track's place in the
+	//array for its kind of shape.
+	std::vector<Plane> restPlanes;
+	std::vector<Triangle> restTriangles;
+	std::vector<Sphere> restSpheres;
+	std::vector<vec3> restVertices;
+	std::vector<int> restOffsets;
+
+	//Track moving each shape, -1 for none, and the key each track is posed
+	//with at the moment
+	std::vector<int> shapeTracks[TRACK_TARGET_COUNT];
+	std::vector<ObjectKey> poseKeys;
+
+	void saveRestPose();
+
+	//Moves the shapes and camera without touching the BVH, listing the BVH
+	//primitives that moved in movedPrimitives
+	void moveShapes(float time);
+	std::vector<BVHPrimitive> movedPrimitives;
+
+	//Acceleration structure over triangles and spheres
+	BVH hierarchy;
+
+	//Triangles again, packed in BVH leaf order for the SIMD tests
+	TriangleStore packedTriangles;
+
+	//Alias table for pickLight: each light's slot is taken with the slot's
+	//threshold and otherwise hands over to its alias, which evens the lights'
+	//shares out over slots of the same size
+	struct LightSlot
+	{
+		float threshold;
+		int alias;
+		float probability;		//Of picking this slot's own light
+	};
+	std::vector<LightSlot> lightSlots;
+};
+
+// --------------------------------------------------------------------------
+#endif // SCENE_H
@@ -0,0 +1,1486 @@
+// ==========================================================================
+// Scene Files
+// ==========================================================================
+
+#include "SceneFile.h"
+#include "LineParser.h"
+#include "MeshFile.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <vector>
+#include <stdint.h>
+
+#ifdef _WIN32
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+// Text format
+
+struct Material
+{
+	vec3 colour;
+	int phongExponent;
+	float reflectivity;
+	int texture;			//Index into the scene's textures, -1 for none
+};
+
+//Directory part of a path, with its trailing slash
+static string directoryOf(const string &fileName)
+{
+	size_t slash = fileName.find_last_of("/\\");
+	return (slash == string::npos) ? "" : fileName.substr(0, slash + 1);
+}
+
+static bool isAbsolutePath(const string &fileName)
+{
+	return (!fileName.empty() && (fileName[0] == '/' || fileName[0] == '\\'))
+		|| (fileName.size() > 1 && fileName[1] == ':');
+}
+
+//Relative paths are made full, so a scene saved somewhere else still finds them
+static string absolutePath(const string &fileName)
+{
+	if (isAbsolutePath(fileName))
+	{
+		return fileName;
+	}
+
+	char directory[4096];
+
+#ifdef _WIN32
+	DWORD length = GetCurrentDirectoryA(sizeof(directory), directory);
+	if (length == 0 || length >= sizeof(directory))
+	{
+		return fileName;
+	}
+#else
+	if (!getcwd(directory, sizeof(directory)))
+	{
+		return fileName;
+	}
+#endif
+
+	return string(directory) + "/" + fileName;
+}
+
+//Point a keyed shape turns about, the middle of it
+static vec3 trackPivot(const Scene &scene, int target, int index)
+{
+	if (target == TRACK_PLANE)
+	{
+		return scene.planes[index].point;
+	}
+	else if (target == TRACK_TRIANGLE)
+	{
+		const Triangle &triangle = scene.triangles[index];
+		return (triangle.p1 + triangle.p2 + triangle.p3) / 3.f;
+	}
+	else if (target == TRACK_SPHERE)
+	{
+		return scene.spheres[index].centre;
+	}
+
+	const Mesh &mesh = scene.meshes[index];
+	vec3 lower = scene.meshVertices[mesh.firstVertex];
+	vec3 upper = lower;
+
+	for (uint32_t v = mesh.firstVertex; v < mesh.firstVertex + mesh.vertexCount; v++)
+	{
+		lower = min(lower, scene.meshVertices[v]);
+		upper = max(upper, scene.meshVertices[v]);
+	}
+
+	return (lower + upper) / 2.f;
+}
+
+bool loadSceneText(istream &in, const string &name, Scene &scene)
+{
+	map<string, Material> materials;
+	map<string, int> textures;
+	map<string, int> objects;
+
+	string line;
+	string keyword;
+	int lineNumber = 0;
+
+	//Shape the next key line moves, the one on the line before
+	int keyTarget = -1;
+	int keyIndex = 0;
+	bool keyTrackStarted = false;
+
+	while (getline(in, line))
+	{
+		lineNumber++;
+
+		LineParser parser(line.c_str());
+
+		if (!parser.word(keyword))
+		{//Blank or just a comment
+			continue;
+		}
+
+		string error;
+		string materialName;
+		Material material;
+		int shapeTarget = -1;
+
+		if (keyword == "material")
+		{
+			string textureName;
+			material.reflectivity = 0;
+			material.texture = -1;
+
+			if (!parser.word(materialName) || !parser.point(material.colour) || !parser.number(material.phongExponent)
+				|| (!parser.atEnd() && !parser.number(material.reflectivity))
+				|| (!parser.atEnd() && !parser.word(textureName)))
+			{
+				error = "expected material name r g b phongExponent, optionally followed by reflectivity and texture";
+			}
+			else if (materials.count(materialName))
+			{
+				error = "material " + materialName + " is already defined";
+			}
+			else if (material.phongExponent < 0)
+			{
+				error = "the phong exponent can't be negative";
+			}
+			else if (material.reflectivity < 0 || material.reflectivity > 1)
+			{
+				error = "the reflectivity must be between 0 and 1";
+			}
+			else if (!textureName.empty() && !textures.count(textureName))
+			{
+				error = "texture " + textureName + " hasn't been defined";
+			}
+			else
+			{
+				if (!textureName.empty())
+				{
+					material.texture = textures[textureName];
+				}
+
+				materials[materialName] = material;
+			}
+		}
+		else if (keyword == "texture")
+		{
+			string textureName, kind, imageFile;
+			Texture texture = Texture(TEXTURE_IMAGE, -1, vec3(1, 1, 1), vec3(0, 0, 0), 1);
+
+			if (!parser.word(textureName) || !parser.word(kind))
+			{
+				error = "expected texture name image fileName, or texture name checker|noise r g b r g b";
+			}
+			else if (textures.count(textureName))
+			{
+				error = "texture " + textureName + " is already defined";
+			}
+			else if (kind == "image")
+			{
+				if (!parser.word(imageFile) || (!parser.atEnd() && !parser.number(texture.scale)))
+				{
+					error = "expected texture name image fileName, optionally followed by scale";
+				}
+			}
+			else if (kind == "checker" || kind == "noise")
+			{
+				texture.kind = (kind == "checker") ? TEXTURE_CHECKER : TEXTURE_NOISE;
+
+				if (!parser.point(texture.colour1) || !parser.point(texture.colour2)
+					|| (!parser.atEnd() && !parser.number(texture.scale)))
+				{
+					error = "expected texture name " + kind + " r g b r g b, optionally followed by scale";
+				}
+			}
+			else
+			{
+				error = "unknown texture kind " + kind + ", expected image, checker or noise";
+			}
+
+			if (error.empty() && texture.scale <= 0)
+			{
+				error = "the texture's scale must be positive";
+			}
+
+			if (error.empty() && texture.kind == TEXTURE_IMAGE)
+			{//Found relative to the scene file, like meshes
+				if (!isAbsolutePath(imageFile))
+				{
+					imageFile = directoryOf(name) + imageFile;
+				}
+
+				texture.image = scene.addTextureImage(absolutePath(imageFile));
+
+				if (texture.image < 0)
+				{
+					error = "failed to load the texture's image";
+				}
+			}
+
+			if (error.empty())
+			{
+				textures[textureName] = (int)scene.textures.size();
+				scene.textures.push_back(texture);
+			}
+		}
+		else if (keyword == "light")
+		{
+			vec3 position;
+			vec3 colour = vec3(1, 1, 1);
+
+			if (!parser.point(position) || (!parser.atEnd() && !parser.point(colour)))
+			{
+				error = "expected light x y z, optionally followed by r g b";
+			}
+			else if (colour.r < 0 || colour.g < 0 || colour.b < 0)
+			{
+				error = "the light's colour can't be negative";
+			}
+			else
+			{
+				scene.lights.push_back(Light(position, colour));
+			}
+		}
+		else if (keyword == "arealight")
+		{
+			vec3 corner, edge1, edge2, colour;
+			int samples;
+
+			if (!parser.point(corner) || !parser.point(edge1) || !parser.point(edge2) || !parser.point(colour)
+				|| !parser.number(samples))
+			{
+				error = "expected arealight corner edge1 edge2 r g b samples";
+			}
+			else if (length(cross(edge1, edge2)) <= 0)
+			{
+				error = "the area light's edges must span an area";
+			}
+			else if (colour.r < 0 || colour.g < 0 || colour.b < 0)
+			{
+				error = "the light's colour can't be negative";
+			}
+			else if (samples < 1 || samples > MAX_AREA_LIGHT_SAMPLES)
+			{
+				error = "the area light needs from 1 to " + to_string(MAX_AREA_LIGHT_SAMPLES) + " samples";
+			}
+			else
+			{
+				scene.lights.push_back(Light(corner, edge1, edge2, colour, samples));
+			}
+		}
+		else if (keyword == "camerakey")
+		{
+			float time;
+			vec3 eye, target;
+			float fieldOfView;
+
+			if (!parser.number(time) || !parser.point(eye) || !parser.point(target) || !parser.number(fieldOfView))
+			{
+				error = "expected camerakey time eye target fieldOfView";
+			}
+			else if (!scene.cameraKeys.empty() && time <= scene.cameraKeys[scene.cameraKeys.size() - 1].time)
+			{
+				error = "camera keys have to be in time order";
+			}
+			else if (length(target - eye) <= 0)
+			{
+				error = "the camera can't look at its own position";
+			}
+			else if (fieldOfView <= 0 || fieldOfView >= 180)
+			{
+				error = "the field of view must be between 0 and 180 degrees";
+			}
+			else
+			{
+				scene.cameraKeys.push_back(CameraKey(time, eye, target, fieldOfView));
+			}
+		}
+		else if (keyword == "key")
+		{
+			float time;
+			vec3 translation;
+			vec3 axis = vec3(0, 1, 0);
+			float angle = 0;
+
+			if (!parser.number(time) || !parser.point(translation)
+				|| (!parser.atEnd() && !(parser.point(axis) && parser.number(angle))))
+			{
+				error = "expected key time moveX moveY moveZ, optionally followed by axisX axisY axisZ degrees";
+			}
+			else if (keyTarget < 0)
+			{
+				error = "a key has to follow the shape it moves, or another key";
+			}
+			else if (keyTrackStarted && time <= scene.objectKeys[scene.objectKeys.size() - 1].time)
+			{
+				error = "a shape's keys have to be in time order";
+			}
+			else if (length(axis) <= 0)
+			{
+				error = "the key's axis can't be zero";
+			}
+			else
+			{
+				if (!keyTrackStarted)
+				{
+					scene.tracks.push_back(ObjectTrack(keyTarget, keyIndex, trackPivot(scene, keyTarget, keyIndex),
+						(uint32_t)scene.objectKeys.size(), 0));
+					keyTrackStarted = true;
+				}
+
+				scene.objectKeys.push_back(ObjectKey(time, translation, angleAxis(radians(angle), normalize(axis))));
+				scene.tracks.writableData()[scene.tracks.size() - 1].keyCount++;
+			}
+		}
+		else if (keyword == "camera")
+		{
+			vec3 eye, target;
+			float fieldOfView;
+
+			if (!parser.point(eye) || !parser.point(target) || !parser.number(fieldOfView))
+			{
+				error = "expected camera eye target fieldOfView";
+			}
+			else if (length(target - eye) <= 0)
+			{
+				error = "the camera can't look at its own position";
+			}
+			else if (fieldOfView <= 0 || fieldOfView >= 180)
+			{
+				error = "the field of view must be between 0 and 180 degrees";
+			}
+			else
+			{
+				scene.hasCamera = true;
+				scene.camera = Camera(eye, target - eye, fieldOfView, scene.camera.width, scene.camera.height);
+			}
+		}
+		else if (keyword == "plane")
+		{
+			vec3 point, normal;
+
+			if (!parser.point(point) || !parser.point(normal) || !parser.word(materialName))
+			{
+				error = "expected plane point normal material";
+			}
+			else if (length(normal) <= 0)
+			{
+				error = "the plane's normal can't be zero";
+			}
+			else if (!materials.count(materialName))
+			{
+				error = "material " + materialName + " hasn't been defined";
+			}
+			else
+			{
+				material = materials[materialName];
+				scene.planes.push_back(Plane(normal, point, material.colour, material.phongExponent, material.reflectivity, material.texture));
+				shapeTarget = TRACK_PLANE;
+			}
+		}
+		else if (keyword == "sphere")
+		{
+			vec3 centre;
+			float radius;
+
+			if (!parser.point(centre) || !parser.number(radius) || !parser.word(materialName))
+			{
+				error = "expected sphere centre radius material";
+			}
+			else if (radius <= 0)
+			{
+				error = "the sphere's radius must be positive";
+			}
+			else if (!materials.count(materialName))
+			{
+				error = "material " + materialName + " hasn't been defined";
+			}
+			else
+			{
+				material = materials[materialName];
+				scene.spheres.push_back(Sphere(radius, centre, material.colour, material.phongExponent, material.reflectivity, material.texture));
+				shapeTarget = TRACK_SPHERE;
+			}
+		}
+		else if (keyword == "triangle")
+		{
+			vec3 p1, p2, p3;
+
+			if (!parser.point(p1) || !parser.point(p2) || !parser.point(p3) || !parser.word(materialName))
+			{
+				error = "expected triangle point1 point2 point3 material";
+			}
+			else if (!materials.count(materialName))
+			{
+				error = "material " + materialName + " hasn't been defined";
+			}
+			else
+			{
+				material = materials[materialName];
+				scene.triangles.push_back(Triangle(p1, p2, p3, material.colour, material.phongExponent, material.reflectivity, material.texture));
+				shapeTarget = TRACK_TRIANGLE;
+			}
+		}
+		else if (keyword == "mesh")
+		{
+			string meshFile;
+			vec3 centre = vec3(0, 0, 0);
+			float size = 0;
+
+			if (!parser.word(meshFile) || !parser.word(materialName)
+				|| (!parser.atEnd() && !(parser.point(centre) && parser.number(size))))
+			{
+				error = "expected mesh fileName material, optionally followed by centre size";
+			}
+			else if (size < 0)
+			{
+				error = "the mesh's size can't be negative";
+			}
+			else if (!materials.count(materialName))
+			{
+				error = "material " + materialName + " hasn't been defined";
+			}
+			else
+			{
+				if (!isAbsolutePath(meshFile))
+				{
+					meshFile = directoryOf(name) + meshFile;
+				}
+
+				material = materials[materialName];
+
+				if (!loadMeshFile(meshFile, scene, material.colour, material.phongExponent, material.reflectivity, centre, size, material.texture))
+				{
+					error = "failed to load the mesh";
+				}
+				else
+				{
+					shapeTarget = TRACK_MESH;
+				}
+			}
+		}
+		else if (keyword == "object")
+		{
+			string objectName, objectFile;
+			vec3 centre = vec3(0, 0, 0);
+			float size = 0;
+
+			if (!parser.word(objectName) || !parser.word(objectFile)
+				|| (!parser.atEnd() && !(parser.point(centre) && parser.number(size))))
+			{
+				error = "expected object name fileName, optionally followed by centre size";
+			}
+			else if (objects.count(objectName))
+			{
+				error = "object " + objectName + " is already defined";
+			}
+			else if (size < 0)
+			{
+				error = "the object's size can't be negative";
+			}
+			else
+			{
+				if (!isAbsolutePath(objectFile))
+				{
+					objectFile = directoryOf(name) + objectFile;
+				}
+
+				if (!loadObjectFile(objectFile, scene, centre, size))
+				{
+					error = "failed to load the object";
+				}
+				else
+				{
+					objects[objectName] = (int)scene.objects.size() - 1;
+				}
+			}
+		}
+		else if (keyword == "instance")
+		{
+			string objectName;
+			vec3 position;
+			vec3 axis = vec3(0, 1, 0);
+			float degrees = 0;
+			float scale = 1;
+
+			if (!parser.word(objectName) || !parser.word(materialName) || !parser.point(position)
+				|| (!parser.atEnd() && !(parser.point(axis) && parser.number(degrees)))
+				|| (!parser.atEnd() && !parser.number(scale)))
+			{
+				error = "expected instance object material x y z, optionally followed by axisX axisY axisZ degrees and scale";
+			}
+			else if (!objects.count(objectName))
+			{
+				error = "object " + objectName + " hasn't been defined";
+			}
+			else if (!materials.count(materialName))
+			{
+				error = "material " + materialName + " hasn't been defined";
+			}
+			else if (length(axis) <= 0)
+			{
+				error = "the instance's axis can't be zero";
+			}
+			else if (scale <= 0)
+			{
+				error = "the instance's scale must be positive";
+			}
+			else
+			{
+				material = materials[materialName];
+				scene.instances.push_back(Instance(objects[objectName], position, axis, degrees, scale,
+					material.colour, material.phongExponent, material.reflectivity, material.texture));
+			}
+		}
+		else
+		{
+			error = "unknown item " + keyword;
+		}
+
+		if (error.empty() && !parser.atEnd())
+		{
+			error = "unexpected text after the " + keyword;
+		}
+
+		if (!error.empty())
+		{
+			cout << "ERROR: " << name << ":" << lineNumber << ": " << error << endl;
+			return false;
+		}
+
+		if (keyword != "key")
+		{//Keys can only follow a shape, or each other
+			keyTarget = shapeTarget;
+			keyTrackStarted = false;
+
+			if (shapeTarget == TRACK_PLANE) keyIndex = (int)scene.planes.size() - 1;
+			else if (shapeTarget == TRACK_TRIANGLE) keyIndex = (int)scene.triangles.size() - 1;
+			else if (shapeTarget == TRACK_SPHERE) keyIndex = (int)scene.spheres.size() - 1;
+			else if (shapeTarget == TRACK_MESH) keyIndex = (int)scene.meshes.size() - 1;
+		}
+	}
+
+	if (in.bad())
+	{
+		cout << "ERROR: Failed reading " << name << endl;
+		return false;
+	}
+
+	return true;
+}
+
+//Enough digits that every float reads back exactly
+static string formatNumber(float f)
+{
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%.9g", f);
+	return buffer;
+}
+
+static string formatPoint(vec3 v)
+{
+	return formatNumber(v.x) + " " + formatNumber(v.y) + " " + formatNumber(v.z);
+}
+
+//Textures are named by their place in the scene
+static string textureName(int texture)
+{
+	return "texture" + to_string(texture + 1);
+}
+
+//Shapes only carry their colour, exponent, reflectivity and texture, so each
+//different combination is written out as a material the first time it is used
+class MaterialWriter
+{
+public:
+	MaterialWriter(ostream &o) : out(o) {}
+
+	string name(vec3 colour, int phongExponent, float reflectivity, int texture)
+	{
+		unsigned int i = 0;
+		while (i < materials.size() && !(materials[i].colour == colour && materials[i].phongExponent == phongExponent
+			&& materials[i].reflectivity == reflectivity && materials[i].texture == texture))
+		{
+			i++;
+		}
+
+		string materialName = "material" + to_string(i + 1);
+
+		if (i == materials.size())
+		{
+			Material material;
+			material.colour = colour;
+			material.phongExponent = phongExponent;
+			material.reflectivity = reflectivity;
+			material.texture = texture;
+			materials.push_back(material);
+
+			out << "material " << materialName << "  " << formatPoint(colour) << "  " << phongExponent;
+			if (reflectivity != 0 || texture >= 0)
+			{
+				out << "  " << formatNumber(reflectivity);
+			}
+			if (texture >= 0)
+			{
+				out << "  " << textureName(texture);
+			}
+			out << "\n";
+		}
+
+		return materialName;
+	}
+
+private:
+	ostream &out;
+	vector<Material> materials;
+};
+
+//Writes the keys of the shape's track, if it has one, to go after its line
+class KeyWriter
+{
+public:
+	KeyWriter(ostream &o, const Scene &s) : out(o), scene(s)
+	{
+		for (unsigned int i = 0; i < scene.tracks.size(); i++)
+		{
+			trackOf[make_pair(scene.tracks[i].target, scene.tracks[i].index)] = i;
+		}
+	}
+
+	void write(int target, int index)
+	{
+		map<pair<int, int>, int>::const_iterator found = trackOf.find(make_pair(target, index));
+		if (found == trackOf.end())
+		{
+			return;
+		}
+
+		const ObjectTrack &track = scene.tracks[found->second];
+
+		for (uint32_t k = track.firstKey; k < track.firstKey + track.keyCount; k++)
+		{
+			const ObjectKey &key = scene.objectKeys[k];
+			out << "key " << formatNumber(key.time) << "  " << formatPoint(key.translation);
+
+			float angle = glm::angle(key.rotation);
+			if (angle != 0)
+			{
+				out << "  " << formatPoint(glm::axis(key.rotation)) << "  " << formatNumber(degrees(angle));
+			}
+			out << "\n";
+		}
+	}
+
+private:
+	ostream &out;
+	const Scene &scene;
+	map<pair<int, int>, int> trackOf;
+};
+
+bool saveSceneText(const Scene &scene, const string &fileName)
+{
+	ofstream out(fileName.c_str());
+	if (!out)
+	{
+		cout << "ERROR: Failed to open " << fileName << " for writing" << endl;
+		return false;
+	}
+
+	for (const Light &light : scene.lights)
+	{
+		if (light.isArea())
+		{
+			out << "arealight " << formatPoint(light.position) << "  " << formatPoint(light.edge1) << "  "
+				<< formatPoint(light.edge2) << "  " << formatPoint(light.colour) << "  " << light.samples << "\n";
+		}
+		else if (light.colour == vec3(1, 1, 1))
+		{
+			out << "light " << formatPoint(light.position) << "\n";
+		}
+		else
+		{
+			out << "light " << formatPoint(light.position) << "  " << formatPoint(light.colour) << "\n";
+		}
+	}
+
+	if (scene.hasCamera)
+	{
+		const Camera &camera = scene.camera;
+		out << "camera " << formatPoint(camera.pos) << "  " << formatPoint(camera.pos + camera.dir) << "  " << formatNumber(camera.fieldOfView) << "\n";
+	}
+
+	for (const CameraKey &key : scene.cameraKeys)
+	{
+		out << "camerakey " << formatNumber(key.time) << "  " << formatPoint(key.eye) << "  " << formatPoint(key.target)
+			<< "  " << formatNumber(key.fieldOfView) << "\n";
+	}
+
+	for (unsigned int i = 0; i < scene.textures.size(); i++)
+	{
+		const Texture &texture = scene.textures[i];
+
+		if (texture.kind == TEXTURE_IMAGE)
+		{
+			out << "texture " << textureName(i) << "  image " << scene.textureImageFiles[texture.image];
+		}
+		else
+		{
+			out << "texture " << textureName(i) << "  " << (texture.kind == TEXTURE_CHECKER ? "checker " : "noise ")
+				<< formatPoint(texture.colour1) << "  " << formatPoint(texture.colour2);
+		}
+
+		if (texture.scale != 1)
+		{
+			out << "  " << formatNumber(texture.scale);
+		}
+		out << "\n";
+	}
+
+	MaterialWriter materials(out);
+	KeyWriter keys(out, scene);
+
+	for (unsigned int i = 0; i < scene.planes.size(); i++)
+	{
+		const Plane &plane = scene.planes[i];
+		string material = materials.name(plane.colour, plane.phongExponent, plane.reflectivity, plane.texture);
+		out << "plane " << formatPoint(plane.point) << "  " << formatPoint(plane.normalVector) << "  " << material << "\n";
+		keys.write(TRACK_PLANE, i);
+	}
+
+	for (unsigned int i = 0; i < scene.spheres.size(); i++)
+	{
+		const Sphere &sphere = scene.spheres[i];
+		string material = materials.name(sphere.colour, sphere.phongExponent, sphere.reflectivity, sphere.texture);
+		out << "sphere " << formatPoint(sphere.centre) << "  " << formatNumber(sphere.radius) << "  " << material << "\n";
+		keys.write(TRACK_SPHERE, i);
+	}
+
+	for (unsigned int i = 0; i < scene.triangles.size(); i++)
+	{
+		const Triangle &triangle = scene.triangles[i];
+		string material = materials.name(triangle.colour, triangle.phongExponent, triangle.reflectivity, triangle.texture);
+		out << "triangle " << formatPoint(triangle.p1) << "  " << formatPoint(triangle.p2) << "  " << formatPoint(triangle.p3) << "  " << material << "\n";
+		keys.write(TRACK_TRIANGLE, i);
+	}
+
+	//Meshes go in their own files beside this one, already in place
+	string directory = directoryOf(fileName);
+	string stem = fileName.substr(directory.size());
+	stem = stem.substr(0, stem.find_last_of('.'));
+
+	for (unsigned int i = 0; i < scene.meshes.size(); i++)
+	{
+		const Mesh &mesh = scene.meshes[i];
+		string material = materials.name(mesh.colour, mesh.phongExponent, mesh.reflectivity, mesh.texture);
+		string meshFile = stem + "_mesh" + to_string(i + 1) + ".obj";
+
+		if (!saveMeshObj(scene, i, directory + meshFile))
+		{
+			return false;
+		}
+
+		out << "mesh " << meshFile << "  " << material << "\n";
+		keys.write(TRACK_MESH, i);
+	}
+
+	//Objects too, where they were loaded; instances place them
+	for (unsigned int i = 0; i < scene.objects.size(); i++)
+	{
+		string objectFile = stem + "_object" + to_string(i + 1) + ".obj";
+
+		if (!saveObjectObj(scene, i, directory + objectFile))
+		{
+			return false;
+		}
+
+		out << "object object" << i + 1 << "  " << objectFile << "\n";
+	}
+
+	for (const Instance &instance : scene.instances)
+	{
+		string material = materials.name(instance.colour, instance.phongExponent, instance.reflectivity, instance.texture);
+		out << "instance object" << instance.object + 1 << "  " << material << "  " << formatPoint(instance.position);
+
+		if (instance.degrees != 0 || instance.scale != 1)
+		{
+			out << "  " << formatPoint(instance.axis) << "  " << formatNumber(instance.degrees);
+		}
+		if (instance.scale != 1)
+		{
+			out << "  " << formatNumber(instance.scale);
+		}
+		out << "\n";
+	}
+
+	if (!out.flush())
+	{
+		cout << "ERROR: Failed writing " << fileName << endl;
+		return false;
+	}
+
+	return true;
+}
+
+// --------------------------------------------------------------------------
+// Binary format
+
+const char BINARY_SCENE_MAGIC[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', 'B' };
+const uint32_t BINARY_SCENE_VERSION = 7;
+const uint32_t BINARY_SCENE_BYTE_ORDER = 0x01020304;
+
+//Shape arrays start on this boundary, mapped files start on a page boundary
+const uint64_t BINARY_SCENE_ALIGNMENT = 16;
+
+struct BinarySceneHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;			//BINARY_SCENE_BYTE_ORDER as the writer stored it
+
+	//sizeof each shape in the writer's build
+	uint32_t planeSize;
+	uint32_t triangleSize;
+	uint32_t sphereSize;
+	uint32_t meshVertexSize;
+	uint32_t meshTriangleSize;
+	uint32_t meshSize;
+	uint32_t lightSize;
+	uint32_t textureSize;
+	uint32_t cameraKeySize;
+	uint32_t trackSize;
+	uint32_t objectKeySize;
+	uint32_t instanceSize;		//Objects are laid out like meshes
+	uint32_t reserved;			//Keeps the counts below 8 byte aligned
+
+	uint32_t hasCamera;
+	uint32_t imageCount;		//Texture images, named in order in the image names
+	float cameraPos[3];
+	float cameraDir[3];
+	float cameraFieldOfView;
+
+	//Where each array starts, in bytes from the start of the file
+	uint64_t planeCount;
+	uint64_t planeOffset;
+	uint64_t triangleCount;
+	uint64_t triangleOffset;
+	uint64_t sphereCount;
+	uint64_t sphereOffset;
+	uint64_t meshVertexCount;
+	uint64_t meshVertexOffset;
+	uint64_t meshTriangleCount;
+	uint64_t meshTriangleOffset;
+	uint64_t meshCount;
+	uint64_t meshOffset;
+	uint64_t lightCount;
+	uint64_t lightOffset;
+	uint64_t textureCount;
+	uint64_t textureOffset;
+	uint64_t cameraKeyCount;
+	uint64_t cameraKeyOffset;
+	uint64_t trackCount;
+	uint64_t trackOffset;
+	uint64_t objectKeyCount;
+	uint64_t objectKeyOffset;
+	uint64_t objectVertexCount;
+	uint64_t objectVertexOffset;
+	uint64_t objectTriangleCount;
+	uint64_t objectTriangleOffset;
+	uint64_t objectCount;
+	uint64_t objectOffset;
+	uint64_t instanceCount;
+	uint64_t instanceOffset;
+
+	//Image file names, each ended by a '\0', in bytes
+	uint64_t imageNamesSize;
+	uint64_t imageNamesOffset;
+};
+
+static_assert(sizeof(BinarySceneHeader) == 360, "the binary scene header must not be padded");
+
+//Keeps the whole file readable for as long as the returned pointer lives
+static shared_ptr<const void> mapFile(const string &fileName, uint64_t &size)
+{
+	size = 0;
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return shared_ptr<const void>();
+	}
+
+	LARGE_INTEGER fileSize;
+	HANDLE mapping = 0;
+	const void *view = 0;
+
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+	{
+		mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+	}
+
+	if (mapping)
+	{//The view keeps the mapping open by itself
+		view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+	}
+
+	CloseHandle(file);
+
+	if (!view)
+	{
+		return shared_ptr<const void>();
+	}
+
+	size = fileSize.QuadPart;
+	return shared_ptr<const void>(view, [](const void *p) { UnmapViewOfFile(p); });
+#else
+	int file = open(fileName.c_str(), O_RDONLY);
+	if (file < 0)
+	{
+		return shared_ptr<const void>();
+	}
+
+	struct stat status;
+	void *view = MAP_FAILED;
+
+	if (fstat(file, &status) == 0 && status.st_size > 0)
+	{
+		view = mmap(0, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	}
+
+	//The mapping stays valid once the file is closed
+	close(file);
+
+	if (view == MAP_FAILED)
+	{
+		return shared_ptr<const void>();
+	}
+
+	size_t mappedSize = status.st_size;
+	size = mappedSize;
+	return shared_ptr<const void>(view, [mappedSize](const void *p) { munmap(const_cast<void *>(p), mappedSize); });
+#endif
+}
+
+//For when the file can't be mapped, reads all of it into memory instead
+static shared_ptr<const void> readFile(const string &fileName, uint64_t &size)
+{
+	size = 0;
+
+	ifstream in(fileName.c_str(), ios::binary);
+	if (!in)
+	{
+		return shared_ptr<const void>();
+	}
+
+	in.seekg(0, ios::end);
+	streamoff length = in.tellg();
+	in.seekg(0, ios::beg);
+
+	if (length <= 0)
+	{
+		return shared_ptr<const void>();
+	}
+
+	//new[] of doubles lands on at least an 8 byte boundary, enough for floats and ints
+	shared_ptr<vector<double> > contents = make_shared<vector<double> >((length + sizeof(double) - 1) / sizeof(double));
+
+	if (!in.read((char *)&(*contents)[0], length))
+	{
+		return shared_ptr<const void>();
+	}
+
+	size = length;
+	return shared_ptr<const void>(contents, &(*contents)[0]);
+}
+
+//True if count shapes of the given size starting at offset fit in the file
+static bool arrayFits(uint64_t offset, uint64_t count, uint64_t shapeSize, uint64_t fileSize)
+{
+	return offset <= fileSize && offset % BINARY_SCENE_ALIGNMENT == 0
+		&& count <= (fileSize - offset) / shapeSize;
+}
+
+//Every corner has to be a real vertex and the meshes have to cover the
+//triangles in order, or a damaged file could send rays reading anywhere.
+//Objects are checked the same way.
+static bool meshesValid(const char *bytes, uint64_t vertexCount, uint64_t triangleOffset, uint64_t triangleCount,
+	uint64_t meshOffset, uint64_t meshCount)
+{
+	const MeshTriangle *triangles = (const MeshTriangle *)(bytes + triangleOffset);
+	const Mesh *meshes = (const Mesh *)(bytes + meshOffset);
+
+	for (uint64_t t = 0; t < triangleCount; t++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			if (triangles[t].corners[c] >= vertexCount)
+			{
+				return false;
+			}
+		}
+	}
+
+	uint64_t nextTriangle = 0;
+
+	for (uint64_t i = 0; i < meshCount; i++)
+	{
+		if (meshes[i].firstTriangle != nextTriangle
+			|| (uint64_t)meshes[i].firstVertex + meshes[i].vertexCount > vertexCount)
+		{
+			return false;
+		}
+
+		nextTriangle += meshes[i].triangleCount;
+	}
+
+	return nextTriangle == triangleCount;
+}
+
+//Instances have to place an object there is, at a size it can be shrunk
+//back from
+static bool instancesValid(const char *bytes, const BinarySceneHeader &header)
+{
+	const Instance *instances = (const Instance *)(bytes + header.instanceOffset);
+
+	for (uint64_t i = 0; i < header.instanceCount; i++)
+	{
+		if (instances[i].object < 0 || (uint64_t)instances[i].object >= header.objectCount
+			|| !(instances[i].scale > 0) || !(length(instances[i].axis) > 0))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//Area lights are sampled into fixed size arrays
+static bool lightsValid(const char *bytes, const BinarySceneHeader &header)
+{
+	const Light *lights = (const Light *)(bytes + header.lightOffset);
+
+	for (uint64_t i = 0; i < header.lightCount; i++)
+	{
+		if (lights[i].samples < 1 || lights[i].samples > MAX_AREA_LIGHT_SAMPLES)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//Textures have to be a kind there is and name an image there is
+static bool texturesValid(const char *bytes, const BinarySceneHeader &header)
+{
+	const Texture *textures = (const Texture *)(bytes + header.textureOffset);
+
+	for (uint64_t i = 0; i < header.textureCount; i++)
+	{
+		if (textures[i].kind < 0 || textures[i].kind >= TEXTURE_KIND_COUNT || !(textures[i].scale > 0)
+			|| (textures[i].kind == TEXTURE_IMAGE && (textures[i].image < 0 || (uint32_t)textures[i].image >= header.imageCount)))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//Each shape's texture has to be one of the scene's, or none
+template<class T>
+static bool shapeTexturesValid(const char *bytes, uint64_t offset, uint64_t count, const BinarySceneHeader &header)
+{
+	const T *shapes = (const T *)(bytes + offset);
+
+	for (uint64_t i = 0; i < count; i++)
+	{
+		if (shapes[i].texture < -1 || shapes[i].texture >= (int64_t)header.textureCount)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//Keys have to be in time order, and tracks have to move a shape there is
+//through keys there are
+static bool animationValid(const char *bytes, const BinarySceneHeader &header)
+{
+	const CameraKey *cameraKeys = (const CameraKey *)(bytes + header.cameraKeyOffset);
+	const ObjectTrack *tracks = (const ObjectTrack *)(bytes + header.trackOffset);
+	const ObjectKey *objectKeys = (const ObjectKey *)(bytes + header.objectKeyOffset);
+
+	for (uint64_t i = 1; i < header.cameraKeyCount; i++)
+	{
+		if (!(cameraKeys[i].time > cameraKeys[i - 1].time))
+		{
+			return false;
+		}
+	}
+
+	const uint64_t shapeCounts[TRACK_TARGET_COUNT] = { header.planeCount, header.triangleCount, header.sphereCount, header.meshCount };
+
+	for (uint64_t i = 0; i < header.trackCount; i++)
+	{
+		const ObjectTrack &track = tracks[i];
+
+		if (track.target < 0 || track.target >= TRACK_TARGET_COUNT || track.index < 0
+			|| (uint64_t)track.index >= shapeCounts[track.target] || track.keyCount < 1
+			|| (uint64_t)track.firstKey + track.keyCount > header.objectKeyCount)
+		{
+			return false;
+		}
+
+		for (uint32_t k = track.firstKey + 1; k < track.firstKey + track.keyCount; k++)
+		{
+			if (!(objectKeys[k].time > objectKeys[k - 1].time))
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+//Splits the image names apart, which have to be exactly imageCount names
+static bool readImageNames(const char *bytes, const BinarySceneHeader &header, vector<string> &names)
+{
+	const char *name = bytes + header.imageNamesOffset;
+	const char *end = name + header.imageNamesSize;
+
+	while (name < end)
+	{
+		const char *nameEnd = (const char *)memchr(name, '\0', end - name);
+		if (!nameEnd)
+		{
+			return false;
+		}
+
+		names.push_back(string(name, nameEnd));
+		name = nameEnd + 1;
+	}
+
+	return names.size() == header.imageCount;
+}
+
+bool loadSceneBinary(const string &fileName, Scene &scene)
+{
+	uint64_t fileSize;
+	shared_ptr<const void> contents = mapFile(fileName, fileSize);
+
+	if (!contents)
+	{
+		contents = readFile(fileName, fileSize);
+	}
+
+	if (!contents)
+	{
+		cout << "ERROR: Failed to open " << fileName << endl;
+		return false;
+	}
+
+	const char *bytes = (const char *)contents.get();
+
+	BinarySceneHeader header;
+	if (fileSize < sizeof(header))
+	{
+		cout << "ERROR: " << fileName << " is too short to be a binary scene" << endl;
+		return false;
+	}
+	memcpy(&header, bytes, sizeof(header));
+
+	if (memcmp(header.magic, BINARY_SCENE_MAGIC, sizeof(header.magic)) != 0)
+	{
+		cout << "ERROR: " << fileName << " is not a binary scene" << endl;
+		return false;
+	}
+
+	if (header.version != BINARY_SCENE_VERSION || header.byteOrder != BINARY_SCENE_BYTE_ORDER
+		|| header.planeSize != sizeof(Plane) || header.triangleSize != sizeof(Triangle) || header.sphereSize != sizeof(Sphere)
+		|| header.meshVertexSize != sizeof(vec3) || header.meshTriangleSize != sizeof(MeshTriangle) || header.meshSize != sizeof(Mesh)
+		|| header.lightSize != sizeof(Light) || header.textureSize != sizeof(Texture)
+		|| header.cameraKeySize != sizeof(CameraKey) || header.trackSize != sizeof(ObjectTrack)
+		|| header.objectKeySize != sizeof(ObjectKey) || header.instanceSize != sizeof(Instance))
+	{
+		cout << "ERROR: " << fileName << " was written by an incompatible build, save it again from its text version" << endl;
+		return false;
+	}
+
+	if (!arrayFits(header.planeOffset, header.planeCount, sizeof(Plane), fileSize)
+		|| !arrayFits(header.triangleOffset, header.triangleCount, sizeof(Triangle), fileSize)
+		|| !arrayFits(header.sphereOffset, header.sphereCount, sizeof(Sphere), fileSize)
+		|| !arrayFits(header.meshVertexOffset, header.meshVertexCount, sizeof(vec3), fileSize)
+		|| !arrayFits(header.meshTriangleOffset, header.meshTriangleCount, sizeof(MeshTriangle), fileSize)
+		|| !arrayFits(header.meshOffset, header.meshCount, sizeof(Mesh), fileSize)
+		|| !arrayFits(header.lightOffset, header.lightCount, sizeof(Light), fileSize)
+		|| !arrayFits(header.textureOffset, header.textureCount, sizeof(Texture), fileSize)
+		|| !arrayFits(header.cameraKeyOffset, header.cameraKeyCount, sizeof(CameraKey), fileSize)
+		|| !arrayFits(header.trackOffset, header.trackCount, sizeof(ObjectTrack), fileSize)
+		|| !arrayFits(header.objectKeyOffset, header.objectKeyCount, sizeof(ObjectKey), fileSize)
+		|| !arrayFits(header.objectVertexOffset, header.objectVertexCount, sizeof(vec3), fileSize)
+		|| !arrayFits(header.objectTriangleOffset, header.objectTriangleCount, sizeof(MeshTriangle), fileSize)
+		|| !arrayFits(header.objectOffset, header.objectCount, sizeof(Mesh), fileSize)
+		|| !arrayFits(header.instanceOffset, header.instanceCount, sizeof(Instance), fileSize)
+		|| !arrayFits(header.imageNamesOffset, header.imageNamesSize, 1, fileSize)
+		|| !meshesValid(bytes, header.meshVertexCount, header.meshTriangleOffset, header.meshTriangleCount,
+						header.meshOffset, header.meshCount)
+		|| !meshesValid(bytes, header.objectVertexCount, header.objectTriangleOffset, header.objectTriangleCount,
+						header.objectOffset, header.objectCount)
+		|| !instancesValid(bytes, header) || !lightsValid(bytes, header) || !texturesValid(bytes, header)
+		|| !shapeTexturesValid<Plane>(bytes, header.planeOffset, header.planeCount, header)
+		|| !shapeTexturesValid<Triangle>(bytes, header.triangleOffset, header.triangleCount, header)
+		|| !shapeTexturesValid<Sphere>(bytes, header.sphereOffset, header.sphereCount, header)
+		|| !shapeTexturesValid<Mesh>(bytes, header.meshOffset, header.meshCount, header)
+		|| !shapeTexturesValid<Instance>(bytes, header.instanceOffset, header.instanceCount, header)
+		|| !animationValid(bytes, header))
+	{
+		cout << "ERROR: " << fileName << " is truncated or damaged" << endl;
+		return false;
+	}
+
+	vector<string> imageNames;
+	if (!readImageNames(bytes, header, imageNames))
+	{
+		cout << "ERROR: " << fileName << " is truncated or damaged" << endl;
+		return false;
+	}
+
+	//Images aren't part of the file, they come from the shared cache; each
+	//name is only written once, so they land at the indices the textures use
+	for (unsigned int i = 0; i < imageNames.size(); i++)
+	{
+		if (scene.addTextureImage(imageNames[i]) != (int)i)
+		{
+			cout << "ERROR: " << fileName << " uses a texture image that can't be loaded" << endl;
+			return false;
+		}
+	}
+
+	scene.hasCamera = header.hasCamera != 0;
+	if (scene.hasCamera)
+	{
+		vec3 pos = vec3(header.cameraPos[0], header.cameraPos[1], header.cameraPos[2]);
+		vec3 dir = vec3(header.cameraDir[0], header.cameraDir[1], header.cameraDir[2]);
+
+		scene.camera = Camera(pos, dir, header.cameraFieldOfView, scene.camera.width, scene.camera.height);
+	}
+
+	//The shapes are used where they lie in the file
+	scene.planes.attach((const Plane *)(bytes + header.planeOffset), header.planeCount);
+	scene.triangles.attach((const Triangle *)(bytes + header.triangleOffset), header.triangleCount);
+	scene.spheres.attach((const Sphere *)(bytes + header.sphereOffset), header.sphereCount);
+	scene.meshVertices.attach((const vec3 *)(bytes + header.meshVertexOffset), header.meshVertexCount);
+	scene.meshTriangles.attach((const MeshTriangle *)(bytes + header.meshTriangleOffset), header.meshTriangleCount);
+	scene.meshes.attach((const Mesh *)(bytes + header.meshOffset), header.meshCount);
+	scene.lights.attach((const Light *)(bytes + header.lightOffset), header.lightCount);
+	scene.textures.attach((const Texture *)(bytes + header.textureOffset), header.textureCount);
+	scene.cameraKeys.attach((const CameraKey *)(bytes + header.cameraKeyOffset), header.cameraKeyCount);
+	scene.tracks.attach((const ObjectTrack *)(bytes + header.trackOffset), header.trackCount);
+	scene.objectKeys.attach((const ObjectKey *)(bytes + header.objectKeyOffset), header.objectKeyCount);
+	scene.objectVertices.attach((const vec3 *)(bytes + header.objectVertexOffset), header.objectVertexCount);
+	scene.objectTriangles.attach((const MeshTriangle *)(bytes + header.objectTriangleOffset), header.objectTriangleCount);
+	scene.objects.attach((const Mesh *)(bytes + header.objectOffset), header.objectCount);
+	scene.instances.attach((const Instance *)(bytes + header.instanceOffset), header.instanceCount);
+	scene.storage = contents;
+
+	return true;
+}
+
+static uint64_t alignUp(uint64_t size)
+{
+	return (size + BINARY_SCENE_ALIGNMENT - 1) / BINARY_SCENE_ALIGNMENT * BINARY_SCENE_ALIGNMENT;
+}
+
+//Zeros up to the next aligned offset
+static void writePadding(ofstream &out, uint64_t &offset)
+{
+	static const char zeros[BINARY_SCENE_ALIGNMENT] = {};
+
+	uint64_t padding = alignUp(offset) - offset;
+	out.write(zeros, padding);
+	offset += padding;
+}
+
+template<class T>
+void writeArray(ofstream &out, const PrimitiveArray<T> &shapes, uint64_t &offset)
+{
+	if (!shapes.empty())
+	{
+		out.write((const char *)shapes.data(), shapes.size() * sizeof(T));
+	}
+
+	offset += shapes.size() * sizeof(T);
+	writePadding(out, offset);
+}
+
+bool saveSceneBinary(const Scene &scene, const string &fileName)
+{
+	BinarySceneHeader header;
+	memset(&header, 0, sizeof(header));
+
+	memcpy(header.magic, BINARY_SCENE_MAGIC, sizeof(header.magic));
+	header.version = BINARY_SCENE_VERSION;
+	header.byteOrder = BINARY_SCENE_BYTE_ORDER;
+	header.planeSize = sizeof(Plane);
+	header.triangleSize = sizeof(Triangle);
+	header.sphereSize = sizeof(Sphere);
+	header.meshVertexSize = sizeof(vec3);
+	header.meshTriangleSize = sizeof(MeshTriangle);
+	header.meshSize = sizeof(Mesh);
+	header.lightSize = sizeof(Light);
+	header.textureSize = sizeof(Texture);
+	header.cameraKeySize = sizeof(CameraKey);
+	header.trackSize = sizeof(ObjectTrack);
+	header.objectKeySize = sizeof(ObjectKey);
+	header.instanceSize = sizeof(Instance);
+
+	header.hasCamera = scene.hasCamera ? 1 : 0;
+	for (int i = 0; i < 3; i++)
+	{
+		header.cameraPos[i] = scene.camera.pos[i];
+		header.cameraDir[i] = scene.camera.dir[i];
+	}
+	header.cameraFieldOfView = scene.camera.fieldOfView;
+
+	header.planeCount = scene.planes.size();
+	header.triangleCount = scene.triangles.size();
+	header.sphereCount = scene.spheres.size();
+	header.meshVertexCount = scene.meshVertices.size();
+	header.meshTriangleCount = scene.meshTriangles.size();
+	header.meshCount = scene.meshes.size();
+	header.lightCount = scene.lights.size();
+	header.textureCount = scene.textures.size();
+	header.cameraKeyCount = scene.cameraKeys.size();
+	header.trackCount = scene.tracks.size();
+	header.objectKeyCount = scene.objectKeys.size();
+	header.objectVertexCount = scene.objectVertices.size();
+	header.objectTriangleCount = scene.objectTriangles.size();
+	header.objectCount = scene.objects.size();
+	header.instanceCount = scene.instances.size();
+
+	string imageNames;
+	for (const string &imageName : scene.textureImageFiles)
+	{
+		imageNames += imageName;
+		imageNames += '\0';
+	}
+	header.imageCount = (uint32_t)scene.textureImageFiles.size();
+	header.imageNamesSize = imageNames.size();
+
+	//Arrays follow each other in this order, each padded to the alignment
+	header.planeOffset = alignUp(sizeof(header));
+	header.triangleOffset = header.planeOffset + alignUp(header.planeCount * sizeof(Plane));
+	header.sphereOffset = header.triangleOffset + alignUp(header.triangleCount * sizeof(Triangle));
+	header.meshVertexOffset = header.sphereOffset + alignUp(header.sphereCount * sizeof(Sphere));
+	header.meshTriangleOffset = header.meshVertexOffset + alignUp(header.meshVertexCount * sizeof(vec3));
+	header.meshOffset = header.meshTriangleOffset + alignUp(header.meshTriangleCount * sizeof(MeshTriangle));
+	header.lightOffset = header.meshOffset + alignUp(header.meshCount * sizeof(Mesh));
+	header.textureOffset = header.lightOffset + alignUp(header.lightCount * sizeof(Light));
+	header.cameraKeyOffset = header.textureOffset + alignUp(header.textureCount * sizeof(Texture));
+	header.trackOffset = header.cameraKeyOffset + alignUp(header.cameraKeyCount * sizeof(CameraKey));
+	header.objectKeyOffset = header.trackOffset + alignUp(header.trackCount * sizeof(ObjectTrack));
+	header.objectVertexOffset = header.objectKeyOffset + alignUp(header.objectKeyCount * sizeof(ObjectKey));
+	header.objectTriangleOffset = header.objectVertexOffset + alignUp(header.objectVertexCount * sizeof(vec3));
+	header.objectOffset = header.objectTriangleOffset + alignUp(header.objectTriangleCount * sizeof(MeshTriangle));
+	header.instanceOffset = header.objectOffset + alignUp(header.objectCount * sizeof(Mesh));
+	header.imageNamesOffset = header.instanceOffset + alignUp(header.instanceCount * sizeof(Instance));
+
+	ofstream out(fileName.c_str(), ios::binary);
+	if (!out)
+	{
+		cout << "ERROR: Failed to open " << fileName << " for writing" << endl;
+		return false;
+	}
+
+	uint64_t offset = sizeof(header);
+	out.write((const char *)&header, sizeof(header));
+	writePadding(out, offset);
+
+	writeArray(out, scene.planes, offset);
+	writeArray(out, scene.triangles, offset);
+	writeArray(out, scene.spheres, offset);
+	writeArray(out, scene.meshVertices, offset);
+	writeArray(out, scene.meshTriangles, offset);
+	writeArray(out, scene.meshes, offset);
+	writeArray(out, scene.lights, offset);
+	writeArray(out, scene.textures, offset);
+	writeArray(out, scene.cameraKeys, offset);
+	writeArray(out, scene.tracks, offset);
+	writeArray(out, scene.objectKeys, offset);
+	writeArray(out, scene.objectVertices, offset);
+	writeArray(out, scene.objectTriangles, offset);
+	writeArray(out, scene.objects, offset);
+	writeArray(out, scene.instances, offset);
+
+	out.write(imageNames.data(), imageNames.size());
+	offset += imageNames.size();
+	writePadding(out, offset);
+
+	if (!out.flush())
+	{
+		cout << "ERROR: Failed writing " << fileName << endl;
+		return false;
+	}
+
+	return true;
+}
+
+// --------------------------------------------------------------------------
+
+static bool hasExtension(const string &fileName, const char *extension)
+{
+	size_t length = strlen(extension);
+	return fileName.size() >= length && fileName.compare(fileName.size() - length, length, extension) == 0;
+}
+
+bool loadSceneFile(const string &fileName, Scene &scene)
+{
+	ifstream in(fileName.c_str(), ios::binary);
+	if (!in)
+	{
+		cout << "ERROR: Failed to open " << fileName << endl;
+		return false;
+	}
+
+	char magic[sizeof(BINARY_SCENE_MAGIC)];
+	if (in.read(magic, sizeof(magic)) && memcmp(magic, BINARY_SCENE_MAGIC, sizeof(magic)) == 0)
+	{
+		in.close();
+		return loadSceneBinary(fileName, scene);
+	}
+
+	in.clear();
+	in.seekg(0, ios::beg);
+
+	return loadSceneText(in, fileName, scene);
+}
+
+bool saveSceneFile(const Scene &scene, const string &fileName)
+{
+	if (hasExtension(fileName, BINARY_SCENE_EXTENSION))
+	{
+		return saveSceneBinary(scene, fileName);
+	}
+
+	return saveSceneText(scene, fileName);
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,83 @@
+// ==========================================================================
+// Scene Files
+//
+// Scenes are kept in files rather than compiled into the program, in one of
+// two formats:
+//
+// Text, for writing by hand. One item per line, blank lines and anything
+// after a # are ignored. Materials are named before the shapes that use them.
+//
+//     camera    eyeX eyeY eyeZ  targetX targetY targetZ  fieldOfView
+//     camerakey time  eyeX eyeY eyeZ  targetX targetY targetZ  fieldOfView
+//     light     x y z  [red green blue]
+//     arealight cornerX cornerY cornerZ  edge1X edge1Y edge1Z
+//               edge2X edge2Y edge2Z  red green blue  samples
+//     texture   name  image fileName  [scale]
+//     texture   name  checker|noise  red1 green1 blue1  red2 green2 blue2
+//               [scale]
+//     material  name  red green blue  phongExponent
+//               [reflectivity  [texture]]
+//     plane     pointX pointY pointZ  normalX normalY normalZ  material
+//     sphere    centreX centreY centreZ  radius  material
+//     triangle  x1 y1 z1  x2 y2 z2  x3 y3 z3  material
+//     mesh      fileName  material  [centreX centreY centreZ  size]
+//     object    name  fileName  [centreX centreY centreZ  size]
+//     instance  object  material  x y z  [axisX axisY axisZ degrees  [scale]]
+//     key       time  moveX moveY moveZ  [axisX axisY axisZ degrees]
+//
+// A material's reflectivity, from 0 (the default) to 1, is how much of the
+// light it reflects like a mirror. The field of view is across the width of
+// the image, in degrees. Without a camera line the scene is viewed from the
+// origin looking down -z. There can be any number of lights; point lights are
+// white unless given a colour, and an area light is the parallelogram spanned
+// by its two edges from the corner, with samples shadow rays sent to it from
+// each point it lights. Meshes are OBJ or PLY files found relative to the
+// scene file, given a size they are scaled to it and centred on the point
+// (see loadMeshFile). Objects are loaded the same way but only drawn by the
+// instances that place them: scaled about the object's origin, turned about
+// the axis, then moved to x y z. Textures are named before the materials that
+// use them; image files are found the same way as meshes and shared through
+// the texture cache, and scale (1 by default) is how many units each repeat
+// of a texture covers. Keys animate the plane, sphere, triangle or mesh on
+// the line before them, and camera keys the camera, in time order (see
+// Animation.h); a keyed shape's texture is laid on it where it sits at rest,
+// so the texture moves with it. The file is parsed a line at a time as it is
+// read, so it is never held in memory.
+//
+// Binary, for loading fast. A fixed header followed by the plane, triangle,
+// sphere, mesh, light, texture, keyframe, object and instance arrays exactly
+// as they sit in memory, then the texture image file names, whose images are
+// loaded when the scene is. The file is mapped rather than read and the
+// scene's arrays point straight into it, so loading costs little more than
+// building the BVH. Files are only readable by builds with the same byte
+// order and shape layout, which the header records.
+// ==========================================================================
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include <iostream>
+#include <string>
+
+#include "Scene.h"
+
+// --------------------------------------------------------------------------
+
+//Loads either format, telling them apart by the binary header. The scene
+//still needs building afterwards. Problems are reported on cout.
+bool loadSceneFile(const std::string &fileName, Scene &scene);
+
+//name says where a problem is, and mesh files are looked for next to it
+bool loadSceneText(std::istream &in, const std::string &name, Scene &scene);
+bool loadSceneBinary(const std::string &fileName, Scene &scene);
+
+//Writes binary if the name ends in BINARY_SCENE_EXTENSION, text otherwise
+bool saveSceneFile(const Scene &scene, const std::string &fileName);
+
+//Each mesh is written next to the scene as an OBJ, named after the scene
+bool saveSceneText(const Scene &scene, const std::string &fileName);
+bool saveSceneBinary(const Scene &scene, const std::string &fileName);
+
+const char *const BINARY_SCENE_EXTENSION = ".bscene";
+
+// --------------------------------------------------------------------------
+#endif // SCENEFILE_H
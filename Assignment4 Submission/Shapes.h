@@ -0,0 +1,310 @@
+// ==========================================================================
+// Ray Tracer Shapes
+//
+// Primitives that make up a scene, the lights shining on it, the material
+// properties of a surface hit and the rays that are traced through the scene.
+// Every shape carries its own material: a colour, a Phong exponent and a
+// reflectivity, the share of the light it reflects like a mirror. It may also
+// name one of the scene's textures, which varies the colour across it.
+//
+// Large models are stored as indexed meshes instead of loose triangles: each
+// corner is a 32 bit index into vertices shared with the neighbouring
+// triangles, and the whole mesh has one material. That is 12 bytes per
+// triangle plus its share of the vertices, against 60 for a Triangle.
+//
+// A model used over and over, like the trees of a forest, is loaded once as
+// an object and placed any number of times as instances, each moved, turned
+// and scaled and with its own material. An instance costs the same however
+// many triangles its object has.
+// ==========================================================================
+#ifndef SHAPES_H
+#define SHAPES_H
+
+#include <stdint.h>
+
+#include "glm/glm.hpp"
+
+using namespace glm;
+
+struct Sphere
+{
+	float radius;
+	vec3 centre;
+	
+	vec3 colour;
+	int phongExponent;
+	float reflectivity;
+	int texture;		//Index into the scene's textures, -1 for none
+	
+	Sphere(){};
+	
+	Sphere(float r, vec3 cent, vec3 col, int e, float refl, int tex = -1)
+	{
+		radius = r;
+		centre = cent;
+		colour = col;
+		phongExponent = e;
+		reflectivity = refl;
+		texture = tex;
+	}
+};
+
+struct Triangle
+{
+	vec3 p1;
+	vec3 p2;
+	vec3 p3;
+	
+	vec3 colour;
+	int phongExponent;
+	float reflectivity;
+	int texture;		//Index into the scene's textures, -1 for none
+	
+	Triangle(){};
+	
+	Triangle(vec3 po1, vec3 po2, vec3 po3, vec3 col, int e, float refl, int tex = -1)
+	{
+		p1 = po1;
+		p2 = po2;
+		p3 = po3;
+		colour = col;
+		phongExponent = e;
+		reflectivity = refl;
+		texture = tex;
+	}
+};
+
+struct Plane
+{
+	vec3 normalVector;
+	vec3 point;
+	
+	vec3 colour;
+	int phongExponent;
+	float reflectivity;
+	int texture;		//Index into the scene's textures, -1 for none
+	
+	Plane(){};
+	
+	Plane(vec3 nVec, vec3 poVec, vec3 col, int e, float refl, int tex = -1)
+	{
+		normalVector = nVec;
+		point = poVec;
+		colour = col;
+		phongExponent = e;
+		reflectivity = refl;
+		texture = tex;
+	}
+};
+
+//Triangle of a mesh, its corners index the scene's mesh vertices
+struct MeshTriangle
+{
+	uint32_t corners[3];
+	
+	MeshTriangle(){};
+	
+	MeshTriangle(uint32_t a, uint32_t b, uint32_t c)
+	{
+		corners[0] = a;
+		corners[1] = b;
+		corners[2] = c;
+	}
+};
+
+//Run of consecutive mesh triangles, using a run of vertices, that share one
+//material
+struct Mesh
+{
+	uint32_t firstTriangle;
+	uint32_t triangleCount;
+	uint32_t firstVertex;
+	uint32_t vertexCount;
+	
+	vec3 colour;
+	int phongExponent;
+	float reflectivity;
+	int texture;		//Index into the scene's textures, -1 for none
+	
+	Mesh(){};
+	
+	Mesh(uint32_t firstTri, uint32_t triCount, uint32_t firstVert, uint32_t vertCount, vec3 col, int e, float refl, int tex = -1)
+	{
+		firstTriangle = firstTri;
+		triangleCount = triCount;
+		firstVertex = firstVert;
+		vertexCount = vertCount;
+		colour = col;
+		phongExponent = e;
+		reflectivity = refl;
+		texture = tex;
+	}
+};
+
+//Copy of one of the scene's objects, placed by scaling it about its own
+//origin, turning it about the axis and then moving it
+struct Instance
+{
+	int object;			//Index into the scene's objects
+	vec3 position;
+	vec3 axis;
+	float degrees;
+	float scale;
+	
+	vec3 colour;
+	int phongExponent;
+	float reflectivity;
+	int texture;		//Index into the scene's textures, -1 for none
+	
+	Instance(){};
+	
+	Instance(int obj, vec3 pos, vec3 ax, float deg, float s, vec3 col, int e, float refl, int tex = -1)
+	{
+		object = obj;
+		position = pos;
+		axis = ax;
+		degrees = deg;
+		scale = s;
+		colour = col;
+		phongExponent = e;
+		reflectivity = refl;
+		texture = tex;
+	}
+};
+
+//What a texture is made of: an image wrapped over the surface, or a pattern
+//worked out from the point in space, so it runs through shapes like grain
+enum TextureKind { TEXTURE_IMAGE, TEXTURE_CHECKER, TEXTURE_NOISE, TEXTURE_KIND_COUNT };
+
+//A shape's colour is multiplied by its texture's at each point. Images are
+//laid flat across planes and triangles once every scale units, and wrapped
+//once around spheres; checkers are cubes scale units wide and noise varies
+//over about that distance.
+struct Texture
+{
+	int kind;
+	int image;			//Index into the scene's texture images, for TEXTURE_IMAGE
+	vec3 colour1;
+	vec3 colour2;		//The two checker colours, or the ends of the noise
+	float scale;
+	
+	Texture(){};
+	
+	Texture(int k, int im, vec3 col1, vec3 col2, float s)
+	{
+		kind = k;
+		image = im;
+		colour1 = col1;
+		colour2 = col2;
+		scale = s;
+	}
+};
+
+//Most shadow rays an area light may ask for per shaded point
+const int MAX_AREA_LIGHT_SAMPLES = 256;
+
+//A point light, or an area light: the parallelogram spanned by two edges
+//from its corner, shining evenly from all of its surface. Lights don't fall
+//off with distance.
+struct Light
+{
+	vec3 position;		//The point, or the area's corner
+	vec3 edge1;
+	vec3 edge2;			//Both zero for a point light
+	
+	vec3 colour;
+	int samples;		//Shadow rays towards it from each shaded point
+	
+	Light(){};
+	
+	Light(vec3 pos, vec3 col)
+	{
+		position = pos;
+		edge1 = vec3(0, 0, 0);
+		edge2 = vec3(0, 0, 0);
+		colour = col;
+		samples = 1;
+	}
+	
+	Light(vec3 corner, vec3 e1, vec3 e2, vec3 col, int s)
+	{
+		position = corner;
+		edge1 = e1;
+		edge2 = e2;
+		colour = col;
+		samples = s;
+	}
+	
+	bool isArea() const { return edge1 != vec3(0, 0, 0) || edge2 != vec3(0, 0, 0); }
+	
+	//Point at (u, v) across the light, both from 0 to 1
+	vec3 pointAt(float u, float v) const { return position + u * edge1 + v * edge2; }
+};
+
+struct MaterialProperties
+{
+	vec3 normalVector;
+	vec3 intersectionPoint;
+	
+	vec3 colour;
+	int phongExponent;
+	float reflectivity;
+	
+	MaterialProperties(){};
+	
+	MaterialProperties(vec3 nVec, vec3 iPoint, vec3 col, int e, float refl)
+	{
+		normalVector = nVec;
+		intersectionPoint = iPoint;
+		colour = col;
+		phongExponent = e;
+		reflectivity = refl;
+	}
+};
+
+//Which kind of shape a ray hit, the index says which one of them
+enum HitType { HIT_NONE, HIT_PLANE, HIT_TRIANGLE, HIT_MESH_TRIANGLE, HIT_SPHERE, HIT_INSTANCE };
+
+struct Ray
+{
+	vec3 startPoint;
+	vec3 directionVector;
+	
+	bool hasIntersected;
+	float closestDistance;
+	vec3 colour;
+	float luminance;
+	
+	//Closest hit found so far, only worked out into a material once the
+	//search is over
+	int struckType;
+	int struckIndex;
+	int struckTriangle;		//Object triangle hit, for HIT_INSTANCE
+	
+	MaterialProperties struckMaterial;
+	
+	Ray()
+	{
+		hasIntersected = false;
+		struckType = HIT_NONE;
+		struckIndex = -1;
+		struckTriangle = -1;
+	};
+	
+	Ray(vec3 start, vec3 direction, vec3 col)
+	{
+		startPoint = start;
+		directionVector = direction;
+		
+		hasIntersected = false;
+		closestDistance = 0;
+		colour = col;
+		
+		struckType = HIT_NONE;
+		struckIndex = -1;
+		struckTriangle = -1;
+		struckMaterial = MaterialProperties();
+	}
+};
+
+#endif // SHAPES_H
@@ -0,0 +1,226 @@
+// ==========================================================================
+// Stress Scenes
+// ==========================================================================
+
+#include "StressScene.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+//Box the shapes are scattered through
+static const vec3 boxLower = vec3(-10, 0.5f, -35);
+static const vec3 boxUpper = vec3(10, 10.5f, -15);
+
+static const int paletteSize = 6;
+static const vec3 palette[paletteSize] =
+{
+	vec3(0.8f, 0.2f, 0.2f), vec3(0.2f, 0.7f, 0.3f), vec3(0.2f, 0.3f, 0.8f),
+	vec3(0.8f, 0.7f, 0.2f), vec3(0.6f, 0.3f, 0.7f), vec3(0.7f, 0.7f, 0.7f)
+};
+
+//Small PCG generator, the same on every platform
+class StressRandom
+{
+public:
+	StressRandom(uint32_t seed) : state(seed * 2654435761u + 1013904223u) {}
+
+	//From 0 up to but not including 1
+	float next()
+	{
+		state = state * 747796405u + 2891336453u;
+		uint32_t word = ((state >> ((state >> 28) + 4)) ^ state) * 277803737u;
+		return (float)(((word >> 22) ^ word) >> 8) / 16777216.f;
+	}
+
+	float range(float low, float high) { return low + (high - low) * next(); }
+
+	vec3 inBox() { return vec3(range(boxLower.x, boxUpper.x), range(boxLower.y, boxUpper.y), range(boxLower.z, boxUpper.z)); }
+
+	int index(int count) { return (int)(next() * count) % count; }
+
+private:
+	uint32_t state;
+};
+
+void generateStressScene(Scene &scene, int sphereCount, int triangleCount, uint32_t seed)
+{
+	StressRandom random = StressRandom(seed);
+
+	//Spacing the shapes would have if they sat on a grid filling the box
+	vec3 box = boxUpper - boxLower;
+	int shapeCount = sphereCount + triangleCount;
+	float spacing = (float)cbrt(box.x * box.y * box.z / (shapeCount > 0 ? shapeCount : 1));
+
+	scene.planes.push_back( Plane(vec3(0, 1, 0), vec3(0, 0, 0), vec3(0.5f, 0.5f, 0.5f), 8, 0.2f) );
+
+	scene.spheres.reserve(sphereCount);
+	for (int i = 0; i < sphereCount; i++)
+	{
+		vec3 centre = random.inBox();
+		float radius = spacing * random.range(0.15f, 0.4f);
+		vec3 colour = palette[random.index(paletteSize)];
+		float reflectivity = random.next() < 0.2f ? 0.5f : 0;
+
+		scene.spheres.push_back( Sphere(radius, centre, colour, 20, reflectivity) );
+	}
+
+	scene.triangles.reserve(triangleCount);
+	for (int i = 0; i < triangleCount; i++)
+	{//Corners spread around a centre, facing every which way
+		vec3 centre = random.inBox();
+		float size = spacing * random.range(0.3f, 0.7f);
+		vec3 corners[3];
+
+		for (int j = 0; j < 3; j++)
+		{
+			corners[j] = centre + size * vec3(random.range(-1, 1), random.range(-1, 1), random.range(-1, 1));
+		}
+
+		vec3 colour = palette[random.index(paletteSize)];
+
+		scene.triangles.push_back( Triangle(corners[0], corners[1], corners[2], colour, 8, 0) );
+	}
+
+	scene.lights.push_back( Light(vec3(-15, 25, 0), vec3(0.6f, 0.6f, 0.6f)) );
+	scene.lights.push_back( Light(vec3(20, 15, -20), vec3(0.4f, 0.4f, 0.35f)) );
+
+	vec3 eye = vec3(0, 7, 4);
+	vec3 target = vec3(0, 4, -25);
+
+	scene.hasCamera = true;
+	scene.camera = Camera(eye, target - eye, 60, scene.camera.width, scene.camera.height);
+}
+
+// --------------------------------------------------------------------------
+// Forests
+
+//Around each ring of a tier of branches, and rings from its base to its tip
+static const int treeSides = 48;
+static const int treeRings = 18;
+static const int treeTiers = 3;
+
+static const int greenCount = 4;
+static const vec3 greens[greenCount] =
+{
+	vec3(0.2f, 0.5f, 0.2f), vec3(0.3f, 0.55f, 0.15f), vec3(0.15f, 0.4f, 0.25f), vec3(0.35f, 0.45f, 0.2f)
+};
+
+//Fan of triangles from a point to a ring of vertices
+static void addFan(PrimitiveArray<MeshTriangle> &triangles, uint32_t point, uint32_t ring, bool flip)
+{
+	for (int i = 0; i < treeSides; i++)
+	{
+		uint32_t a = ring + i;
+		uint32_t b = ring + (i + 1) % treeSides;
+		triangles.push_back(flip ? MeshTriangle(point, b, a) : MeshTriangle(point, a, b));
+	}
+}
+
+//Quads between two rings of vertices, as pairs of triangles
+static void addBand(PrimitiveArray<MeshTriangle> &triangles, uint32_t lower, uint32_t upper)
+{
+	for (int i = 0; i < treeSides; i++)
+	{
+		int next = (i + 1) % treeSides;
+		triangles.push_back(MeshTriangle(lower + i, lower + next, upper + next));
+		triangles.push_back(MeshTriangle(lower + i, upper + next, upper + i));
+	}
+}
+
+//Ring of vertices around the trunk's axis, a little lumpy when rough
+static uint32_t addRing(Scene &scene, StressRandom &random, float height, float radius, float roughness)
+{
+	uint32_t first = (uint32_t)scene.objectVertices.size();
+
+	for (int i = 0; i < treeSides; i++)
+	{
+		float angle = 2.f * 3.14159265f * i / treeSides;
+		float r = radius * (1.f + roughness * random.range(-1, 1));
+
+		scene.objectVertices.push_back(vec3(r * cos(angle), height, r * sin(angle)));
+	}
+
+	return first;
+}
+
+//A trunk under tiers of cones of branches, standing on the origin about 4.5
+//units tall
+static void addTree(Scene &scene, StressRandom &random)
+{
+	uint32_t firstVertex = (uint32_t)scene.objectVertices.size();
+	uint32_t firstTriangle = (uint32_t)scene.objectTriangles.size();
+
+	uint32_t trunkBase = addRing(scene, random, 0, 0.18f, 0);
+	uint32_t trunkTop = addRing(scene, random, 1.f, 0.15f, 0);
+	addBand(scene.objectTriangles, trunkBase, trunkTop);
+
+	for (int tier = 0; tier < treeTiers; tier++)
+	{
+		float base = 0.8f + 0.9f * tier;
+		float height = 1.8f - 0.2f * tier;
+		float radius = 1.3f - 0.3f * tier;
+
+		uint32_t centre = (uint32_t)scene.objectVertices.size();
+		scene.objectVertices.push_back(vec3(0, base, 0));
+
+		uint32_t previous = addRing(scene, random, base, radius, 0.1f);
+		addFan(scene.objectTriangles, centre, previous, true);
+
+		for (int ring = 1; ring < treeRings; ring++)
+		{
+			float along = (float)ring / treeRings;
+			uint32_t next = addRing(scene, random, base + height * along, radius * (1.f - along), 0.1f);
+
+			addBand(scene.objectTriangles, previous, next);
+			previous = next;
+		}
+
+		uint32_t tip = (uint32_t)scene.objectVertices.size();
+		scene.objectVertices.push_back(vec3(0, base + height, 0));
+		addFan(scene.objectTriangles, tip, previous, false);
+	}
+
+	scene.objects.push_back( Mesh(firstTriangle, (uint32_t)scene.objectTriangles.size() - firstTriangle,
+		firstVertex, (uint32_t)scene.objectVertices.size() - firstVertex, vec3(1, 1, 1), 0, 0) );
+}
+
+void generateForestScene(Scene &scene, int treeCount, uint32_t seed)
+{
+	StressRandom random = StressRandom(seed);
+
+	addTree(scene, random);
+
+	//Planted a few units apart on a jittered square grid, running away from
+	//the camera
+	int columns = std::max(1, (int)ceil(sqrt((float)treeCount)));
+	float spacing = 4.f;
+	float width = columns * spacing;
+
+	scene.planes.push_back( Plane(vec3(0, 1, 0), vec3(0, 0, 0), vec3(0.45f, 0.4f, 0.3f), 4, 0) );
+
+	scene.instances.reserve(treeCount);
+	for (int i = 0; i < treeCount; i++)
+	{
+		float x = (i % columns + random.range(0.1f, 0.9f)) * spacing - width / 2;
+		float z = -(i / columns + random.range(0.1f, 0.9f)) * spacing - 5;
+		vec3 colour = greens[random.index(greenCount)];
+
+		scene.instances.push_back( Instance(0, vec3(x, 0, z), vec3(0, 1, 0), random.range(0, 360),
+			random.range(0.7f, 1.3f), colour, 8, 0) );
+	}
+
+	scene.lights.push_back( Light(vec3(-60, 80, 20), vec3(0.7f, 0.7f, 0.65f)) );
+	scene.lights.push_back( Light(vec3(80, 40, -40), vec3(0.3f, 0.3f, 0.35f)) );
+
+	vec3 eye = vec3(0, 14, 8);
+	vec3 target = vec3(0, 0, -50);
+
+	scene.hasCamera = true;
+	scene.camera = Camera(eye, target - eye, 60, scene.camera.width, scene.camera.height);
+}
+
+// --------------------------------------------------------------------------
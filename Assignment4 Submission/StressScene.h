@@ -0,0 +1,32 @@
+// ==========================================================================
+// Stress Scenes
+//
+// Scenes made up on the spot for benchmarking: any number of spheres and
+// triangles scattered through a box above a floor, lit by two point lights
+// and seen through a camera looking into the box. Shapes shrink as their
+// number grows so the box stays about as full whatever the counts.
+//
+// The scattering uses its own random numbers rather than the standard
+// library's, whose results differ between implementations, so the same
+// counts and seed make the same scene, and the same image, on every machine.
+//
+// A forest is the other kind: one tree of about 5,000 triangles, made up as
+// an object, with any number of instances of it planted over a floor, each
+// turned, scaled and coloured differently.
+// ==========================================================================
+#ifndef STRESSSCENE_H
+#define STRESSSCENE_H
+
+#include <stdint.h>
+
+#include "Scene.h"
+
+// --------------------------------------------------------------------------
+
+//Adds the shapes, lights and camera to an empty scene, which still needs
+//building afterwards
+void generateStressScene(Scene &scene, int sphereCount, int triangleCount, uint32_t seed = 1);
+void generateForestScene(Scene &scene, int treeCount, uint32_t seed = 1);
+
+// --------------------------------------------------------------------------
+#endif // STRESSSCENE_H
@@ -0,0 +1,254 @@
+// ==========================================================================
+// Ray Tracer Textures
+// ==========================================================================
+
+#include "Texture.h"
+
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+
+#include <stb_image.h>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+bool MipImage::load(const string &fileName)
+{
+	int w, h, components;
+	unsigned char *pixels = stbi_load(fileName.c_str(), &w, &h, &components, 3);
+
+	if (!pixels)
+	{
+		cout << "ERROR: Failed to read texture image " << fileName << endl;
+		return false;
+	}
+
+	levels.clear();
+	levels.push_back(Level());
+
+	Level &full = levels.back();
+	full.width = w;
+	full.height = h;
+	full.texels.resize(w * h * 3);
+
+	//Files start with their top row
+	for (int y = 0; y < h; y++)
+	{
+		const unsigned char *row = pixels + (h - 1 - y) * w * 3;
+
+		for (int i = 0; i < w * 3; i++)
+		{
+			full.texels[y * w * 3 + i] = row[i] / 255.f;
+		}
+	}
+
+	stbi_image_free(pixels);
+
+	//Each level averages 2x2 texels of the one before, odd edges reuse
+	//their last row or column
+	while (levels.back().width > 1 || levels.back().height > 1)
+	{
+		const Level &previous = levels.back();
+
+		Level next;
+		next.width = std::max(1, previous.width / 2);
+		next.height = std::max(1, previous.height / 2);
+		next.texels.resize(next.width * next.height * 3);
+
+		for (int y = 0; y < next.height; y++)
+		{
+			int y0 = std::min(2 * y, previous.height - 1);
+			int y1 = std::min(2 * y + 1, previous.height - 1);
+
+			for (int x = 0; x < next.width; x++)
+			{
+				int x0 = std::min(2 * x, previous.width - 1);
+				int x1 = std::min(2 * x + 1, previous.width - 1);
+
+				for (int c = 0; c < 3; c++)
+				{
+					float sum = previous.texels[(y0 * previous.width + x0) * 3 + c]
+						+ previous.texels[(y0 * previous.width + x1) * 3 + c]
+						+ previous.texels[(y1 * previous.width + x0) * 3 + c]
+						+ previous.texels[(y1 * previous.width + x1) * 3 + c];
+
+					next.texels[(y * next.width + x) * 3 + c] = sum / 4.f;
+				}
+			}
+		}
+
+		levels.push_back(next);
+	}
+
+	return true;
+}
+
+//Texel coordinates wrap around, so the image tiles
+static int wrap(int i, int size)
+{
+	i %= size;
+	return (i < 0) ? i + size : i;
+}
+
+vec3 MipImage::bilinear(const Level &level, vec2 uv) const
+{
+	//Texel centres sit half a texel in from their corners
+	float x = uv.x * level.width - 0.5f;
+	float y = uv.y * level.height - 0.5f;
+
+	float fx = floor(x);
+	float fy = floor(y);
+	float tx = x - fx;
+	float ty = y - fy;
+
+	int x0 = wrap((int)fx, level.width);
+	int x1 = wrap(x0 + 1, level.width);
+	int y0 = wrap((int)fy, level.height);
+	int y1 = wrap(y0 + 1, level.height);
+
+	const float *t00 = &level.texels[(y0 * level.width + x0) * 3];
+	const float *t10 = &level.texels[(y0 * level.width + x1) * 3];
+	const float *t01 = &level.texels[(y1 * level.width + x0) * 3];
+	const float *t11 = &level.texels[(y1 * level.width + x1) * 3];
+
+	vec3 colour;
+	for (int c = 0; c < 3; c++)
+	{
+		float bottom = t00[c] + (t10[c] - t00[c]) * tx;
+		float top = t01[c] + (t11[c] - t01[c]) * tx;
+		colour[c] = bottom + (top - bottom) * ty;
+	}
+
+	return colour;
+}
+
+vec3 MipImage::sample(vec2 uv, float lod) const
+{
+	if (levels.empty())
+	{
+		return vec3(1, 1, 1);
+	}
+
+	int last = (int)levels.size() - 1;
+	lod = clamp(lod, 0.f, (float)last);
+
+	int lower = (int)lod;
+	float blend = lod - lower;
+
+	vec3 colour = bilinear(levels[lower], uv);
+
+	if (blend > 0 && lower < last)
+	{
+		colour = mix(colour, bilinear(levels[lower + 1], uv), blend);
+	}
+
+	return colour;
+}
+
+// --------------------------------------------------------------------------
+
+shared_ptr<const MipImage> loadTextureImage(const string &fileName)
+{
+	//Weak, so an image goes once the last scene using it does
+	static mutex cacheLock;
+	static map<string, weak_ptr<const MipImage> > cache;
+
+	lock_guard<mutex> guard(cacheLock);
+
+	shared_ptr<const MipImage> image = cache[fileName].lock();
+
+	if (!image)
+	{
+		shared_ptr<MipImage> loaded = make_shared<MipImage>();
+
+		if (!loaded->load(fileName))
+		{
+			cache.erase(fileName);
+			return shared_ptr<const MipImage>();
+		}
+
+		cache[fileName] = loaded;
+		image = loaded;
+	}
+
+	return image;
+}
+
+// --------------------------------------------------------------------------
+
+//Same value every time for the same lattice point, from 0 to 1
+static float latticeValue(int x, int y, int z)
+{
+	uint32_t h = (uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u ^ (uint32_t)z * 83492791u;
+	h ^= h >> 13;
+	h *= 0x5bd1e995u;
+	h ^= h >> 15;
+
+	return (h & 0xffffff) / 16777215.f;
+}
+
+//Value noise: lattice values blended smoothly in between
+static float valueNoise(vec3 p)
+{
+	vec3 cell = floor(p);
+	vec3 t = p - cell;
+	t = t * t * (3.f - 2.f * t);
+
+	int x = (int)cell.x, y = (int)cell.y, z = (int)cell.z;
+
+	float c00 = mix(latticeValue(x, y, z), latticeValue(x + 1, y, z), t.x);
+	float c10 = mix(latticeValue(x, y + 1, z), latticeValue(x + 1, y + 1, z), t.x);
+	float c01 = mix(latticeValue(x, y, z + 1), latticeValue(x + 1, y, z + 1), t.x);
+	float c11 = mix(latticeValue(x, y + 1, z + 1), latticeValue(x + 1, y + 1, z + 1), t.x);
+
+	return mix(mix(c00, c10, t.y), mix(c01, c11, t.y), t.z);
+}
+
+//Octaves of noise, each twice as fine and half as strong as the last
+const int NOISE_OCTAVES = 4;
+
+vec3 textureColour(const Texture &texture, const MipImage *image, vec3 point, vec2 uv, float uvPerUnit, float footprint)
+{
+	if (texture.kind == TEXTURE_CHECKER)
+	{//Nudged so points on a cube's face, as on a floor at 0, all fall the same side
+		vec3 cell = floor(point / texture.scale + 1e-3f);
+		int parity = ((int)cell.x + (int)cell.y + (int)cell.z) & 1;
+
+		return parity ? texture.colour2 : texture.colour1;
+	}
+
+	if (texture.kind == TEXTURE_NOISE)
+	{
+		vec3 p = point / texture.scale;
+		float sum = 0;
+		float weight = 1;
+		float total = 0;
+
+		for (int i = 0; i < NOISE_OCTAVES; i++)
+		{
+			sum += weight * valueNoise(p);
+			total += weight;
+			weight *= 0.5f;
+			p *= 2.f;
+		}
+
+		return mix(texture.colour1, texture.colour2, sum / total);
+	}
+
+	if (!image)
+	{
+		return vec3(1, 1, 1);
+	}
+
+	//Level whose texels are about as wide as the pixel's footprint
+	float texels = footprint * uvPerUnit * image->width();
+	float lod = (texels > 1) ? log2(texels) : 0;
+
+	return image->sample(uv, lod);
+}
+
+// --------------------------------------------------------------------------
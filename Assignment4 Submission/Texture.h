@@ -0,0 +1,60 @@
+// ==========================================================================
+// Ray Tracer Textures
+//
+// Images are read once into a shared cache, however many textures, materials
+// or scenes use them, and kept with a chain of MIP levels, each half the size
+// of the one before, down to a single texel. A lookup blends the two levels
+// whose texels are nearest the size of the patch of surface a pixel covers,
+// so a texture far away is averaged rather than sampled into noise.
+//
+// Checkers and noise aren't stored at all; they are worked out from the
+// point being shaded each time.
+// ==========================================================================
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Shapes.h"
+
+// --------------------------------------------------------------------------
+
+class MipImage
+{
+public:
+	//Reads an 8 bit image, problems are reported on cout
+	bool load(const std::string &fileName);
+
+	int width() const { return levels.empty() ? 0 : levels[0].width; }
+	int height() const { return levels.empty() ? 0 : levels[0].height; }
+
+	//Bilinear lookups in the two levels either side of lod, where 0 is the
+	//full image and each step up halves it, blended. (0, 0) is the image's
+	//bottom-left corner and (1, 1) its top-right; beyond that it repeats.
+	vec3 sample(vec2 uv, float lod) const;
+
+private:
+	struct Level
+	{
+		int width;
+		int height;
+		std::vector<float> texels;		//RGB, bottom row first
+	};
+	std::vector<Level> levels;
+
+	vec3 bilinear(const Level &level, vec2 uv) const;
+};
+
+//The image in the file, loaded the first time it is asked for and shared
+//from then on while anything still holds it. Null if it can't be read.
+std::shared_ptr<const MipImage> loadTextureImage(const std::string &fileName);
+
+//Colour of the texture at a point. uv places it in an image texture, and
+//uvPerUnit is how far the uvs move for each scene unit moved across the
+//surface; footprint is the width of the surface one pixel covers there.
+vec3 textureColour(const Texture &texture, const MipImage *image, vec3 point, vec2 uv, float uvPerUnit, float footprint);
+
+// --------------------------------------------------------------------------
+#endif // TEXTURE_H
@@ -0,0 +1,150 @@
+// ==========================================================================
+// Work-Stealing Thread Pool
+// ==========================================================================
+
+#include "ThreadPool.h"
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+    : m_batch(0), m_stop(false), m_remaining(0)
+{
+    if (threadCount == 0)
+        threadCount = thread::hardware_concurrency();
+    if (threadCount == 0)
+        threadCount = 1;
+
+    // queue 0 belongs to whichever thread submits a batch
+    for (unsigned int i = 0; i < threadCount; ++i)
+        m_queues.push_back(new WorkQueue());
+    for (unsigned int i = 1; i < threadCount; ++i)
+        m_workers.push_back(thread(&ThreadPool::WorkerLoop, this, (int)i));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> guard(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+
+    for (size_t i = 0; i < m_workers.size(); ++i)
+        m_workers[i].join();
+    for (size_t i = 0; i < m_queues.size(); ++i)
+        delete m_queues[i];
+}
+
+// --------------------------------------------------------------------------
+
+void ThreadPool::ParallelFor(int count, const Job &job)
+{
+    ParallelForLanes(count, [&job](int index, int) { job(index); });
+}
+
+void ThreadPool::ParallelForLanes(int count, const LaneJob &job)
+{
+    if (count <= 0) return;
+
+    // nothing to share the work with, so just run it in order
+    if (m_workers.empty())
+    {
+        for (int i = 0; i < count; ++i)
+            job(i, 0);
+        return;
+    }
+
+    // the counter must be set before any job becomes visible to a worker
+    m_remaining = count;
+
+    // deal jobs out round-robin so every queue starts with a fair share; each
+    // queue is consumed from the back, so push in reverse to run in order
+    int queueCount = (int)m_queues.size();
+    for (int q = 0; q < queueCount; ++q)
+    {
+        lock_guard<mutex> guard(m_queues[q]->lock);
+        for (int i = count - 1; i >= 0; --i)
+        {
+            if (i % queueCount != q) continue;
+            Task task = { &job, i };
+            m_queues[q]->tasks.push_back(task);
+        }
+    }
+
+    {
+        lock_guard<mutex> guard(m_mutex);
+        ++m_batch;
+    }
+    m_wake.notify_all();
+
+    // help out, then wait for the stragglers
+    Drain(0);
+
+    unique_lock<mutex> guard(m_mutex);
+    m_done.wait(guard, [this]() { return m_remaining.load() == 0; });
+}
+
+// --------------------------------------------------------------------------
+
+bool ThreadPool::PopLocal(int queueIndex, Task &task)
+{
+    WorkQueue &queue = *m_queues[queueIndex];
+    lock_guard<mutex> guard(queue.lock);
+    if (queue.tasks.empty()) return false;
+
+    task = queue.tasks.back();
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool ThreadPool::Steal(int queueIndex, Task &task)
+{
+    int queueCount = (int)m_queues.size();
+    for (int offset = 1; offset < queueCount; ++offset)
+    {
+        WorkQueue &victim = *m_queues[(queueIndex + offset) % queueCount];
+        lock_guard<mutex> guard(victim.lock);
+        if (victim.tasks.empty()) continue;
+
+        task = victim.tasks.front();
+        victim.tasks.pop_front();
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::Drain(int queueIndex)
+{
+    Task task;
+    while (PopLocal(queueIndex, task) || Steal(queueIndex, task))
+    {
+        (*task.job)(task.index, queueIndex);
+
+        if (--m_remaining == 0)
+        {
+            // take the lock so the waiting submitter cannot miss the signal
+            lock_guard<mutex> guard(m_mutex);
+            m_done.notify_all();
+        }
+    }
+}
+
+void ThreadPool::WorkerLoop(int queueIndex)
+{
+    unsigned long seenBatch = 0;
+    for (;;)
+    {
+        {
+            unique_lock<mutex> guard(m_mutex);
+            m_wake.wait(guard, [&]() { return m_stop || m_batch != seenBatch; });
+            if (m_stop) return;
+            seenBatch = m_batch;
+        }
+
+        Drain(queueIndex);
+    }
+}
+
+// --------------------------------------------------------------------------
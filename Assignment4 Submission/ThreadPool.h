@@ -0,0 +1,79 @@
+// ==========================================================================
+// Work-Stealing Thread Pool
+//
+// A fixed set of worker threads, sized to the machine by default, that run
+// batches of indexed jobs. Each worker owns a double-ended queue: it takes
+// work from the back of its own queue and, once that runs dry, steals from
+// the front of the other workers' queues. The thread that submits a batch
+// takes part in the work and returns when every job has finished.
+// ==========================================================================
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// --------------------------------------------------------------------------
+
+class ThreadPool
+{
+public:
+    typedef std::function<void(int)> Job;
+
+    // a job that is also told the lane running it, in [0, ThreadCount),
+    // where 0 is the thread that submitted the batch; no two jobs on the
+    // same lane ever run at once, so a lane can own per-thread scratch
+    typedef std::function<void(int index, int lane)> LaneJob;
+
+    // a thread count of 0 uses one thread per hardware core
+    explicit ThreadPool(unsigned int threadCount = 0);
+    ~ThreadPool();
+
+    // number of threads that take part in a batch, including the caller
+    unsigned int ThreadCount() const { return (unsigned int)m_queues.size(); }
+
+    // runs job(0) ... job(count-1) across the pool and blocks until all of
+    // them have completed; batches must be submitted from one thread at a time
+    void ParallelFor(int count, const Job &job);
+    void ParallelForLanes(int count, const LaneJob &job);
+
+private:
+    struct Task
+    {
+        const LaneJob *job;
+        int index;
+    };
+
+    struct WorkQueue
+    {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    bool PopLocal(int queueIndex, Task &task);
+    bool Steal(int queueIndex, Task &task);
+    void Drain(int queueIndex);
+    void WorkerLoop(int queueIndex);
+
+    std::vector<WorkQueue *> m_queues;
+    std::vector<std::thread> m_workers;
+
+    // batch hand-off and completion signalling
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    unsigned long m_batch;
+    bool m_stop;
+    std::atomic<int> m_remaining;
+
+    ThreadPool(const ThreadPool &);
+    ThreadPool &operator=(const ThreadPool &);
+};
+
+// --------------------------------------------------------------------------
+#endif // THREADPOOL_H
@@ -0,0 +1,55 @@
+// ==========================================================================
+// Tile-Based Parallel Renderer
+// ==========================================================================
+
+#include "TileRenderer.h"
+#include "ImageBuffer.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+TileRenderer::TileRenderer(unsigned int threadCount, int tileSize)
+    : m_pool(threadCount), m_tileSize(std::max(1, tileSize))
+{
+}
+
+void TileRenderer::Render(ImageBuffer &buffer, int width, int height, const PixelShader &shade)
+{
+    RenderBlocks(buffer, width, height, [&](int x0, int y0, int w, int h, vec3 *colours)
+    {
+        for (int y = 0; y < h; ++y)
+            for (int x = 0; x < w; ++x)
+                colours[y * w + x] = shade(x0 + x, y0 + y);
+    });
+}
+
+void TileRenderer::RenderBlocks(ImageBuffer &buffer, int width, int height, const BlockShader &shade)
+{
+    int tilesX = (width + m_tileSize - 1) / m_tileSize;
+    int tilesY = (height + m_tileSize - 1) / m_tileSize;
+
+    m_pool.ParallelFor(tilesX * tilesY, [&](int tile)
+    {
+        int x0 = (tile % tilesX) * m_tileSize;
+        int y0 = (tile / tilesX) * m_tileSize;
+        int w = std::min(m_tileSize, width - x0);
+        int h = std::min(m_tileSize, height - y0);
+
+        // shade into a private block so threads only meet in SetBlock, or
+        // not at all when the buffer is stored in tiles the same size
+        vector<vec3> pixels(w * h);
+        shade(x0, y0, w, h, &pixels[0]);
+
+        if (buffer.TileSize() == m_tileSize)
+            buffer.SetTile(tile % tilesX, tile / tilesX, &pixels[0]);
+        else
+            buffer.SetBlock(x0, y0, w, h, &pixels[0]);
+    });
+}
+
+// --------------------------------------------------------------------------
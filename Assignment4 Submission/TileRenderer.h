@@ -0,0 +1,49 @@
+// ==========================================================================
+// Tile-Based Parallel Renderer
+//
+// Splits an image into square tiles and shades them on a work-stealing thread
+// pool. Every pixel is shaded by the same callback the serial loop would use,
+// so the result doesn't depend on the number of threads or the tile order.
+// ==========================================================================
+#ifndef TILERENDERER_H
+#define TILERENDERER_H
+
+#include <functional>
+#include <glm/vec3.hpp>
+
+#include "ThreadPool.h"
+
+class ImageBuffer;
+
+// --------------------------------------------------------------------------
+
+class TileRenderer
+{
+public:
+    // returns the colour of pixel (x,y); called concurrently from all threads
+    typedef std::function<glm::vec3(int x, int y)> PixelShader;
+
+    // fills colours (row by row) with the width x height block of pixels
+    // starting at (x,y); called concurrently from all threads
+    typedef std::function<void(int x, int y, int width, int height, glm::vec3 *colours)> BlockShader;
+
+    // a thread count of 0 uses one thread per hardware core, 1 renders serially
+    explicit TileRenderer(unsigned int threadCount = 0, int tileSize = 32);
+
+    unsigned int ThreadCount() const { return m_pool.ThreadCount(); }
+    int TileSize() const { return m_tileSize; }
+    ThreadPool &Pool() { return m_pool; }
+
+    // shades every pixel of a width x height image into the buffer
+    void Render(ImageBuffer &buffer, int width, int height, const PixelShader &shade);
+
+    // as Render, but hands each whole tile to the shader at once
+    void RenderBlocks(ImageBuffer &buffer, int width, int height, const BlockShader &shade);
+
+private:
+    ThreadPool m_pool;
+    int m_tileSize;
+};
+
+// --------------------------------------------------------------------------
+#endif // TILERENDERER_H
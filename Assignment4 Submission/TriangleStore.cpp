@@ -0,0 +1,488 @@
+// ==========================================================================
+// Packed Triangle Store
+//
+// Kernels are compiled for SSE and AVX regardless of the compiler flags and
+// the best one the running CPU supports is chosen on first use. Setting
+// RAYTRACER_ISA to scalar, sse or avx forces a particular one, which is handy
+// for comparing them.
+// ==========================================================================
+
+#include "TriangleStore.h"
+#include "BVH.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define TRIANGLE_SIMD
+	#define TARGET_SSE __attribute__((target("sse2")))
+	#define TARGET_AVX __attribute__((target("avx")))
+	#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	#define TRIANGLE_SIMD
+	#define TARGET_SSE
+	#define TARGET_AVX
+	#include <immintrin.h>
+	#include <intrin.h>
+#endif
+
+using namespace std;
+
+//Widest load a kernel does past the last slot
+const int SLOT_PADDING = 8;
+
+// --------------------------------------------------------------------------
+// Aligned storage
+
+AlignedFloats::~AlignedFloats()
+{
+	#ifdef TRIANGLE_SIMD
+	_mm_free(data);
+	#else
+	free(data);
+	#endif
+}
+
+void AlignedFloats::resize(int n)
+{
+	#ifdef TRIANGLE_SIMD
+	_mm_free(data);
+	data = (float *)_mm_malloc((n + SLOT_PADDING) * sizeof(float), 32);
+	#else
+	free(data);
+	data = (float *)malloc((n + SLOT_PADDING) * sizeof(float));
+	#endif
+
+	//Padding slots are all zero, a degenerate triangle no ray can hit
+	memset(data, 0, (n + SLOT_PADDING) * sizeof(float));
+	count = n;
+}
+
+// --------------------------------------------------------------------------
+// Building
+
+void TriangleStore::clear()
+{
+	count = 0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		v0[axis].resize(0);
+		e1[axis].resize(0);
+		e2[axis].resize(0);
+	}
+	triangleIndices.clear();
+	slotOffsets.clear();
+}
+
+void TriangleStore::build(const PrimitiveArray<Triangle> &triangles, const BVH &bvh)
+{
+	clear();
+
+	count = (int)triangles.size();
+	for (int axis = 0; axis < 3; axis++)
+	{
+		v0[axis].resize(count);
+		e1[axis].resize(count);
+		e2[axis].resize(count);
+	}
+
+	triangleIndices.reserve(count);
+	slotOffsets.reserve(bvh.primitiveCount() + 1);
+
+	//Walk the primitives in leaf order, so every leaf's triangles end up in
+	//consecutive slots
+	int slot = 0;
+	for (int i = 0; i < bvh.primitiveCount(); i++)
+	{
+		slotOffsets.push_back(slot);
+
+		const BVHPrimitive &primitive = bvh.primitive(i);
+		if (primitive.type != BVHPrimitive::TRIANGLE)
+		{
+			continue;
+		}
+
+		const Triangle &triangle = triangles[primitive.index];
+		vec3 edge1 = triangle.p2 - triangle.p1;
+		vec3 edge2 = triangle.p3 - triangle.p1;
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			v0[axis].get()[slot] = triangle.p1[axis];
+			e1[axis].get()[slot] = edge1[axis];
+			e2[axis].get()[slot] = edge2[axis];
+		}
+
+		triangleIndices.push_back(primitive.index);
+		slot++;
+	}
+	slotOffsets.push_back(slot);
+}
+
+void TriangleStore::update(const PrimitiveArray<Triangle> &triangles, const BVH &bvh, const vector<BVHPrimitive> &moved)
+{
+	for (const BVHPrimitive &primitive : moved)
+	{
+		if (primitive.type != BVHPrimitive::TRIANGLE)
+		{
+			continue;
+		}
+
+		//Triangles come first in their leaf, so a triangle's primitive
+		//position maps straight to its slot
+		int slot = slotOffsets[bvh.position(primitive)];
+		const Triangle &triangle = triangles[primitive.index];
+		vec3 edge1 = triangle.p2 - triangle.p1;
+		vec3 edge2 = triangle.p3 - triangle.p1;
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			v0[axis].get()[slot] = triangle.p1[axis];
+			e1[axis].get()[slot] = edge1[axis];
+			e2[axis].get()[slot] = edge2[axis];
+		}
+	}
+}
+
+TriangleStore::Arrays TriangleStore::arrays() const
+{
+	Arrays a;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		a.v0[axis] = v0[axis].get();
+		a.e1[axis] = e1[axis].get();
+		a.e2[axis] = e2[axis].get();
+	}
+	return a;
+}
+
+// --------------------------------------------------------------------------
+// Kernels
+//
+// Every kernel answers the same question for the slots [begin, end): in
+// closest mode, the nearest hit with 0 <= t < maxDistance; in any-hit mode,
+// the first hit found with 0 <= t <= maxDistance.
+
+typedef int (*TriangleKernel)(const TriangleStore::Arrays &a, const vec3 &start, const vec3 &direction,
+	int begin, int end, float maxDistance, bool anyHit, float &hitDistance);
+
+static int scalarKernel(const TriangleStore::Arrays &a, const vec3 &start, const vec3 &direction,
+	int begin, int end, float maxDistance, bool anyHit, float &hitDistance)
+{
+	int bestSlot = -1;
+
+	for (int i = begin; i < end; i++)
+	{
+		vec3 v0 = vec3(a.v0[0][i], a.v0[1][i], a.v0[2][i]);
+		vec3 e1 = vec3(a.e1[0][i], a.e1[1][i], a.e1[2][i]);
+		vec3 e2 = vec3(a.e2[0][i], a.e2[1][i], a.e2[2][i]);
+
+		vec3 p = cross(direction, e2);
+		float det = dot(e1, p);
+		if (std::abs(det) <= DETERMINANT_EPSILON)
+		{
+			continue;
+		}
+		float inverseDet = 1.f / det;
+
+		vec3 s = start - v0;
+		float u = dot(s, p) * inverseDet;
+		vec3 q = cross(s, e1);
+		float v = dot(direction, q) * inverseDet;
+		float t = dot(e2, q) * inverseDet;
+
+		if (u < 0.f || v < 0.f || u + v > 1.f || t < 0.f)
+		{
+			continue;
+		}
+
+		if (anyHit)
+		{
+			if (t <= maxDistance)
+			{
+				hitDistance = t;
+				return i;
+			}
+		}
+		else if (t < maxDistance)
+		{
+			maxDistance = t;
+			hitDistance = t;
+			bestSlot = i;
+		}
+	}
+
+	return bestSlot;
+}
+
+#ifdef TRIANGLE_SIMD
+
+TARGET_SSE
+static int sseKernel(const TriangleStore::Arrays &a, const vec3 &start, const vec3 &direction,
+	int begin, int end, float maxDistance, bool anyHit, float &hitDistance)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 epsilon = _mm_set1_ps(DETERMINANT_EPSILON);
+	const __m128 signMask = _mm_set1_ps(-0.f);
+	const __m128 laneOffsets = _mm_setr_ps(0.f, 1.f, 2.f, 3.f);
+
+	__m128 dx = _mm_set1_ps(direction.x);
+	__m128 dy = _mm_set1_ps(direction.y);
+	__m128 dz = _mm_set1_ps(direction.z);
+	__m128 ox = _mm_set1_ps(start.x);
+	__m128 oy = _mm_set1_ps(start.y);
+	__m128 oz = _mm_set1_ps(start.z);
+
+	__m128 limit = _mm_set1_ps(maxDistance);
+	int bestSlot = -1;
+
+	for (int i = begin; i < end; i += 4)
+	{
+		__m128 e1x = _mm_loadu_ps(a.e1[0] + i);
+		__m128 e1y = _mm_loadu_ps(a.e1[1] + i);
+		__m128 e1z = _mm_loadu_ps(a.e1[2] + i);
+		__m128 e2x = _mm_loadu_ps(a.e2[0] + i);
+		__m128 e2y = _mm_loadu_ps(a.e2[1] + i);
+		__m128 e2z = _mm_loadu_ps(a.e2[2] + i);
+
+		//p = direction x e2
+		__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+		__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+		__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+
+		__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+		__m128 inverseDet = _mm_div_ps(one, det);
+
+		//s = start - v0
+		__m128 sx = _mm_sub_ps(ox, _mm_loadu_ps(a.v0[0] + i));
+		__m128 sy = _mm_sub_ps(oy, _mm_loadu_ps(a.v0[1] + i));
+		__m128 sz = _mm_sub_ps(oz, _mm_loadu_ps(a.v0[2] + i));
+
+		__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inverseDet);
+
+		//q = s x e1
+		__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+		__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+		__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+
+		__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inverseDet);
+		__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverseDet);
+
+		__m128 hit = _mm_cmpgt_ps(_mm_andnot_ps(signMask, det), epsilon);
+		hit = _mm_and_ps(hit, _mm_cmpge_ps(u, zero));
+		hit = _mm_and_ps(hit, _mm_cmpge_ps(v, zero));
+		hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), one));
+		hit = _mm_and_ps(hit, _mm_cmpge_ps(t, zero));
+		hit = _mm_and_ps(hit, anyHit ? _mm_cmple_ps(t, limit) : _mm_cmplt_ps(t, limit));
+		hit = _mm_and_ps(hit, _mm_cmplt_ps(laneOffsets, _mm_set1_ps((float)(end - i))));
+
+		int lanes = _mm_movemask_ps(hit);
+		if (lanes == 0)
+		{
+			continue;
+		}
+
+		float distances[4];
+		_mm_storeu_ps(distances, t);
+
+		for (int lane = 0; lane < 4; lane++)
+		{
+			if ( !(lanes & (1 << lane)) ) continue;
+
+			if (anyHit)
+			{
+				hitDistance = distances[lane];
+				return i + lane;
+			}
+
+			if (distances[lane] < maxDistance)
+			{
+				maxDistance = distances[lane];
+				hitDistance = maxDistance;
+				bestSlot = i + lane;
+			}
+		}
+		limit = _mm_set1_ps(maxDistance);
+	}
+
+	return bestSlot;
+}
+
+TARGET_AVX
+static int avxKernel(const TriangleStore::Arrays &a, const vec3 &start, const vec3 &direction,
+	int begin, int end, float maxDistance, bool anyHit, float &hitDistance)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.f);
+	const __m256 epsilon = _mm256_set1_ps(DETERMINANT_EPSILON);
+	const __m256 signMask = _mm256_set1_ps(-0.f);
+	const __m256 laneOffsets = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+
+	__m256 dx = _mm256_set1_ps(direction.x);
+	__m256 dy = _mm256_set1_ps(direction.y);
+	__m256 dz = _mm256_set1_ps(direction.z);
+	__m256 ox = _mm256_set1_ps(start.x);
+	__m256 oy = _mm256_set1_ps(start.y);
+	__m256 oz = _mm256_set1_ps(start.z);
+
+	__m256 limit = _mm256_set1_ps(maxDistance);
+	int bestSlot = -1;
+
+	for (int i = begin; i < end; i += 8)
+	{
+		__m256 e1x = _mm256_loadu_ps(a.e1[0] + i);
+		__m256 e1y = _mm256_loadu_ps(a.e1[1] + i);
+		__m256 e1z = _mm256_loadu_ps(a.e1[2] + i);
+		__m256 e2x = _mm256_loadu_ps(a.e2[0] + i);
+		__m256 e2y = _mm256_loadu_ps(a.e2[1] + i);
+		__m256 e2z = _mm256_loadu_ps(a.e2[2] + i);
+
+		//p = direction x e2
+		__m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+		__m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+		__m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+
+		__m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+		__m256 inverseDet = _mm256_div_ps(one, det);
+
+		//s = start - v0
+		__m256 sx = _mm256_sub_ps(ox, _mm256_loadu_ps(a.v0[0] + i));
+		__m256 sy = _mm256_sub_ps(oy, _mm256_loadu_ps(a.v0[1] + i));
+		__m256 sz = _mm256_sub_ps(oz, _mm256_loadu_ps(a.v0[2] + i));
+
+		__m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), inverseDet);
+
+		//q = s x e1
+		__m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+		__m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+		__m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+
+		__m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), inverseDet);
+		__m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), inverseDet);
+
+		__m256 hit = _mm256_cmp_ps(_mm256_andnot_ps(signMask, det), epsilon, _CMP_GT_OQ);
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+		hit = _mm256_and_ps(hit, anyHit ? _mm256_cmp_ps(t, limit, _CMP_LE_OQ) : _mm256_cmp_ps(t, limit, _CMP_LT_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(laneOffsets, _mm256_set1_ps((float)(end - i)), _CMP_LT_OQ));
+
+		int lanes = _mm256_movemask_ps(hit);
+		if (lanes == 0)
+		{
+			continue;
+		}
+
+		float distances[8];
+		_mm256_storeu_ps(distances, t);
+
+		for (int lane = 0; lane < 8; lane++)
+		{
+			if ( !(lanes & (1 << lane)) ) continue;
+
+			if (anyHit)
+			{
+				hitDistance = distances[lane];
+				return i + lane;
+			}
+
+			if (distances[lane] < maxDistance)
+			{
+				maxDistance = distances[lane];
+				hitDistance = maxDistance;
+				bestSlot = i + lane;
+			}
+		}
+		limit = _mm256_set1_ps(maxDistance);
+	}
+
+	return bestSlot;
+}
+
+static bool cpuHasAVX()
+{
+	#if defined(__GNUC__)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx");
+	#else
+	//AVX needs both the instructions and an OS that saves the YMM registers
+	int info[4];
+	__cpuid(info, 1);
+	bool osSaves = (info[2] & (1 << 27)) != 0;
+	bool hasAVX = (info[2] & (1 << 28)) != 0;
+	return osSaves && hasAVX && (_xgetbv(0) & 6) == 6;
+	#endif
+}
+
+#endif // TRIANGLE_SIMD
+
+// --------------------------------------------------------------------------
+// Dispatch
+
+struct KernelChoice
+{
+	TriangleKernel kernel;
+	const char *name;
+};
+
+static KernelChoice chooseKernel()
+{
+	KernelChoice choice = { scalarKernel, "scalar" };
+
+	#ifdef TRIANGLE_SIMD
+	const char *forced = getenv("RAYTRACER_ISA");
+	string request = forced ? forced : "";
+
+	if (request == "scalar")
+	{
+		return choice;
+	}
+
+	choice.kernel = sseKernel;
+	choice.name = "sse";
+
+	if (request != "sse" && cpuHasAVX())
+	{
+		choice.kernel = avxKernel;
+		choice.name = "avx";
+	}
+	#endif
+
+	return choice;
+}
+
+static const KernelChoice &selectedKernel()
+{
+	//Initialised once, on first use, from whichever thread gets here first
+	static const KernelChoice choice = chooseKernel();
+	return choice;
+}
+
+const char *TriangleStore::kernelName()
+{
+	return selectedKernel().name;
+}
+
+// --------------------------------------------------------------------------
+// Queries
+
+int TriangleStore::closestHit(const vec3 &start, const vec3 &direction, int begin, int end,
+	float maxDistance, float &hitDistance) const
+{
+	if (begin >= end) return -1;
+	return selectedKernel().kernel(arrays(), start, direction, begin, end, maxDistance, false, hitDistance);
+}
+
+bool TriangleStore::anyHit(const vec3 &start, const vec3 &direction, int begin, int end,
+	float maxDistance) const
+{
+	if (begin >= end) return false;
+	float hitDistance;
+	return selectedKernel().kernel(arrays(), start, direction, begin, end, maxDistance, true, hitDistance) >= 0;
+}
+
+// --------------------------------------------------------------------------
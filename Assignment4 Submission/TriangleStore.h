@@ -0,0 +1,104 @@
+// ==========================================================================
+// Packed Triangle Store
+//
+// Triangles in structure-of-arrays form, one array per coordinate, with the
+// first vertex and both edge vectors precomputed. They are laid out in BVH
+// leaf order so the triangles of a leaf sit next to each other, and a single
+// Moller-Trumbore test checks 4 (SSE) or 8 (AVX) of them per instruction.
+// The widest kernel the CPU supports is picked once at run time.
+// ==========================================================================
+#ifndef TRIANGLESTORE_H
+#define TRIANGLESTORE_H
+
+#include <vector>
+
+#include "Shapes.h"
+#include "PrimitiveArray.h"
+
+class BVH;
+struct BVHPrimitive;
+
+//Triangles this close to edge-on are treated as missed
+const float DETERMINANT_EPSILON = 1e-12f;
+
+// --------------------------------------------------------------------------
+
+//Array of floats on a 32 byte boundary, padded so a full 8-wide load
+//starting at any valid slot stays inside the allocation
+class AlignedFloats
+{
+public:
+	AlignedFloats() : data(0), count(0) {}
+	~AlignedFloats();
+
+	void resize(int n);
+	float *get() { return data; }
+	const float *get() const { return data; }
+
+private:
+	float *data;
+	int count;
+
+	AlignedFloats(const AlignedFloats &);
+	AlignedFloats &operator=(const AlignedFloats &);
+};
+
+// --------------------------------------------------------------------------
+
+class TriangleStore
+{
+public:
+	TriangleStore() : count(0) {}
+
+	//Lay the triangles out in the order the BVH leaves refer to them
+	void build(const PrimitiveArray<Triangle> &triangles, const BVH &bvh);
+	void clear();
+
+	//Copies the corners of the triangles that have moved into their slots
+	//again, for a BVH that was refit rather than rebuilt
+	void update(const PrimitiveArray<Triangle> &triangles, const BVH &bvh, const std::vector<BVHPrimitive> &moved);
+
+	int size() const { return count; }
+
+	//Packed slots holding the triangles of BVH primitives [first, first + n)
+	int firstSlot(int primitive) const { return slotOffsets[primitive]; }
+
+	//Index into the scene's triangles of the triangle in this slot
+	int triangleIndex(int slot) const { return triangleIndices[slot]; }
+
+	//Closest triangle in slots [begin, end) hit at a distance in [0, maxDistance),
+	//returns its slot or -1 and leaves the distance in hitDistance
+	int closestHit(const vec3 &start, const vec3 &direction, int begin, int end,
+		float maxDistance, float &hitDistance) const;
+
+	//True if any triangle in slots [begin, end) is hit at a distance in
+	//[0, maxDistance]
+	bool anyHit(const vec3 &start, const vec3 &direction, int begin, int end,
+		float maxDistance) const;
+
+	//Name of the instruction set the kernels run on, for reporting
+	static const char *kernelName();
+
+	//Raw packed arrays, read by the kernels and the packet tracer
+	struct Arrays
+	{
+		const float *v0[3];
+		const float *e1[3];
+		const float *e2[3];
+	};
+
+	Arrays arrays() const;
+
+private:
+	int count;
+
+	AlignedFloats v0[3];	//First vertex, x y z
+	AlignedFloats e1[3];	//p2 - p1
+	AlignedFloats e2[3];	//p3 - p1
+
+	std::vector<int> triangleIndices;
+	std::vector<int> slotOffsets;
+};
+
+// --------------------------------------------------------------------------
+#endif // TRIANGLESTORE_H